@@ -0,0 +1,66 @@
+#!/bin/bash
+
+# Latence des petits fichiers pendant la diffusion d'un gros fichier, avec et sans lecture directe (O_DIRECT)
+#   - la taille du gros fichier en Mo
+#   - le nombre de petits fichiers demandes
+#   - le numero de port
+if [ $# -ne 3 ]; then
+    echo "Usage: $0 <taille gros fichier (Mo)> <nombre de requetes> <numéro de port>"
+    exit 1
+fi
+
+bigSize=$1
+nbReq=$2
+port=$3
+bin=${TFTP_BIN:-$(pwd)/bin/tftp}
+work=$(mktemp -d)
+
+# Fichiers du serveur : un gros fichier et des petits fichiers (type chargeur de demarrage / configuration)
+mkdir -p $work/srv $work/big $work/small
+head -c $(( bigSize * 1024 * 1024 )) /dev/urandom > $work/srv/image.bin
+for ((i=0; i<16; i++)); do
+    head -c 20000 /dev/urandom > $work/srv/boot$i.cfg
+done
+
+# Latence (ms) de nbReq telechargements de petits fichiers, affichee en mediane / p99 / max
+measure() {
+    local times=()
+    for ((i=0; i<$nbReq; i++)); do
+        local start=$(date +%s%N)
+        (cd $work/small && printf "get boot$((i % 16)).cfg\nexit\n" | $bin --mode CLT --port $port > /dev/null 2>&1)
+        times+=( $(( ( $(date +%s%N) - start ) / 1000 )) )
+    done
+    printf "%s\n" "${times[@]}" | sort -n | awk '{ v[NR] = $1 } END {
+        printf "mediane %.2f ms, p99 %.2f ms, max %.2f ms\n", v[int(NR * 0.5) + 1] / 1000, v[int(NR * 0.99) + 1] / 1000, v[NR] / 1000 }'
+}
+
+for mode in buffered direct; do
+    if [ $mode == direct ]; then threshold=$(( 16 * 1024 * 1024 )); else threshold=0; fi
+
+    # Cache du noyau vide pour chaque mode (si autorise)
+    sync; echo 1 > /proc/sys/vm/drop_caches 2> /dev/null
+
+    (cd $work/srv && exec $bin --mode SRV --port $port --index none --direct-threshold $threshold > /dev/null 2>&1) &
+    srvPid=$!
+    sleep 0.5
+
+    echo "== $mode"
+    echo -n "  petits fichiers seuls           : "; measure
+
+    # Diffusion du gros fichier en parallele
+    (cd $work/big && printf "get image.bin\nexit\n" | $bin --mode CLT --port $port > /dev/null 2>&1) &
+    bigPid=$!
+    sleep 0.2
+    echo -n "  pendant le transfert du gros    : "; measure
+    wait $bigPid
+
+    # Occupation du cache par le gros fichier apres le transfert
+    if command -v fincore > /dev/null; then
+        echo "  cache occupe par image.bin      : $(fincore -n -o RES $work/srv/image.bin)"
+    fi
+
+    kill -INT $srvPid
+    wait $srvPid 2> /dev/null
+done
+
+rm -rf $work
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Comparaison de deux resultats de microbench (make bench > fichier)
+#   - le resultat de reference
+#   - le nouveau resultat
+#   - le seuil de regression en % (20 par defaut)
+# Code retour 1 si une mesure est plus lente que la reference au-dela du seuil
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <reference.tsv> <nouveau.tsv> [seuil %]"
+    exit 1
+fi
+
+awk -F'\t' -v threshold=${3:-20} '
+    /^#/ { next }
+    NR == FNR { ref[$1 "/" $2] = $4; next }
+    ($1 "/" $2) in ref {
+        delta = ref[$1 "/" $2] > 0 ? ( $4 - ref[$1 "/" $2] ) * 100 / ref[$1 "/" $2] : 0
+        status = delta > threshold ? "REGRESSION" : "ok"
+        if( delta > threshold ) failed = 1
+        printf "%-16s %-22s %12.1f %12.1f %+8.1f%%  %s\n", $1, $2, ref[$1 "/" $2], $4, delta, status
+    }
+    END { exit failed }
+' "$1" "$2"
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Debit et renvois du serveur sous differentes degradations du reseau (boucle locale)
+#   - le port du serveur
+#   - une ou plusieurs degradations (syntaxe de --impair, "none" pour aucune)
+# Les options apres -- sont passees au generateur de charge (--sessions, --requests, --sizes...)
+# Variables : TFTP (executable, ./bin/tftp par defaut), SEED (graine des tirages, 1 par defaut)
+# Une ligne par degradation, colonnes separees par des tabulations :
+#   degradation  completees  echouees  octets/s  p99 (ms)  renvois  timeouts
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <port> <degradation>... [-- options du generateur de charge]"
+    exit 1
+fi
+
+TFTP=$(realpath ${TFTP:-./bin/tftp})
+PORT=$1
+shift
+
+# Degradations puis options du generateur de charge
+SPECS=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    SPECS+=("$1")
+    shift
+done
+[ "$1" == "--" ] && shift
+
+# Repertoire de travail du serveur
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+printf "#spec\tcompleted\tfailed\tbytes_s\tp99_ms\tretransmits\ttimeouts\n"
+for SPEC in "${SPECS[@]}"; do
+    IMPAIR=()
+    [ "$SPEC" != "none" ] && IMPAIR=(--impair "$SPEC" --impair-seed ${SEED:-1})
+
+    # Serveur degrade, metriques ecrites a l'arret
+    (cd "$DIR" && exec "$TFTP" --mode SRV --port $PORT --index none --log-level error --metrics "$DIR/metrics.prom" \
+        "${IMPAIR[@]}" > /dev/null 2>&1) &
+    SERVER=$!
+    sleep 0.5
+
+    RESULT=$(cd "$DIR" && "$TFTP" --mode BENCH --port $PORT --seed ${SEED:-1} "$@" 2> /dev/null | tail -1)
+    kill -INT $SERVER
+    wait $SERVER
+
+    # Extraction des champs du resultat JSON et des compteurs du serveur
+    field() { echo "$RESULT" | grep -o "\"$1\":[0-9.]*" | head -1 | cut -d: -f2; }
+    counter() { grep "^$1 " "$DIR/metrics.prom" | cut -d' ' -f2; }
+    printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$SPEC" "$(field completed)" "$(field failed)" "$(field throughput_Bps)" \
+        "$(field p99)" "$(counter tftp_retransmits_total)" "$(counter tftp_timeouts_total)"
+done
@@ -0,0 +1,569 @@
+//--------------------------------------------------------------------------------------------------------------
+// Microbenchmarks : codec des paquets, sockets, index des fichiers et empreintes
+//
+// Usage : microbench [--repeat N] [--filter TEXTE]
+//
+// Une ligne par mesure, colonnes separees par des tabulations :
+//      nom  parametre  iterations  ns/op (mediane)  ns/op (min)
+// Les nombres d'iterations et les donnees sont fixes (tirages a graine constante) : deux executions sur la
+// meme machine sont directement comparables (voir compare.sh).
+//--------------------------------------------------------------------------------------------------------------
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+// Local
+#include "tftp/packet.h"
+#include "tftp/sock.h"
+#include "tftp/addr.h"
+#include "tftp/tftp.h"
+#include "tftp/FileAVL.h"
+#include "tftp/digest.h"
+
+
+// Nombre max de repetitions d'une mesure
+#define MAX_REPEAT 32
+
+// Iterations par mesure
+#define CODEC_ITERATIONS 1000000
+#define SOCK_ITERATIONS 20000
+#define FIND_ITERATIONS 1000000
+#define DIGEST_ITERATIONS 200
+
+// Taille des donnees d'une empreinte mesuree
+#define DIGEST_BENCH_SIZE ( 64 * 1024 )
+
+// Tailles des index et nombres de threads mesures
+static const int AVL_SIZES[] = { 256, 1024, 4096 };
+static const int THREAD_COUNTS[] = { 1, 2, 4, 8 };
+
+/** Fonction mesuree : execute iterations fois l'operation
+ *
+ */
+typedef void (*BenchFunction)( void* context, long iterations );
+
+/** Paquet encode ou decode en boucle
+ *
+ */
+typedef struct
+{
+    Packet packet;                          // Paquet a encoder
+    Packet decoded;                         // Paquet decode
+    union
+    {
+        XrqPacket xrq;
+        DataPacket data;
+        AckPacket ack;
+        ErrorPacket error;
+        OackPacket oack;
+    } in, out;                              // Donnees specifiques des paquets
+    unsigned char buff[PACKET_MAX_SIZE];    // Paquet encode
+    size_t size;                            // Taille du paquet encode
+} CodecBench;
+
+/** Datagrammes echanges sur la boucle locale
+ *
+ */
+typedef struct
+{
+    Sock* tx;                               // Socket d'emission
+    Sock* rx;                               // Socket de reception
+    Addr* to;                               // Adresse de la socket de reception
+    unsigned char buff[PACKET_MAX_SIZE];    // Datagramme envoye
+    size_t size;                            // Taille du datagramme
+} SockBench;
+
+/** Recherches ou ajouts dans l'index
+ *
+ */
+typedef struct
+{
+    char (*names)[32];                      // Noms des fichiers (ordre aleatoire)
+    int nameCount;                          // Nombre de noms (taille de l'index)
+    FileAVL* avl;                           // Index (recherches)
+    pthread_mutex_t mutex;                  // Verrou de l'index
+    int threads;                            // Nombre de threads (recherches)
+} AvlBench;
+
+/** Empreinte de donnees en memoire
+ *
+ */
+typedef struct
+{
+    unsigned char* data;                    // Donnees (DIGEST_BENCH_SIZE octets)
+    int algorithm;                          // Algorithme
+} DigestBench;
+
+/** Tache d'un thread de recherche
+ *
+ */
+typedef struct
+{
+    AvlBench* bench;
+    long iterations;
+    unsigned int seed;
+} FindTask;
+
+// Parametres de la ligne de commande
+static int repeat = 5;
+static const char* filter = NULL;
+
+// Resultats conserves pour que les appels ne soient pas elimines
+static volatile size_t sink = 0;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Mesure d'une fonction : une execution de chauffe puis repeat executions, affichage mediane et minimum
+ *
+ */
+static void run( const char* name, const char* param, BenchFunction function, void* context, long iterations );
+
+/** Horloge monotone (ns)
+ *
+ */
+static int64_t now();
+
+/** Comparaison de deux durees (tri)
+ *
+ */
+static int compareDurations( const void* a, const void* b );
+
+/** Mesures du codec
+ *
+ */
+static void benchCodec();
+static void initCodec( CodecBench* bench, uint16_t code );
+static void encodeLoop( void* context, long iterations );
+static void decodeLoop( void* context, long iterations );
+static void encodeDataLoop( void* context, long iterations );
+
+/** Mesures des sockets
+ *
+ */
+static void benchSock();
+static int initSock( SockBench* bench, const void* data, size_t size );
+static void releaseSock( SockBench* bench );
+static void sockLoop( void* context, long iterations );
+static void recvPacketLoop( void* context, long iterations );
+
+/** Mesures de l'index
+ *
+ */
+static void benchAvl();
+static void addLoop( void* context, long iterations );
+static void findLoop( void* context, long iterations );
+static void* findTask( void* arg );
+
+/** Mesures des empreintes (implementation acceleree et repli portable)
+ *
+ */
+static void benchDigest();
+static void digestLoop( void* context, long iterations );
+
+
+//--- Programme principal --------------------------------------------------------------------------------------
+
+int main( int argc, char* argv[] )
+{
+    // Parsing de la ligne de commande
+    for( int i = 1; i < argc; ++i )
+    {
+        if( strcmp( argv[i], "--repeat" ) == 0 && i + 1 < argc ) repeat = atoi( argv[++i] );
+        else if( strcmp( argv[i], "--filter" ) == 0 && i + 1 < argc ) filter = argv[++i];
+        else
+        {
+            fprintf( stderr, "Usage: %s [--repeat N] [--filter TEXTE]\n", argv[0] );
+            return( 1 );
+        }
+    }
+    if( repeat < 1 ) repeat = 1;
+    if( repeat > MAX_REPEAT ) repeat = MAX_REPEAT;
+
+    // Entete
+    fprintf( stdout, "# name\tparam\titerations\tns_op_median\tns_op_min\n" );
+
+    benchCodec();
+    benchSock();
+    benchAvl();
+    benchDigest();
+
+    return( 0 );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void run( const char* name, const char* param, BenchFunction function, void* context, long iterations )
+{
+    // Filtre sur "nom/parametre"
+    char fullName[128];
+    snprintf( fullName, sizeof( fullName ), "%s/%s", name, param );
+    if( filter != NULL && strstr( fullName, filter ) == NULL ) return;
+
+    // Chauffe (caches, allocateur)
+    function( context, iterations / 10 > 0 ? iterations / 10 : 1 );
+
+    // Mesures
+    double durations[MAX_REPEAT];
+    for( int i = 0; i < repeat; ++i )
+    {
+        const int64_t start = now();
+        function( context, iterations );
+        durations[i] = (double)( now() - start ) / (double)iterations;
+    }
+    qsort( durations, repeat, sizeof( double ), compareDurations );
+
+    fprintf( stdout, "%s\t%s\t%ld\t%.1f\t%.1f\n", name, param, iterations, durations[repeat / 2], durations[0] );
+    fflush( stdout );
+}
+
+
+static int64_t now()
+{
+    struct timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return( (int64_t)time.tv_sec * 1000000000 + time.tv_nsec );
+}
+
+
+static int compareDurations( const void* a, const void* b )
+{
+    const double durationA = *(const double*)a;
+    const double durationB = *(const double*)b;
+    return( ( durationA > durationB ) - ( durationA < durationB ) );
+}
+
+
+static void benchCodec()
+{
+    static const struct { const char* name; uint16_t code; } TYPES[] = {
+        { "rrq", TFTP_RRQ }, { "wrq", TFTP_WRQ }, { "data", TFTP_DATA },
+        { "ack", TFTP_ACK }, { "error", TFTP_ERROR }, { "oack", TFTP_OACK }
+    };
+
+    CodecBench bench;
+    for( size_t i = 0; i < sizeof( TYPES ) / sizeof( TYPES[0] ); ++i )
+    {
+        initCodec( &bench, TYPES[i].code );
+        run( "packet.encode", TYPES[i].name, encodeLoop, &bench, CODEC_ITERATIONS );
+        run( "packet.decode", TYPES[i].name, decodeLoop, &bench, CODEC_ITERATIONS );
+    }
+
+    // Requete avec options (RFC 2347)
+    initCodec( &bench, TFTP_RRQ );
+    PACKET_addOption( bench.in.xrq.options, &bench.in.xrq.optionCount, "blksize", "1428" );
+    PACKET_addOption( bench.in.xrq.options, &bench.in.xrq.optionCount, "tsize", "0" );
+    PACKET_addOption( bench.in.xrq.options, &bench.in.xrq.optionCount, "timeout", "1" );
+    PACKET_encode( &bench.packet, bench.buff, &bench.size );
+    run( "packet.encode", "rrq-options", encodeLoop, &bench, CODEC_ITERATIONS );
+    run( "packet.decode", "rrq-options", decodeLoop, &bench, CODEC_ITERATIONS );
+
+    // Encodage direct des blocs (chemin d'envoi des fichiers)
+    initCodec( &bench, TFTP_DATA );
+    run( "packet.encodeData", "512", encodeDataLoop, &bench, CODEC_ITERATIONS );
+}
+
+
+static void initCodec( CodecBench* bench, uint16_t code )
+{
+    memset( bench, 0, sizeof( CodecBench ) );
+    bench->packet.code = code;
+    bench->packet.data = &bench->in;
+    bench->decoded.code = code;
+    bench->decoded.data = &bench->out;
+
+    // Contenu representatif de chaque type
+    switch( code )
+    {
+        case TFTP_RRQ:
+        case TFTP_WRQ:
+            strcpy( bench->in.xrq.fileName, "lofoten.jpg" );
+            strcpy( bench->in.xrq.mode, "octet" );
+            break;
+
+        case TFTP_DATA:
+            bench->in.data.blockNum = 1234;
+            for( int i = 0; i < DATA_SIZE; ++i ) bench->in.data.bytes[i] = (unsigned char)( i * 31 );
+            bench->in.data.bytesCount = DATA_SIZE;
+            break;
+
+        case TFTP_ACK:
+            bench->in.ack.blockNum = 1234;
+            break;
+
+        case TFTP_ERROR:
+            bench->in.error.errorCode = ERR_FILE_NOT_FOUND;
+            strcpy( bench->in.error.errorMsg, "Fichier inexistant" );
+            break;
+
+        case TFTP_OACK:
+            PACKET_addOption( bench->in.oack.options, &bench->in.oack.optionCount, "blksize", "1428" );
+            PACKET_addOption( bench->in.oack.options, &bench->in.oack.optionCount, "tsize", "1048576" );
+            break;
+    }
+
+    PACKET_encode( &bench->packet, bench->buff, &bench->size );
+}
+
+
+static void encodeLoop( void* context, long iterations )
+{
+    CodecBench* bench = (CodecBench*)context;
+    for( long i = 0; i < iterations; ++i )
+    {
+        PACKET_encode( &bench->packet, bench->buff, &bench->size );
+        sink += bench->size;
+    }
+}
+
+
+static void decodeLoop( void* context, long iterations )
+{
+    // Decodage apres le code du paquet (lu par l'appelant, comme dans TFTP_recvPacket)
+    CodecBench* bench = (CodecBench*)context;
+    for( long i = 0; i < iterations; ++i )
+        sink += PACKET_decode( &bench->decoded, bench->buff + sizeof( uint16_t ), bench->size - sizeof( uint16_t ) );
+}
+
+
+static void encodeDataLoop( void* context, long iterations )
+{
+    CodecBench* bench = (CodecBench*)context;
+    for( long i = 0; i < iterations; ++i )
+        sink += PACKET_encodeData( bench->buff, (uint16_t)i, bench->in.data.bytes, DATA_SIZE );
+}
+
+
+static void benchSock()
+{
+    SockBench bench;
+    unsigned char bytes[PACKET_MAX_SIZE];
+    memset( bytes, 0x5a, sizeof( bytes ) );
+
+    // Aller simple d'un datagramme (envoi puis reception)
+    static const size_t SIZES[] = { 4, PACKET_MAX_SIZE };
+    for( size_t i = 0; i < sizeof( SIZES ) / sizeof( SIZES[0] ); ++i )
+    {
+        if( initSock( &bench, bytes, SIZES[i] ) != 0 ) return;
+        char param[16];
+        snprintf( param, sizeof( param ), "%zu", SIZES[i] );
+        run( "sock.loopback", param, sockLoop, &bench, SOCK_ITERATIONS );
+        releaseSock( &bench );
+    }
+
+    // Reception et decodage d'un paquet (allocation comprise)
+    CodecBench codec;
+    initCodec( &codec, TFTP_DATA );
+    if( initSock( &bench, codec.buff, codec.size ) != 0 ) return;
+    run( "tftp.recvPacket", "data", recvPacketLoop, &bench, SOCK_ITERATIONS );
+    releaseSock( &bench );
+
+    initCodec( &codec, TFTP_ACK );
+    if( initSock( &bench, codec.buff, codec.size ) != 0 ) return;
+    run( "tftp.recvPacket", "ack", recvPacketLoop, &bench, SOCK_ITERATIONS );
+    releaseSock( &bench );
+}
+
+
+static int initSock( SockBench* bench, const void* data, size_t size )
+{
+    bench->tx = SOCK_create( 0 );
+    bench->rx = SOCK_create( 0 );
+    if( bench->tx == NULL || bench->rx == NULL )
+    {
+        fprintf( stderr, "ERREUR - Creation des sockets impossible\n" );
+        return( 1 );
+    }
+
+    // Port effectif de la socket de reception
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof( addr );
+    getsockname( bench->rx->fd, (struct sockaddr*)&addr, &addrLen );
+    bench->to = ADDR_createRemote( "127.0.0.1", ntohs( addr.sin_port ) );
+
+    memcpy( bench->buff, data, size );
+    bench->size = size;
+
+    return( bench->to == NULL );
+}
+
+
+static void releaseSock( SockBench* bench )
+{
+    SOCK_destroy( bench->tx );
+    SOCK_destroy( bench->rx );
+    ADDR_destroy( bench->to );
+}
+
+
+static void sockLoop( void* context, long iterations )
+{
+    SockBench* bench = (SockBench*)context;
+    for( long i = 0; i < iterations; ++i )
+    {
+        unsigned char buff[PACKET_MAX_SIZE];
+        size_t size = sizeof( buff );
+        SOCK_sendData( bench->tx, bench->buff, bench->size, bench->to );
+        SOCK_recvData( bench->rx, buff, &size, NULL );
+        sink += size;
+    }
+}
+
+
+static void recvPacketLoop( void* context, long iterations )
+{
+    SockBench* bench = (SockBench*)context;
+    for( long i = 0; i < iterations; ++i )
+    {
+        SOCK_sendData( bench->tx, bench->buff, bench->size, bench->to );
+        Packet* packet = TFTP_recvPacket( bench->rx, NULL );
+        sink += packet->code;
+        PACKET_destroy( packet );
+    }
+}
+
+
+static void benchAvl()
+{
+    // Noms des fichiers dans un ordre aleatoire (graine fixe)
+    const int maxSize = AVL_SIZES[sizeof( AVL_SIZES ) / sizeof( AVL_SIZES[0] ) - 1];
+    AvlBench bench;
+    memset( &bench, 0, sizeof( AvlBench ) );
+    bench.names = malloc( maxSize * sizeof( *bench.names ) );
+    for( int i = 0; i < maxSize; ++i ) snprintf( bench.names[i], sizeof( *bench.names ), "dir/file-%06d.bin", i );
+    unsigned int seed = 1;
+    for( int i = maxSize - 1; i > 0; --i )
+    {
+        const int j = rand_r( &seed ) % ( i + 1 );
+        char name[32];
+        memcpy( name, bench.names[i], sizeof( name ) );
+        memcpy( bench.names[i], bench.names[j], sizeof( name ) );
+        memcpy( bench.names[j], name, sizeof( name ) );
+    }
+    pthread_mutex_init( &bench.mutex, NULL );
+
+    for( size_t s = 0; s < sizeof( AVL_SIZES ) / sizeof( AVL_SIZES[0] ); ++s )
+    {
+        char param[32];
+        bench.nameCount = AVL_SIZES[s];
+
+        // Construction d'un index de n fichiers (cout moyen d'un ajout)
+        snprintf( param, sizeof( param ), "n=%d", bench.nameCount );
+        run( "fileavl.add", param, addLoop, &bench, bench.nameCount );
+
+        // Recherches concurrentes dans l'index complet
+        bench.avl = NULL;
+        for( int i = 0; i < bench.nameCount; ++i ) FILEAVL_addInAVL( bench.names[i], &bench.avl, &bench.mutex );
+        for( size_t t = 0; t < sizeof( THREAD_COUNTS ) / sizeof( THREAD_COUNTS[0] ); ++t )
+        {
+            bench.threads = THREAD_COUNTS[t];
+            snprintf( param, sizeof( param ), "n=%d,threads=%d", bench.nameCount, bench.threads );
+            run( "fileavl.find", param, findLoop, &bench, FIND_ITERATIONS );
+        }
+        FILEAVL_destroy( bench.avl );
+    }
+
+    pthread_mutex_destroy( &bench.mutex );
+    free( bench.names );
+}
+
+
+static void addLoop( void* context, long iterations )
+{
+    // Nouvel index a chaque execution (iterations ajouts, au plus nameCount)
+    AvlBench* bench = (AvlBench*)context;
+    FileAVL* avl = NULL;
+    for( long i = 0; i < iterations; ++i )
+        FILEAVL_addInAVL( bench->names[i % bench->nameCount], &avl, &bench->mutex );
+    FILEAVL_destroy( avl );
+}
+
+
+static void findLoop( void* context, long iterations )
+{
+    AvlBench* bench = (AvlBench*)context;
+    FindTask tasks[8];
+    pthread_t threads[8];
+
+    // Un seul thread : recherche dans le thread courant
+    if( bench->threads == 1 )
+    {
+        FindTask task = { bench, iterations, 1 };
+        findTask( &task );
+        return;
+    }
+
+    // Debit global de plusieurs threads (ns par recherche, tous threads confondus)
+    for( int i = 0; i < bench->threads; ++i )
+    {
+        tasks[i].bench = bench;
+        tasks[i].iterations = iterations / bench->threads;
+        tasks[i].seed = (unsigned int)( i + 1 );
+        pthread_create( &threads[i], NULL, findTask, &tasks[i] );
+    }
+    for( int i = 0; i < bench->threads; ++i ) pthread_join( threads[i], NULL );
+}
+
+
+static void* findTask( void* arg )
+{
+    FindTask* task = (FindTask*)arg;
+    AvlBench* bench = task->bench;
+    size_t found = 0;
+    for( long i = 0; i < task->iterations; ++i )
+    {
+        const int index = rand_r( &task->seed ) % bench->nameCount;
+        found += FILEAVL_findInAVL( &bench->avl, bench->names[index], &bench->mutex ) != NULL;
+    }
+    sink += found;
+    return( NULL );
+}
+
+
+static void benchDigest()
+{
+    DigestBench bench;
+    bench.data = (unsigned char*)malloc( DIGEST_BENCH_SIZE );
+    if( bench.data == NULL ) return;
+    unsigned int seed = 1;
+    for( size_t i = 0; i < DIGEST_BENCH_SIZE; ++i ) bench.data[i] = (unsigned char)rand_r( &seed );
+
+    // Parametre : algorithme et implementation (identique pour les deux mesures sans support materiel)
+    for( int algorithm = DIGEST_CRC32C; algorithm < DIGEST_COUNT; ++algorithm )
+    {
+        for( int accelerated = 0; accelerated <= 1; ++accelerated )
+        {
+            char param[64];
+            DIGEST_setAccelerated( accelerated );
+            bench.algorithm = algorithm;
+            snprintf( param, sizeof( param ), "%s,%s,%d", DIGEST_name( algorithm ), DIGEST_engine( algorithm ),
+                      DIGEST_BENCH_SIZE );
+            run( "digest", param, digestLoop, &bench, DIGEST_ITERATIONS );
+        }
+    }
+
+    DIGEST_setAccelerated( 1 );
+    free( bench.data );
+}
+
+
+static void digestLoop( void* context, long iterations )
+{
+    DigestBench* bench = (DigestBench*)context;
+    DigestContext digestContext;
+    Digest digest;
+    for( long i = 0; i < iterations; ++i )
+    {
+        DIGEST_init( &digestContext, bench->algorithm );
+        DIGEST_add( &digestContext, bench->data, DIGEST_BENCH_SIZE );
+        DIGEST_final( &digestContext, &digest );
+        sink += digest.bytes[0];
+    }
+}
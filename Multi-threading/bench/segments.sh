@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# Debit d'un get par segments selon le nombre de segments, avec un delai injecte par le serveur
+#   - le port du serveur
+#   - la taille du fichier lu (octets, suffixe K ou M)
+#   - un ou plusieurs nombres de segments
+# Variables : TFTP (executable, ./bin/tftp par defaut), IMPAIR (degradation du serveur, "both:delay=5" par defaut)
+# Une ligne par nombre de segments, colonnes separees par des tabulations :
+#   segments  duree (s)  octets/s  acceleration (par rapport a la premiere ligne)
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 <port> <taille> <segments>..."
+    exit 1
+fi
+
+TFTP=$(realpath ${TFTP:-./bin/tftp})
+PORT=$1
+SIZE=$(numfmt --from=iec $2)
+shift 2
+
+# Repertoires du serveur et du client, fichier de test
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+mkdir "$DIR/srv" "$DIR/clt"
+head -c $SIZE /dev/urandom > "$DIR/srv/segments.bin"
+
+# Serveur degrade (delai sur chaque datagramme)
+(cd "$DIR/srv" && exec "$TFTP" --mode SRV --port $PORT --index none --log-level error \
+    --impair "${IMPAIR:-both:delay=5}" > /dev/null 2>&1) &
+SERVER=$!
+trap 'kill -INT $SERVER; wait $SERVER; rm -rf "$DIR"' EXIT
+sleep 0.5
+
+printf "#segments\tduration_s\tbytes_s\tspeedup\n"
+BASE=
+for COUNT in "$@"; do
+    rm -f "$DIR/clt/segments.bin"
+    START=$(date +%s.%N)
+    (cd "$DIR/clt" && "$TFTP" --mode CLT --port $PORT --segments $COUNT --exec "get segments.bin" > /dev/null 2>&1)
+    END=$(date +%s.%N)
+
+    # Fichier recu identique, sinon ligne en erreur
+    if ! cmp -s "$DIR/srv/segments.bin" "$DIR/clt/segments.bin"; then
+        printf "%s\terror\n" $COUNT
+        continue
+    fi
+    DURATION=$(awk "BEGIN { print $END - $START }")
+    [ -z "$BASE" ] && BASE=$DURATION
+    awk "BEGIN { printf \"%s\t%.3f\t%.0f\t%.2f\n\", $COUNT, $DURATION, $SIZE / $DURATION, $BASE / $DURATION }"
+done
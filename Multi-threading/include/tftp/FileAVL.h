@@ -3,43 +3,121 @@
 
 #include <pthread.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include "tftp/digest.h"
+
+/**
+ * @brief Nom du snapshot de l'index, écrit à la racine du serveur.
+*/
+#define FILEAVL_INDEX_FILE ".tftp-index"
+/**
+ * @brief Préfixe des fichiers internes au serveur (snapshot, fichiers temporaires). Ils ne sont jamais indexés.
+*/
+#define FILEAVL_PRIVATE_PREFIX ".tftp"
+
+/**
+ * @brief Etat d'une entrée de l'index par rapport au système de fichiers
+*/
+enum {
+    FILEAVL_UNCHECKED = 0,  // Entrée issue du snapshot, pas encore confrontée au disque
+    FILEAVL_PRESENT,        // Fichier présent sur le disque
+    FILEAVL_MISSING         // Fichier supprimé depuis l'écriture du snapshot
+};
+
 /**
  * @brief AVL de fichier disponible sur le serveur
 */
 typedef struct FileAVL {
     char filename[256];
     pthread_mutex_t mutex;
+    int64_t size;           // Taille connue du fichier
+    int64_t mtime;          // Date de dernière modification connue (ns)
+    int64_t ino;            // Inode connu (une version publiée par rename change d'inode)
+    Digest digests[DIGEST_COUNT];   // Empreintes de la version (ino, size, mtime), par algorithme
+    unsigned digestMask;    // Empreintes valides (bit 1 << algorithme)
+    int state;              // FILEAVL_UNCHECKED, FILEAVL_PRESENT ou FILEAVL_MISSING
     struct FileAVL *left, *right;
 } FileAVL;
 
 /**
  * @brief Instancie l'AVL de départ avec tous les fichiers présents à la racine de l'exécutable du serveur.
- * @return Renvoie l'avl de départ. L'avl doit être free avec FILEAVL_destroy(FileAVL * ).
+ * @return Renvoie l'avl de départ (NULL si aucun fichier). L'avl doit être free avec FILEAVL_destroy(FileAVL * ).
 */
 extern FileAVL *FILEAVL_create();
 /**
- * @brief Ajoute un élément dans l'AVL. Nécessaire après un WRQ reçu par un client si le fichier n'existe pas.
+ * @brief Instancie l'AVL à partir d'un snapshot écrit par FILEAVL_save(), sans parcourir le disque.
+ * Les entrées sont marquées FILEAVL_UNCHECKED et doivent être confrontées au disque avec FILEAVL_check()
+ * ou FILEAVL_reconcile().
+ * @param indexPath : chemin du snapshot.
+ * @return Renvoie l'avl, ou NULL si le snapshot est absent ou invalide (en-tête, taille, noms non terminés ou non triés).
+*/
+extern FileAVL *FILEAVL_load(const char *indexPath);
+/**
+ * @brief Ecrit un snapshot de l'AVL (chemins, tailles, dates, empreintes). L'écriture est atomique.
+ * @return Renvoie 0 en cas de succès.
+*/
+extern int FILEAVL_save(FileAVL **avl, const char *indexPath, pthread_mutex_t *avl_mutex);
+/**
+ * @brief Parcourt le disque pour ajouter les fichiers absents de l'AVL et confronter les entrées non vérifiées.
+ * Prévu pour tourner en tâche de fond après FILEAVL_load().
+*/
+extern void FILEAVL_reconcile(FileAVL **avl, pthread_mutex_t *avl_mutex);
+/**
+ * @brief Confronte une entrée au disque si nécessaire (stat) et met à jour taille et date.
+ * @return Renvoie 0 si le fichier existe, 1 sinon.
+*/
+extern int FILEAVL_check(FileAVL *node, pthread_mutex_t *avl_mutex);
+/**
+ * @brief Relit taille et date d'une entrée sur le disque (après l'écriture du fichier par un WRQ).
+ * @return Renvoie 0 si le fichier existe, 1 sinon.
+*/
+extern int FILEAVL_update(FileAVL *node, pthread_mutex_t *avl_mutex);
+/**
+ * @brief Donne l'empreinte conservée pour une version (inode, taille, date) du fichier, sans lire le fichier.
+ * @param algorithm : DIGEST_CRC32C ou DIGEST_SHA256.
+ * @param version : stat du fichier ouvert (celui qui sera envoyé).
+ * @param digest : empreinte de cette version.
+ * @return Renvoie 0 si l'empreinte est connue, 1 sinon (elle est alors calculée au fil de l'envoi).
+*/
+extern int FILEAVL_getDigest(FileAVL *node, pthread_mutex_t *avl_mutex, int algorithm, const struct stat *version,
+                             Digest *digest);
+/**
+ * @brief Conserve l'empreinte calculée au fil de l'envoi d'une version, si c'est toujours la version du fichier sur le
+ * disque.
+*/
+extern void FILEAVL_setDigest(FileAVL *node, pthread_mutex_t *avl_mutex, const struct stat *version,
+                              const Digest *digest);
+/**
+ * @brief Indique si un chemin désigne un fichier interne au serveur (un de ses composants commence par
+ * FILEAVL_PRIVATE_PREFIX). Ces fichiers ne sont ni indexés ni accessibles par le réseau.
+ * @return Renvoie 1 si le chemin est privé, 0 sinon.
+*/
+extern int FILEAVL_isPrivate(const char *filepath);
+/**
+ * @brief Ajoute un élément dans l'AVL s'il n'y est pas déjà. Nécessaire après un WRQ reçu par un client si le fichier n'existe pas.
  * @param filepath : nom du fichier à ajouter.
- * @param avl : l'avl dans lequel on ajoute filepath
- * @return Renvoie l'avl avec le fichier ajouté.
+ * @param avl : l'avl dans lequel on ajoute filepath (la racine est mise à jour)
+ * @return Renvoie le noeud correspondant au fichier (NULL pour un chemin privé).
 */
-extern FileAVL *FILEAVL_addInAVL(const char *filepath, FileAVL *avl, pthread_mutex_t *avl_mutex);
+extern FileAVL *FILEAVL_addInAVL(const char *filepath, FileAVL **avl, pthread_mutex_t *avl_mutex);
 /**
  * @brief Permet de trouver un élément dans l'AVL. Cela permet de récupérer le noeud correspondant au fichier et donc de prendre le mutex associé.
  * @param avl : l'AVL dans lequel on cherche l'élément.
  * @param filename : le nom du fichier que l'on cherche.
+ * Tant que FILEAVL_reconcile() n'a pas fini après FILEAVL_load(), un fichier absent de l'AVL est cherché sur le
+ * disque et ajouté s'il existe.
  * @return Renvoie le noeud cherché.
 */
-extern FileAVL *FILEAVL_findInAVL(FileAVL *avl, const char *filename, pthread_mutex_t *avl_mutex);
+extern FileAVL *FILEAVL_findInAVL(FileAVL **avl, const char *filename, pthread_mutex_t *avl_mutex);
 /**
  * @brief Libère la mémoire de l'AVL.
 */
 extern void FILEAVL_destroy(FileAVL *avl);
 
 
-#endif
\ No newline at end of file
+#endif
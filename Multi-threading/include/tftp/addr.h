@@ -49,6 +49,11 @@ extern Addr* ADDR_createRemote( const char* host, uint16_t port );
  */
 extern void ADDR_update( Addr* addr, const struct sockaddr_in* inAddr );
 
+/** Comparaison de deux adresses (IP et port), retourne 1 si identiques
+ *
+ */
+extern int ADDR_equals( const Addr* addr1, const Addr* addr2 );
+
 /** Destruction d'une addresse
  *
  */
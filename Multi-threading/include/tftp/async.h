@@ -0,0 +1,93 @@
+#ifndef _TFTP_ASYNC_H_
+#define _TFTP_ASYNC_H_
+
+// System
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Local
+#include "tftp/addr.h"
+#include "tftp/xfer.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: ASYNC
+// Description:
+//      Boucle d'evenements du client : transferts XFER simultanes dans un seul thread (une socket non bloquante,
+//      donc un TID, par transfert, attendues ensemble par epoll), echeances de renvoi et minuteries rangees
+//      dans un tas binaire
+//--------------------------------------------------------------------------------------------------------------
+
+// Nombre max d'evenements traites par attente
+#define ASYNC_MAX_EVENTS 256
+
+// Nouvel essai d'un paquet retarde deja echu mais non remis (transfert rendu a son echeance, socket hors de
+// la boucle, us)
+#define ASYNC_IMPAIR_RETRY_US 1000
+
+/** Fin d'un transfert : resultat dans session->result (la session est detruite au retour, le fichier n'est
+ *  pas ferme)
+ */
+typedef void (*AsyncDone)( XferSession* session, void* context );
+
+/** Minuterie arrivee a echeance
+ *
+ */
+typedef void (*AsyncTimer)( void* context );
+
+/** Boucle d'evenements
+ *
+ */
+typedef struct
+{
+    int epollFd;                        // Attente des sockets de tous les transferts
+    struct AsyncEntry** heap;           // Echeances (tas binaire, la plus proche en tete)
+    size_t heapCount;                   // Nombre d'echeances
+    size_t heapCapacity;                // Taille du tas
+    size_t transfers;                   // Transferts en cours
+    struct AsyncEntry** sockets;        // Transferts par descripteur de socket
+    size_t socketCapacity;              // Taille de la table des descripteurs
+    struct AsyncEntry* impair;          // Remise du prochain paquet retarde en reception (NULL : pas encore)
+} AsyncLoop;
+
+
+/** Creation d'une boucle d'evenements
+ *
+ */
+extern AsyncLoop* ASYNC_create();
+
+/** Lecture d'un fichier du serveur, ecrit dans file (NULL : donnees ignorees), done appele a la fin
+ *
+ *  Retourne le transfert lance, NULL si la socket n'a pas pu etre creee (done n'est pas appele)
+ */
+extern XferSession* ASYNC_get( AsyncLoop* loop, const Addr* server, const char* remoteName, FILE* file,
+                               const XferOptions* options, AsyncDone done, void* context );
+
+/** Ecriture d'un fichier sur le serveur, lu dans file, done appele a la fin
+ *
+ */
+extern XferSession* ASYNC_put( AsyncLoop* loop, const Addr* server, const char* remoteName, FILE* file,
+                               const XferOptions* options, AsyncDone done, void* context );
+
+/** Appel de timer apres delay millisecondes
+ *
+ */
+extern int ASYNC_after( AsyncLoop* loop, int64_t delay, AsyncTimer timer, void* context );
+
+/** Traitement des evenements pendant au plus timeout millisecondes (-1 : jusqu'au prochain evenement),
+ *  retourne le nombre de transferts et de minuteries en attente
+ */
+extern size_t ASYNC_poll( AsyncLoop* loop, int timeout );
+
+/** Traitement des evenements jusqu'a la fin de tous les transferts et minuteries (y compris ceux lances
+ *  par les fonctions de fin)
+ */
+extern void ASYNC_run( AsyncLoop* loop );
+
+/** Destruction d'une boucle (les transferts en cours sont abandonnes sans appel de leur fonction de fin)
+ *
+ */
+extern void ASYNC_destroy( AsyncLoop* loop );
+
+#endif // _TFTP_ASYNC_H_
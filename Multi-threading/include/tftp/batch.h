@@ -0,0 +1,88 @@
+#ifndef _TFTP_BATCH_H_
+#define _TFTP_BATCH_H_
+
+// System
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Local
+#include "tftp/addr.h"
+#include "tftp/packet.h"
+#include "tftp/xfer.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: BATCH
+// Description:
+//      Transferts de plusieurs fichiers en parallele dans un seul thread (boucle ASYNC, une socket, donc un TID,
+//      par transfert en cours), avec un nombre limite de transferts simultanes
+//--------------------------------------------------------------------------------------------------------------
+
+// Transferts simultanes par defaut et max
+#define BATCH_DEFAULT_JOBS 4
+#define BATCH_MAX_JOBS 4096
+
+// Nouvelles tentatives par defaut apres un echec transitoire, et delai avant la premiere (double ensuite)
+#define BATCH_DEFAULT_RETRIES 2
+#define BATCH_RETRY_DELAY_MS 500
+
+// Longueur d'un chemin local
+#define BATCH_PATH_SIZE 256
+
+// Sens d'un transfert
+enum
+{
+    BATCH_GET = 0,              // Lecture depuis le serveur
+    BATCH_PUT                   // Ecriture sur le serveur
+};
+
+/** Transfert d'un fichier
+ *
+ */
+typedef struct
+{
+    int direction;                      // BATCH_GET ou BATCH_PUT
+    char remote[FILENAME_SIZE];         // Nom du fichier sur le serveur
+    char local[BATCH_PATH_SIZE];        // Chemin du fichier local
+    XferOptions options;                // Options demandees
+    int status;                         // 0 si le transfert a abouti
+    int attempts;                       // Nombre de tentatives
+    XferResult result;                  // Debit et parametres de la derniere tentative
+} BatchItem;
+
+
+/** Nombre max de transferts simultanes
+ *
+ */
+extern void BATCH_setJobs( int jobs );
+
+/** Nombre de nouvelles tentatives apres un echec transitoire (timeout, socket, erreur non definie du serveur)
+ *
+ */
+extern void BATCH_setRetries( int retries );
+
+/** Lecture d'un manifeste ("-" : entree standard), une ligne par transfert :
+ *
+ *  get|put DISTANT LOCAL [blksize=N] [windowsize=N]    (lignes vides et commentaires '#' ignores)
+ *  Les transferts sont alloues dans items (a liberer par l'appelant)
+ */
+extern int BATCH_loadManifest( const char* path, BatchItem** items, size_t* count );
+
+/** Transferts des fichiers avec le serveur, retourne le nombre d'echecs
+ *
+ *  duration : duree totale (microsecondes)
+ */
+extern size_t BATCH_run( const Addr* server, BatchItem* items, size_t count, int64_t* duration );
+
+/** Affichage de l'etat de chaque transfert et du debit global
+ *
+ */
+extern void BATCH_printSummary( FILE* out, const BatchItem* items, size_t count, int64_t duration );
+
+/** Rapport JSON (une ligne) : bilan global et etat de chaque transfert
+ *
+ */
+extern void BATCH_writeReport( FILE* out, const BatchItem* items, size_t count, int64_t duration );
+
+#endif // _TFTP_BATCH_H_
@@ -0,0 +1,60 @@
+#ifndef _TFTP_BENCH_H_
+#define _TFTP_BENCH_H_
+
+// System
+#include <stdint.h>
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: BENCH
+// Description:
+//      Generateur de charge : nombreuses sessions TFTP simultanees depuis un seul processus
+//--------------------------------------------------------------------------------------------------------------
+
+// Nombre max de tailles de fichiers
+#define BENCH_MAX_SIZES 8
+
+// Nombre de fichiers distincts ecrits par taille (les PUT d'un meme fichier sont serialises par le serveur)
+#define BENCH_PUT_FILES 16
+
+/** Parametres d'une mesure
+ *
+ */
+typedef struct
+{
+    int sessions;                       // Sessions simultanees (boucle fermee) ou max (boucle ouverte)
+    double rate;                        // Requetes par seconde en boucle ouverte (0 : boucle fermee)
+    long requests;                      // Nombre de requetes (0 : limite par la duree)
+    double duration;                    // Duree max en secondes (0 : limitee par le nombre de requetes)
+    int getWeight;                      // Poids des GET dans le melange
+    int putWeight;                      // Poids des PUT dans le melange
+    size_t sizes[BENCH_MAX_SIZES];      // Tailles des fichiers (choisies uniformement)
+    int sizeCount;                      // Nombre de tailles
+    unsigned int seed;                  // Graine du tirage des requetes
+} BenchConfig;
+
+
+/** Parametres par defaut (100 sessions en boucle fermee, 1000 GET de 64 Ko)
+ *
+ */
+extern void BENCH_initConfig( BenchConfig* config );
+
+/** Lecture du melange de requetes ("get:80,put:20")
+ *
+ */
+extern int BENCH_parseMix( BenchConfig* config, const char* value );
+
+/** Lecture des tailles de fichiers ("512,64K,1M")
+ *
+ */
+extern int BENCH_parseSizes( BenchConfig* config, const char* value );
+
+/** Lancement de la mesure contre le serveur specifie
+ *
+ *  Les fichiers lus sont d'abord ecrits sur le serveur (bench-TAILLE.bin). Le resultat (debit, erreurs,
+ *  percentiles de latence) est affiche en clair puis sur une ligne JSON.
+ */
+extern int BENCH_run( const BenchConfig* config, const char* srvHost, uint16_t srvPort );
+
+#endif // _TFTP_BENCH_H_
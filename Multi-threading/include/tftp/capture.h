@@ -0,0 +1,58 @@
+#ifndef _TFTP_CAPTURE_H_
+#define _TFTP_CAPTURE_H_
+
+// System
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+// Local
+#include "tftp/sock.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: CAPTURE
+// Description:
+//      Capture pcap des datagrammes de SOCK_sendData / SOCK_recvData (entetes IPv4/UDP reconstitues), ecrite
+//      par un thread de fond avec rotation des fichiers
+//--------------------------------------------------------------------------------------------------------------
+
+// Taille d'un tampon de capture (deux tampons : l'un se remplit pendant que l'autre est ecrit)
+#define CAPTURE_BUFFER_SIZE ( 4 * 1024 * 1024 )
+
+// Periode d'ecriture des tampons (millisecondes)
+#define CAPTURE_FLUSH_MS 100
+
+// Taille max d'un fichier et nombre de fichiers conserves par defaut
+#define CAPTURE_DEFAULT_MAX_SIZE ( 64 * 1024 * 1024 )
+#define CAPTURE_DEFAULT_FILES 4
+
+
+/** Choix du fichier de capture (chaine vide pour desactiver)
+ *
+ */
+extern void CAPTURE_setOutput( const char* path );
+
+/** Taille max d'un fichier, et nombre de fichiers conserves (FICHIER, FICHIER.1, ... FICHIER.N-1)
+ *
+ */
+extern void CAPTURE_setLimits( long maxSize, int files );
+
+/** Lancement du thread d'ecriture (si un fichier est specifie)
+ *
+ */
+extern int CAPTURE_start();
+
+/** Arret du thread d'ecriture (les paquets en attente sont ecrits)
+ *
+ */
+extern void CAPTURE_stop();
+
+/** Capture d'un datagramme envoye (outgoing) ou recu par la socket, peer : destinataire ou emetteur
+ *
+ *  Copie dans le tampon courant sous un verrou court ; tampon plein : paquet perdu et compte
+ */
+extern void CAPTURE_packet( const Sock* sock, const struct sockaddr_in* peer, int outgoing, const void* data,
+                            size_t size );
+
+#endif // _TFTP_CAPTURE_H_
@@ -38,10 +38,16 @@ extern Client* CLIENT_create( const char* srvHost, uint16_t srvPort );
  */
 extern void CLIENT_run( Client* client );
 
-/** Lancement du client TFTP (On spam des commandes dans le terminal)
+/** Execution non interactive de commandes separees par des ';', retourne le nombre de commandes en echec
  *
  */
-extern void CLIENT_MultiRun( Client* client );
+extern int CLIENT_exec( Client* client, const char* commands );
+
+/** Transferts d'un manifeste (voir BATCH_loadManifest) et rapport JSON (report NULL : sortie standard)
+ *
+ *  Retourne le nombre de transferts en echec, -1 si le manifeste est invalide
+ */
+extern int CLIENT_runManifest( Client* client, const char* manifest, const char* report );
 
 /** Destruction d'un client
  *
@@ -0,0 +1,139 @@
+#ifndef _TFTP_DIGEST_H_
+#define _TFTP_DIGEST_H_
+
+// System
+#include <stddef.h>
+#include <stdint.h>
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: DIGEST
+// Description:
+//      Empreinte des fichiers transferes (option "checksum") : calcul au fil des blocs envoyes par le serveur,
+//      verification au fil des blocs recus par le client. Implementation choisie a l'execution selon le
+//      processeur (CRC-32C : SSE4.2 et PCLMUL, SHA-256 : extensions SHA), repli portable sinon
+//--------------------------------------------------------------------------------------------------------------
+
+// Algorithmes d'empreinte
+enum
+{
+    DIGEST_NONE = 0,            // Pas d'empreinte
+    DIGEST_CRC32C,              // CRC-32C (Castagnoli, polynome 0x1EDC6F41), 4 octets
+    DIGEST_SHA256,              // SHA-256 (FIPS 180-4), 32 octets
+    DIGEST_COUNT
+};
+
+// Taille max d'une empreinte (octets) et de la valeur de l'option checksum ("algorithme:hexadecimal")
+#define DIGEST_MAX_SIZE 32
+#define DIGEST_VALUE_SIZE ( 8 + 2 * DIGEST_MAX_SIZE )
+
+/** Empreinte calculee
+ *
+ */
+typedef struct
+{
+    int algorithm;                          // Algorithme (DIGEST_NONE : pas d'empreinte)
+    unsigned char bytes[DIGEST_MAX_SIZE];   // Valeur (DIGEST_size octets, CRC en big-endian)
+} Digest;
+
+/** Calcul d'une empreinte par morceaux
+ *
+ */
+typedef struct
+{
+    int algorithm;              // Algorithme
+    uint32_t crc;               // CRC-32C des octets traites
+    uint32_t state[8];          // SHA-256 : etat
+    uint64_t length;            // SHA-256 : octets traites
+    unsigned char block[64];    // SHA-256 : bloc incomplet
+    size_t used;                // SHA-256 : octets du bloc incomplet
+} DigestContext;
+
+/** Verification d'une empreinte au fil de la reception
+ *
+ */
+typedef struct
+{
+    Digest expected;            // Empreinte annoncee par le serveur (DIGEST_NONE : pas de verification)
+    int deferred;               // Empreinte envoyee apres les donnees (OACK avant le dernier bloc)
+    int pending;                // Empreinte differee pas encore recue
+    DigestContext context;      // Empreinte des octets recus
+} DigestCheck;
+
+
+/** Algorithme designe par son nom ("none", "crc32c", "sha256"), -1 si inconnu
+ *
+ */
+extern int DIGEST_parse( const char* name );
+
+/** Nom d'un algorithme
+ *
+ */
+extern const char* DIGEST_name( int algorithm );
+
+/** Taille d'une empreinte (octets)
+ *
+ */
+extern size_t DIGEST_size( int algorithm );
+
+/** Implementation utilisee pour un algorithme ("scalar", "sse4.2", "sse4.2+pclmul", "sha-ni")
+ *
+ */
+extern const char* DIGEST_engine( int algorithm );
+
+/** Implementations accelerees autorisees (par defaut) ou repli portable force (mesures, comparaisons)
+ *
+ */
+extern void DIGEST_setAccelerated( int accelerated );
+
+/** CRC-32C de size octets a la suite de crc (0 pour le premier appel)
+ *
+ */
+extern uint32_t DIGEST_crc32c( uint32_t crc, const void* data, size_t size );
+
+/** Debut d'un calcul
+ *
+ */
+extern void DIGEST_init( DigestContext* context, int algorithm );
+
+/** Prise en compte de size octets a la suite
+ *
+ */
+extern void DIGEST_add( DigestContext* context, const void* data, size_t size );
+
+/** Fin d'un calcul
+ *
+ */
+extern void DIGEST_final( DigestContext* context, Digest* digest );
+
+/** Egalite de deux empreintes
+ *
+ */
+extern int DIGEST_equals( const Digest* a, const Digest* b );
+
+/** Valeur de l'option checksum ("algorithme:empreinte" en hexadecimal)
+ *
+ */
+extern void DIGEST_format( const Digest* digest, char* value, size_t size );
+
+/** Debut d'une verification a partir de la valeur de l'option checksum recue ("algorithme:hexadecimal", ou
+ *  l'algorithme seul si l'empreinte suit les donnees), retourne 0 si elle est valide
+ */
+extern int DIGEST_start( DigestCheck* check, const char* value );
+
+/** Empreinte differee recue ("algorithme:hexadecimal", meme algorithme), retourne 0 si elle est valide (une
+ *  empreinte recue une seconde fois doit etre la meme, l'algorithme seul est ignore)
+ */
+extern int DIGEST_complete( DigestCheck* check, const char* value );
+
+/** Prise en compte de size octets recus a la suite
+ *
+ */
+extern void DIGEST_update( DigestCheck* check, const void* data, size_t size );
+
+/** Resultat de la verification, une fois tous les octets recus : 0 si les empreintes sont egales (ou sans
+ *  verification), echec si l'empreinte differee n'a pas ete recue
+ */
+extern int DIGEST_verify( DigestCheck* check );
+
+#endif // _TFTP_DIGEST_H_
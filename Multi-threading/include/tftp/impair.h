@@ -0,0 +1,80 @@
+#ifndef _TFTP_IMPAIR_H_
+#define _TFTP_IMPAIR_H_
+
+// System
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+// Local
+#include "tftp/sock.h"
+#include "tftp/addr.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: IMPAIR
+// Description:
+//      Degradation volontaire du reseau sous SOCK_sendData / SOCK_recvData : pertes, duplications, desordre,
+//      delai et debit limite par sens, avec des tirages reproductibles (tests de performance sur la boucle
+//      locale, sans netem)
+//--------------------------------------------------------------------------------------------------------------
+
+// Sens de degradation
+enum
+{
+    IMPAIR_SEND = 0,
+    IMPAIR_RECV,
+    IMPAIR_DIRECTIONS
+};
+
+// File d'attente max d'un lien a debit limite (microsecondes d'emission) : au-dela, le paquet est perdu
+#define IMPAIR_MAX_BACKLOG_US 1000000
+
+// Retard par defaut d'un paquet desordonne (millisecondes)
+#define IMPAIR_DEFAULT_GAP_MS 10
+
+
+/** Configuration d'un sens : "send:", "recv:" ou "both:" suivi de cle=valeur separes par des virgules
+ *
+ *  loss, dup, reorder : probabilites (0 a 1) de perte, duplication et desordre d'un paquet
+ *  delay, jitter, gap : delai fixe, delai aleatoire supplementaire et retard d'un paquet desordonne (ms)
+ *  rate : debit max en octets/s (suffixe K ou M)
+ */
+extern int IMPAIR_configure( const char* spec );
+
+/** Graine des tirages : le n-ieme socket cree fait les memes tirages d'une execution a l'autre
+ *
+ */
+extern void IMPAIR_setSeed( uint64_t seed );
+
+/** Degradation active dans un sens
+ *
+ */
+extern int IMPAIR_isActive( int direction );
+
+/** Initialisation des tirages d'une nouvelle socket
+ *
+ */
+extern void IMPAIR_attach( Sock* sock );
+
+/** Envoi degrade (meme contrat que SOCK_sendData) : les paquets retardes sont emis par un thread de fond
+ *
+ */
+extern int IMPAIR_send( Sock* sock, const void* data, size_t size, const Addr* to );
+
+/** Reception degradee (meme contrat que SOCK_recvData, timeout SO_RCVTIMEO respecte), from : emetteur
+ *
+ */
+extern int IMPAIR_recv( Sock* sock, void* data, size_t* size, struct sockaddr_in* from );
+
+/** Prochain paquet retarde en reception : retourne le descripteur de sa socket (-1 : aucun), due : date de
+ *  remise (METRICS_now)
+ */
+extern int IMPAIR_nextRecv( int64_t* due );
+
+/** Fermeture d'une socket : ses paquets retardes en emission partent quand meme, ceux en reception sont perdus
+ *
+ */
+extern void IMPAIR_forget( Sock* sock );
+
+#endif // _TFTP_IMPAIR_H_
@@ -0,0 +1,77 @@
+#ifndef _TFTP_LOG_H_
+#define _TFTP_LOG_H_
+
+// System
+#include <stdint.h>
+
+// Local
+#include "tftp/addr.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: LOG
+// Description:
+//      Journal asynchrone : tampons circulaires par thread vides par un thread de fond
+//--------------------------------------------------------------------------------------------------------------
+
+// Nombre de messages d'un tampon de thread (un message de plus est perdu et compte)
+#define LOG_RING_SIZE 128
+
+// Taille max d'un message, d'un nom de fichier et d'une adresse client dans un enregistrement
+#define LOG_MESSAGE_SIZE 160
+#define LOG_FILE_SIZE 64
+#define LOG_CLIENT_SIZE 24
+
+// Periode de vidage des tampons (millisecondes)
+#define LOG_FLUSH_MS 10
+
+// Pas de numero de bloc associe au message
+#define LOG_NO_BLOCK -1
+
+// Niveaux
+enum
+{
+    LOG_DEBUG = 0,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+
+/** Choix du niveau minimal des messages ecrits (LOG_INFO par defaut)
+ *
+ */
+extern void LOG_setLevel( int level );
+
+/** Lecture d'un niveau ("debug", "info", "warn" ou "error"), retourne -1 si inconnu
+ *
+ */
+extern int LOG_parseLevel( const char* name );
+
+/** Lancement du thread de vidage. Sans lui (client), les messages sont ecrits directement par l'appelant
+ *
+ */
+extern int LOG_start();
+
+/** Arret du thread de vidage (les messages en attente sont ecrits)
+ *
+ */
+extern void LOG_stop();
+
+/** Contexte des messages du thread appelant : session, client et fichier (client et fichier optionnels)
+ *
+ */
+extern void LOG_setSession( uint64_t session, const Addr* client, const char* file );
+
+/** Fin du contexte du thread appelant
+ *
+ */
+extern void LOG_clearSession();
+
+/** Ecriture d'un message (niveau filtre avant formatage, copie dans le tampon du thread sans verrou)
+ *
+ *  block : numero de bloc concerne, ou LOG_NO_BLOCK
+ */
+extern void LOG_write( int level, int64_t block, const char* format, ... ) __attribute__(( format( printf, 3, 4 ) ));
+
+#endif // _TFTP_LOG_H_
@@ -0,0 +1,77 @@
+#ifndef _TFTP_MCAST_H_
+#define _TFTP_MCAST_H_
+
+// System
+#include <stdint.h>
+#include <sys/types.h>
+
+// Local
+#include "tftp/sock.h"
+#include "tftp/addr.h"
+#include "tftp/packet.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: MCAST
+// Description:
+//      Diffusion multicast des fichiers (option "multicast", RFC 2090)
+//--------------------------------------------------------------------------------------------------------------
+
+// Port de base des groupes (une session par fichier diffuse, sur le port de base + numero de session)
+#define MCAST_DEFAULT_PORT 1758
+
+// Nombre max de sessions simultanees et de clients par session
+#define MCAST_MAX_SESSIONS 16
+#define MCAST_MAX_CLIENTS 512
+
+// Delai d'attente de l'ACK du client maitre (millisecondes)
+#define MCAST_TIMEOUT_MS 1000
+
+// Retour de MCAST_sendFile() quand la diffusion multicast n'est pas possible (envoi unicast a faire)
+#define MCAST_DECLINED -1
+
+/** Client d'une session multicast
+ *
+ */
+typedef struct
+{
+    Addr addr;                  // Adresse unicast du client
+    int withSize;               // 1 si le client a demande l'option tsize
+} McastClient;
+
+/** Structure de donnees associee a une session multicast
+ *
+ *  Le fichier est emis une seule fois vers le groupe. Seul le premier client de la liste (le maitre) acquitte
+ *  les blocs ; quand il a termine, le client suivant devient maitre et redemande les blocs qui lui manquent.
+ */
+typedef struct
+{
+    char fileName[256];                         // Fichier diffuse
+    off_t size;                                 // Taille du fichier
+    int slot;                                   // Numero de la session
+    Sock* sock;                                 // Socket de la session (identifiant de transfert)
+    Addr* group;                                // Adresse du groupe
+    McastClient clients[MCAST_MAX_CLIENTS];     // Clients en attente, le premier est le maitre
+    int clientCount;                            // Nombre de clients
+} McastSession;
+
+
+/** Choix de l'adresse du groupe multicast (active la diffusion multicast)
+ *
+ */
+extern int MCAST_setGroup( const char* host );
+
+/** Choix du port de base des groupes
+ *
+ */
+extern void MCAST_setBasePort( uint16_t port );
+
+/** Traitement d'une demande de lecture avec l'option multicast
+ *
+ *  Si une session diffuse deja le fichier, le client la rejoint et l'appel retourne immediatement. Sinon, une
+ *  session est ouverte et la diffusion se fait dans le thread appelant jusqu'au dernier client.
+ *  Retourne MCAST_DECLINED si l'option n'est pas demandee ou pas utilisable (transfert unicast a faire).
+ */
+extern int MCAST_sendFile( Sock* sock, const char* fileName, const XrqPacket* request, const Addr* client );
+
+#endif // _TFTP_MCAST_H_
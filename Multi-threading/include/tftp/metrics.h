@@ -0,0 +1,143 @@
+#ifndef _TFTP_METRICS_H_
+#define _TFTP_METRICS_H_
+
+// System
+#include <stdint.h>
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: METRICS
+// Description:
+//      Compteurs et jauges du serveur, exportes au format texte Prometheus
+//--------------------------------------------------------------------------------------------------------------
+
+// Nombre de codes d'erreur TFTP suivis (RFC 1350 : 0 a 7, RFC 2347 : 8)
+#define METRICS_ERROR_CODES 9
+
+// Periode de reecriture du fichier d'export (millisecondes)
+#define METRICS_PERIOD_MS 1000
+
+// Prefixe d'une cible d'export sur socket UNIX (sinon fichier)
+#define METRICS_UNIX_PREFIX "unix:"
+
+// Taille max d'un snapshot
+#define METRICS_SNAPSHOT_SIZE 65536
+
+// Histogrammes log-lineaires (microsecondes) : valeurs exactes jusqu'a 2^METRICS_SUB_BITS, puis
+// 2^METRICS_SUB_BITS intervalles par puissance de 2 jusqu'a 2^METRICS_MAX_EXPONENT (erreur relative < 12.5 %)
+#define METRICS_SUB_BITS 3
+#define METRICS_MAX_EXPONENT 40
+#define METRICS_BUCKETS ( ( METRICS_MAX_EXPONENT - METRICS_SUB_BITS + 2 ) << METRICS_SUB_BITS )
+
+// Bornes exportees (le = 2^k us pour k <= METRICS_EXPORT_EXPONENT, alignees sur les intervalles)
+#define METRICS_EXPORT_EXPONENT 35
+
+// Mesures (compteurs, sauf mention contraire)
+enum
+{
+    METRICS_REQUESTS_RRQ = 0,               // Requetes de lecture recues
+    METRICS_REQUESTS_WRQ,                   // Requetes d'ecriture recues
+    METRICS_REQUESTS_OTHER,                 // Requetes hors protocole recues
+    METRICS_ACTIVE_SESSIONS,                // Services en cours (jauge)
+    METRICS_BYTES_SENT,                     // Octets envoyes (datagrammes UDP)
+    METRICS_BYTES_RECEIVED,                 // Octets recus (datagrammes UDP)
+    METRICS_RETRANSMITS,                    // Paquets renvoyes apres un timeout
+    METRICS_TIMEOUTS,                       // Attentes de reponse expirees
+    METRICS_DROPPED_REQUESTS,               // Requetes ignorees (MAX_NB_THREADS atteint)
+    METRICS_INDEX_HITS,                     // Recherches dans l'index abouties
+    METRICS_INDEX_MISSES,                   // Recherches dans l'index sans resultat
+    METRICS_LOG_DROPPED,                    // Messages de journal perdus (tampon plein)
+    METRICS_TRACE_DROPPED,                  // Evenements de trace perdus (tampon plein)
+    METRICS_CAPTURE_DROPPED,                // Paquets non captures (tampon de capture plein)
+    METRICS_DIGEST_HITS,                    // Empreintes de fichier deja calculees
+    METRICS_DIGEST_MISSES,                  // Empreintes de fichier absentes (calculees au fil de l'envoi)
+    METRICS_ERRORS,                         // Paquets ERROR envoyes, par code (METRICS_ERRORS + code)
+    METRICS_COUNT = METRICS_ERRORS + METRICS_ERROR_CODES
+};
+
+// Histogrammes de latence
+enum
+{
+    METRICS_FIRST_BYTE = 0,                 // Reception du RRQ a l'envoi du premier DATA
+    METRICS_BLOCK_RTT,                      // Envoi d'un DATA a la reception de son ACK (hors renvois)
+    METRICS_TRANSFER_64K,                   // Duree totale d'un transfert, fichier <= 64 Ko
+    METRICS_TRANSFER_1M,                    // Duree totale d'un transfert, fichier <= 1 Mo
+    METRICS_TRANSFER_16M,                   // Duree totale d'un transfert, fichier <= 16 Mo
+    METRICS_TRANSFER_LARGE,                 // Duree totale d'un transfert, fichier > 16 Mo
+    METRICS_SERVICE_WAIT,                   // Reception de la requete au demarrage de son service
+    METRICS_ACK_DELAY,                      // Reception d'un DATA (WRQ) a l'envoi de son ACK, hors dernier bloc
+    METRICS_ACK_DELAY_LAST,                 // Reception du dernier DATA a l'envoi de son ACK (fichier publie)
+    METRICS_HISTOGRAM_COUNT
+};
+
+
+/** Ajout d'une valeur a une mesure (compteur du thread appelant, sans verrou)
+ *
+ */
+extern void METRICS_add( int metric, int64_t value );
+
+/** Valeur courante d'une mesure (somme sur tous les threads)
+ *
+ */
+extern int64_t METRICS_get( int metric );
+
+/** Horloge monotone (microsecondes)
+ *
+ */
+extern int64_t METRICS_now();
+
+/** Enregistrement d'une duree (microsecondes) dans un histogramme (histogramme du thread appelant, sans verrou)
+ *
+ */
+extern void METRICS_record( int histogram, int64_t duration );
+
+/** Histogramme des durees de transfert correspondant a une taille de fichier
+ *
+ */
+extern int METRICS_transferHistogram( int64_t size );
+
+/** Date de reception de la requete traitee par le thread appelant (pour METRICS_recordFirstByte)
+ *
+ */
+extern void METRICS_startRequest( int64_t received );
+
+/** Envoi du premier DATA de la requete du thread appelant (enregistre une seule fois par requete)
+ *
+ */
+extern void METRICS_recordFirstByte();
+
+/** Copie d'un histogramme (somme sur tous les threads) : METRICS_BUCKETS compteurs, somme et nombre
+ *
+ *  Les intervalles sont fixes : les histogrammes de plusieurs threads ou processus s'additionnent terme a terme
+ */
+extern void METRICS_getHistogram( int histogram, uint64_t* buckets, int64_t* sum, uint64_t* count );
+
+/** Intervalle d'un histogramme contenant une duree, et borne superieure (exclue) d'un intervalle
+ *
+ */
+extern int METRICS_bucketIndex( int64_t duration );
+extern int64_t METRICS_bucketLimit( int index );
+
+/** Ecriture du snapshot au format texte Prometheus, retourne sa taille
+ *
+ */
+extern size_t METRICS_format( char* buff, size_t size );
+
+/** Choix de la cible d'export : fichier reecrit periodiquement, ou "unix:CHEMIN" pour une socket UNIX
+ *  (un snapshot par connexion). Chaine vide pour desactiver
+ *
+ */
+extern void METRICS_setExport( const char* target );
+
+/** Lancement du thread d'export (si une cible est specifiee)
+ *
+ */
+extern int METRICS_startExport();
+
+/** Arret du thread d'export (dernier snapshot ecrit dans le fichier)
+ *
+ */
+extern void METRICS_stopExport();
+
+#endif // _TFTP_METRICS_H_
@@ -22,6 +22,13 @@
 #define DATA_SIZE 512
 #define ERROR_SIZE 64
 
+// Options negociees (RFC 2347). Une valeur peut contenir une empreinte SHA-256 ("sha256:" et 64 chiffres) ;
+// les options encodees sont limitees a OPTIONS_MAX_BYTES pour qu'une requete tienne dans PACKET_MAX_SIZE
+#define MAX_OPTIONS 8
+#define OPTION_NAME_SIZE 16
+#define OPTION_VALUE_SIZE 80
+#define OPTIONS_MAX_BYTES ( PACKET_MAX_SIZE - sizeof( uint16_t ) - FILENAME_SIZE - MODE_SIZE )
+
 // Types de paquets TFTP disponibles
 enum 
 {
@@ -29,7 +36,8 @@ enum
     TFTP_WRQ,                // Demande d'ecriture
     TFTP_DATA,               // Donnees
     TFTP_ACK,                // Accuse de reception
-    TFTP_ERROR               // Erreur
+    TFTP_ERROR,              // Erreur
+    TFTP_OACK                // Acquittement des options (RFC 2347)
 };
 
 // Codes d'erreurs
@@ -42,7 +50,8 @@ enum
     ERR_INVALID_OPTION,
     ERR_UNKNOWN_TRANSFER_ID,
     ERR_FILE_ALREADY_EXISTS,
-    ERR_UNKOWN_USER
+    ERR_UNKOWN_USER,
+    ERR_OPTION_REFUSED                      // Options refusees (RFC 2347)
 };
 
 /** Structure de donnees associee a un packet TFTP general
@@ -54,6 +63,15 @@ typedef struct
     void* data;     // Donnees specifique du paquet (en fonction du code)
 } Packet;
 
+/** Option d'une requete ou d'un OACK (nom et valeur textuels)
+ *
+ */
+typedef struct
+{
+    char name[OPTION_NAME_SIZE];            // Nom de l'option (insensible a la casse)
+    char value[OPTION_VALUE_SIZE];          // Valeur de l'option
+} Option;
+
 /** Donnees pour un paquet RRQ ou WRQ
  *
  */
@@ -61,6 +79,8 @@ typedef struct
 {
     char fileName[FILENAME_SIZE];           // Nom du fichier
     char mode[MODE_SIZE];                   // Mode d'encodage (toujours "octet")
+    Option options[MAX_OPTIONS];            // Options demandees
+    size_t optionCount;                     // Nombre d'options
 } XrqPacket;
 
 /** Donnees pour un paquet DATA
@@ -90,6 +110,15 @@ typedef struct
     char errorMsg[ERROR_SIZE];              // Message d'erreur
 } ErrorPacket;
 
+/** Donnees pour un paquet OACK
+ *
+ */
+typedef struct
+{
+    Option options[MAX_OPTIONS];            // Options acceptees
+    size_t optionCount;                     // Nombre d'options
+} OackPacket;
+
 
 /** Creation d'un packet (donnees initialisee par defaut)
  *
@@ -107,6 +136,23 @@ extern int PACKET_decode( Packet* packet, const unsigned char* buff, size_t buff
  */
 extern int PACKET_encode( Packet* packet, unsigned char* buff, size_t* buffSize );
 
+/** Encodage direct d'un paquet DATA (avec le code), sans creation de paquet
+ *
+ *  Retourne la taille encodee (au plus PACKET_MAX_SIZE)
+ */
+extern size_t PACKET_encodeData( unsigned char* buff, uint16_t blockNum, const unsigned char* bytes, size_t bytesCount );
+
+/** Recherche de la valeur d'une option (NULL si absente)
+ *
+ */
+extern const char* PACKET_getOption( const Option* options, size_t optionCount, const char* name );
+
+/** Ajout d'une option (refusee si la liste est pleine, si le nom ou la valeur sont trop longs, ou si les options
+ *  encodees depassent OPTIONS_MAX_BYTES)
+ *
+ */
+extern int PACKET_addOption( Option* options, size_t* optionCount, const char* name, const char* value );
+
 /** Destruction d'un packet
  *
  */
@@ -0,0 +1,81 @@
+#ifndef _TFTP_READER_H_
+#define _TFTP_READER_H_
+
+// System
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: READER
+// Description:
+//      Lecture des fichiers envoyes (lecture par tampons et lecture anticipee)
+//--------------------------------------------------------------------------------------------------------------
+
+// Taille du tampon de lecture (une lecture disque sert plusieurs blocs DATA)
+#define READER_CHUNK_SIZE ( 64 * 1024 )
+
+// Taille du tampon en lecture directe (O_DIRECT) : chaque lecture attend le disque, elle doit etre grande
+#define READER_DIRECT_CHUNK_SIZE ( 1024 * 1024 )
+
+// Alignement du tampon de lecture (requis par O_DIRECT)
+#define READER_ALIGNMENT 4096
+
+// Distance de lecture anticipee par defaut (en blocs de DATA_SIZE octets)
+#define READER_DEFAULT_PREFETCH 2048
+
+/** Structure de donnees associee a un lecteur
+ *
+ */
+typedef struct
+{
+    int fd;                         // Fichier lu
+    off_t size;                     // Taille du fichier a l'ouverture
+    int direct;                     // 1 si le fichier est lu sans passer par le cache (O_DIRECT)
+    unsigned char* chunk;           // Tampon de lecture
+    size_t chunkCapacity;           // Taille du tampon de lecture
+    off_t chunkOffset;              // Position du tampon dans le fichier
+    size_t chunkSize;               // Nombre d'octets valides dans le tampon
+    off_t prefetched;               // Fin de la zone deja demandee au noyau
+} Reader;
+
+
+/** Choix de la distance de lecture anticipee (en blocs, 0 pour desactiver)
+ *
+ *  Le noyau est prevenu (posix_fadvise WILLNEED) des donnees situees jusqu'a cette distance devant le bloc
+ *  courant : la lecture disque est lancee en tache de fond et la boucle d'envoi trouve les donnees en cache.
+ */
+extern void READER_setPrefetchDistance( size_t blocks );
+
+/** Choix de la taille de fichier a partir de laquelle la lecture est directe (0 pour desactiver)
+ *
+ *  Les gros fichiers, lus une seule fois par client, ne remplissent alors plus le cache du noyau au
+ *  detriment des petits fichiers souvent demandes. Si le systeme de fichiers ne supporte pas O_DIRECT, la
+ *  lecture se fait normalement.
+ */
+extern void READER_setDirectThreshold( off_t size );
+
+/** Ouverture d'un fichier en lecture sequentielle
+ *
+ */
+extern Reader* READER_open( const char* fileName );
+
+/** Lecture de size octets a la position specifiee
+ *
+ *  Retourne le nombre d'octets lus (inferieur a size en fin de fichier), ou -1 en cas d'erreur
+ */
+extern ssize_t READER_read( Reader* reader, off_t offset, void* data, size_t size );
+
+/** Lecture de size octets a la position specifiee, sans passer par le tampon du lecteur
+ *
+ *  Utilisable en parallele de READER_read (une lecture disque par appel). Retourne le nombre d'octets lus, ou -1
+ */
+extern ssize_t READER_pread( const Reader* reader, off_t offset, void* data, size_t size );
+
+/** Fermeture du fichier et destruction du lecteur
+ *
+ */
+extern void READER_close( Reader* reader );
+
+#endif // _TFTP_READER_H_
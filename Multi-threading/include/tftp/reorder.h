@@ -0,0 +1,72 @@
+#ifndef _TFTP_REORDER_H_
+#define _TFTP_REORDER_H_
+
+// System
+#include <stddef.h>
+#include <stdint.h>
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: REORDER
+// Description:
+//      Tampon de reordonnancement des blocs DATA recus : les blocs arrives en avance sont conserves jusqu'a la
+//      reception des blocs manquants, puis rendus dans l'ordre (liens agreges, chemins multiples)
+//--------------------------------------------------------------------------------------------------------------
+
+// Nombre de blocs conserves par defaut (transferts pas a pas)
+#define REORDER_DEFAULT_BLOCKS 16
+
+// Ecart entre deux numeros de bloc (16 bits, rebouclage) a partir duquel un bloc est considere en retard
+#define REORDER_HALF_RANGE 0x8000
+
+// Resultat d'une mise en attente
+enum
+{
+    REORDER_HELD = 0,           // Bloc conserve
+    REORDER_DUPLICATE,          // Bloc deja conserve
+    REORDER_TOO_FAR             // Bloc hors du tampon (trop en avance ou trop grand)
+};
+
+/** Tampon de reordonnancement
+ *
+ *  Le bloc n est range a l'emplacement n % slots (slots : puissance de 2, donc diviseur de 65536)
+ */
+typedef struct
+{
+    size_t blockSize;           // Taille max d'un bloc
+    uint16_t slots;             // Nombre d'emplacements
+    uint16_t held;              // Blocs conserves
+    unsigned char* bytes;       // Donnees des blocs (slots * blockSize)
+    size_t* counts;             // Taille de chaque bloc
+    unsigned char* used;        // Emplacements occupes
+} Reorder;
+
+
+/** Creation d'un tampon pour au moins blocks blocs en avance de blockSize octets
+ *
+ */
+extern Reorder* REORDER_create( size_t blockSize, uint16_t blocks );
+
+/** Mise en attente du bloc blockNum, en avance sur le bloc attendu expected
+ *
+ *  Retourne REORDER_HELD, REORDER_DUPLICATE ou REORDER_TOO_FAR
+ */
+extern int REORDER_hold( Reorder* reorder, uint16_t expected, uint16_t blockNum, const unsigned char* bytes,
+                         size_t count );
+
+/** Retrait du bloc blockNum s'il est conserve (NULL sinon), donnees valides jusqu'a la prochaine mise en attente
+ *
+ */
+extern const unsigned char* REORDER_take( Reorder* reorder, uint16_t blockNum, size_t* count );
+
+/** Abandon de tous les blocs conserves
+ *
+ */
+extern void REORDER_clear( Reorder* reorder );
+
+/** Destruction d'un tampon
+ *
+ */
+extern void REORDER_destroy( Reorder* reorder );
+
+#endif // _TFTP_REORDER_H_
@@ -0,0 +1,61 @@
+#ifndef _TFTP_RESUME_H_
+#define _TFTP_RESUME_H_
+
+// System
+#include <stdio.h>
+#include <stdint.h>
+
+// Local
+#include "tftp/sock.h"
+#include "tftp/addr.h"
+#include "tftp/xfer.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: RESUME
+// Description:
+//      Lectures reprenables : le fichier partiel est conserve apres un echec transitoire, avec un fichier de
+//      reprise (LOCAL.resume) qui enregistre les octets ecrits sur disque, et le get suivant reprend a cet
+//      octet (option offset)
+//--------------------------------------------------------------------------------------------------------------
+
+// Suffixe du fichier de reprise
+#define RESUME_SUFFIX ".resume"
+
+// Longueur max du chemin du fichier de reprise
+#define RESUME_PATH_SIZE 512
+
+/** Etat d'une lecture reprenable, transmis au suivi de progression
+ *
+ */
+typedef struct
+{
+    char path[RESUME_PATH_SIZE];        // Fichier de reprise
+    const char* remoteName;             // Nom du fichier sur le serveur
+    const char* localPath;              // Chemin du fichier local
+    FILE* file;                         // Fichier local
+    uint64_t verified;                  // Octets ecrits sur disque et enregistres
+} ResumeState;
+
+
+/** Ouverture du fichier local d'une lecture reprenable (transfert pilote par l'appelant, voir ASYNC)
+ *
+ *  Les options du transfert sont ecrites dans current (offset, taille attendue et suivi). state doit rester
+ *  valide jusqu'a RESUME_close
+ */
+extern FILE* RESUME_open( ResumeState* state, const char* remoteName, const char* localPath,
+                          const XferOptions* options, XferOptions* current, XferResult* result );
+
+/** Fin d'une lecture reprenable (status : resultat du transfert) : fichier local ferme, fichier partiel
+ *  conserve si une reprise peut aboutir, supprime sinon
+ */
+extern int RESUME_close( ResumeState* state, int status, XferResult* result );
+
+/** Lecture d'un fichier du serveur dans localPath, reprise la ou un get precedent s'est arrete
+ *
+ *  options NULL : options par defaut (offset, taille attendue et suivi sont fixes par le module)
+ */
+extern int RESUME_get( Sock* sock, const Addr* server, const char* remoteName, const char* localPath,
+                       const XferOptions* options, XferResult* result );
+
+#endif // _TFTP_RESUME_H_
@@ -0,0 +1,47 @@
+#ifndef _TFTP_SEGMENT_H_
+#define _TFTP_SEGMENT_H_
+
+// System
+#include <stdint.h>
+
+// Local
+#include "tftp/sock.h"
+#include "tftp/addr.h"
+#include "tftp/xfer.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: SEGMENT
+// Description:
+//      Lecture d'un gros fichier par segments : le fichier est decoupe en K plages (options offset et length),
+//      lues par K transferts simultanes d'une boucle ASYNC (une socket, donc un TID, par segment) et ecrites par
+//      pwrite dans le fichier local prealloue
+//--------------------------------------------------------------------------------------------------------------
+
+// Segments par defaut (1 : lecture en un seul transfert) et max
+#define SEGMENT_DEFAULT_COUNT 1
+#define SEGMENT_MAX_COUNT 32
+
+// Taille min d'un segment (un petit fichier est lu en moins de segments)
+#define SEGMENT_MIN_SIZE ( 256 * 1024 )
+
+
+/** Nombre de segments d'une lecture
+ *
+ */
+extern void SEGMENT_setCount( int count );
+
+/** Nombre de segments d'une lecture (1 : lecture en un seul transfert)
+ *
+ */
+extern int SEGMENT_getCount();
+
+/** Lecture d'un fichier du serveur par segments dans localPath (options NULL : options par defaut)
+ *
+ *  La taille est demandee d'abord (plage vide avec tsize) ; si le serveur ne gere pas les plages, le fichier
+ *  est lu en un seul transfert (avec reprise, voir RESUME_get)
+ */
+extern int SEGMENT_get( Sock* sock, const Addr* server, const char* remoteName, const char* localPath,
+                        const XferOptions* options, XferResult* result );
+
+#endif // _TFTP_SEGMENT_H_
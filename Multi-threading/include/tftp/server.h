@@ -17,6 +17,9 @@
 
 #define MAX_NB_THREADS 512
 
+// Longueur du chemin du snapshot de l'index
+#define INDEX_PATH_SIZE 256
+
 /** Structure de donnees associee au serer TFTP
  *
  */
@@ -24,6 +27,9 @@ typedef struct
 {
     Sock* sock;                              // Socket du serveur (attente des requetes entrantes)
     Service* listService[MAX_NB_THREADS];    // Liste des services (threads)
+    FileAVL* avl;                            // Index des fichiers disponibles
+    pthread_mutex_t avl_mutex;               // Mutex de l'index
+    char indexPath[INDEX_PATH_SIZE];         // Snapshot de l'index (vide si desactive)
 } Server;
 
 
@@ -32,7 +38,14 @@ typedef struct
  */
 extern Server* SERVER_create( uint16_t port );
 
-/** Lancement du serveur TFTP
+/** Choix du snapshot de l'index (chaine vide pour desactiver)
+ *
+ *  Le snapshot est charge au lancement (pas de parcours du disque avant la premiere requete) et reecrit a
+ *  l'arret du serveur (SIGINT/SIGTERM)
+ */
+extern void SERVER_setIndexPath( Server* srv, const char* indexPath );
+
+/** Lancement du serveur TFTP (jusqu'a reception de SIGINT/SIGTERM)
  *
  */
 extern void SERVER_run( Server* srv );
@@ -31,6 +31,8 @@ typedef struct
     pthread_mutex_t mutex;      // Mutex du service 
     FileAVL **avl;              // AVL de mutex de fichier
     pthread_mutex_t *avl_mutex; // Mutex de l'AVL
+    int64_t received;           // Date de reception de la requete (us, METRICS_now)
+    uint64_t id;                // Numero de la requete (journal)
 } Service;
 
 
@@ -51,8 +53,10 @@ extern void* SERVICE_ProcessRequest( void* arg );
 
 /** Traitement d'une requette WRQ
  * 
+ *  Le fichier est recu dans un fichier temporaire voisin, puis publie par un rename atomique. Les lecteurs
+ *  en cours continuent sur l'ancienne version, et un transfert en echec laisse le fichier inchange.
  */
-extern int SERVICE_RecvFile( Sock* sock, Addr* cltAddr, XrqPacket* wrq );
+extern int SERVICE_RecvFile( Sock* sock, Addr* cltAddr, const char* fileName );
 
 /** Destruction d'un service
  *
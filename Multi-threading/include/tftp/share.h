@@ -0,0 +1,65 @@
+#ifndef _TFTP_SHARE_H_
+#define _TFTP_SHARE_H_
+
+// System
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Local
+#include "tftp/sock.h"
+#include "tftp/addr.h"
+#include "tftp/reader.h"
+#include "tftp/digest.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: SHARE
+// Description:
+//      Envoi mutualise d'un meme fichier a plusieurs lecteurs simultanes
+//--------------------------------------------------------------------------------------------------------------
+
+// Nombre max de paquets DATA encodes gardes par fichier (1 Mo de donnees)
+#define SHARE_RING_BLOCKS 2048
+
+// Nombre de blocs lus et encodes d'un coup quand un bloc manque (un tampon du lecteur)
+#define SHARE_FILL_BLOCKS ( READER_CHUNK_SIZE / DATA_SIZE )
+
+/** Structure de donnees associee a un fichier partage
+ *
+ *  Les paquets DATA sont lus et encodes une seule fois dans un anneau (bloc n dans la case n % ringBlocks), par un
+ *  lecteur a la fois et hors verrou : les cases sont reservees, remplies, puis publiees. Chaque lecteur n'a en
+ *  propre que son numero de bloc courant et la copie du paquet a renvoyer sur timeout. Un lecteur distance de plus
+ *  d'un anneau lit lui-meme ses blocs.
+ */
+typedef struct SharedFile
+{
+    char fileName[256];                 // Nom du fichier
+    dev_t dev;                          // Version du fichier : peripherique, inode, date de modification, taille
+    ino_t ino;
+    int64_t mtime;
+    off_t size;
+    Reader* reader;                     // Lecteur unique du fichier
+    size_t ringBlocks;                  // Nombre de cases de l'anneau
+    unsigned char* packets;             // Paquets encodes (ringBlocks x PACKET_MAX_SIZE octets)
+    uint16_t* sizes;                    // Taille de chaque paquet encode
+    uint64_t* blocks;                   // Numero de bloc contenu par chaque case (0 : vide ou reservee)
+    uint64_t head;                      // Dernier bloc lu dans l'anneau
+    int filling;                        // 1 pendant la lecture des cases reservees (lecteur partage occupe)
+    int refCount;                       // Nombre de lecteurs
+    pthread_mutex_t mutex;              // Protection de l'anneau
+    pthread_cond_t filled;              // Publication des cases reservees
+    struct SharedFile* next;            // Fichier partage suivant
+} SharedFile;
+
+
+/** Envoi d'un fichier vers l'adresse specifiee, en partageant lecture et encodage avec les autres lecteurs
+ *  de la meme version du fichier
+ *
+ *  reader : fichier deja ouvert (version envoyee, detruit par l'envoi), NULL pour ouvrir fileName
+ *  trailer : NULL, ou empreinte (algorithme trailer->algorithm) calculee sur les blocs envoyes, envoyee dans un
+ *  OACK avant le dernier bloc (acquitte par l'ACK de l'avant-dernier) et rendue dans trailer
+ */
+extern int SHARE_sendFile( Sock* sock, const char* fileName, Reader* reader, Digest* trailer, const Addr* endpoint );
+
+#endif // _TFTP_SHARE_H_
@@ -19,8 +19,9 @@
  */
 typedef struct
 {
-    int fd;         // File descriptor de la socket
-    Addr* addr;     // Adresse a laquelle la socket est rattachee
+    int fd;                 // File descriptor de la socket
+    Addr* addr;             // Adresse a laquelle la socket est rattachee
+    uint64_t impair[2];     // Etat des tirages de la degradation reseau (emission, reception)
 } Sock;
 
 
@@ -31,17 +32,29 @@ typedef struct
  */
 extern Sock* SOCK_create( uint16_t port );
 
+/** Creation d'une socket de reception d'un groupe multicast
+ *
+ *  La socket est rattachee a l'adresse du groupe (port partage entre les clients de la machine) et rejoint
+ *  le groupe sur l'interface de la socket unicast specifiee
+ */
+extern Sock* SOCK_createMulticast( const Addr* group, const Sock* unicast );
+
+/** Emission multicast par l'interface a laquelle la socket est rattachee
+ *
+ */
+extern int SOCK_setMulticastInterface( Sock* sock );
+
 /** Reception d'un bloc de donnees de taille connue
  *
  */
 extern int SOCK_recvSizedData( Sock* sock, void* data, size_t size );
 
-/** Envoi d'un bloc de donnees a l'adresse specifiee
+/** Envoi d'un bloc de donnees a l'adresse specifiee (degrade si une degradation est configuree, voir IMPAIR)
  *
  */
 extern int SOCK_sendData( Sock* sock, const void* data, size_t size, const Addr* to );
 
-/** Reception d'un bloc de donnees de taille inconnue
+/** Reception d'un bloc de donnees de taille inconnue (degradee si une degradation est configuree)
  *
  *  En entree, size specifie la taille max du buffer de reception. En sortie, size contient la taille
  *  des donnees recues
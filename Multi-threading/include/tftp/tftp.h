@@ -3,25 +3,37 @@
 
 // System
 #include <stdint.h>
+#include <sys/types.h>
 
 // Local
 #include "tftp/sock.h"
 #include "tftp/packet.h"
 #include "tftp/addr.h"
+#include "tftp/writer.h"
 
 #define TIMEOUT ((Packet*)1)
 #define MAX_TRY_TIMEOUT 5
 
+// Delai min (ms) entre l'envoi d'un bloc et son renvoi sur un ACK du bloc precedent : ACK renvoye par le client
+// apres son propre timeout, les doublons plus proches de l'envoi sont ignores
+#define DUP_ACK_RESEND_MS 250
+
 //--------------------------------------------------------------------------------------------------------------
 // Module: TFTP
 // Description:
 //      Envoi et reception des paquets TFTP
 //--------------------------------------------------------------------------------------------------------------
 
-/** Envoi d'un paquet WRQ/RRQ
+/** Envoi d'un paquet WRQ/RRQ (avec d'eventuelles options)
+ *
+ */
+extern int TFTP_sendXrqPacket(
+        Sock* sock, uint16_t code, const char* fileName, const Option* options, size_t optionCount, const Addr* to );
+
+/** Envoi d'un paquet OACK
  *
  */
-extern int TFTP_sendXrqPacket( Sock* sock, uint16_t code, const char* fileName, const Addr* to );
+extern int TFTP_sendOackPacket( Sock* sock, const Option* options, size_t optionCount, const Addr* to );
 
 /** Envoi d'un paquet ACK
  *
@@ -41,17 +53,48 @@ extern int TFTP_sendErrorPacket( Sock* sock, uint16_t error, const char* msg, co
 
 /** Reception d'un paquet TFTP
  *
+ *  Retourne TIMEOUT a l'expiration du timeout de la socket, NULL en cas d'erreur ou de paquet invalide
  */
 extern Packet* TFTP_recvPacket( Sock* sock, Addr* from );
 
-/** Envoi d'un fichier vers l'adresse specifiee
+/** Reception d'un paquet TFTP, en distinguant une erreur de la socket (*sockError a 1) d'un paquet invalide
+ *  ignorable (NULL, *sockError a 0)
+ */
+extern Packet* TFTP_recvPacketStatus( Sock* sock, Addr* from, int* sockError );
+
+/** Envoi de length octets d'un fichier (-1 : jusqu'a la fin) vers l'adresse specifiee, a partir de l'octet start
+ *  (le bloc 1 commence a start)
+ */
+extern int TFTP_sendFileToEndpoint( Sock* sock, const char* fileName, off_t start, off_t length,
+                                    const Addr* endpoint );
+
+/** Envoi d'un OACK et attente de l'ACK 0 du client (renvoi en cas de timeout)
+ *
+ *  Retourne 0 si les options ont ete acquittees
+ */
+extern int TFTP_sendOackAndWaitAck( Sock* sock, const Option* options, size_t optionCount, const Addr* endpoint );
+
+/** Envoi d'un OACK en cours de transfert (empreinte envoyee apres les donnees), acquitte par l'ACK du bloc
+ *  blockNum et renvoye comme un paquet DATA
+ *
+ *  Retourne 0 si l'OACK a ete acquitte
+ */
+extern int TFTP_sendOackAndWaitBlockAck( Sock* sock, const Option* options, size_t optionCount, uint16_t blockNum,
+                                         const Addr* endpoint );
+
+/** Envoi d'un paquet DATA deja encode et attente de son ACK (renvoi en cas de timeout)
  *
+ *  Retourne 0 si le bloc a ete acquitte
  */
-extern int TFTP_sendFileToEndpoint( Sock* sock, const char* fileName, const Addr* endpoint );
+extern int TFTP_sendDataAndWaitAck( Sock* sock, const unsigned char* buff, size_t size, uint16_t blockNum,
+                                    const Addr* endpoint );
 
-/** Reception d'un fichier et stockage dans le stream specifie
+/** Reception d'un fichier et stockage via l'ecrivain specifie
  *
+ *  Les blocs sont confies a l'ecrivain (ecriture differee) : l'ACK part sans attendre le disque. La
+ *  durabilite est assuree par WRITER_close(). L'ACK du dernier bloc (numero dans lastBlock) n'est pas envoye :
+ *  l'appelant l'envoie une fois le fichier ecrit, ou une ERROR en cas d'echec
  */
-extern int TFTP_recvFileFromEndpoint( Sock* sock, FILE* file, const Addr* endpoint );
+extern int TFTP_recvFileFromEndpoint( Sock* sock, Writer* writer, const Addr* endpoint, uint16_t* lastBlock );
 
 #endif // _TFTP_TFTP_H_
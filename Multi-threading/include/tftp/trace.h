@@ -0,0 +1,105 @@
+#ifndef _TFTP_TRACE_H_
+#define _TFTP_TRACE_H_
+
+// System
+#include <stdint.h>
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: TRACE
+// Description:
+//      Traces binaires des sessions : evenements compacts dans un tampon par thread, ecrits dans un fichier
+//      par un thread de fond (decodage hors ligne avec tftp-trace)
+//--------------------------------------------------------------------------------------------------------------
+
+// Entete du fichier de traces
+#define TRACE_MAGIC "TFTPTRC"
+#define TRACE_VERSION 1
+
+// Nombre d'evenements d'un tampon de thread (un evenement de plus est perdu et compte)
+#define TRACE_RING_SIZE 1024
+
+// Taille max d'un fichier de traces avant rotation (l'ancien fichier devient FICHIER.1)
+#define TRACE_MAX_FILE_SIZE ( 64 * 1024 * 1024 )
+
+// Periode de vidage des tampons (millisecondes)
+#define TRACE_FLUSH_MS 50
+
+// Types d'evenements
+enum
+{
+    TRACE_REQUEST = 1,          // Requete recue (arg : code RRQ/WRQ)
+    TRACE_OPTIONS,              // Options negociees envoyees dans un OACK (arg : nombre d'options)
+    TRACE_DATA_SENT,            // DATA envoye (block)
+    TRACE_DATA_RESENT,          // DATA renvoye apres timeout (block, arg : numero de l'essai)
+    TRACE_ACK_RECEIVED,         // ACK attendu recu (block)
+    TRACE_DUPLICATE,            // ACK ou DATA duplique recu (block)
+    TRACE_DATA_RECEIVED,        // DATA recu (block, arg : taille)
+    TRACE_ACK_SENT,             // ACK envoye (block)
+    TRACE_TIMEOUT,              // Attente de reponse expiree
+    TRACE_ERROR_SENT,           // ERROR envoye (arg : code)
+    TRACE_ERROR_RECEIVED,       // ERROR recu (arg : code)
+    TRACE_COMPLETE,             // Fin de la session (arg : 0 si succes)
+    TRACE_EVENT_COUNT
+};
+
+/** Entete du fichier de traces
+ *
+ */
+typedef struct
+{
+    char magic[8];                          // TRACE_MAGIC
+    uint32_t version;                       // TRACE_VERSION
+    uint32_t eventSize;                     // sizeof( TraceEvent )
+} TraceHeader;
+
+/** Evenement (24 octets, ordre des octets de la machine)
+ *
+ */
+typedef struct
+{
+    uint64_t time;                          // Date (ns depuis l'epoch, CLOCK_REALTIME)
+    uint64_t session;                       // Numero de la requete (0 si aucune)
+    uint32_t block;                         // Numero de bloc (0 si sans objet)
+    uint16_t type;                          // Type d'evenement
+    uint16_t arg;                           // Parametre selon le type
+} TraceEvent;
+
+
+/** Nom d'un type d'evenement
+ *
+ */
+extern const char* TRACE_eventName( int type );
+
+/** Choix du fichier de traces (chaine vide pour desactiver)
+ *
+ */
+extern void TRACE_setOutput( const char* path );
+
+/** Lancement du thread d'ecriture et activation des traces (si un fichier est specifie)
+ *
+ *  SIGUSR1 active ou desactive les traces pendant le fonctionnement du serveur
+ */
+extern int TRACE_start();
+
+/** Arret du thread d'ecriture (les evenements en attente sont ecrits)
+ *
+ */
+extern void TRACE_stop();
+
+/** Activation ou desactivation des traces
+ *
+ */
+extern void TRACE_setEnabled( int enabled );
+
+/** Session des evenements du thread appelant
+ *
+ */
+extern void TRACE_setSession( uint64_t session );
+
+/** Enregistrement d'un evenement (sans effet si les traces sont desactivees)
+ *
+ */
+extern void TRACE_record( int type, uint32_t block, uint16_t arg );
+
+#endif // _TFTP_TRACE_H_
@@ -0,0 +1,98 @@
+#ifndef _TFTP_WRITER_H_
+#define _TFTP_WRITER_H_
+
+// System
+#include <stddef.h>
+#include <pthread.h>
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: WRITER
+// Description:
+//      Ecriture differee des fichiers recus (write-behind) et politique de durabilite
+//--------------------------------------------------------------------------------------------------------------
+
+// Taille et nombre des tampons d'ecriture (tampons alignes, ecrits en une seule fois)
+#define WRITER_CHUNK_SIZE ( 64 * 1024 )
+#define WRITER_CHUNK_COUNT 4
+
+// Alignement des tampons (compatible avec les ecritures directes)
+#define WRITER_ALIGNMENT 4096
+
+// Fenetre de regroupement des synchronisations en mode WRITER_SYNC_GROUP (microsecondes)
+#define WRITER_GROUP_WINDOW_US 2000
+
+// Politiques de durabilite en fin de fichier
+enum
+{
+    WRITER_SYNC_NONE = 0,       // Aucune synchronisation (donnees laissees au cache du noyau)
+    WRITER_SYNC_FILE,           // fdatasync() du fichier
+    WRITER_SYNC_GROUP           // Synchronisation regroupee entre les transferts concurrents
+};
+
+/** Structure de donnees associee a un ecrivain
+ *
+ *  Le thread reseau remplit le tampon courant (head). Les tampons pleins sont ecrits par un thread de fond
+ *  dans l'ordre (tail), l'emission des ACK n'attend donc pas le disque.
+ */
+typedef struct
+{
+    int fd;                                             // Fichier de destination
+    size_t written;                                     // Nombre d'octets deja ecrits sur le disque
+    int direct;                                         // 1 si le fichier est ecrit en O_DIRECT
+    unsigned char* chunks[WRITER_CHUNK_COUNT];          // Tampons d'ecriture
+    size_t fill[WRITER_CHUNK_COUNT];                    // Remplissage de chaque tampon
+    int head;                                           // Tampon en cours de remplissage
+    int tail;                                           // Prochain tampon a ecrire
+    int pending;                                        // Nombre de tampons en attente d'ecriture
+    int closing;                                        // Fin du fichier demandee
+    int error;                                          // Erreur d'ecriture rencontree (errno, 0 : aucune)
+    pthread_mutex_t mutex;                              // Protection de l'etat partage
+    pthread_cond_t cond;                                // Signalisation entre les deux threads
+    pthread_t thread;                                   // Thread d'ecriture
+} Writer;
+
+
+/** Choix de la politique de durabilite (pour tous les ecrivains)
+ *
+ */
+extern void WRITER_setSyncPolicy( int policy );
+
+/** Choix de la taille a partir de laquelle un fichier recu est ecrit sans passer par le cache (0 : jamais)
+ *
+ *  La taille d'un fichier recu n'est pas connue a l'avance : O_DIRECT est active des que le fichier depasse le
+ *  seuil. Les tampons pleins sont alignes en position et en taille ; le dernier tampon (partiel) est ecrit
+ *  normalement.
+ */
+extern void WRITER_setDirectThreshold( size_t size );
+
+/** Conversion d'un nom de politique ("none", "file", "group"), -1 si inconnu
+ *
+ */
+extern int WRITER_parseSyncPolicy( const char* name );
+
+/** Creation d'un ecrivain sur le fichier specifie (le fichier reste a la charge de l'appelant)
+ *
+ */
+extern Writer* WRITER_create( int fd );
+
+/** Ajout de donnees en fin de fichier
+ *
+ *  Les donnees sont copiees : l'appel ne bloque que si tous les tampons sont en attente d'ecriture
+ */
+extern int WRITER_write( Writer* writer, const void* data, size_t size );
+
+/** Ecriture des donnees restantes, application de la politique de durabilite et destruction de l'ecrivain
+ *
+ *  Retourne 0 si toutes les donnees ont ete ecrites (et synchronisees selon la politique), sinon le code errno
+ *  de l'echec (ENOSPC : disque plein)
+ */
+extern int WRITER_close( Writer* writer );
+
+/** Application de la politique de durabilite au repertoire du fichier specifie (entree creee par un rename)
+ *
+ *  Retourne 0 si le repertoire est synchronise (ou si la politique est WRITER_SYNC_NONE), sinon le code errno
+ */
+extern int WRITER_syncDirectory( const char* path );
+
+#endif // _TFTP_WRITER_H_
@@ -0,0 +1,213 @@
+#ifndef _TFTP_XFER_H_
+#define _TFTP_XFER_H_
+
+// System
+#include <stdio.h>
+#include <stdint.h>
+
+// Local
+#include "tftp/sock.h"
+#include "tftp/addr.h"
+#include "tftp/packet.h"
+#include "tftp/reorder.h"
+#include "tftp/digest.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+// Module: XFER
+// Description:
+//      Moteur de transfert du client : negociation de blksize, windowsize et tsize (RFC 2348, 7440, 2349),
+//      DATA et ACK pipelines par fenetre, repli en pas a pas de 512 octets si le serveur ignore les options.
+//      Empreinte du fichier entier (option checksum) verifiee au fil des blocs recus.
+//      Un transfert est une machine a etats sans attente (XFER_onReadable, XFER_onTimer), pilotee par la
+//      boucle d'evenements de l'appelant (voir ASYNC) ou par XFER_get et XFER_put, bloquants
+//--------------------------------------------------------------------------------------------------------------
+
+// Taille de bloc par defaut (trame Ethernet de 1500 octets) et bornes de la RFC 2348
+#define XFER_DEFAULT_BLOCK_SIZE 1428
+#define XFER_MIN_BLOCK_SIZE 8
+#define XFER_MAX_BLOCK_SIZE 65464
+
+// Fenetre par defaut et taille max (blocs conserves en memoire pour les renvois d'un envoi)
+#define XFER_DEFAULT_WINDOW_SIZE 8
+#define XFER_MAX_WINDOW_SIZE 64
+
+// Delai avant renvoi (millisecondes)
+#define XFER_TIMEOUT_MS 1000
+
+// Octets recus entre deux appels du suivi de progression
+#define XFER_PROGRESS_BYTES ( 1024 * 1024 )
+
+
+// Types de transfert
+enum
+{
+    XFER_GET = 0,               // Lecture (RRQ)
+    XFER_PUT                    // Ecriture (WRQ)
+};
+
+// Etats d'un transfert
+enum
+{
+    XFER_REQUEST = 0,           // Requete envoyee, attente de la premiere reponse
+    XFER_TRANSFER,              // Transfert en cours
+    XFER_DONE,                  // Transfert termine
+    XFER_FAILED                 // Transfert en erreur
+};
+
+// Causes d'echec
+enum
+{
+    XFER_ERR_NONE = 0,
+    XFER_ERR_TIMEOUT,           // Pas de reponse apres MAX_TRY_TIMEOUT renvois
+    XFER_ERR_SERVER,            // Paquet ERROR recu (code dans errorCode)
+    XFER_ERR_PROTOCOL,          // Paquet inattendu ou options invalides
+    XFER_ERR_SOCKET,            // Erreur d'envoi ou de reception
+    XFER_ERR_LOCAL,             // Erreur de lecture ou d'ecriture du fichier local
+    XFER_ERR_CHECKSUM,          // Empreinte des octets recus differente de celle annoncee par le serveur
+    XFER_ERR_COUNT
+};
+
+/** Options demandees pour un transfert
+ *
+ */
+typedef struct
+{
+    uint16_t blockSize;         // blksize (512 : pas d'option)
+    uint16_t windowSize;        // windowsize (1 : pas d'option)
+    uint64_t offset;            // Lecture : octets deja presents, fichier positionne a la suite (option offset)
+    int64_t length;             // Lecture d'une plage : octets demandes a partir d'offset, ecrits par pwrite a
+                                // leur position (option length, -1 : fichier entier)
+    int64_t expectedSize;       // Lecture reprise : taille du fichier distant attendue (-1 : non verifiee)
+    int checksum;               // Lecture du fichier entier : empreinte demandee (option checksum, DIGEST_NONE :
+                                // pas d'option)
+    void (*progress)( void* context, uint64_t bytes, int64_t size );   // Lecture : suivi (octets du fichier)
+    void* context;              // Contexte du suivi
+    int quiet;                  // Pas d'affichage des echecs (generateur de charge)
+} XferOptions;
+
+/** Resultat d'un transfert
+ *
+ */
+typedef struct
+{
+    uint64_t bytes;             // Octets de donnees transferes
+    int64_t size;               // Taille annoncee par tsize (-1 si inconnue)
+    uint64_t offset;            // Octet de depart accepte par le serveur (reprise)
+    int64_t length;             // Longueur de plage acceptee par le serveur (-1 : fichier entier)
+    int64_t duration;           // Duree du transfert, requete comprise (microsecondes)
+    uint16_t blockSize;         // Taille de bloc retenue
+    uint16_t windowSize;        // Fenetre retenue
+    int negotiated;             // Options acceptees par le serveur (OACK)
+    int checksum;               // Empreinte annoncee par le serveur et verifiee (DIGEST_NONE : pas d'empreinte)
+    uint32_t retransmits;       // Paquets renvoyes (timeouts et trous dans une fenetre)
+    int error;                  // Cause de l'echec
+    uint16_t errorCode;         // Code TFTP d'un paquet ERROR recu
+    char message[ERROR_SIZE + 32];  // Description de l'echec
+} XferResult;
+
+/** Transfert en cours
+ *
+ */
+typedef struct
+{
+    Sock* sock;                         // Socket du transfert (identifiant de transfert du client)
+    int type;                           // XFER_GET ou XFER_PUT
+    int state;                          // Etat courant
+    const Addr* server;                 // Adresse du serveur (requetes)
+    char remoteName[FILENAME_SIZE];     // Nom du fichier sur le serveur
+    FILE* file;                         // Fichier local (lecture : NULL pour ignorer les donnees)
+    XferOptions options;                // Options demandees (offset remis a 0 si la reprise est abandonnee)
+    int withOptions;                    // Requete avec options (0 apres un refus du serveur)
+    int ranged;                         // Lecture d'une plage (blocs ecrits a leur position)
+    int64_t size;                       // Ecriture : taille annoncee par tsize (-1 si inconnue)
+    off_t origin;                       // Lecture : debut du fichier local (retour si la reprise est abandonnee)
+    Addr peer;                          // Adresse du transfert (identifiant de transfert du serveur)
+    Addr stale;                         // Lecture : serveur d'une tentative abandonnee (paquets ignores)
+    int hasStale;                       // Adresse stale renseignee
+    uint16_t expected;                  // Lecture : prochain bloc attendu
+    uint16_t acked;                     // Lecture : dernier bloc acquitte
+    Reorder* reorder;                   // Lecture : blocs arrives en avance dans la fenetre (cree au premier
+                                        // desordre)
+    DigestCheck digest;                 // Lecture : empreinte annoncee et empreinte des blocs ecrits
+    uint64_t reported;                  // Lecture : octets recus au dernier suivi de progression
+    uint64_t base;                      // Ecriture : premier bloc non acquitte (numerote sans rebouclage)
+    uint64_t next;                      // Ecriture : prochain bloc a emettre
+    uint64_t read;                      // Ecriture : dernier bloc lu dans le fichier
+    uint64_t last;                      // Ecriture : dernier bloc du fichier (0 : pas encore lu)
+    unsigned char* window;              // Ecriture : paquets de la fenetre, conserves jusqu'a leur acquittement
+    size_t* sizes;                      // Ecriture : tailles des paquets de la fenetre
+    int resync;                         // ACK de resynchronisation (lecture) ou fenetre (ecriture) deja renvoye
+    int tries;                          // Renvois sans progression
+    int64_t start;                      // Debut du transfert (microsecondes, voir METRICS_now)
+    int64_t deadline;                   // Echeance du renvoi (microsecondes, voir METRICS_now)
+    XferResult result;                  // Resultat
+    void* context;                      // Contexte libre pour l'appelant
+} XferSession;
+
+
+/** Taille de bloc demandee par defaut (512 : pas d'option blksize)
+ *
+ */
+extern void XFER_setBlockSize( uint16_t blockSize );
+
+/** Fenetre demandee par defaut (1 : pas d'option windowsize)
+ *
+ */
+extern void XFER_setWindowSize( uint16_t windowSize );
+
+/** Empreinte demandee par defaut pour les lectures de fichier entier (DIGEST_NONE : pas d'option checksum)
+ *
+ */
+extern void XFER_setChecksum( int algorithm );
+
+/** Options par defaut
+ *
+ */
+extern void XFER_initOptions( XferOptions* options );
+
+/** Creation d'un transfert sur la socket specifiee (options NULL : options par defaut)
+ *
+ *  La socket doit rester valide jusqu'a la destruction du transfert
+ */
+extern XferSession* XFER_create( Sock* sock, int type, const Addr* server, const char* remoteName, FILE* file,
+                                 const XferOptions* options );
+
+/** Debut du transfert : envoi de la requete, retourne l'etat du transfert
+ *
+ */
+extern int XFER_start( XferSession* session, int64_t now );
+
+/** Traitement des paquets recus jusqu'au timeout de la socket (immediat pour une socket non bloquante),
+ *  retourne l'etat du transfert
+ */
+extern int XFER_onReadable( XferSession* session );
+
+/** Renvoi si l'echeance est passee (requete, dernier ACK ou fenetre), retourne l'etat du transfert
+ *
+ */
+extern int XFER_onTimer( XferSession* session, int64_t now );
+
+/** Destruction d'un transfert (la socket et le fichier ne sont pas fermes)
+ *
+ */
+extern void XFER_destroy( XferSession* session );
+
+/** Lecture d'un fichier du serveur, ecrit dans file (options NULL : options par defaut)
+ *
+ */
+extern int XFER_get( Sock* sock, const Addr* server, const char* remoteName, FILE* file, const XferOptions* options,
+                     XferResult* result );
+
+/** Ecriture d'un fichier sur le serveur, lu dans file (options NULL : options par defaut)
+ *
+ */
+extern int XFER_put( Sock* sock, const Addr* server, const char* remoteName, FILE* file, const XferOptions* options,
+                     XferResult* result );
+
+/** Affichage du debit obtenu et des parametres d'un transfert
+ *
+ */
+extern void XFER_printResult( FILE* out, const char* name, const XferResult* result );
+
+#endif // _TFTP_XFER_H_
@@ -1,4 +1,44 @@
 #include "tftp/FileAVL.h"
+#include "tftp/metrics.h"
+#include "tftp/digest.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*-----------------------------------
+    Format du snapshot
+------------------------------------*/
+#define INDEX_MAGIC "TFTPIDX"
+#define INDEX_VERSION 2
+
+/**
+ * @brief En-tête du snapshot, suivi de count enregistrements triés par nom.
+*/
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+} IndexHeader;
+
+/**
+ * @brief Enregistrement de taille fixe pour un fichier (lu directement depuis le mapping).
+*/
+typedef struct {
+    char filename[256];
+    int64_t size;
+    int64_t mtime;
+    int64_t ino;
+    uint32_t digestMask;
+    uint32_t reserved;
+    unsigned char digests[DIGEST_COUNT][DIGEST_MAX_SIZE];
+} IndexRecord;
+
+/**
+ * @brief 1 entre FILEAVL_load() et la fin de FILEAVL_reconcile() : une absence de l'AVL n'est pas encore sûre
+ * (lu et écrit avec le mutex de l'AVL).
+*/
+static int reconcilePending = 0;
 
 
 /*-----------------------------------
@@ -55,6 +95,60 @@ FileAVL *fillAVL(const char *path, FileAVL *avl);
 
 
 FileAVL *findRec(FileAVL *avl, const char *filename);
+/**
+ * @brief Alloue un noeud pour filename.
+*/
+FileAVL *newNode(const char *filename);
+/**
+ * @brief Construit un AVL équilibré à partir des enregistrements triés [first, last[.
+*/
+FileAVL *buildFromRecords(const IndexRecord *records, uint32_t first, uint32_t last);
+/**
+ * @return Renvoie 1 si les count enregistrements sont exploitables : noms terminés par un NUL, non privés et
+ * strictement croissants (strcmp), 0 sinon.
+*/
+int validRecords(const IndexRecord *records, uint32_t count);
+/**
+ * @brief Compte les entrées à sauvegarder (hors fichiers supprimés).
+*/
+uint32_t countRecords(FileAVL *avl);
+/**
+ * @brief Ecrit les entrées de l'AVL dans l'ordre (parcours infixe).
+*/
+int writeRecords(FileAVL *avl, FILE *file);
+/**
+ * @brief Met à jour inode, taille et date d'un noeud depuis un stat.
+*/
+void updateFromStat(FileAVL *node, const struct stat *statbuf);
+/**
+ * @return Renvoie 1 si statbuf décrit la version connue du noeud (inode, taille, date), 0 sinon
+*/
+int sameVersion(const FileAVL *node, const struct stat *statbuf);
+/**
+ * @brief Ajoute les fichiers de path manquant dans l'AVL.
+*/
+void reconcileDir(const char *path, FileAVL **avl, pthread_mutex_t *avl_mutex);
+/**
+ * @brief Confronte au disque toutes les entrées non vérifiées.
+*/
+void checkAll(FileAVL **avl, pthread_mutex_t *avl_mutex);
+/**
+ * @brief Nombre de noeuds de l'AVL.
+*/
+size_t countNodes(FileAVL *avl);
+/**
+ * @brief Copie les noeuds de l'AVL dans nodes à partir de index (parcours infixe).
+ * @return Renvoie l'indice qui suit le dernier noeud copié.
+*/
+size_t collectNodes(FileAVL *avl, FileAVL **nodes, size_t index);
+/**
+ * @return Renvoie 1 si le nom correspond à un fichier interne au serveur.
+*/
+int isPrivate(const char *name);
+/**
+ * @return Renvoie 1 si le chemin contient un composant "..", 0 sinon.
+*/
+int hasParentRef(const char *filepath);
 
 /*-----------------------------------
     Fonctions locales
@@ -181,7 +275,7 @@ FileAVL *fillAVL(const char *path, FileAVL *avl) {
             else
                 snprintf(fullpath, sizeof(fullpath), "%s", entry->d_name);
 
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || isPrivate(entry->d_name))
                 continue;
 
             if (stat(fullpath, &statbuf) == -1) {
@@ -192,13 +286,9 @@ FileAVL *fillAVL(const char *path, FileAVL *avl) {
             if (S_ISDIR(statbuf.st_mode)) {
                 avl = fillAVL(fullpath, avl);
             } else {
-                FileAVL *node = (FileAVL*)malloc(sizeof(FileAVL));
+                FileAVL *node = newNode(fullpath);
                 if (node) {
-                    strcpy(node->filename, fullpath);
-                    pthread_mutex_init(&node->mutex, NULL);
-                    node->left = NULL;
-                    node->right = NULL;
-
+                    updateFromStat(node, &statbuf);
                     avl = add_AVL(avl, node);
                 }
             }
@@ -220,6 +310,168 @@ FileAVL *findRec(FileAVL *avl, const char *filename) {
     return avl;
 }
 
+FileAVL *newNode(const char *filename) {
+    FileAVL *node = (FileAVL*)malloc(sizeof(FileAVL));
+    if (node) {
+        snprintf(node->filename, sizeof(node->filename), "%s", filename);
+        pthread_mutex_init(&node->mutex, NULL);
+        node->size = 0;
+        node->mtime = 0;
+        node->ino = 0;
+        memset(node->digests, 0, sizeof(node->digests));
+        node->digestMask = 0;
+        node->state = FILEAVL_UNCHECKED;
+        node->left = NULL;
+        node->right = NULL;
+    }
+    return node;
+}
+
+FileAVL *buildFromRecords(const IndexRecord *records, uint32_t first, uint32_t last) {
+    if (first >= last) return NULL;
+
+    // Le milieu de l'intervalle trié devient la racine : l'arbre est équilibré sans rotation
+    uint32_t middle = first + (last - first) / 2;
+    FileAVL *node = newNode(records[middle].filename);
+    if (node) {
+        node->size = records[middle].size;
+        node->mtime = records[middle].mtime;
+        node->ino = records[middle].ino;
+        for (int i = 0; i < DIGEST_COUNT; i++) {
+            node->digests[i].algorithm = i;
+            memcpy(node->digests[i].bytes, records[middle].digests[i], DIGEST_MAX_SIZE);
+        }
+        node->digestMask = records[middle].digestMask & (((1u << DIGEST_COUNT) - 1) & ~(1u << DIGEST_NONE));
+        node->left = buildFromRecords(records, first, middle);
+        node->right = buildFromRecords(records, middle + 1, last);
+    }
+    return node;
+}
+
+int validRecords(const IndexRecord *records, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (memchr(records[i].filename, '\0', sizeof(records[i].filename)) == NULL
+            || records[i].filename[0] == '\0' || FILEAVL_isPrivate(records[i].filename))
+            return 0;
+        // Ordre de findRec : sinon des fichiers seraient introuvables
+        if (i > 0 && strcmp(records[i - 1].filename, records[i].filename) >= 0) return 0;
+    }
+    return 1;
+}
+
+uint32_t countRecords(FileAVL *avl) {
+    if (avl) {
+        return (avl->state != FILEAVL_MISSING) + countRecords(avl->left) + countRecords(avl->right);
+    }
+    return 0;
+}
+
+int writeRecords(FileAVL *avl, FILE *file) {
+    if (avl) {
+        if (writeRecords(avl->left, file) != 0) return 1;
+        if (avl->state != FILEAVL_MISSING) {
+            IndexRecord record;
+            memset(&record, 0, sizeof(record));
+            strcpy(record.filename, avl->filename);
+            record.size = avl->size;
+            record.mtime = avl->mtime;
+            record.ino = avl->ino;
+            record.digestMask = avl->digestMask;
+            for (int i = 0; i < DIGEST_COUNT; i++) memcpy(record.digests[i], avl->digests[i].bytes, DIGEST_MAX_SIZE);
+            if (fwrite(&record, sizeof(record), 1, file) != 1) return 1;
+        }
+        return writeRecords(avl->right, file);
+    }
+    return 0;
+}
+
+void updateFromStat(FileAVL *node, const struct stat *statbuf) {
+    // Les empreintes ne sont plus valables si le fichier a changé
+    if (!sameVersion(node, statbuf)) node->digestMask = 0;
+    node->size = statbuf->st_size;
+    node->mtime = (int64_t)statbuf->st_mtim.tv_sec * 1000000000 + statbuf->st_mtim.tv_nsec;
+    node->ino = (int64_t)statbuf->st_ino;
+    node->state = FILEAVL_PRESENT;
+}
+
+int sameVersion(const FileAVL *node, const struct stat *statbuf) {
+    int64_t mtime = (int64_t)statbuf->st_mtim.tv_sec * 1000000000 + statbuf->st_mtim.tv_nsec;
+    return node->size == statbuf->st_size && node->mtime == mtime && node->ino == (int64_t)statbuf->st_ino;
+}
+
+void reconcileDir(const char *path, FileAVL **avl, pthread_mutex_t *avl_mutex) {
+    struct dirent *entry;
+    char fullpath[1024];
+    struct stat statbuf;
+    DIR *dir = opendir(path);
+
+    if (dir != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || isPrivate(entry->d_name))
+                continue;
+
+            if (strcmp(path, "."))
+                snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
+            else
+                snprintf(fullpath, sizeof(fullpath), "%s", entry->d_name);
+
+            if (stat(fullpath, &statbuf) == -1) continue;
+
+            if (S_ISDIR(statbuf.st_mode)) {
+                reconcileDir(fullpath, avl, avl_mutex);
+            } else {
+                FileAVL *node = FILEAVL_addInAVL(fullpath, avl, avl_mutex);
+                if (node) {
+                    pthread_mutex_lock(avl_mutex);
+                    updateFromStat(node, &statbuf);
+                    pthread_mutex_unlock(avl_mutex);
+                }
+            }
+        }
+        closedir(dir);
+    }
+}
+
+void checkAll(FileAVL **avl, pthread_mutex_t *avl_mutex) {
+    // Les rotations des WRQ modifient les fils sous le mutex : liste des noeuds relevée sous le mutex, puis stat sans
+    // le mutex (les noeuds ne sont jamais libérés avant FILEAVL_destroy())
+    pthread_mutex_lock(avl_mutex);
+    size_t count = countNodes(*avl);
+    FileAVL **nodes = count > 0 ? (FileAVL**)malloc(count * sizeof(FileAVL*)) : NULL;
+    if (nodes) collectNodes(*avl, nodes, 0);
+    pthread_mutex_unlock(avl_mutex);
+
+    if (nodes) {
+        for (size_t i = 0; i < count; i++) FILEAVL_check(nodes[i], avl_mutex);
+        free(nodes);
+    }
+}
+
+size_t countNodes(FileAVL *avl) {
+    return avl ? 1 + countNodes(avl->left) + countNodes(avl->right) : 0;
+}
+
+size_t collectNodes(FileAVL *avl, FileAVL **nodes, size_t index) {
+    if (avl) {
+        index = collectNodes(avl->left, nodes, index);
+        nodes[index++] = avl;
+        index = collectNodes(avl->right, nodes, index);
+    }
+    return index;
+}
+
+int isPrivate(const char *name) {
+    return strncmp(name, FILEAVL_PRIVATE_PREFIX, strlen(FILEAVL_PRIVATE_PREFIX)) == 0;
+}
+
+int hasParentRef(const char *filepath) {
+    for (const char *name = filepath; name; name = strchr(name, '/')) {
+        while (*name == '/') name++;
+        if (strncmp(name, "..", 2) == 0 && (name[2] == '/' || name[2] == '\0')) return 1;
+    }
+    return 0;
+}
+
 /*-----------------------------------
     Fonctions publiques
 ------------------------------------*/
@@ -227,30 +479,166 @@ FileAVL *FILEAVL_create() {
     return fillAVL(".", NULL);
 }
 
-FileAVL *FILEAVL_addInAVL(const char *filepath, FileAVL *avl, pthread_mutex_t *avl_mutex) {
-    if (filepath) {
+FileAVL *FILEAVL_load(const char *indexPath) {
+    int fd = open(indexPath, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1 || (size_t)statbuf.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Mapping du snapshot : les enregistrements sont lus en place, sans copie intermédiaire
+    void *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    FileAVL *avl = NULL;
+    const IndexHeader *header = (const IndexHeader*)map;
+    const IndexRecord *records = (const IndexRecord*)((const char*)map + sizeof(IndexHeader));
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && header->version == INDEX_VERSION
+        && (size_t)statbuf.st_size == sizeof(IndexHeader) + (size_t)header->count * sizeof(IndexRecord)
+        && validRecords(records, header->count)) {
+        avl = buildFromRecords(records, 0, header->count);
+        reconcilePending = avl != NULL;
+    }
+    else {
+        fprintf(stderr, "ERREUR - Snapshot d'index invalide : %s\n", indexPath);
+    }
+
+    munmap(map, statbuf.st_size);
+    return avl;
+}
+
+int FILEAVL_save(FileAVL **avl, const char *indexPath, pthread_mutex_t *avl_mutex) {
+    // Ecriture dans un fichier temporaire puis rename : un snapshot est toujours complet
+    char tmpPath[1024];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", indexPath);
+    FILE *file = fopen(tmpPath, "wb");
+    if (!file) {
+        perror("Erreur ecriture snapshot : ");
+        return 1;
+    }
+
+    pthread_mutex_lock(avl_mutex);
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.count = countRecords(*avl);
+    int error = fwrite(&header, sizeof(header), 1, file) != 1 || writeRecords(*avl, file) != 0;
+    pthread_mutex_unlock(avl_mutex);
+
+    if (fclose(file) != 0) error = 1;
+    if (error || rename(tmpPath, indexPath) != 0) {
+        perror("Erreur ecriture snapshot : ");
+        unlink(tmpPath);
+        return 1;
+    }
+    return 0;
+}
+
+void FILEAVL_reconcile(FileAVL **avl, pthread_mutex_t *avl_mutex) {
+    // Ajout des fichiers apparus depuis le snapshot
+    reconcileDir(".", avl, avl_mutex);
+
+    // Les entrées restées non vérifiées ont peut-être été supprimées
+    checkAll(avl, avl_mutex);
+
+    pthread_mutex_lock(avl_mutex);
+    reconcilePending = 0;
+    pthread_mutex_unlock(avl_mutex);
+}
+
+int FILEAVL_check(FileAVL *node, pthread_mutex_t *avl_mutex) {
+    pthread_mutex_lock(avl_mutex);
+    int state = node->state;
+    pthread_mutex_unlock(avl_mutex);
+    if (state == FILEAVL_PRESENT) return 0;
+
+    // Entrée jamais vérifiée (ou supprimée et peut-être recréée) : on interroge le disque
+    return FILEAVL_update(node, avl_mutex);
+}
+
+int FILEAVL_update(FileAVL *node, pthread_mutex_t *avl_mutex) {
+    struct stat statbuf;
+    int found = stat(node->filename, &statbuf) == 0 && !S_ISDIR(statbuf.st_mode);
+    pthread_mutex_lock(avl_mutex);
+    if (found) updateFromStat(node, &statbuf);
+    else node->state = FILEAVL_MISSING;
+    pthread_mutex_unlock(avl_mutex);
+    return !found;
+}
+int FILEAVL_getDigest(FileAVL *node, pthread_mutex_t *avl_mutex, int algorithm, const struct stat *version,
+                      Digest *digest) {
+    // L'empreinte conservée n'est valable que pour la version connue du noeud
+    pthread_mutex_lock(avl_mutex);
+    int cached = sameVersion(node, version) && (node->digestMask & (1u << algorithm));
+    if (cached) *digest = node->digests[algorithm];
+    pthread_mutex_unlock(avl_mutex);
+    METRICS_add(cached ? METRICS_DIGEST_HITS : METRICS_DIGEST_MISSES, 1);
+    return !cached;
+}
+
+void FILEAVL_setDigest(FileAVL *node, pthread_mutex_t *avl_mutex, const struct stat *version, const Digest *digest) {
+    // Version envoyée toujours publiée : le noeud est mis à jour depuis le disque avant de lui associer l'empreinte
+    FILEAVL_update(node, avl_mutex);
+    pthread_mutex_lock(avl_mutex);
+    if (sameVersion(node, version)) {
+        node->digests[digest->algorithm] = *digest;
+        node->digestMask |= 1u << digest->algorithm;
+    }
+    pthread_mutex_unlock(avl_mutex);
+}
+
+int FILEAVL_isPrivate(const char *filepath) {
+    // Chaque composant du chemin, comme lors du parcours du disque (un répertoire privé n'est pas parcouru)
+    const char *name = filepath;
+    while (name) {
+        while (*name == '/') name++;
+        if (isPrivate(name)) return 1;
+        name = strchr(name, '/');
+    }
+    return 0;
+}
+
+FileAVL *FILEAVL_addInAVL(const char *filepath, FileAVL **avl, pthread_mutex_t *avl_mutex) {
+    if (filepath && !FILEAVL_isPrivate(filepath)) {
         if (*filepath == '/') filepath++;    // Enleve le '/' si y'en un au début
-        FileAVL *node = (FileAVL*)malloc(sizeof(FileAVL));
-        if (node) {
-            node->left = NULL;
-            node->right = NULL;
-            strcpy(node->filename, filepath);
-            pthread_mutex_init(&node->mutex, NULL);
-            pthread_mutex_lock(avl_mutex);
-            FileAVL *temp = add_AVL(avl, node);
-            pthread_mutex_unlock(avl_mutex);
-            return temp;
+        pthread_mutex_lock(avl_mutex);
+        FileAVL *node = findRec(*avl, filepath);
+        if (!node) {
+            node = newNode(filepath);
+            if (node) *avl = add_AVL(*avl, node);
         }
+        pthread_mutex_unlock(avl_mutex);
+        return node;
     }
     return NULL;
 }
 
-FileAVL *FILEAVL_findInAVL(FileAVL *avl, const char *filename, pthread_mutex_t *avl_mutex) {
+FileAVL *FILEAVL_findInAVL(FileAVL **avl, const char *filename, pthread_mutex_t *avl_mutex) {
     FileAVL *result = NULL;
     if (*filename == '/') filename++;
     pthread_mutex_lock(avl_mutex);
-    result = findRec(avl, filename);
+    result = findRec(*avl, filename);
+    int pending = reconcilePending;
     pthread_mutex_unlock(avl_mutex);
+
+    // Index chargé d'un snapshot et pas encore confronté au disque : le fichier a pu être créé depuis, on interroge
+    // le disque (uniquement sous le répertoire servi, comme le parcours)
+    struct stat statbuf;
+    if (!result && pending && !FILEAVL_isPrivate(filename) && !hasParentRef(filename)
+        && stat(filename, &statbuf) == 0 && !S_ISDIR(statbuf.st_mode)) {
+        result = FILEAVL_addInAVL(filename, avl, avl_mutex);
+        if (result) {
+            pthread_mutex_lock(avl_mutex);
+            updateFromStat(result, &statbuf);
+            pthread_mutex_unlock(avl_mutex);
+        }
+    }
+    METRICS_add(result ? METRICS_INDEX_HITS : METRICS_INDEX_MISSES, 1);
     return result;
 }
 
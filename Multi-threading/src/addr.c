@@ -96,6 +96,13 @@ void ADDR_update( Addr* addr, const struct sockaddr_in* inAddr )
 }
 
 
+int ADDR_equals( const Addr* addr1, const Addr* addr2 )
+{
+    return( addr1->inAddr.sin_addr.s_addr == addr2->inAddr.sin_addr.s_addr
+            && addr1->inAddr.sin_port == addr2->inAddr.sin_port );
+}
+
+
 void ADDR_destroy( Addr* addr )
 {
     // Si adresse valide
@@ -0,0 +1,445 @@
+#include "tftp/async.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+// Local
+#include "tftp/sock.h"
+#include "tftp/impair.h"
+#include "tftp/metrics.h"
+
+
+// Position d'une echeance retiree du tas
+#define NOT_IN_HEAP ( (size_t)-1 )
+
+/** Echeance : renvoi d'un transfert, minuterie ou remise des paquets retardes (loop->impair)
+ *
+ *  L'echeance d'un transfert est une borne inferieure de son echeance de renvoi (reportee a chaque progression) :
+ *  elle n'est mise a jour qu'a sa sortie du tas
+ */
+typedef struct AsyncEntry
+{
+    int64_t when;                       // Echeance (microsecondes, voir METRICS_now)
+    size_t index;                       // Position dans le tas
+    XferSession* session;               // Transfert (NULL : minuterie)
+    AsyncDone done;                     // Fin du transfert
+    AsyncTimer timer;                   // Minuterie
+    void* context;                      // Contexte de l'appelant
+} AsyncEntry;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Lancement d'un transfert : socket non bloquante, requete envoyee
+ *
+ */
+static XferSession* startTransfer( AsyncLoop* loop, int type, const Addr* server, const char* remoteName,
+                                   FILE* file, const XferOptions* options, AsyncDone done, void* context );
+
+/** Fin d'un transfert : appel de la fonction de fin, puis liberation
+ *
+ */
+static void finish( AsyncLoop* loop, AsyncEntry* entry );
+
+/** Echeances passees : renvois et minuteries
+ *
+ */
+static void runTimers( AsyncLoop* loop );
+
+/** Remise des paquets retardes echus a leurs transferts (une fois par transfert)
+ *
+ */
+static void deliverHeld( AsyncLoop* loop, int64_t now );
+
+/** Echeance de remise placee sur le prochain paquet retarde en reception, retiree s'il n'y en a pas
+ *
+ */
+static void armImpair( AsyncLoop* loop );
+
+/** Enregistrement d'un transfert sous le descripteur de sa socket (NULL : place reservee)
+ *
+ */
+static int setSocket( AsyncLoop* loop, int fd, AsyncEntry* entry );
+
+/** Echeances en attente, hors remise des paquets retardes
+ *
+ */
+static size_t pending( const AsyncLoop* loop );
+
+/** Transfert termine ou en erreur
+ *
+ */
+static int isOver( const XferSession* session );
+
+/** Ajout d'une echeance dans le tas
+ *
+ */
+static int heapPush( AsyncLoop* loop, AsyncEntry* entry );
+
+/** Retrait d'une echeance du tas
+ *
+ */
+static void heapRemove( AsyncLoop* loop, size_t index );
+
+/** Placement d'une echeance du tas apres modification (vers la tete ou vers les feuilles)
+ *
+ */
+static void heapFix( AsyncLoop* loop, size_t index );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+AsyncLoop* ASYNC_create()
+{
+    AsyncLoop* loop = (AsyncLoop*)calloc( 1, sizeof( AsyncLoop ) );
+    if( loop == NULL ) return( NULL );
+
+    loop->epollFd = epoll_create1( 0 );
+    if( loop->epollFd == -1 )
+    {
+        free( loop );
+        return( NULL );
+    }
+
+    return( loop );
+}
+
+
+XferSession* ASYNC_get( AsyncLoop* loop, const Addr* server, const char* remoteName, FILE* file,
+                        const XferOptions* options, AsyncDone done, void* context )
+{
+    return( startTransfer( loop, XFER_GET, server, remoteName, file, options, done, context ) );
+}
+
+
+XferSession* ASYNC_put( AsyncLoop* loop, const Addr* server, const char* remoteName, FILE* file,
+                        const XferOptions* options, AsyncDone done, void* context )
+{
+    return( startTransfer( loop, XFER_PUT, server, remoteName, file, options, done, context ) );
+}
+
+
+int ASYNC_after( AsyncLoop* loop, int64_t delay, AsyncTimer timer, void* context )
+{
+    AsyncEntry* entry = (AsyncEntry*)calloc( 1, sizeof( AsyncEntry ) );
+    if( entry == NULL ) return( 1 );
+    entry->when = METRICS_now() + delay * 1000;
+    entry->timer = timer;
+    entry->context = context;
+    if( heapPush( loop, entry ) != 0 )
+    {
+        free( entry );
+        return( 2 );
+    }
+
+    return( 0 );
+}
+
+
+size_t ASYNC_poll( AsyncLoop* loop, int timeout )
+{
+    if( pending( loop ) == 0 )
+    {
+        if( loop->impair != NULL && loop->impair->index != NOT_IN_HEAP ) heapRemove( loop, loop->impair->index );
+        return( 0 );
+    }
+
+    // Attente jusqu'a la prochaine echeance (arrondie a la milliseconde superieure)
+    const int64_t untilNext = ( loop->heap[0]->when - METRICS_now() + 999 ) / 1000;
+    int wait = untilNext < 0 ? 0 : untilNext > 60000 ? 60000 : (int)untilNext;
+    if( timeout >= 0 && timeout < wait ) wait = timeout;
+
+    struct epoll_event events[ASYNC_MAX_EVENTS];
+    const int count = epoll_wait( loop->epollFd, events, ASYNC_MAX_EVENTS, wait );
+    for( int i = 0; i < count; ++i )
+    {
+        AsyncEntry* entry = (AsyncEntry*)events[i].data.ptr;
+        if( ! isOver( entry->session ) ) XFER_onReadable( entry->session );
+        if( isOver( entry->session ) ) finish( loop, entry );
+    }
+
+    runTimers( loop );
+
+    // Reception degradee : les paquets retardes sont rendus par SOCK_recvData sans que la socket soit prete,
+    // une echeance reveille la boucle a la date de remise du prochain
+    if( IMPAIR_isActive( IMPAIR_RECV ) ) armImpair( loop );
+
+    return( pending( loop ) );
+}
+
+
+void ASYNC_run( AsyncLoop* loop )
+{
+    while( ASYNC_poll( loop, -1 ) > 0 );
+}
+
+
+void ASYNC_destroy( AsyncLoop* loop )
+{
+    if( loop != NULL )
+    {
+        for( size_t i = 0; i < loop->heapCount; ++i )
+        {
+            AsyncEntry* entry = loop->heap[i];
+            if( entry->session != NULL )
+            {
+                Sock* sock = entry->session->sock;
+                XFER_destroy( entry->session );
+                SOCK_destroy( sock );
+            }
+            free( entry );
+        }
+        if( loop->impair != NULL && loop->impair->index == NOT_IN_HEAP ) free( loop->impair );
+        free( loop->heap );
+        free( loop->sockets );
+        close( loop->epollFd );
+        free( loop );
+    }
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static XferSession* startTransfer( AsyncLoop* loop, int type, const Addr* server, const char* remoteName,
+                                   FILE* file, const XferOptions* options, AsyncDone done, void* context )
+{
+    // Socket non bloquante : la boucle attend pour tous les transferts
+    Sock* sock = SOCK_create( 0 );
+    if( sock == NULL || fcntl( sock->fd, F_SETFL, O_NONBLOCK ) != 0 )
+    {
+        SOCK_destroy( sock );
+        return( NULL );
+    }
+
+    XferSession* session = XFER_create( sock, type, server, remoteName, file, options );
+    AsyncEntry* entry = (AsyncEntry*)calloc( 1, sizeof( AsyncEntry ) );
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = entry;
+    if( session == NULL || entry == NULL || setSocket( loop, sock->fd, NULL ) != 0 ||
+        epoll_ctl( loop->epollFd, EPOLL_CTL_ADD, sock->fd, &event ) != 0 )
+    {
+        free( entry );
+        XFER_destroy( session );
+        SOCK_destroy( sock );
+        return( NULL );
+    }
+    entry->session = session;
+    loop->sockets[sock->fd] = entry;
+    entry->done = done;
+    entry->context = context;
+
+    // Echec immediat (envoi de la requete) : fin traitee par la prochaine attente, hors de l'appel
+    const int64_t now = METRICS_now();
+    XFER_start( session, now );
+    entry->when = isOver( session ) ? now : session->deadline;
+    if( heapPush( loop, entry ) != 0 )
+    {
+        epoll_ctl( loop->epollFd, EPOLL_CTL_DEL, sock->fd, NULL );
+        loop->sockets[sock->fd] = NULL;
+        free( entry );
+        XFER_destroy( session );
+        SOCK_destroy( sock );
+        return( NULL );
+    }
+    ++loop->transfers;
+
+    return( session );
+}
+
+
+static void finish( AsyncLoop* loop, AsyncEntry* entry )
+{
+    XferSession* session = entry->session;
+    Sock* sock = session->sock;
+    epoll_ctl( loop->epollFd, EPOLL_CTL_DEL, sock->fd, NULL );
+    loop->sockets[sock->fd] = NULL;
+    if( entry->index != NOT_IN_HEAP ) heapRemove( loop, entry->index );
+    --loop->transfers;
+
+    if( entry->done != NULL ) entry->done( session, entry->context );
+    XFER_destroy( session );
+    SOCK_destroy( sock );
+    free( entry );
+}
+
+
+static void runTimers( AsyncLoop* loop )
+{
+    const int64_t now = METRICS_now();
+    while( loop->heapCount > 0 && loop->heap[0]->when <= now )
+    {
+        AsyncEntry* entry = loop->heap[0];
+        XferSession* session = entry->session;
+
+        // Paquets retardes : echeance replacee par armImpair apres les remises
+        if( entry == loop->impair )
+        {
+            heapRemove( loop, 0 );
+            deliverHeld( loop, now );
+            continue;
+        }
+
+        // Minuterie : retiree avant l'appel (qui peut en ajouter)
+        if( session == NULL )
+        {
+            heapRemove( loop, 0 );
+            entry->timer( entry->context );
+            free( entry );
+            continue;
+        }
+
+        // Renvoi si l'echeance n'a pas ete reportee entre temps, puis nouvelle echeance
+        if( ! isOver( session ) ) XFER_onTimer( session, now );
+        if( isOver( session ) )
+        {
+            finish( loop, entry );
+            continue;
+        }
+        entry->when = session->deadline;
+        heapFix( loop, 0 );
+    }
+}
+
+
+static void deliverHeld( AsyncLoop* loop, int64_t now )
+{
+    // Premier paquet de la file, jusqu'a un paquet non echu ou un transfert deja servi (qui a rendu la main
+    // avant la fin de ses paquets echus)
+    int served = -1;
+    int64_t due = 0;
+    int fd;
+    while( ( fd = IMPAIR_nextRecv( &due ) ) != -1 && due <= now && fd != served )
+    {
+        AsyncEntry* entry = (size_t)fd < loop->socketCapacity ? loop->sockets[fd] : NULL;
+        if( entry == NULL ) break;
+        served = fd;
+        XFER_onReadable( entry->session );
+        if( isOver( entry->session ) ) finish( loop, entry );
+    }
+}
+
+
+static void armImpair( AsyncLoop* loop )
+{
+    int64_t due = 0;
+    if( loop->transfers == 0 || IMPAIR_nextRecv( &due ) == -1 )
+    {
+        if( loop->impair != NULL && loop->impair->index != NOT_IN_HEAP ) heapRemove( loop, loop->impair->index );
+        return;
+    }
+
+    if( loop->impair == NULL )
+    {
+        loop->impair = (AsyncEntry*)calloc( 1, sizeof( AsyncEntry ) );
+        if( loop->impair == NULL ) return;
+        loop->impair->index = NOT_IN_HEAP;
+    }
+
+    // Paquet deja echu : laisse a son transfert ou a sa socket, nouvel essai un peu plus tard
+    const int64_t now = METRICS_now();
+    loop->impair->when = due > now ? due : now + ASYNC_IMPAIR_RETRY_US;
+    if( loop->impair->index == NOT_IN_HEAP )
+    {
+        if( heapPush( loop, loop->impair ) != 0 ) return;
+    }
+    else heapFix( loop, loop->impair->index );
+}
+
+
+static int setSocket( AsyncLoop* loop, int fd, AsyncEntry* entry )
+{
+    if( (size_t)fd >= loop->socketCapacity )
+    {
+        size_t capacity = loop->socketCapacity > 0 ? loop->socketCapacity : 64;
+        while( capacity <= (size_t)fd ) capacity *= 2;
+        AsyncEntry** grown = (AsyncEntry**)realloc( loop->sockets, capacity * sizeof( AsyncEntry* ) );
+        if( grown == NULL ) return( 1 );
+        memset( grown + loop->socketCapacity, 0, ( capacity - loop->socketCapacity ) * sizeof( AsyncEntry* ) );
+        loop->sockets = grown;
+        loop->socketCapacity = capacity;
+    }
+
+    loop->sockets[fd] = entry;
+
+    return( 0 );
+}
+
+
+static size_t pending( const AsyncLoop* loop )
+{
+    const int impair = loop->impair != NULL && loop->impair->index != NOT_IN_HEAP;
+    return( loop->heapCount - ( impair ? 1 : 0 ) );
+}
+
+
+static int isOver( const XferSession* session )
+{
+    return( session->state == XFER_DONE || session->state == XFER_FAILED );
+}
+
+
+static int heapPush( AsyncLoop* loop, AsyncEntry* entry )
+{
+    if( loop->heapCount == loop->heapCapacity )
+    {
+        const size_t capacity = loop->heapCapacity > 0 ? loop->heapCapacity * 2 : 64;
+        AsyncEntry** grown = (AsyncEntry**)realloc( loop->heap, capacity * sizeof( AsyncEntry* ) );
+        if( grown == NULL ) return( 1 );
+        loop->heap = grown;
+        loop->heapCapacity = capacity;
+    }
+
+    entry->index = loop->heapCount;
+    loop->heap[loop->heapCount++] = entry;
+    heapFix( loop, entry->index );
+
+    return( 0 );
+}
+
+
+static void heapRemove( AsyncLoop* loop, size_t index )
+{
+    // Derniere echeance placee a la position liberee
+    loop->heap[index]->index = NOT_IN_HEAP;
+    AsyncEntry* last = loop->heap[--loop->heapCount];
+    if( index == loop->heapCount ) return;
+    loop->heap[index] = last;
+    last->index = index;
+    heapFix( loop, index );
+}
+
+
+static void heapFix( AsyncLoop* loop, size_t index )
+{
+    AsyncEntry** heap = loop->heap;
+    AsyncEntry* entry = heap[index];
+
+    // Vers la tete tant que le parent est plus tardif
+    while( index > 0 && heap[( index - 1 ) / 2]->when > entry->when )
+    {
+        heap[index] = heap[( index - 1 ) / 2];
+        heap[index]->index = index;
+        index = ( index - 1 ) / 2;
+    }
+
+    // Vers les feuilles tant qu'un enfant est plus proche
+    while( 1 )
+    {
+        size_t child = 2 * index + 1;
+        if( child >= loop->heapCount ) break;
+        if( child + 1 < loop->heapCount && heap[child + 1]->when < heap[child]->when ) ++child;
+        if( heap[child]->when >= entry->when ) break;
+        heap[index] = heap[child];
+        heap[index]->index = index;
+        index = child;
+    }
+
+    heap[index] = entry;
+    entry->index = index;
+}
@@ -0,0 +1,407 @@
+#include "tftp/batch.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local
+#include "tftp/async.h"
+#include "tftp/metrics.h"
+#include "tftp/resume.h"
+
+
+struct BatchQueue;
+
+/** Transfert d'un fichier en cours (tentative ou attente avant une nouvelle tentative)
+ *
+ */
+typedef struct
+{
+    struct BatchQueue* queue;   // File des transferts
+    BatchItem* item;            // Fichier transfere
+    ResumeState resume;         // Lecture : fichier partiel et fichier de reprise
+    FILE* file;                 // Ecriture : fichier local
+    int64_t delay;              // Delai avant la prochaine tentative (ms)
+} BatchJob;
+
+/** Transferts lances par la boucle d'evenements
+ *
+ */
+typedef struct BatchQueue
+{
+    const Addr* server;         // Adresse du serveur
+    AsyncLoop* loop;            // Boucle d'evenements de tous les transferts
+    BatchJob* jobs;             // Transferts
+    size_t count;               // Nombre de transferts
+    size_t next;                // Prochain transfert a lancer
+} BatchQueue;
+
+// Transferts simultanes et nouvelles tentatives
+static int maxJobs = BATCH_DEFAULT_JOBS;
+static int maxRetries = BATCH_DEFAULT_RETRIES;
+
+// Noms des sens et des causes d'echec dans le rapport
+static const char* DIRECTIONS[] = { "get", "put" };
+static const char* ERRORS[] = { "none", "timeout", "server", "protocol", "socket", "local", "checksum" };
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Lancement du prochain transfert de la file
+ *
+ */
+static void startNext( BatchQueue* queue );
+
+/** Tentative de transfert d'un fichier (un GET reprend la ou la tentative precedente s'est arretee)
+ *
+ */
+static void tryJob( BatchJob* job );
+
+/** Nouvelle tentative apres le delai (minuterie)
+ *
+ */
+static void retryJob( void* context );
+
+/** Fin d'une tentative (fonction de fin du transfert)
+ *
+ */
+static void onDone( XferSession* session, void* context );
+
+/** Fin d'une tentative : nouvelle tentative apres un echec transitoire (delai qui double a chaque fois), sinon
+ *  etat final du fichier et transfert suivant
+ */
+static void endJob( BatchJob* job, int status );
+
+/** Echec transitoire (une nouvelle tentative peut aboutir)
+ *
+ */
+static int isTransient( const XferResult* result );
+
+/** Lecture d'une ligne du manifeste dans item
+ *
+ */
+static int parseManifestLine( char* line, BatchItem* item );
+
+/** Ecriture d'une chaine JSON (avec guillemets et echappements)
+ *
+ */
+static void writeJsonString( FILE* out, const char* value );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void BATCH_setJobs( int jobs )
+{
+    if( jobs >= 1 && jobs <= BATCH_MAX_JOBS ) maxJobs = jobs;
+}
+
+
+void BATCH_setRetries( int retries )
+{
+    if( retries >= 0 ) maxRetries = retries;
+}
+
+
+int BATCH_loadManifest( const char* path, BatchItem** items, size_t* count )
+{
+    FILE* manifest = strcmp( path, "-" ) == 0 ? stdin : fopen( path, "r" );
+    if( manifest == NULL )
+    {
+        fprintf( stderr, "ERREUR - Impossible d'ouvrir le manifeste : %s\n", path );
+        return( 1 );
+    }
+
+    // Tableau agrandi au fil des lignes
+    *items = NULL;
+    *count = 0;
+    size_t capacity = 0;
+    int status = 0;
+    char line[1024];
+    for( int lineNum = 1; fgets( line, sizeof( line ), manifest ) != NULL; ++lineNum )
+    {
+        // Commentaire ou ligne vide
+        line[strcspn( line, "#\r\n" )] = '\0';
+        if( strspn( line, " \t" ) == strlen( line ) ) continue;
+
+        if( *count == capacity )
+        {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            BatchItem* grown = (BatchItem*)realloc( *items, capacity * sizeof( BatchItem ) );
+            if( grown == NULL )
+            {
+                status = 2;
+                break;
+            }
+            *items = grown;
+        }
+        if( parseManifestLine( line, &( *items )[*count] ) != 0 )
+        {
+            fprintf( stderr, "ERREUR - %s:%d : ligne invalide\n", path, lineNum );
+            status = 3;
+            break;
+        }
+        ++*count;
+    }
+
+    if( manifest != stdin ) fclose( manifest );
+    if( status != 0 )
+    {
+        free( *items );
+        *items = NULL;
+        *count = 0;
+    }
+
+    return( status );
+}
+
+
+size_t BATCH_run( const Addr* server, BatchItem* items, size_t count, int64_t* duration )
+{
+    const int64_t start = METRICS_now();
+    for( size_t i = 0; i < count; ++i )
+    {
+        items[i].status = -1;
+        items[i].attempts = 0;
+    }
+
+    // Au plus maxJobs transferts en cours dans la boucle, le suivant lance a la fin de chacun
+    BatchQueue queue = { server, ASYNC_create(), (BatchJob*)calloc( count, sizeof( BatchJob ) ), count, 0 };
+    if( queue.loop != NULL && queue.jobs != NULL )
+    {
+        for( size_t i = 0; i < count; ++i )
+        {
+            queue.jobs[i].queue = &queue;
+            queue.jobs[i].item = &items[i];
+            queue.jobs[i].delay = BATCH_RETRY_DELAY_MS;
+        }
+        for( int i = 0; i < maxJobs; ++i ) startNext( &queue );
+        ASYNC_run( queue.loop );
+    }
+    else fprintf( stderr, "ERREUR - Lancement des transferts impossible\n" );
+    ASYNC_destroy( queue.loop );
+    free( queue.jobs );
+
+    *duration = METRICS_now() - start;
+    size_t failed = 0;
+    for( size_t i = 0; i < count; ++i ) if( items[i].status != 0 ) ++failed;
+
+    return( failed );
+}
+
+
+void BATCH_printSummary( FILE* out, const BatchItem* items, size_t count, int64_t duration )
+{
+    uint64_t bytes = 0;
+    size_t failed = 0;
+    for( size_t i = 0; i < count; ++i )
+    {
+        const BatchItem* item = &items[i];
+        const char* name = item->direction == BATCH_GET ? item->remote : item->local;
+        if( item->status == 0 )
+        {
+            fprintf( out, "OK      " );
+            XFER_printResult( out, name, &item->result );
+            bytes += item->result.bytes;
+        }
+        else
+        {
+            fprintf( out, "ERREUR  %s : %s\n", name, item->status == -1 ? "non traité" : item->result.message );
+            ++failed;
+        }
+    }
+
+    const double seconds = duration > 0 ? duration / 1e6 : 1e-6;
+    fprintf( out, "Total : %zu fichiers, %zu en erreur, %llu octets en %.3f s (%.2f Mo/s)\n", count, failed,
+             (unsigned long long)bytes, seconds, bytes / seconds / 1e6 );
+}
+
+
+void BATCH_writeReport( FILE* out, const BatchItem* items, size_t count, int64_t duration )
+{
+    uint64_t bytes = 0;
+    size_t failed = 0;
+    for( size_t i = 0; i < count; ++i )
+    {
+        if( items[i].status == 0 ) bytes += items[i].result.bytes;
+        else ++failed;
+    }
+    const double seconds = duration > 0 ? duration / 1e6 : 1e-6;
+
+    fprintf( out, "{\"transfers\":%zu,\"completed\":%zu,\"failed\":%zu,\"bytes\":%llu,\"duration_s\":%.6f,"
+             "\"throughput_Bps\":%.0f,\"items\":[", count, count - failed, failed, (unsigned long long)bytes, seconds,
+             bytes / seconds );
+    for( size_t i = 0; i < count; ++i )
+    {
+        const BatchItem* item = &items[i];
+        const XferResult* result = &item->result;
+        fprintf( out, "%s{\"direction\":\"%s\",\"remote\":", i > 0 ? "," : "", DIRECTIONS[item->direction] );
+        writeJsonString( out, item->remote );
+        fprintf( out, ",\"local\":" );
+        writeJsonString( out, item->local );
+        fprintf( out, ",\"status\":\"%s\",\"attempts\":%d,\"bytes\":%llu,\"duration_s\":%.6f,\"blksize\":%u,"
+                 "\"windowsize\":%u,\"retransmits\":%u", item->status == 0 ? "ok" : "failed", item->attempts,
+                 (unsigned long long)result->bytes, result->duration / 1e6, result->blockSize, result->windowSize,
+                 result->retransmits );
+        if( item->status != 0 )
+        {
+            fprintf( out, ",\"error\":\"%s\",\"error_code\":%u,\"message\":",
+                     item->attempts > 0 ? ERRORS[result->error] : "none", result->errorCode );
+            writeJsonString( out, item->attempts > 0 ? result->message : "non traité" );
+        }
+        fprintf( out, "}" );
+    }
+    fprintf( out, "]}\n" );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void startNext( BatchQueue* queue )
+{
+    if( queue->next < queue->count ) tryJob( &queue->jobs[queue->next++] );
+}
+
+
+static void tryJob( BatchJob* job )
+{
+    BatchQueue* queue = job->queue;
+    BatchItem* item = job->item;
+    ++item->attempts;
+
+    // Lecture : fichier partiel conserve apres un echec transitoire
+    XferSession* session = NULL;
+    if( item->direction == BATCH_GET )
+    {
+        XferOptions options;
+        FILE* file = RESUME_open( &job->resume, item->remote, item->local, &item->options, &options, &item->result );
+        if( file == NULL )
+        {
+            endJob( job, 1 );
+            return;
+        }
+        session = ASYNC_get( queue->loop, queue->server, item->remote, file, &options, onDone, job );
+    }
+    else
+    {
+        job->file = fopen( item->local, "rb" );
+        if( job->file == NULL )
+        {
+            memset( &item->result, 0, sizeof( item->result ) );
+            item->result.error = XFER_ERR_LOCAL;
+            snprintf( item->result.message, sizeof( item->result.message ), "Impossible d'ouvrir le fichier local" );
+            fprintf( stderr, "ERREUR - Impossible d'ouvrir le fichier local: %s\n", item->local );
+            endJob( job, 1 );
+            return;
+        }
+        session = ASYNC_put( queue->loop, queue->server, item->remote, job->file, &item->options, onDone, job );
+    }
+
+    // Pas de socket : echec transitoire
+    if( session == NULL )
+    {
+        memset( &item->result, 0, sizeof( item->result ) );
+        item->result.error = XFER_ERR_SOCKET;
+        snprintf( item->result.message, sizeof( item->result.message ), "Création de la socket impossible" );
+        onDone( NULL, job );
+    }
+}
+
+
+static void retryJob( void* context )
+{
+    tryJob( (BatchJob*)context );
+}
+
+
+static void onDone( XferSession* session, void* context )
+{
+    BatchJob* job = (BatchJob*)context;
+    BatchItem* item = job->item;
+    if( session != NULL ) item->result = session->result;
+    int status = session != NULL && session->state == XFER_DONE ? 0 : 1;
+
+    // Fichier local ferme (lecture : fichier partiel conserve ou supprime)
+    if( item->direction == BATCH_GET ) status = RESUME_close( &job->resume, status, &item->result );
+    else
+    {
+        fclose( job->file );
+        job->file = NULL;
+    }
+
+    endJob( job, status != 0 ? 2 : 0 );
+}
+
+
+static void endJob( BatchJob* job, int status )
+{
+    BatchItem* item = job->item;
+    if( status != 0 && item->attempts <= maxRetries && isTransient( &item->result ) )
+    {
+        fprintf( stderr, "Nouvelle tentative dans %lld ms : %s\n", (long long)job->delay, item->remote );
+        if( ASYNC_after( job->queue->loop, job->delay, retryJob, job ) == 0 )
+        {
+            job->delay *= 2;
+            return;
+        }
+    }
+
+    item->status = status;
+    startNext( job->queue );
+}
+
+
+static int isTransient( const XferResult* result )
+{
+    return( result->error == XFER_ERR_TIMEOUT || result->error == XFER_ERR_SOCKET || result->error == XFER_ERR_CHECKSUM
+            || ( result->error == XFER_ERR_SERVER && result->errorCode == ERR_UNDEFINED ) );
+}
+
+
+static int parseManifestLine( char* line, BatchItem* item )
+{
+    memset( item, 0, sizeof( *item ) );
+    XFER_initOptions( &item->options );
+
+    // Sens, fichier distant, fichier local
+    char* direction = strtok( line, " \t" );
+    char* remote = strtok( NULL, " \t" );
+    char* local = strtok( NULL, " \t" );
+    if( local == NULL || strlen( remote ) >= sizeof( item->remote ) || strlen( local ) >= sizeof( item->local ) )
+        return( 1 );
+    if( strcmp( direction, "get" ) == 0 ) item->direction = BATCH_GET;
+    else if( strcmp( direction, "put" ) == 0 ) item->direction = BATCH_PUT;
+    else return( 2 );
+    strcpy( item->remote, remote );
+    strcpy( item->local, local );
+
+    // Options cle=valeur
+    char* option;
+    while( ( option = strtok( NULL, " \t" ) ) != NULL )
+    {
+        char* value = strchr( option, '=' );
+        if( value == NULL ) return( 3 );
+        *value++ = '\0';
+        const long number = atol( value );
+        if( strcmp( option, "blksize" ) == 0 && number >= XFER_MIN_BLOCK_SIZE && number <= XFER_MAX_BLOCK_SIZE )
+            item->options.blockSize = (uint16_t)number;
+        else if( strcmp( option, "windowsize" ) == 0 && number >= 1 && number <= XFER_MAX_WINDOW_SIZE )
+            item->options.windowSize = (uint16_t)number;
+        else return( 4 );
+    }
+
+    return( 0 );
+}
+
+
+static void writeJsonString( FILE* out, const char* value )
+{
+    fputc( '"', out );
+    for( const unsigned char* c = (const unsigned char*)value; *c != '\0'; ++c )
+    {
+        if( *c == '"' || *c == '\\' ) fprintf( out, "\\%c", *c );
+        else if( *c < 0x20 ) fprintf( out, "\\u%04x", *c );
+        else fputc( *c, out );
+    }
+    fputc( '"', out );
+}
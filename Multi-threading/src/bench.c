@@ -0,0 +1,477 @@
+#include "tftp/bench.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
+
+// Local
+#include "tftp/async.h"
+#include "tftp/addr.h"
+#include "tftp/metrics.h"
+
+
+// Noms des causes d'echec (dans l'ordre de l'enum des transferts)
+static const char* ERRORS[] = { "none", "timeout", "server", "protocol", "socket", "local", "checksum" };
+
+struct Bench;
+
+/** Requete en cours sur une session
+ *
+ */
+typedef struct
+{
+    struct Bench* bench;                // Mesure
+    int id;                             // Numero de la session (fichier ecrit par un PUT)
+    FILE* file;                         // Donnees envoyees par un PUT (en memoire)
+    int64_t start;                      // Debut de la requete, ou date d'arrivee en boucle ouverte (us)
+} BenchRequest;
+
+/** Etat d'une mesure
+ *
+ */
+typedef struct Bench
+{
+    const BenchConfig* config;          // Parametres
+    Addr* server;                       // Adresse du serveur
+    unsigned char* data;                // Donnees envoyees par les PUT
+    AsyncLoop* loop;                    // Boucle d'evenements de tous les transferts
+    XferOptions options;                // Options des transferts
+    BenchRequest* requests;             // Requete de chaque session
+    int* idle;                          // Sessions libres (pile)
+    int idleCount;                      // Nombre de sessions libres
+    int64_t end;                        // Fin de la mesure (us, INT64_MAX : limitee par le nombre de requetes)
+    int64_t nextArrival;                // Prochaine arrivee en boucle ouverte (us)
+    long started;                       // Requetes lancees (ou rejetees faute de session libre)
+    long completed;                     // Requetes terminees
+    long failed;                        // Requetes en erreur
+    long rejected;                      // Arrivees sans session libre (boucle ouverte)
+    long errors[XFER_ERR_COUNT];        // Erreurs par cause
+    uint64_t bytes;                     // Octets de donnees transferes
+    double* latencies;                  // Latences des requetes terminees (ms)
+    size_t latencyCount;                // Nombre de latences
+    size_t latencyCapacity;             // Taille du tableau des latences
+    unsigned int seed;                  // Etat du tirage des requetes
+    int setupStatus;                    // Resultat de l'ecriture d'un fichier de preparation
+} Bench;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Ecriture sur le serveur des fichiers lus pendant la mesure
+ *
+ */
+static int setup( Bench* bench );
+
+/** Fin de l'ecriture d'un fichier de preparation
+ *
+ */
+static void setupDone( XferSession* session, void* context );
+
+/** Boucle de mesure
+ *
+ */
+static void measure( Bench* bench, int64_t* elapsed );
+
+/** Requete a lancer (nombre de requetes et duree non atteints)
+ *
+ */
+static int canStart( const Bench* bench );
+
+/** Arrivees poissonniennes en boucle ouverte, independantes des reponses du serveur
+ *
+ */
+static void arrive( void* context );
+
+/** Lancement d'une requete tiree au sort sur une session libre
+ *
+ */
+static void startRequest( Bench* bench, int64_t time );
+
+/** Prise en compte d'une requete terminee (ou en erreur) et liberation de la session
+ *
+ */
+static void finish( XferSession* session, void* context );
+
+/** Comptage d'une requete en erreur et liberation de la session
+ *
+ */
+static void release( Bench* bench, BenchRequest* request, int error );
+
+/** Affichage du resultat
+ *
+ */
+static void report( Bench* bench, int64_t elapsed );
+
+/** Percentile des latences triees
+ *
+ */
+static double percentile( const Bench* bench, double p );
+
+/** Comparaison de deux latences (tri)
+ *
+ */
+static int compareLatencies( const void* a, const void* b );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void BENCH_initConfig( BenchConfig* config )
+{
+    memset( config, 0, sizeof( BenchConfig ) );
+    config->sessions = 100;
+    config->requests = 1000;
+    config->getWeight = 1;
+    config->sizes[0] = 64 * 1024;
+    config->sizeCount = 1;
+    config->seed = 1;
+}
+
+
+int BENCH_parseMix( BenchConfig* config, const char* value )
+{
+    config->getWeight = 0;
+    config->putWeight = 0;
+
+    // Liste de paires type:poids
+    char buff[128];
+    snprintf( buff, sizeof( buff ), "%s", value );
+    for( char* token = strtok( buff, "," ); token != NULL; token = strtok( NULL, "," ) )
+    {
+        int weight = 0;
+        if( sscanf( token, "get:%d", &weight ) == 1 && weight >= 0 ) config->getWeight = weight;
+        else if( sscanf( token, "put:%d", &weight ) == 1 && weight >= 0 ) config->putWeight = weight;
+        else
+        {
+            fprintf( stderr, "ERREUR - Mélange de requêtes invalide : %s\n", token );
+            return( 1 );
+        }
+    }
+
+    if( config->getWeight + config->putWeight == 0 )
+    {
+        fprintf( stderr, "ERREUR - Mélange de requêtes vide\n" );
+        return( 1 );
+    }
+
+    return( 0 );
+}
+
+
+int BENCH_parseSizes( BenchConfig* config, const char* value )
+{
+    config->sizeCount = 0;
+
+    // Liste de tailles avec suffixe K ou M eventuel
+    char buff[128];
+    snprintf( buff, sizeof( buff ), "%s", value );
+    for( char* token = strtok( buff, "," ); token != NULL; token = strtok( NULL, "," ) )
+    {
+        char* end = NULL;
+        size_t size = (size_t)strtoull( token, &end, 10 );
+        if( *end == 'K' || *end == 'k' ) size *= 1024, ++end;
+        else if( *end == 'M' || *end == 'm' ) size *= 1024 * 1024, ++end;
+        if( end == token || *end != '\0' || config->sizeCount == BENCH_MAX_SIZES )
+        {
+            fprintf( stderr, "ERREUR - Taille de fichier invalide : %s\n", token );
+            return( 1 );
+        }
+        config->sizes[config->sizeCount++] = size;
+    }
+
+    return( config->sizeCount == 0 );
+}
+
+
+int BENCH_run( const BenchConfig* config, const char* srvHost, uint16_t srvPort )
+{
+    // Une socket par session : relevement de la limite de descripteurs si besoin
+    struct rlimit limit;
+    if( getrlimit( RLIMIT_NOFILE, &limit ) == 0 && limit.rlim_cur < (rlim_t)config->sessions + 64 )
+    {
+        limit.rlim_cur = limit.rlim_max < (rlim_t)config->sessions + 64 ? limit.rlim_max : (rlim_t)config->sessions + 64;
+        setrlimit( RLIMIT_NOFILE, &limit );
+    }
+
+    // Allocation de l'etat de la mesure
+    Bench bench;
+    memset( &bench, 0, sizeof( Bench ) );
+    bench.config = config;
+    bench.seed = config->seed;
+    bench.server = ADDR_createRemote( srvHost, srvPort );
+    bench.loop = ASYNC_create();
+    bench.requests = (BenchRequest*)calloc( config->sessions, sizeof( BenchRequest ) );
+    bench.idle = (int*)calloc( config->sessions, sizeof( int ) );
+    if( bench.server == NULL || bench.loop == NULL || bench.requests == NULL || bench.idle == NULL )
+    {
+        fprintf( stderr, "ERREUR - Initialisation de la mesure impossible\n" );
+        ASYNC_destroy( bench.loop );
+        free( bench.requests );
+        free( bench.idle );
+        ADDR_destroy( bench.server );
+        return( 1 );
+    }
+
+    // Options du client (--blksize, --windowsize), echecs comptes sans affichage
+    XFER_initOptions( &bench.options );
+    bench.options.quiet = 1;
+
+    // Donnees des PUT (la plus grande taille, les autres en sont des prefixes)
+    size_t maxSize = 0;
+    for( int i = 0; i < config->sizeCount; ++i ) if( config->sizes[i] > maxSize ) maxSize = config->sizes[i];
+    bench.data = (unsigned char*)malloc( maxSize + 1 );
+    for( size_t i = 0; i < maxSize; ++i ) bench.data[i] = (unsigned char)rand_r( &bench.seed );
+
+    // Sessions libres
+    for( int i = 0; i < config->sessions; ++i )
+    {
+        bench.requests[i].bench = &bench;
+        bench.requests[i].id = i;
+        bench.idle[bench.idleCount++] = config->sessions - 1 - i;
+    }
+
+    // Preparation puis mesure
+    int status = setup( &bench );
+    if( status == 0 )
+    {
+        int64_t elapsed = 0;
+        measure( &bench, &elapsed );
+        report( &bench, elapsed );
+    }
+
+    // Liberation memoire
+    ASYNC_destroy( bench.loop );
+    free( bench.requests );
+    free( bench.idle );
+    free( bench.data );
+    free( bench.latencies );
+    ADDR_destroy( bench.server );
+
+    return( status );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static int setup( Bench* bench )
+{
+    // Rien a lire pendant la mesure
+    if( bench->config->getWeight == 0 ) return( 0 );
+
+    // Un fichier par taille, ecrits l'un apres l'autre
+    for( int i = 0; i < bench->config->sizeCount; ++i )
+    {
+        char fileName[FILENAME_SIZE];
+        snprintf( fileName, sizeof( fileName ), "bench-%zu.bin", bench->config->sizes[i] );
+        FILE* file = fmemopen( bench->data, bench->config->sizes[i], "rb" );
+        bench->setupStatus = 1;
+        if( file != NULL && ASYNC_put( bench->loop, bench->server, fileName, file, &bench->options, setupDone, bench ) != NULL )
+            ASYNC_run( bench->loop );
+        if( file != NULL ) fclose( file );
+        if( bench->setupStatus != 0 )
+        {
+            fprintf( stderr, "ERREUR - Echec de l'écriture de %s\n", fileName );
+            return( 1 );
+        }
+    }
+
+    return( 0 );
+}
+
+
+static void setupDone( XferSession* session, void* context )
+{
+    Bench* bench = (Bench*)context;
+    bench->setupStatus = session->state == XFER_DONE ? 0 : 1;
+    if( bench->setupStatus != 0 ) fprintf( stderr, "ERREUR - %s\n", session->result.message );
+}
+
+
+static void measure( Bench* bench, int64_t* elapsed )
+{
+    const BenchConfig* config = bench->config;
+    const int64_t start = METRICS_now();
+    bench->end = config->duration > 0 ? start + (int64_t)( config->duration * 1e6 ) : INT64_MAX;
+
+    // Boucle ouverte : premiere arrivee ; boucle fermee : une requete par session, relancee a sa fin
+    if( config->rate > 0 )
+    {
+        bench->nextArrival = start;
+        arrive( bench );
+    }
+    else
+    {
+        while( bench->idleCount > 0 && canStart( bench ) ) startRequest( bench, METRICS_now() );
+    }
+
+    // Jusqu'a la fin de toutes les requetes lancees
+    ASYNC_run( bench->loop );
+
+    *elapsed = METRICS_now() - start;
+}
+
+
+static int canStart( const Bench* bench )
+{
+    return( ( bench->config->requests == 0 || bench->started < bench->config->requests )
+            && METRICS_now() < bench->end );
+}
+
+
+static void arrive( void* context )
+{
+    Bench* bench = (Bench*)context;
+    const int64_t time = METRICS_now();
+
+    // Arrivees echues (plusieurs par milliseconde a haut debit)
+    while( bench->nextArrival <= time && canStart( bench ) )
+    {
+        if( bench->idleCount > 0 ) startRequest( bench, bench->nextArrival );
+        else
+        {
+            ++bench->started;
+            ++bench->rejected;
+        }
+        const double u = (double)rand_r( &bench->seed ) / ( (double)RAND_MAX + 1.0 );
+        bench->nextArrival += (int64_t)( -log( 1.0 - u ) / bench->config->rate * 1e6 );
+    }
+
+    // Arrivee suivante
+    if( canStart( bench ) ) ASYNC_after( bench->loop, ( bench->nextArrival - time ) / 1000, arrive, bench );
+}
+
+
+static void startRequest( Bench* bench, int64_t time )
+{
+    const BenchConfig* config = bench->config;
+    BenchRequest* request = &bench->requests[bench->idle[--bench->idleCount]];
+    ++bench->started;
+
+    // Tirage du type de requete et de la taille du fichier
+    const int type = (int)( rand_r( &bench->seed ) % ( config->getWeight + config->putWeight ) ) < config->getWeight
+                     ? XFER_GET : XFER_PUT;
+    const size_t size = config->sizes[rand_r( &bench->seed ) % config->sizeCount];
+
+    // Fichier lu (ecrit pendant la preparation, donnees ignorees) ou ecrit (donnees en memoire)
+    char fileName[FILENAME_SIZE];
+    if( type == XFER_GET ) snprintf( fileName, sizeof( fileName ), "bench-%zu.bin", size );
+    else snprintf( fileName, sizeof( fileName ), "bench-%zu-%d.bin", size, request->id % BENCH_PUT_FILES );
+
+    // La latence d'une arrivee en boucle ouverte compte depuis sa date d'arrivee
+    request->start = time;
+    request->file = NULL;
+    XferSession* session = NULL;
+    if( type == XFER_GET )
+        session = ASYNC_get( bench->loop, bench->server, fileName, NULL, &bench->options, finish, request );
+    else
+    {
+        request->file = fmemopen( bench->data, size, "rb" );
+        if( request->file == NULL )
+        {
+            release( bench, request, XFER_ERR_LOCAL );
+            return;
+        }
+        session = ASYNC_put( bench->loop, bench->server, fileName, request->file, &bench->options, finish, request );
+    }
+    if( session == NULL ) release( bench, request, XFER_ERR_SOCKET );
+}
+
+
+static void finish( XferSession* session, void* context )
+{
+    BenchRequest* request = (BenchRequest*)context;
+    Bench* bench = request->bench;
+    const int64_t time = METRICS_now();
+
+    if( session->state != XFER_DONE ) release( bench, request, session->result.error );
+    else
+    {
+        // Latence et volume des requetes terminees
+        ++bench->completed;
+        bench->bytes += session->result.bytes;
+        if( bench->latencyCount == bench->latencyCapacity )
+        {
+            bench->latencyCapacity = bench->latencyCapacity ? bench->latencyCapacity * 2 : 1024;
+            bench->latencies = (double*)realloc( bench->latencies, bench->latencyCapacity * sizeof( double ) );
+        }
+        bench->latencies[bench->latencyCount++] = (double)( time - request->start ) / 1e3;
+        release( bench, request, XFER_ERR_NONE );
+    }
+
+    // Boucle fermee : la session relance une requete
+    if( bench->config->rate <= 0 && canStart( bench ) ) startRequest( bench, time );
+}
+
+
+static void release( Bench* bench, BenchRequest* request, int error )
+{
+    if( error != XFER_ERR_NONE )
+    {
+        ++bench->failed;
+        ++bench->errors[error];
+    }
+
+    // Session de nouveau libre
+    if( request->file != NULL ) fclose( request->file );
+    request->file = NULL;
+    bench->idle[bench->idleCount++] = request->id;
+}
+
+
+static void report( Bench* bench, int64_t elapsed )
+{
+    const BenchConfig* config = bench->config;
+    const double seconds = (double)elapsed / 1e6;
+    qsort( bench->latencies, bench->latencyCount, sizeof( double ), compareLatencies );
+
+    double mean = 0.0;
+    for( size_t i = 0; i < bench->latencyCount; ++i ) mean += bench->latencies[i];
+    if( bench->latencyCount > 0 ) mean /= (double)bench->latencyCount;
+
+    // Resultat lisible
+    fprintf( stdout, "Requêtes : %ld terminées, %ld en erreur (timeout %ld, serveur %ld, protocole %ld, socket %ld, "
+             "local %ld, empreinte %ld), %ld rejetées\n", bench->completed, bench->failed,
+             bench->errors[XFER_ERR_TIMEOUT], bench->errors[XFER_ERR_SERVER], bench->errors[XFER_ERR_PROTOCOL],
+             bench->errors[XFER_ERR_SOCKET], bench->errors[XFER_ERR_LOCAL], bench->errors[XFER_ERR_CHECKSUM],
+             bench->rejected );
+    fprintf( stdout, "Durée : %.3f s\n", seconds );
+    fprintf( stdout, "Débit : %.1f req/s, %.2f Mo/s\n", bench->completed / seconds, bench->bytes / seconds / 1e6 );
+    fprintf( stdout, "Latence (ms) : moyenne %.3f, p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n", mean,
+             percentile( bench, 0.50 ), percentile( bench, 0.90 ), percentile( bench, 0.99 ),
+             percentile( bench, 0.999 ), percentile( bench, 1.0 ) );
+
+    // Resultat JSON (une ligne)
+    fprintf( stdout, "{\"mode\":\"%s\",\"sessions\":%d,\"rate\":%.3f,\"requests\":%ld,\"completed\":%ld,"
+             "\"failed\":%ld,\"rejected\":%ld,\"errors\":{", config->rate > 0 ? "open" : "closed", config->sessions,
+             config->rate, bench->started, bench->completed, bench->failed, bench->rejected );
+    for( int i = XFER_ERR_NONE + 1; i < XFER_ERR_COUNT; ++i )
+        fprintf( stdout, "%s\"%s\":%ld", i > 1 ? "," : "", ERRORS[i], bench->errors[i] );
+    fprintf( stdout, "},\"duration_s\":%.6f,\"throughput_rps\":%.3f,\"throughput_Bps\":%.0f,"
+             "\"latency_ms\":{\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}}\n",
+             seconds, bench->completed / seconds, bench->bytes / seconds, mean, percentile( bench, 0.50 ),
+             percentile( bench, 0.90 ), percentile( bench, 0.99 ), percentile( bench, 0.999 ),
+             percentile( bench, 1.0 ) );
+}
+
+
+static double percentile( const Bench* bench, double p )
+{
+    if( bench->latencyCount == 0 ) return( 0.0 );
+
+    // Plus petite latence couvrant la proportion p des requetes
+    size_t index = (size_t)ceil( p * (double)bench->latencyCount );
+    if( index > 0 ) --index;
+    if( index >= bench->latencyCount ) index = bench->latencyCount - 1;
+
+    return( bench->latencies[index] );
+}
+
+
+static int compareLatencies( const void* a, const void* b )
+{
+    const double latencyA = *(const double*)a;
+    const double latencyB = *(const double*)b;
+    return( ( latencyA > latencyB ) - ( latencyA < latencyB ) );
+}
@@ -0,0 +1,324 @@
+#include "tftp/capture.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+// Local
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+
+
+// Format pcap : horodatage en nanosecondes, paquets IPv4 sans entete de liaison (LINKTYPE_RAW)
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_SNAP_LENGTH 65535
+
+/** Entete d'un fichier pcap
+ *
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t thisZone;
+    uint32_t sigFigs;
+    uint32_t snapLength;
+    uint32_t linkType;
+} PcapHeader;
+
+/** Entete d'un paquet pcap, suivi des entetes IPv4 et UDP reconstitues puis des donnees
+ *
+ */
+typedef struct
+{
+    uint32_t seconds;
+    uint32_t nanoseconds;
+    uint32_t capturedLength;
+    uint32_t length;
+    uint8_t ip[20];
+    uint8_t udp[8];
+} PcapRecord;
+
+// Fichier de capture et limites
+static char outputPath[256] = "";
+static long maxSize = CAPTURE_DEFAULT_MAX_SIZE;
+static int maxFiles = CAPTURE_DEFAULT_FILES;
+
+// Double tampon : current se remplit (sous le verrou), l'autre est ecrit par le thread de fond
+static unsigned char* buffers[2] = { NULL, NULL };
+static int current = 0;
+static size_t fill = 0;
+static uint64_t dropped = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+// Thread d'ecriture et fichier courant
+static pthread_t writeThread;
+static volatile int running = 0;
+static int stopWrite = 0;
+static FILE* output = NULL;
+static long outputSize = 0;
+
+// Identifiant des entetes IPv4
+static uint16_t ipId = 0;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Thread d'ecriture
+ *
+ */
+static void* writeLoop( void* arg );
+
+/** Ecriture des paquets d'un tampon (rotation a la limite de taille, entre deux paquets)
+ *
+ */
+static void writeBuffer( const unsigned char* buff, size_t size );
+
+/** Ouverture d'un nouveau fichier (avec rotation des anciens)
+ *
+ */
+static int openOutput( int rotate );
+
+/** Somme de controle de l'entete IPv4
+ *
+ */
+static uint16_t ipChecksum( const uint8_t* header );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void CAPTURE_setOutput( const char* path )
+{
+    snprintf( outputPath, sizeof( outputPath ), "%s", path );
+}
+
+
+void CAPTURE_setLimits( long size, int files )
+{
+    if( size > 0 ) maxSize = size;
+    if( files > 0 ) maxFiles = files;
+}
+
+
+int CAPTURE_start()
+{
+    if( outputPath[0] == '\0' ) return( 0 );
+
+    buffers[0] = (unsigned char*)malloc( CAPTURE_BUFFER_SIZE );
+    buffers[1] = (unsigned char*)malloc( CAPTURE_BUFFER_SIZE );
+    if( buffers[0] == NULL || buffers[1] == NULL || openOutput( 0 ) != 0 )
+    {
+        free( buffers[0] );
+        free( buffers[1] );
+        return( 1 );
+    }
+
+    // Aucun signal traite par le thread d'ecriture (arret du serveur par le thread principal)
+    sigset_t all;
+    sigset_t previous;
+    sigfillset( &all );
+    pthread_sigmask( SIG_BLOCK, &all, &previous );
+    stopWrite = 0;
+    const int status = pthread_create( &writeThread, NULL, writeLoop, NULL );
+    pthread_sigmask( SIG_SETMASK, &previous, NULL );
+    if( status != 0 )
+    {
+        fprintf( stderr, "ERREUR - Lancement de la capture impossible\n" );
+        fclose( output );
+        output = NULL;
+        return( 1 );
+    }
+    running = 1;
+
+    return( 0 );
+}
+
+
+void CAPTURE_stop()
+{
+    if( ! running ) return;
+
+    // Plus de nouveaux paquets, ecriture des derniers tampons par le thread
+    pthread_mutex_lock( &mutex );
+    running = 0;
+    stopWrite = 1;
+    pthread_cond_signal( &cond );
+    pthread_mutex_unlock( &mutex );
+    pthread_join( writeThread, NULL );
+
+    fclose( output );
+    output = NULL;
+    free( buffers[0] );
+    free( buffers[1] );
+    buffers[0] = buffers[1] = NULL;
+}
+
+
+void CAPTURE_packet( const Sock* sock, const struct sockaddr_in* peer, int outgoing, const void* data, size_t size )
+{
+    if( ! running ) return;
+
+    // Entetes hors verrou
+    PcapRecord record;
+    struct timespec time;
+    clock_gettime( CLOCK_REALTIME, &time );
+    const size_t captured = size < PCAP_SNAP_LENGTH - sizeof( record.ip ) - sizeof( record.udp )
+                            ? size : PCAP_SNAP_LENGTH - sizeof( record.ip ) - sizeof( record.udp );
+    record.seconds = (uint32_t)time.tv_sec;
+    record.nanoseconds = (uint32_t)time.tv_nsec;
+    record.capturedLength = (uint32_t)( sizeof( record.ip ) + sizeof( record.udp ) + captured );
+    record.length = (uint32_t)( sizeof( record.ip ) + sizeof( record.udp ) + size );
+
+    // IPv4 : source et destination selon le sens (la socket est rattachee a une adresse connue)
+    const struct sockaddr_in* local = &sock->addr->inAddr;
+    const struct sockaddr_in* source = outgoing ? local : peer;
+    const struct sockaddr_in* destination = outgoing ? peer : local;
+    const uint16_t ipLength = htons( (uint16_t)( record.length > UINT16_MAX ? UINT16_MAX : record.length ) );
+    const uint16_t id = htons( __atomic_add_fetch( &ipId, 1, __ATOMIC_RELAXED ) );
+    memset( record.ip, 0, sizeof( record.ip ) );
+    record.ip[0] = 0x45;                    // Version 4, entete de 20 octets
+    memcpy( &record.ip[2], &ipLength, 2 );
+    memcpy( &record.ip[4], &id, 2 );
+    record.ip[6] = 0x40;                    // Ne pas fragmenter
+    record.ip[8] = 64;                      // TTL
+    record.ip[9] = IPPROTO_UDP;
+    memcpy( &record.ip[12], &source->sin_addr, 4 );
+    memcpy( &record.ip[16], &destination->sin_addr, 4 );
+    const uint16_t checksum = ipChecksum( record.ip );
+    memcpy( &record.ip[10], &checksum, 2 );
+
+    // UDP (somme de controle facultative en IPv4 : nulle)
+    const uint16_t udpLength = htons( (uint16_t)( sizeof( record.udp ) + size ) );
+    memcpy( &record.udp[0], &source->sin_port, 2 );
+    memcpy( &record.udp[2], &destination->sin_port, 2 );
+    memcpy( &record.udp[4], &udpLength, 2 );
+    memset( &record.udp[6], 0, 2 );
+
+    // Copie dans le tampon courant (plein : paquet perdu, jamais d'attente)
+    pthread_mutex_lock( &mutex );
+    if( running && fill + sizeof( record ) + captured <= CAPTURE_BUFFER_SIZE )
+    {
+        memcpy( buffers[current] + fill, &record, sizeof( record ) );
+        memcpy( buffers[current] + fill + sizeof( record ), data, captured );
+        fill += sizeof( record ) + captured;
+
+        // Tampon a moitie plein : ecriture anticipee
+        if( fill - sizeof( record ) - captured < CAPTURE_BUFFER_SIZE / 2 && fill >= CAPTURE_BUFFER_SIZE / 2 )
+            pthread_cond_signal( &cond );
+    }
+    else ++dropped;
+    pthread_mutex_unlock( &mutex );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void* writeLoop( void* arg )
+{
+    (void)arg;
+
+    pthread_mutex_lock( &mutex );
+    while( 1 )
+    {
+        // Attente de la periode ou d'un tampon a moitie plein
+        if( ! stopWrite )
+        {
+            struct timespec due;
+            clock_gettime( CLOCK_REALTIME, &due );
+            due.tv_nsec += CAPTURE_FLUSH_MS * 1000000L;
+            due.tv_sec += due.tv_nsec / 1000000000L;
+            due.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait( &cond, &mutex, &due );
+        }
+
+        // Echange des tampons : les producteurs continuent dans l'autre
+        const int full = current;
+        const size_t size = fill;
+        const uint64_t lost = dropped;
+        current = 1 - current;
+        fill = 0;
+        dropped = 0;
+        const int last = stopWrite;
+        pthread_mutex_unlock( &mutex );
+
+        writeBuffer( buffers[full], size );
+        if( lost > 0 ) METRICS_add( METRICS_CAPTURE_DROPPED, (int64_t)lost );
+        if( last ) break;
+
+        pthread_mutex_lock( &mutex );
+    }
+
+    return( NULL );
+}
+
+
+static void writeBuffer( const unsigned char* buff, size_t size )
+{
+    size_t offset = 0;
+    while( offset < size && output != NULL )
+    {
+        uint32_t capturedLength = 0;
+        memcpy( &capturedLength, buff + offset + offsetof( PcapRecord, capturedLength ), sizeof( capturedLength ) );
+        const size_t recordSize = offsetof( PcapRecord, ip ) + capturedLength;
+
+        // Fichier plein : rotation (un fichier contient au moins un paquet)
+        if( outputSize + (long)recordSize > maxSize && outputSize > (long)sizeof( PcapHeader ) && openOutput( 1 ) != 0 )
+            return;
+
+        fwrite( buff + offset, recordSize, 1, output );
+        outputSize += (long)recordSize;
+        offset += recordSize;
+    }
+    if( output != NULL ) fflush( output );
+}
+
+
+static int openOutput( int rotate )
+{
+    if( output != NULL ) fclose( output );
+
+    // FICHIER.N-2 -> FICHIER.N-1, ..., FICHIER -> FICHIER.1 (le plus ancien est ecrase)
+    if( rotate )
+    {
+        char from[sizeof( outputPath ) + 16];
+        char to[sizeof( outputPath ) + 16];
+        for( int i = maxFiles - 1; i > 0; --i )
+        {
+            if( i > 1 ) snprintf( from, sizeof( from ), "%s.%d", outputPath, i - 1 );
+            else snprintf( from, sizeof( from ), "%s", outputPath );
+            snprintf( to, sizeof( to ), "%s.%d", outputPath, i );
+            rename( from, to );
+        }
+    }
+
+    output = fopen( outputPath, "w" );
+    if( output == NULL )
+    {
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Ouverture du fichier de capture impossible : %s", outputPath );
+        return( 1 );
+    }
+
+    const PcapHeader header = { PCAP_MAGIC_NS, 2, 4, 0, 0, PCAP_SNAP_LENGTH, PCAP_LINKTYPE_RAW };
+    fwrite( &header, sizeof( header ), 1, output );
+    outputSize = sizeof( header );
+
+    return( 0 );
+}
+
+
+static uint16_t ipChecksum( const uint8_t* header )
+{
+    uint32_t sum = 0;
+    for( int i = 0; i < 20; i += 2 ) sum += (uint32_t)( header[i] << 8 | header[i + 1] );
+    while( sum >> 16 ) sum = ( sum & 0xffff ) + ( sum >> 16 );
+
+    return( htons( (uint16_t)~sum ) );
+}
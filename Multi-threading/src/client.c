@@ -5,19 +5,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/stat.h>
-#include <time.h>
+#include <sys/select.h>
 
 // Local
 #include "tftp/tftp.h"
 #include "tftp/packet.h"
+#include "tftp/xfer.h"
+#include "tftp/batch.h"
+#include "tftp/resume.h"
+#include "tftp/segment.h"
+#include "tftp/reorder.h"
+#include "tftp/digest.h"
 
 // Commandes disponibles
-enum { CMD_NONE = -1, CMD_GET = 0, CMD_PUT, CMD_HELP, CMD_EXIT };
+enum { CMD_NONE = -1, CMD_GET = 0, CMD_PUT, CMD_MCGET, CMD_MGET, CMD_MPUT, CMD_HELP, CMD_EXIT };
 static const char* CMDS[] =
 {
     "get",
     "put",
+    "mcget",
+    "mget",
+    "mput",
     "help",
     "exit"
 };
@@ -29,6 +39,16 @@ static const size_t CMD_COUNT = sizeof( CMDS ) / sizeof( char* );
 // Taille de mot
 #define WORD_SIZE 256
 
+// Nombre max d'arguments d'une commande
+#define MAX_ARGS 64
+
+// Fichier local designant l'entree ou la sortie standard (get et put en flux)
+#define STD_STREAM "-"
+
+// Reception multicast : periode d'attente (ms) et nombre max de periodes sans paquet avant abandon
+#define MCAST_POLL_MS 1000
+#define MCAST_MAX_IDLE 30
+
 // Terminaison possible d'une reception de fichier
 enum
 {
@@ -40,25 +60,63 @@ enum
 
 //--- Declaration des fonctions locales ------------------------------------------------------------------------
 
-/** Envoi d'un fichier au serveur
+/** Execution d'une commande
+ *
+ */
+static int runCommand( Client* client, int cmd, char args[][WORD_SIZE], size_t argCount );
+
+/** Envoi d'un fichier au serveur sous le nom remoteName (NULL : filePath), lu sur l'entree standard si filePath
+ *  vaut STD_STREAM (taille inconnue, pas de tsize)
+ */
+static int putFile( Client* client, char* filePath, const char* remoteName );
+
+/** Demande de fichier au serveur, ecrit dans localName (NULL : nom du fichier demande), ou sur la sortie standard
+ *  si localName vaut STD_STREAM (pas de reprise ni de segments, messages sur la sortie d'erreur)
+ */
+static int getFile( Client* client, char* filePath, const char* localName );
+
+/** Transfert de plusieurs fichiers en parallele (direction : BATCH_GET ou BATCH_PUT)
+ *
+ */
+static int transferFiles( Client* client, int direction, char args[][WORD_SIZE], size_t argCount );
+
+/** Demande de fichier au serveur avec l'option multicast (repli en unicast si le serveur l'ignore)
+ *
+ */
+static int getFileMulticast( Client* client, char* filePath );
+
+/** Reception des blocs diffuses sur le groupe annonce par l'OACK du serveur
  *
  */
-static int putFile( Client* client, char* filePath );
+static int recvMulticast( Client* client, FILE* file, const OackPacket* oack, const Addr* server );
 
-/** Demande de fichier au serveur
+/** Decodage de la valeur de l'option multicast ("adresse,port,mc", adresse et port facultatifs)
  *
  */
-static int getFile( Client* client, char* filePath );
+static int parseMulticastOption( const char* value, char* host, uint16_t* port, int* master );
+
+/** Nom du fichier local correspondant au chemin demande (partie apres le dernier '/')
+ *
+ */
+static void getLocalFileName( const char* filePath, char* fileName );
 
 /** Reception d'un morceau de fichier envoye par le serveur, avec renvoi de l'ACK
  *
  */
-static int recvNextFileChunk( Client* client, FILE* file, uint16_t* lastBlock, Addr* from );
+static int recvNextFileChunk( Client* client, FILE* file, Reorder* reorder, DigestCheck* digest, uint16_t* lastBlock,
+                              Addr* from );
+
+/** Traitement d'un paquet recu pendant un transfert unicast (DATA, OACK ou ERROR) : blocs ecrits dans l'ordre,
+ *  blocs en avance conserves dans reorder, ACK du dernier bloc recu dans l'ordre (lastBlock). L'empreinte des blocs
+ *  ecrits est verifiee a la fin du fichier (empreinte differee : OACK recu avant le dernier bloc)
+ */
+static int handleFileChunk( Client* client, FILE* file, Reorder* reorder, DigestCheck* digest, Packet* response,
+                            uint16_t* lastBlock, const Addr* from );
 
-/** Parsing d'une ligne de commande (controle, extraction du code de commande et d'un eventuel argument)
+/** Parsing d'une ligne de commande (controle, extraction du code de commande et de ses arguments)
  *
  */
-static int parseCmdLine( char* buff, int* cmd, char* arg );
+static int parseCmdLine( char* buff, int* cmd, char args[][WORD_SIZE], size_t* argCount );
 
 /** Retourne le code de commande correspondant au mot specifie (ou CMD_NONE si non-reconnu)
  *
@@ -127,106 +185,74 @@ void CLIENT_run( Client* client )
 
         // Parsing de la ligne de commande
         int cmd = CMD_NONE;
-        char arg[WORD_SIZE];
-        if( parseCmdLine( buff, &cmd, arg ) != 0 ) continue;
+        char args[MAX_ARGS][WORD_SIZE];
+        size_t argCount = 0;
+        if( parseCmdLine( buff, &cmd, args, &argCount ) != 0 ) continue;
 
-        // Selon la commande
-        switch( cmd )
+        // Flux standard reserves aux commandes et au prompt de la session
+        if( ( cmd == CMD_PUT && strcmp( args[0], STD_STREAM ) == 0 )
+            || ( cmd == CMD_GET && argCount > 1 && strcmp( args[1], STD_STREAM ) == 0 ) )
         {
-            // Envoi d'un fichier
-            case CMD_PUT:
-                putFile( client, arg );
-                break;
-
-            // Recuperation d'un fichier
-            case CMD_GET:
-                getFile( client, arg );
-                break;
-
-            // Aide en ligne
-            case CMD_HELP:
-                printHelp();
-                break;
-
-            // Fin de session
-            case CMD_EXIT:
-                loop = 0;
-                fprintf( stdout, "bye!\n" );
-                break;
+            fprintf( stderr, "ERREUR - Transfert en flux possible uniquement avec --exec\n" );
+            continue;
         }
+
+        // Execution (fin de session sur exit)
+        runCommand( client, cmd, args, argCount );
+        if( cmd == CMD_EXIT ) loop = 0;
     }
 }
 
 
-void CLIENT_MultiRun( Client* client )
+int CLIENT_exec( Client* client, const char* commands )
 {
-    srand( time( NULL ) );
-
-    // Boucle d'interactivite avec le client
-    int loop = 3;
-    while( loop )
+    // Commandes separees par des ';', executees dans l'ordre jusqu'a exit
+    int failed = 0;
+    const char* start = commands;
+    while( *start != '\0' )
     {
-        // On recupere la commande a utilise et le fichier
-        int cmd = rand() % 2;
-        int iarg = rand() % 3;
-
-        int facteur = ( rand() % 3 ) + 1;
-        struct timespec delai;
-        delai.tv_sec = 0;                     // Pas d'attente en secondes
-        delai.tv_nsec = facteur * 100000000;  // Attente en microsecondes
-
-        nanosleep (&delai, NULL );
-
-        // Fichier a traiter
-        char arg[WORD_SIZE];
-
-        // Selon la valeur de iarg le fichier a traiter est
-        switch ( iarg )
-        {
-            case 0:
-                strcpy( arg, "lofoten.jpg" );
-                break;
-
-            case 1:
-                strcpy( arg, "test.txt" );
-                break;
-
-            case 2:
-                strcpy( arg, "smallFile.txt" );
-                break;
-
-            default:
-                fprintf( stderr, "Erreur - echec lors du choix de la commande" );
-                break;
-        }
+        const char* end = strchr( start, ';' );
+        const size_t length = end != NULL ? (size_t)( end - start ) : strlen( start );
+        char buff[BUFF_SIZE];
+        snprintf( buff, sizeof( buff ), "%.*s", (int)length, start );
+        start += end != NULL ? length + 1 : length;
 
-        // Selon la commande
-        switch( cmd )
-        {
-            // Envoi d'un fichier
-            case CMD_PUT:
-                putFile( client, arg );
-                --loop;
-                break;
+        // Ligne vide ignoree, commande invalide comptee en echec
+        if( strspn( buff, " " ) == strlen( buff ) ) continue;
+        int cmd = CMD_NONE;
+        char args[MAX_ARGS][WORD_SIZE];
+        size_t argCount = 0;
+        if( parseCmdLine( buff, &cmd, args, &argCount ) != 0 || runCommand( client, cmd, args, argCount ) != 0 )
+            ++failed;
+        if( cmd == CMD_EXIT ) break;
+    }
 
-            // Recuperation d'un fichier
-            case CMD_GET:
-                getFile( client, arg );
-                --loop;
-                break;
+    return( failed );
+}
 
-            // Aide en ligne
-            case CMD_HELP:
-                printHelp();
-                break;
 
-            // Fin de session
-            case CMD_EXIT:
-                loop = 0;
-                fprintf( stdout, "bye!\n" );
-                break;
-        }
+int CLIENT_runManifest( Client* client, const char* manifest, const char* report )
+{
+    // Transferts du manifeste (aucun n'est lance s'il est invalide)
+    BatchItem* items = NULL;
+    size_t count = 0;
+    if( BATCH_loadManifest( manifest, &items, &count ) != 0 ) return( -1 );
+
+    int64_t duration = 0;
+    const size_t failed = BATCH_run( client->toSrv, items, count, &duration );
+
+    // Bilan lisible, et rapport JSON dans le fichier specifie ou en derniere ligne de la sortie standard
+    BATCH_printSummary( stdout, items, count, duration );
+    FILE* out = report != NULL ? fopen( report, "w" ) : stdout;
+    if( out == NULL ) fprintf( stderr, "ERREUR - Impossible d'ouvrir le rapport : %s\n", report );
+    else
+    {
+        BATCH_writeReport( out, items, count, duration );
+        if( out != stdout ) fclose( out );
     }
+    free( items );
+
+    return( (int)failed );
 }
 
 
@@ -249,95 +275,169 @@ void CLIENT_destroy( Client* client )
 
 //--- Fonctions locales ---------------------------------------------------------------------------------------
 
-int putFile( Client* client, char* filePath )
+static int runCommand( Client* client, int cmd, char args[][WORD_SIZE], size_t argCount )
 {
-    // Verification que le fichier est accessible en lecture
-    if( access( filePath, R_OK ) != 0 )
+    // Selon la commande
+    switch( cmd )
     {
-        fprintf( stderr, "Fichier inconnu : %s\n", filePath );
-        return( 1 );
-    }
+        // Envoi d'un fichier
+        case CMD_PUT:
+            return( putFile( client, args[0], argCount > 1 ? args[1] : NULL ) );
 
-    // Envoi du paquet WRQ
-    if( TFTP_sendXrqPacket( client->sock, TFTP_WRQ, filePath, client->toSrv ) != 0 ) return( 1 );
+        // Recuperation d'un fichier
+        case CMD_GET:
+            return( getFile( client, args[0], argCount > 1 ? args[1] : NULL ) );
 
-    // Attente de la reponse (ACK ou ERROR), et recuperation de l'adresse qu'il faudra utiliser pour le transfert
-    Addr* from = ADDR_create();
-    Packet* response = TFTP_recvPacket( client->sock, from );
-    if( response == NULL  || response == TIMEOUT)
-    {
-        ADDR_destroy( from );
-        return( 2 );
-    }
+        // Recuperation d'un fichier diffuse en multicast
+        case CMD_MCGET:
+            return( getFileMulticast( client, args[0] ) );
 
-    // Valeur retournee
-    int status = 0;
+        // Recuperation de plusieurs fichiers
+        case CMD_MGET:
+            return( transferFiles( client, BATCH_GET, args, argCount ) );
 
-    // Selon le code de la reponse
-    switch( response->code )
-    {
-        // ACK
-        case TFTP_ACK:
-            // Envoi du fichier
-            status = TFTP_sendFileToEndpoint( client->sock, filePath, from );
-            if( status == 0 )
-            {
-                fprintf( stdout, "OK - Fichier envoyé : %s\n", filePath );
-            }
-            break;
+        // Envoi de plusieurs fichiers
+        case CMD_MPUT:
+            return( transferFiles( client, BATCH_PUT, args, argCount ) );
 
-        // ERROR
-        case TFTP_ERROR:
-        {
-            // Affichage de l'erreur
-            ErrorPacket* err = (ErrorPacket*)response->data;
-            fprintf( stderr, "ERREUR - code = %u, msg = %s\n", err->errorCode, err->errorMsg );
-            status = 4;
+        // Aide en ligne
+        case CMD_HELP:
+            printHelp();
             break;
-        }
-        break;
 
-        // Code imprevu
-        default:
-            fprintf( stderr, "ERREUR - Réception d'un paquet non-prévu: code = %u\n", response->code );
-            status = 5;
+        // Fin de session
+        case CMD_EXIT:
+            fprintf( stdout, "bye!\n" );
             break;
     }
 
-    // Liberation memoire
-    PACKET_destroy( response );
-    ADDR_destroy( from );
+    return( 0 );
+}
 
-    return( status );
+
+int putFile( Client* client, char* filePath, const char* remoteName )
+{
+    // Entree standard : nom distant obligatoire
+    const int streamed = strcmp( filePath, STD_STREAM ) == 0;
+    if( remoteName == NULL ) remoteName = filePath;
+    if( streamed && remoteName == filePath )
+    {
+        fprintf( stderr, "ERREUR - Nom distant requis pour un envoi depuis l'entrée standard\n" );
+        return( 1 );
+    }
+
+    // Ouverture du fichier a envoyer
+    FILE* file = streamed ? stdin : fopen( filePath, "rb" );
+    if( file == NULL )
+    {
+        fprintf( stderr, "Fichier inconnu : %s\n", filePath );
+        return( 1 );
+    }
+
+    // Envoi par le moteur de transfert (options negociees si le serveur les accepte)
+    XferResult result;
+    const int status = XFER_put( client->sock, client->toSrv, remoteName, file, NULL, &result );
+    if( ! streamed ) fclose( file );
+    if( status != 0 ) return( 2 );
+
+    fprintf( stdout, "OK - Fichier envoyé : %s\n", remoteName );
+    XFER_printResult( stdout, remoteName, &result );
+
+    return( 0 );
 }
 
 
-int getFile( Client* client, char* filePath )
+int getFile( Client* client, char* filePath, const char* localName )
 {
     // Construction du path du fichier local
     char fileName[FILENAME_SIZE];
-    char* lastSlash = strrchr( filePath, '/' );
-    if( lastSlash != NULL )
+    if( localName != NULL ) snprintf( fileName, sizeof( fileName ), "%s", localName );
+    else getLocalFileName( filePath, fileName );
+
+    // Sortie standard : reception dans l'ordre, sans reprise, la sortie ne porte que les donnees
+    XferResult result;
+    if( strcmp( fileName, STD_STREAM ) == 0 )
     {
-        // Copie de la fin du path (apres le dernier '/')
-        strcpy( fileName, lastSlash + 1 );
+        const int status = XFER_get( client->sock, client->toSrv, filePath, stdout, NULL, &result );
+        if( fflush( stdout ) != 0 )
+        {
+            fprintf( stderr, "ERREUR - Echec d'écriture sur la sortie standard\n" );
+            return( 2 );
+        }
+        if( status != 0 ) return( 2 );
+
+        fprintf( stderr, "OK - Fichier copié : %s\n", filePath );
+        XFER_printResult( stderr, filePath, &result );
+        return( 0 );
     }
-    else
+
+    // Reception par le moteur de transfert, par segments simultanes si demande (sinon, fichier partiel conserve
+    // pour une reprise apres un echec transitoire)
+    const int status = SEGMENT_getCount() > 1
+                       ? SEGMENT_get( client->sock, client->toSrv, filePath, fileName, NULL, &result )
+                       : RESUME_get( client->sock, client->toSrv, filePath, fileName, NULL, &result );
+    if( status != 0 ) return( 2 );
+
+    fprintf( stdout, "OK - Fichier copié : %s\n", fileName );
+    XFER_printResult( stdout, fileName, &result );
+
+    return( 0 );
+}
+
+
+static int transferFiles( Client* client, int direction, char args[][WORD_SIZE], size_t argCount )
+{
+    // Un transfert par argument : nom distant et fichier local
+    BatchItem* items = (BatchItem*)calloc( argCount, sizeof( BatchItem ) );
+    if( items == NULL ) return( 1 );
+    for( size_t i = 0; i < argCount; ++i )
     {
-        // Copie du path entier (qui ne contient pas de '/' )
-        strcpy( fileName, filePath );
+        if( strlen( args[i] ) >= FILENAME_SIZE )
+        {
+            fprintf( stderr, "ERREUR - Nom de fichier trop long : %s\n", args[i] );
+            free( items );
+            return( 2 );
+        }
+        items[i].direction = direction;
+        XFER_initOptions( &items[i].options );
+        strcpy( items[i].remote, args[i] );
+        if( direction == BATCH_GET ) getLocalFileName( args[i], items[i].local );
+        else strcpy( items[i].local, args[i] );
     }
 
-    // Ouverture du fichier local
-    FILE* file = fopen( fileName, "wb" );
+    // Transferts simultanes, puis bilan
+    int64_t duration = 0;
+    const size_t failed = BATCH_run( client->toSrv, items, argCount, &duration );
+    BATCH_printSummary( stdout, items, argCount, duration );
+    free( items );
+
+    return( failed != 0 ? 3 : 0 );
+}
+
+
+static int getFileMulticast( Client* client, char* filePath )
+{
+    // Ouverture du fichier local (les blocs d'un client tardif arrivent dans le desordre)
+    char fileName[FILENAME_SIZE];
+    getLocalFileName( filePath, fileName );
+    FILE* file = fopen( fileName, "wb+" );
     if( file == NULL )
     {
         fprintf( stderr, "ERREUR - Impossible d'ouvrir le fichier local: %s\n", fileName );
         return( 1 );
     }
 
-    // Envoi du paquet RRQ
-    if( TFTP_sendXrqPacket( client->sock, TFTP_RRQ, filePath, client->toSrv ) != 0 )
+    // Envoi du paquet RRQ avec l'option multicast, et tsize pour connaitre le nombre de blocs (empreinte
+    // verifiee en cas de repli en unicast)
+    XferOptions defaults;
+    XFER_initOptions( &defaults );
+    Option options[3];
+    size_t optionCount = 0;
+    PACKET_addOption( options, &optionCount, "multicast", "" );
+    PACKET_addOption( options, &optionCount, "tsize", "0" );
+    if( defaults.checksum != DIGEST_NONE )
+        PACKET_addOption( options, &optionCount, "checksum", DIGEST_name( defaults.checksum ) );
+    if( TFTP_sendXrqPacket( client->sock, TFTP_RRQ, filePath, options, optionCount, client->toSrv ) != 0 )
     {
         fclose( file );
         unlink( fileName );
@@ -347,81 +447,353 @@ int getFile( Client* client, char* filePath )
     // Adresse renvoyee par le serveur pour la duree du transfert
     Addr* from = ADDR_create();
 
-    // Boucle de reception des paquets de reponse
-    int status = RECV_FILE_IN_PROGRESS;
+    // Premiere reponse : OACK si le serveur accepte des options, DATA sinon
+    int status = RECV_FILE_ERROR;
     uint16_t lastBlock = 0;
+    DigestCheck digest;
+    memset( &digest, 0, sizeof( digest ) );
+    Reorder* reorder = REORDER_create( DATA_SIZE, REORDER_DEFAULT_BLOCKS );
+    Packet* response = reorder != NULL ? TFTP_recvPacket( client->sock, from ) : NULL;
+    if( response != NULL && response != TIMEOUT )
+    {
+        const OackPacket* oack = (const OackPacket*)response->data;
+        if( response->code == TFTP_OACK
+            && PACKET_getOption( oack->options, oack->optionCount, "multicast" ) != NULL )
+        {
+            // Diffusion multicast
+            status = recvMulticast( client, file, oack, from );
+        }
+        else if( response->code == TFTP_OACK )
+        {
+            // Options acceptees sans le multicast : transfert unicast apres l'ACK 0, empreinte annoncee
+            const char* value = PACKET_getOption( oack->options, oack->optionCount, "checksum" );
+            if( value != NULL && ( DIGEST_start( &digest, value ) != 0 || digest.expected.algorithm != defaults.checksum ) )
+            {
+                fprintf( stderr, "ERREUR - Option checksum invalide : %s\n", value );
+                TFTP_sendErrorPacket( client->sock, ERR_OPTION_REFUSED, "Option checksum invalide", from );
+            }
+            else if( TFTP_sendAckPacket( client->sock, 0, from ) == 0 ) status = RECV_FILE_IN_PROGRESS;
+        }
+        else
+        {
+            // Option ignoree : le premier paquet DATA est deja la
+            status = handleFileChunk( client, file, reorder, &digest, response, &lastBlock, from );
+        }
+        PACKET_destroy( response );
+    }
+
+    // Suite d'un transfert unicast
     while( status == RECV_FILE_IN_PROGRESS )
+        status = recvNextFileChunk( client, file, reorder, &digest, &lastBlock, from );
+
+    // Fermeture du fichier (supprime en cas d'erreur)
+    fclose( file );
+    if( status == RECV_FILE_COMPLETE ) fprintf( stdout, "OK - Fichier copié : %s\n", fileName );
+    else unlink( fileName );
+
+    // Liberation memoire
+    REORDER_destroy( reorder );
+    ADDR_destroy( from );
+
+    return( status == RECV_FILE_COMPLETE ? 0 : 3 );
+}
+
+
+static int recvMulticast( Client* client, FILE* file, const OackPacket* oack, const Addr* server )
+{
+    // Groupe et role du client
+    char host[ADDR_SIZE] = "";
+    uint16_t port = 0;
+    int master = 0;
+    const char* value = PACKET_getOption( oack->options, oack->optionCount, "multicast" );
+    if( parseMulticastOption( value, host, &port, &master ) != 0 || host[0] == '\0' || port == 0 )
+    {
+        fprintf( stderr, "ERREUR - Option multicast invalide : %s\n", value );
+        TFTP_sendErrorPacket( client->sock, ERR_UNDEFINED, "Option multicast invalide", server );
+        return( RECV_FILE_ERROR );
+    }
+
+    // Nombre de blocs du fichier (le dernier peut etre vide)
+    const char* tsize = PACKET_getOption( oack->options, oack->optionCount, "tsize" );
+    const long long size = tsize != NULL ? atoll( tsize ) : -1;
+    if( size < 0 || size / DATA_SIZE + 1 > UINT16_MAX )
+    {
+        fprintf( stderr, "ERREUR - Taille du fichier absente ou invalide\n" );
+        TFTP_sendErrorPacket( client->sock, ERR_UNDEFINED, "Option tsize invalide", server );
+        return( RECV_FILE_ERROR );
+    }
+    const uint16_t nbBlocks = (uint16_t)( size / DATA_SIZE + 1 );
+
+    // Adhesion au groupe
+    Addr* groupAddr = ADDR_createRemote( host, port );
+    Sock* group = groupAddr != NULL ? SOCK_createMulticast( groupAddr, client->sock ) : NULL;
+    ADDR_destroy( groupAddr );
+    if( group == NULL )
     {
-        // Reception du paquet suivant
-        status = recvNextFileChunk( client, file, &lastBlock, from );
+        TFTP_sendErrorPacket( client->sock, ERR_UNDEFINED, "Groupe multicast inaccessible", server );
+        return( RECV_FILE_ERROR );
+    }
+
+    // Blocs recus, nombre de blocs recus, et nombre de blocs recus sans trou depuis le debut
+    unsigned char* received = (unsigned char*)calloc( (size_t)nbBlocks + 1, 1 );
+    uint16_t count = 0;
+    uint16_t contiguous = 0;
+
+    // Maitre des l'ouverture : demande du premier bloc manquant
+    if( master ) TFTP_sendAckPacket( client->sock, contiguous, server );
 
-        // Si transfer termine
-        if( status == RECV_FILE_COMPLETE )
+    // Boucle de reception (groupe et socket unicast, sur laquelle arrivent les changements de role)
+    int status = RECV_FILE_IN_PROGRESS;
+    int serverError = 0;
+    int idle = 0;
+    Addr* src = ADDR_create();
+    while( status == RECV_FILE_IN_PROGRESS )
+    {
+        fd_set fds;
+        FD_ZERO( &fds );
+        FD_SET( group->fd, &fds );
+        FD_SET( client->sock->fd, &fds );
+        struct timeval timeout;
+        timeout.tv_sec = MCAST_POLL_MS / 1000;
+        timeout.tv_usec = ( MCAST_POLL_MS % 1000 ) * 1000;
+        const int maxFd = group->fd > client->sock->fd ? group->fd : client->sock->fd;
+        const int ready = select( maxFd + 1, &fds, NULL, NULL, &timeout );
+        if( ready == -1 && errno == EINTR ) continue;
+        if( ready == -1 )
         {
-            // Fermeture du fichier
-            fclose( file );
-            fprintf( stdout, "OK - Fichier copié : %s\n", fileName );
+            status = RECV_FILE_ERROR;
             break;
         }
 
-        // Si transfer en erreur
-        else if( status == RECV_FILE_ERROR )
+        // Silence : le maitre redemande le bloc manquant, les autres attendent leur tour
+        if( ready == 0 )
         {
-            // Fermeture et suppression du fichier
-            fclose( file );
-            unlink( fileName );
-            break;
+            if( ++idle > MCAST_MAX_IDLE )
+            {
+                fprintf( stderr, "ERREUR - Diffusion multicast interrompue\n" );
+                status = RECV_FILE_ERROR;
+            }
+            else if( master ) TFTP_sendAckPacket( client->sock, contiguous, server );
+            continue;
+        }
+        idle = 0;
+
+        // Lecture des sockets pretes
+        Sock* socks[2] = { group, client->sock };
+        for( int i = 0; i < 2 && status == RECV_FILE_IN_PROGRESS; ++i )
+        {
+            if( ! FD_ISSET( socks[i]->fd, &fds ) ) continue;
+            Packet* packet = TFTP_recvPacket( socks[i], src );
+            if( packet == NULL || packet == TIMEOUT ) continue;
+
+            switch( packet->code )
+            {
+                // DATA : ecriture a la position du bloc s'il est nouveau
+                case TFTP_DATA:
+                {
+                    const DataPacket* data = (const DataPacket*)packet->data;
+                    if( data->blockNum == 0 || data->blockNum > nbBlocks || received[data->blockNum] ) break;
+                    if( fseeko( file, (off_t)( data->blockNum - 1 ) * DATA_SIZE, SEEK_SET ) != 0
+                        || fwrite( data->bytes, 1, data->bytesCount, file ) != data->bytesCount )
+                    {
+                        fprintf( stderr, "ERREUR - Echec d'écriture\n" );
+                        status = RECV_FILE_ERROR;
+                        break;
+                    }
+                    received[data->blockNum] = 1;
+                    ++count;
+
+                    // Le maitre acquitte sa progression : le serveur emet alors le bloc suivant
+                    const uint16_t previous = contiguous;
+                    while( contiguous < nbBlocks && received[contiguous + 1] ) ++contiguous;
+                    if( master && contiguous != previous && count < nbBlocks )
+                        TFTP_sendAckPacket( client->sock, contiguous, server );
+                }
+                break;
+
+                // OACK : changement de role (le nouveau maitre demande son premier bloc manquant)
+                case TFTP_OACK:
+                {
+                    const OackPacket* update = (const OackPacket*)packet->data;
+                    value = PACKET_getOption( update->options, update->optionCount, "multicast" );
+                    if( value != NULL && parseMulticastOption( value, host, &port, &master ) == 0 && master
+                        && count < nbBlocks )
+                        TFTP_sendAckPacket( client->sock, contiguous, server );
+                }
+                break;
+
+                // ERROR : abandon
+                case TFTP_ERROR:
+                {
+                    ErrorPacket* err = (ErrorPacket*)packet->data;
+                    fprintf( stderr, "ERREUR - code = %u, msg = %s\n", err->errorCode, err->errorMsg );
+                    status = RECV_FILE_ERROR;
+                    serverError = 1;
+                }
+                break;
+
+                // Autres paquets ignores
+                default:
+                    break;
+            }
+
+            PACKET_destroy( packet );
+        }
+
+        // Fichier complet : acquittement du dernier bloc (le serveur retire le client de la session)
+        if( status == RECV_FILE_IN_PROGRESS && count == nbBlocks )
+        {
+            TFTP_sendAckPacket( client->sock, nbBlocks, server );
+            status = RECV_FILE_COMPLETE;
         }
     }
 
-    // Liberation memoire
-    ADDR_destroy( from );
+    // Abandon : le serveur retire le client de la session
+    if( status == RECV_FILE_ERROR && ! serverError )
+        TFTP_sendErrorPacket( client->sock, ERR_UNDEFINED, "Abandon du transfert", server );
+
+    // Liberation memoire (la fermeture de la socket quitte le groupe)
+    ADDR_destroy( src );
+    free( received );
+    SOCK_destroy( group );
+
+    return( status );
+}
+
+
+static int parseMulticastOption( const char* value, char* host, uint16_t* port, int* master )
+{
+    // Trois champs separes par des virgules
+    const char* comma1 = strchr( value, ',' );
+    const char* comma2 = comma1 != NULL ? strchr( comma1 + 1, ',' ) : NULL;
+    if( comma2 == NULL ) return( 1 );
+
+    // Adresse et port (absents si inchanges)
+    const size_t hostLength = (size_t)( comma1 - value );
+    if( hostLength >= ADDR_SIZE ) return( 1 );
+    if( hostLength > 0 )
+    {
+        memcpy( host, value, hostLength );
+        host[hostLength] = '\0';
+    }
+    if( comma2 != comma1 + 1 ) *port = (uint16_t)atoi( comma1 + 1 );
+
+    // Role du client
+    *master = atoi( comma2 + 1 ) == 1;
 
     return( 0 );
 }
 
 
-static int recvNextFileChunk( Client* client, FILE* file, uint16_t* lastBlock, Addr* from )
+static void getLocalFileName( const char* filePath, char* fileName )
 {
-    // Code de retour
-    int status = RECV_FILE_IN_PROGRESS;
+    const char* lastSlash = strrchr( filePath, '/' );
+    if( lastSlash != NULL )
+    {
+        // Copie de la fin du path (apres le dernier '/')
+        strcpy( fileName, lastSlash + 1 );
+    }
+    else
+    {
+        // Copie du path entier (qui ne contient pas de '/' )
+        strcpy( fileName, filePath );
+    }
+}
+
 
+static int recvNextFileChunk( Client* client, FILE* file, Reorder* reorder, DigestCheck* digest, uint16_t* lastBlock,
+                              Addr* from )
+{
     // Attente de la reponse (DATA ou ERROR)
     Packet* response = TFTP_recvPacket( client->sock, from );
     if( response == NULL || response == TIMEOUT) return( RECV_FILE_ERROR );
 
+    // Traitement de la reponse
+    const int status = handleFileChunk( client, file, reorder, digest, response, lastBlock, from );
+
+    // Liberation memoire
+    PACKET_destroy( response );
+
+    return( status );
+}
+
+
+static int handleFileChunk( Client* client, FILE* file, Reorder* reorder, DigestCheck* digest, Packet* response,
+                            uint16_t* lastBlock, const Addr* from )
+{
+    // Code de retour
+    int status = RECV_FILE_IN_PROGRESS;
+
     // Selon le code de la reponse
     switch( response->code )
     {
         // DATA
         case TFTP_DATA:
         {
-            // Paquet DATA
+            // Paquet DATA, position par rapport au bloc attendu (numeros sur 16 bits)
             DataPacket* packet = (DataPacket*)response->data;
+            const uint16_t ahead = (uint16_t)( packet->blockNum - *lastBlock - 1 );
 
-            // Envoi de l'ACK (a l'adresse d'ou provient le paquet DATA)
-            if( TFTP_sendAckPacket( client->sock, packet->blockNum, from ) != 0 )
+            // Bloc en avance : conserve jusqu'a la reception des blocs manquants, sans ACK
+            if( ahead != 0 && ahead < REORDER_HALF_RANGE )
             {
-                status = RECV_FILE_ERROR;
+                REORDER_hold( reorder, (uint16_t)( *lastBlock + 1 ), packet->blockNum, packet->bytes,
+                              packet->bytesCount );
                 break;
             }
 
-            // Si code bloc different du precedent
-            if( packet->blockNum  != *lastBlock )
+            // Bloc attendu : copie des donnees dans le fichier local, puis des blocs conserves qui suivent (un
+            // doublon est seulement acquitte)
+            const unsigned char* bytes = ahead == 0 ? packet->bytes : NULL;
+            size_t bytesCount = packet->bytesCount;
+            while( bytes != NULL )
             {
-                // Copie des donnees du paquet dans le fichier local
-                fwrite( packet->bytes, packet->bytesCount, 1, file );
+                if( fwrite( bytes, 1, bytesCount, file ) != bytesCount )
+                {
+                    fprintf( stderr, "ERREUR - Echec d'écriture du fichier local\n" );
+                    status = RECV_FILE_ERROR;
+                    break;
+                }
+                DIGEST_update( digest, bytes, bytesCount );
+                ++*lastBlock;
+
+                // Si le paquet a une taille inferieure a DATA_SIZE : il s'agit du dernier paquet DATA
+                if( bytesCount < DATA_SIZE )
+                {
+                    status = RECV_FILE_COMPLETE;
+                    break;
+                }
+                bytes = REORDER_take( reorder, (uint16_t)( *lastBlock + 1 ), &bytesCount );
+            }
+            if( status == RECV_FILE_ERROR ) break;
 
-                // Mise a jour dernier bloc recu
-                *lastBlock = packet->blockNum;
+            // Fichier complet dont l'empreinte differe de celle annoncee : ERROR a la place du dernier ACK
+            if( status == RECV_FILE_COMPLETE && DIGEST_verify( digest ) != 0 )
+            {
+                fprintf( stderr, "ERREUR - Empreinte %s %s\n", DIGEST_name( digest->expected.algorithm ),
+                         digest->pending ? "non reçue" : "invalide" );
+                TFTP_sendErrorPacket( client->sock, ERR_UNDEFINED, "Empreinte invalide", from );
+                status = RECV_FILE_ERROR;
+                break;
             }
 
-            // Si le paquet a une taille inferieure a DATA_SIZE
-            if( packet->bytesCount < DATA_SIZE )
+            // Envoi de l'ACK du dernier bloc recu dans l'ordre (a l'adresse d'ou provient le paquet DATA)
+            if( TFTP_sendAckPacket( client->sock, *lastBlock, from ) != 0 ) status = RECV_FILE_ERROR;
+        }
+        break;
+
+        // OACK : empreinte calculee par le serveur au fil de l'envoi, acquittee par l'ACK du dernier bloc recu
+        case TFTP_OACK:
+        {
+            const OackPacket* oack = (const OackPacket*)response->data;
+            const char* value = PACKET_getOption( oack->options, oack->optionCount, "checksum" );
+            if( value == NULL || DIGEST_complete( digest, value ) != 0 )
             {
-                // Il s'agit du dernier paquet DATA
-                status = RECV_FILE_COMPLETE;
+                fprintf( stderr, "ERREUR - Option checksum invalide : %s\n", value != NULL ? value : "" );
+                TFTP_sendErrorPacket( client->sock, ERR_OPTION_REFUSED, "Option checksum invalide", from );
+                status = RECV_FILE_ERROR;
             }
+            else if( TFTP_sendAckPacket( client->sock, *lastBlock, from ) != 0 ) status = RECV_FILE_ERROR;
         }
         break;
 
@@ -442,14 +814,11 @@ static int recvNextFileChunk( Client* client, FILE* file, uint16_t* lastBlock, A
             break;
     }
 
-    // Liberation memoire
-    PACKET_destroy( response );
-
     return( status );
 }
 
 
-static int parseCmdLine( char* buff, int* cmd, char* arg )
+static int parseCmdLine( char* buff, int* cmd, char args[][WORD_SIZE], size_t* argCount )
 {
     // Initialisation du parsing
     char* token = strtok( buff, " " );
@@ -475,32 +844,49 @@ static int parseCmdLine( char* buff, int* cmd, char* arg )
     char sCmd[WORD_SIZE];
     strcpy( sCmd, token );
 
-    // Selon la commande
+    // Nombre d'arguments attendus selon la commande
+    size_t minArgs = 0;
+    size_t maxArgs = 0;
     switch( *cmd )
     {
-        // Argument attendu pour les commandes ci-dessous
+        // Un argument, et le nom distant (put) ou local (get)
         case CMD_PUT:
         case CMD_GET:
-            // Extraction et controle de l'argument
-            token = strtok( NULL, " " );
-            if( token == NULL )
-            {
-                fprintf( stderr, "ERREUR - La commande '%s' requiert un argument\n", sCmd );
-                fprintf( stderr, "Taper 'help' pour l'aide en ligne\n" );
-                return( 3 );
-            }
-            else
-            {
-                // Copie de l'argument
-                strcpy( arg, token );
-            }
+            minArgs = 1;
+            maxArgs = 2;
+            break;
+
+        // Un argument
+        case CMD_MCGET:
+            minArgs = maxArgs = 1;
             break;
 
-        // Parsing termine
+        // Un ou plusieurs arguments
+        case CMD_MGET:
+        case CMD_MPUT:
+            minArgs = 1;
+            maxArgs = MAX_ARGS;
+            break;
+
+        // Pas d'argument
         default:
             break;
     }
 
+    // Extraction des arguments
+    *argCount = 0;
+    while( *argCount < maxArgs && ( token = strtok( NULL, " " ) ) != NULL )
+    {
+        snprintf( args[*argCount], WORD_SIZE, "%s", token );
+        ++*argCount;
+    }
+    if( *argCount < minArgs )
+    {
+        fprintf( stderr, "ERREUR - La commande '%s' requiert un argument\n", sCmd );
+        fprintf( stderr, "Taper 'help' pour l'aide en ligne\n" );
+        return( 3 );
+    }
+
     // Controle arguments superflus
     if( strtok( NULL, " " ) != NULL )
     {
@@ -534,8 +920,11 @@ static void printHelp()
 {
     fprintf( stdout, "Utilisation : CMD [ARG]\n\n" );
     fprintf( stdout, "Commandes supportées :\n" );
-    fprintf( stdout, "- put FILE: upload d'un fichier vers le serveur\n" );
-    fprintf( stdout, "- get FILE: download d'un fichier depuis le serveur\n" );
+    fprintf( stdout, "- put FILE [REMOTE]: upload d'un fichier vers le serveur (FILE '-' : entrée standard)\n" );
+    fprintf( stdout, "- get FILE [LOCAL]: download d'un fichier depuis le serveur (LOCAL '-' : sortie standard)\n" );
+    fprintf( stdout, "- mcget FILE: download d'un fichier diffusé en multicast (unicast si refusé)\n" );
+    fprintf( stdout, "- mget FILE...: download de plusieurs fichiers en parallèle\n" );
+    fprintf( stdout, "- mput FILE...: upload de plusieurs fichiers en parallèle\n" );
     fprintf( stdout, "- help: affiche ce message\n" );
     fprintf( stdout, "- exit: termine la session TFTP\n" );
 }
@@ -0,0 +1,542 @@
+#include "tftp/digest.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined( __x86_64__ )
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+
+// Polynome du CRC-32C, bits inverses
+#define CRC32C_POLY 0x82F63B78
+
+// Octets traites par chacun des trois CRC calcules en parallele (SSE4.2 et PCLMUL)
+#define CRC_STRIDE 4096
+
+// Taille d'un bloc SHA-256
+#define SHA256_BLOCK_SIZE 64
+
+// Noms des algorithmes (dans l'ordre de l'enum)
+static const char* NAMES[DIGEST_COUNT] = { "none", "crc32c", "sha256" };
+
+// Constantes des tours de SHA-256
+static const uint32_t SHA256_K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Etat initial de SHA-256
+static const uint32_t SHA256_INIT[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// Tables du CRC par octet (slicing-by-8 : table k pour l'octet situe k octets avant la fin du mot)
+static uint32_t crcTables[8][256];
+
+// Constantes de decalage d'un CRC de CRC_STRIDE et 2 * CRC_STRIDE octets (multiplication sans retenue)
+static uint32_t crcShift1;
+static uint32_t crcShift2;
+
+// Implementations retenues (initialisees au premier calcul)
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+static int accelerated = 1;
+static uint32_t (*crcUpdate)( uint32_t crc, const unsigned char* data, size_t size );
+static void (*sha256Blocks)( uint32_t state[8], const unsigned char* data, size_t blocks );
+static const char* crcEngine = "scalar";
+static const char* sha256Engine = "scalar";
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Construction des tables, choix des implementations selon le processeur
+ *
+ */
+static void init();
+
+/** Choix des implementations (portables si accelerated vaut 0)
+ *
+ */
+static void selectEngines();
+
+/** x^( 8 * bytes - 33 ) modulo le polynome du CRC (bits inverses) : le produit sans retenue d'un CRC par cette
+ *  constante, reduit par l'instruction crc32, decale le CRC de bytes octets nuls
+ */
+static uint32_t crcShiftConstant( size_t bytes );
+
+/** CRC-32C sans inversion, 8 octets par iteration (slicing-by-8)
+ *
+ */
+static uint32_t crcScalar( uint32_t crc, const unsigned char* data, size_t size );
+
+/** Blocs de 64 octets de SHA-256
+ *
+ */
+static void sha256Scalar( uint32_t state[8], const unsigned char* data, size_t blocks );
+
+#if defined( __x86_64__ )
+/** CRC-32C sans inversion par l'instruction crc32 (SSE4.2)
+ *
+ */
+static uint32_t crcSse42( uint32_t crc, const unsigned char* data, size_t size );
+
+/** CRC-32C sans inversion, trois CRC independants par bloc de 3 * CRC_STRIDE octets (latence de l'instruction
+ *  crc32 masquee), recombines par multiplication sans retenue (PCLMUL)
+ */
+static uint32_t crcPclmul( uint32_t crc, const unsigned char* data, size_t size );
+
+/** Blocs de 64 octets de SHA-256 par les extensions SHA
+ *
+ */
+static void sha256Shani( uint32_t state[8], const unsigned char* data, size_t blocks );
+#endif
+
+/** Entier de 32 bits big-endian
+ *
+ */
+static uint32_t readBigEndian32( const unsigned char* bytes );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+int DIGEST_parse( const char* name )
+{
+    for( int i = 0; i < DIGEST_COUNT; ++i )
+    {
+        if( strcmp( name, NAMES[i] ) == 0 ) return( i );
+    }
+
+    return( -1 );
+}
+
+
+const char* DIGEST_name( int algorithm )
+{
+    return( algorithm >= 0 && algorithm < DIGEST_COUNT ? NAMES[algorithm] : "?" );
+}
+
+
+size_t DIGEST_size( int algorithm )
+{
+    return( algorithm == DIGEST_CRC32C ? 4 : algorithm == DIGEST_SHA256 ? 32 : 0 );
+}
+
+
+const char* DIGEST_engine( int algorithm )
+{
+    pthread_once( &initOnce, init );
+
+    return( algorithm == DIGEST_CRC32C ? crcEngine : algorithm == DIGEST_SHA256 ? sha256Engine : "-" );
+}
+
+
+void DIGEST_setAccelerated( int enabled )
+{
+    pthread_once( &initOnce, init );
+    accelerated = enabled;
+    selectEngines();
+}
+
+
+uint32_t DIGEST_crc32c( uint32_t crc, const void* data, size_t size )
+{
+    pthread_once( &initOnce, init );
+
+    return( ~crcUpdate( ~crc, (const unsigned char*)data, size ) );
+}
+
+
+void DIGEST_init( DigestContext* context, int algorithm )
+{
+    pthread_once( &initOnce, init );
+    memset( context, 0, sizeof( *context ) );
+    context->algorithm = algorithm;
+    memcpy( context->state, SHA256_INIT, sizeof( SHA256_INIT ) );
+}
+
+
+void DIGEST_add( DigestContext* context, const void* data, size_t size )
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    if( context->algorithm == DIGEST_CRC32C )
+    {
+        context->crc = ~crcUpdate( ~context->crc, bytes, size );
+        return;
+    }
+    if( context->algorithm != DIGEST_SHA256 ) return;
+
+    // Bloc incomplet d'un appel precedent, puis blocs entiers traites sans copie
+    context->length += size;
+    if( context->used > 0 )
+    {
+        const size_t count = size < SHA256_BLOCK_SIZE - context->used ? size : SHA256_BLOCK_SIZE - context->used;
+        memcpy( context->block + context->used, bytes, count );
+        context->used += count;
+        bytes += count;
+        size -= count;
+        if( context->used < SHA256_BLOCK_SIZE ) return;
+        sha256Blocks( context->state, context->block, 1 );
+        context->used = 0;
+    }
+    sha256Blocks( context->state, bytes, size / SHA256_BLOCK_SIZE );
+    context->used = size % SHA256_BLOCK_SIZE;
+    memcpy( context->block, bytes + size - context->used, context->used );
+}
+
+
+void DIGEST_final( DigestContext* context, Digest* digest )
+{
+    memset( digest, 0, sizeof( *digest ) );
+    digest->algorithm = context->algorithm;
+    if( context->algorithm == DIGEST_CRC32C )
+    {
+        for( int i = 0; i < 4; ++i ) digest->bytes[i] = (unsigned char)( context->crc >> ( 24 - 8 * i ) );
+        return;
+    }
+    if( context->algorithm != DIGEST_SHA256 ) return;
+
+    // Bourrage : 0x80, zeros, longueur en bits (big-endian) dans les 8 derniers octets du dernier bloc
+    const uint64_t bits = context->length * 8;
+    unsigned char padding[2 * SHA256_BLOCK_SIZE];
+    const size_t count = ( context->used < 56 ? 64 : 128 ) - context->used;
+    memset( padding, 0, sizeof( padding ) );
+    padding[0] = 0x80;
+    for( int i = 0; i < 8; ++i ) padding[count - 1 - i] = (unsigned char)( bits >> ( 8 * i ) );
+    DIGEST_add( context, padding, count );
+    for( int i = 0; i < 32; ++i ) digest->bytes[i] = (unsigned char)( context->state[i / 4] >> ( 24 - 8 * ( i % 4 ) ) );
+}
+
+
+int DIGEST_equals( const Digest* a, const Digest* b )
+{
+    return( a->algorithm == b->algorithm && memcmp( a->bytes, b->bytes, DIGEST_size( a->algorithm ) ) == 0 );
+}
+
+
+void DIGEST_format( const Digest* digest, char* value, size_t size )
+{
+    int length = snprintf( value, size, "%s:", DIGEST_name( digest->algorithm ) );
+    for( size_t i = 0; i < DIGEST_size( digest->algorithm ) && length > 0 && (size_t)length < size; ++i )
+        length += snprintf( value + length, size - (size_t)length, "%02x", digest->bytes[i] );
+}
+
+
+int DIGEST_start( DigestCheck* check, const char* value )
+{
+    memset( check, 0, sizeof( *check ) );
+
+    // Algorithme seul : empreinte envoyee apres les donnees
+    const char* separator = strchr( value, ':' );
+    if( separator == NULL )
+    {
+        const int algorithm = DIGEST_parse( value );
+        if( algorithm <= DIGEST_NONE ) return( 1 );
+        check->expected.algorithm = algorithm;
+        check->deferred = 1;
+        check->pending = 1;
+        DIGEST_init( &check->context, algorithm );
+        return( 0 );
+    }
+
+    // Algorithme, puis 2 chiffres hexadecimaux par octet
+    char name[16];
+    const size_t length = (size_t)( separator - value );
+    if( length >= sizeof( name ) ) return( 2 );
+    memcpy( name, value, length );
+    name[length] = '\0';
+    const int algorithm = DIGEST_parse( name );
+    const char* hex = separator + 1;
+    if( algorithm <= DIGEST_NONE || strlen( hex ) != 2 * DIGEST_size( algorithm )
+        || strspn( hex, "0123456789abcdefABCDEF" ) != strlen( hex ) )
+        return( 3 );
+
+    Digest* expected = &check->expected;
+    for( size_t i = 0; i < DIGEST_size( algorithm ); ++i )
+    {
+        const char pair[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+        expected->bytes[i] = (unsigned char)strtoul( pair, NULL, 16 );
+    }
+    expected->algorithm = algorithm;
+    DIGEST_init( &check->context, algorithm );
+
+    return( 0 );
+}
+
+
+int DIGEST_complete( DigestCheck* check, const char* value )
+{
+    DigestCheck announced;
+    if( ! check->deferred || DIGEST_start( &announced, value ) != 0
+        || announced.expected.algorithm != check->expected.algorithm )
+        return( 1 );
+
+    // OACK initial repete : algorithme seul
+    if( announced.deferred ) return( 0 );
+
+    // OACK repete : meme empreinte
+    if( ! check->pending ) return( ! DIGEST_equals( &announced.expected, &check->expected ) );
+
+    check->expected = announced.expected;
+    check->pending = 0;
+
+    return( 0 );
+}
+
+
+void DIGEST_update( DigestCheck* check, const void* data, size_t size )
+{
+    if( check->expected.algorithm != DIGEST_NONE ) DIGEST_add( &check->context, data, size );
+}
+
+
+int DIGEST_verify( DigestCheck* check )
+{
+    if( check->expected.algorithm == DIGEST_NONE ) return( 0 );
+    if( check->pending ) return( 1 );
+
+    Digest received;
+    DIGEST_final( &check->context, &received );
+
+    return( ! DIGEST_equals( &received, &check->expected ) );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void init()
+{
+    for( uint32_t i = 0; i < 256; ++i )
+    {
+        uint32_t crc = i;
+        for( int bit = 0; bit < 8; ++bit ) crc = ( crc & 1 ) ? ( crc >> 1 ) ^ CRC32C_POLY : crc >> 1;
+        crcTables[0][i] = crc;
+    }
+    for( int k = 1; k < 8; ++k )
+    {
+        for( int i = 0; i < 256; ++i )
+            crcTables[k][i] = ( crcTables[k - 1][i] >> 8 ) ^ crcTables[0][crcTables[k - 1][i] & 0xFF];
+    }
+    crcShift1 = crcShiftConstant( CRC_STRIDE );
+    crcShift2 = crcShiftConstant( 2 * CRC_STRIDE );
+
+    selectEngines();
+}
+
+
+static void selectEngines()
+{
+    crcUpdate = crcScalar;
+    crcEngine = "scalar";
+    sha256Blocks = sha256Scalar;
+    sha256Engine = "scalar";
+    if( ! accelerated ) return;
+
+#if defined( __x86_64__ )
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if( __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) == 0 ) return;
+    const int sse42 = ( ecx & bit_SSE4_2 ) != 0;
+    const int pclmul = ( ecx & bit_PCLMUL ) != 0;
+    const int sse41 = ( ecx & bit_SSE4_1 ) != 0 && ( ecx & bit_SSSE3 ) != 0;
+    const int sha = __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) != 0 && ( ebx & bit_SHA ) != 0;
+
+    if( sse42 && pclmul )
+    {
+        crcUpdate = crcPclmul;
+        crcEngine = "sse4.2+pclmul";
+    }
+    else if( sse42 )
+    {
+        crcUpdate = crcSse42;
+        crcEngine = "sse4.2";
+    }
+    if( sha && sse41 )
+    {
+        sha256Blocks = sha256Shani;
+        sha256Engine = "sha-ni";
+    }
+#endif
+}
+
+
+static uint32_t crcShiftConstant( size_t bytes )
+{
+    // Bits inverses : 0x80000000 represente 1, une multiplication par x est un decalage a droite
+    uint32_t value = 0x80000000;
+    for( size_t i = 0; i < 8 * bytes - 33; ++i ) value = ( value & 1 ) ? ( value >> 1 ) ^ CRC32C_POLY : value >> 1;
+
+    return( value );
+}
+
+
+static uint32_t crcScalar( uint32_t crc, const unsigned char* data, size_t size )
+{
+    while( size >= 8 )
+    {
+        const uint32_t low = crc ^ ( (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16
+                                     | (uint32_t)data[3] << 24 );
+        crc = crcTables[7][low & 0xFF] ^ crcTables[6][( low >> 8 ) & 0xFF] ^ crcTables[5][( low >> 16 ) & 0xFF]
+              ^ crcTables[4][low >> 24] ^ crcTables[3][data[4]] ^ crcTables[2][data[5]] ^ crcTables[1][data[6]]
+              ^ crcTables[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while( size-- > 0 ) crc = crcTables[0][( crc ^ *data++ ) & 0xFF] ^ ( crc >> 8 );
+
+    return( crc );
+}
+
+
+static void sha256Scalar( uint32_t state[8], const unsigned char* data, size_t blocks )
+{
+#define ROTR( x, n ) ( ( ( x ) >> ( n ) ) | ( ( x ) << ( 32 - ( n ) ) ) )
+    for( ; blocks > 0; --blocks, data += SHA256_BLOCK_SIZE )
+    {
+        uint32_t w[64];
+        for( int i = 0; i < 16; ++i ) w[i] = readBigEndian32( data + 4 * i );
+        for( int i = 16; i < 64; ++i )
+        {
+            const uint32_t s0 = ROTR( w[i - 15], 7 ) ^ ROTR( w[i - 15], 18 ) ^ ( w[i - 15] >> 3 );
+            const uint32_t s1 = ROTR( w[i - 2], 17 ) ^ ROTR( w[i - 2], 19 ) ^ ( w[i - 2] >> 10 );
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for( int i = 0; i < 64; ++i )
+        {
+            const uint32_t t1 = h + ( ROTR( e, 6 ) ^ ROTR( e, 11 ) ^ ROTR( e, 25 ) ) + ( ( e & f ) ^ ( ~e & g ) )
+                                + SHA256_K[i] + w[i];
+            const uint32_t t2 = ( ROTR( a, 2 ) ^ ROTR( a, 13 ) ^ ROTR( a, 22 ) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+#undef ROTR
+}
+
+
+#if defined( __x86_64__ )
+__attribute__(( target( "sse4.2" ) ))
+static uint32_t crcSse42( uint32_t crc, const unsigned char* data, size_t size )
+{
+    uint64_t crc64 = crc;
+    for( ; size >= 8; data += 8, size -= 8 )
+    {
+        uint64_t word;
+        memcpy( &word, data, sizeof( word ) );
+        crc64 = _mm_crc32_u64( crc64, word );
+    }
+    crc = (uint32_t)crc64;
+    while( size-- > 0 ) crc = _mm_crc32_u8( crc, *data++ );
+
+    return( crc );
+}
+
+
+__attribute__(( target( "sse4.2,pclmul" ) ))
+static uint32_t crcPclmul( uint32_t crc, const unsigned char* data, size_t size )
+{
+    const __m128i shifts = _mm_set_epi64x( crcShift1, crcShift2 );
+    for( ; size >= 3 * CRC_STRIDE; data += 3 * CRC_STRIDE, size -= 3 * CRC_STRIDE )
+    {
+        // Trois CRC independants sur trois tiers du bloc
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for( size_t i = 0; i < CRC_STRIDE; i += 8 )
+        {
+            uint64_t words[3];
+            memcpy( &words[0], data + i, sizeof( uint64_t ) );
+            memcpy( &words[1], data + CRC_STRIDE + i, sizeof( uint64_t ) );
+            memcpy( &words[2], data + 2 * CRC_STRIDE + i, sizeof( uint64_t ) );
+            crc0 = _mm_crc32_u64( crc0, words[0] );
+            crc1 = _mm_crc32_u64( crc1, words[1] );
+            crc2 = _mm_crc32_u64( crc2, words[2] );
+        }
+
+        // CRC du bloc : premier tiers decale de deux tiers, deuxieme d'un tiers (CRC lineaire)
+        const __m128i first = _mm_clmulepi64_si128( _mm_cvtsi64_si128( (long long)crc0 ), shifts, 0x00 );
+        const __m128i second = _mm_clmulepi64_si128( _mm_cvtsi64_si128( (long long)crc1 ), shifts, 0x10 );
+        crc = (uint32_t)_mm_crc32_u64( 0, (uint64_t)_mm_cvtsi128_si64( _mm_xor_si128( first, second ) ) )
+              ^ (uint32_t)crc2;
+    }
+
+    return( crcSse42( crc, data, size ) );
+}
+
+
+__attribute__(( target( "sha,sse4.1,ssse3" ) ))
+static void sha256Shani( uint32_t state[8], const unsigned char* data, size_t blocks )
+{
+    // Etat reorganise pour les instructions sha256rnds2 : ABEF et CDGH
+    const __m128i byteSwap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+    __m128i tmp = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*)&state[0] ), 0xB1 );
+    __m128i state1 = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*)&state[4] ), 0x1B );
+    __m128i state0 = _mm_alignr_epi8( tmp, state1, 8 );
+    state1 = _mm_blend_epi16( state1, tmp, 0xF0 );
+
+    for( ; blocks > 0; --blocks, data += SHA256_BLOCK_SIZE )
+    {
+        const __m128i savedState0 = state0;
+        const __m128i savedState1 = state1;
+
+        // 16 groupes de 4 tours : les mots du message sont etendus 4 par 4 (msg[i % 4] : mots 4i a 4i + 3)
+        __m128i msg[4];
+        for( int i = 0; i < 16; ++i )
+        {
+            if( i < 4 ) msg[i] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)( data + 16 * i ) ), byteSwap );
+            __m128i words = _mm_add_epi32( msg[i % 4], _mm_loadu_si128( (const __m128i*)&SHA256_K[4 * i] ) );
+            state1 = _mm_sha256rnds2_epu32( state1, state0, words );
+            if( i >= 3 && i < 15 )
+            {
+                tmp = _mm_alignr_epi8( msg[i % 4], msg[( i + 3 ) % 4], 4 );
+                msg[( i + 1 ) % 4] = _mm_add_epi32( msg[( i + 1 ) % 4], tmp );
+                msg[( i + 1 ) % 4] = _mm_sha256msg2_epu32( msg[( i + 1 ) % 4], msg[i % 4] );
+            }
+            words = _mm_shuffle_epi32( words, 0x0E );
+            state0 = _mm_sha256rnds2_epu32( state0, state1, words );
+            if( i >= 1 && i < 13 ) msg[( i + 3 ) % 4] = _mm_sha256msg1_epu32( msg[( i + 3 ) % 4], msg[i % 4] );
+        }
+
+        state0 = _mm_add_epi32( state0, savedState0 );
+        state1 = _mm_add_epi32( state1, savedState1 );
+    }
+
+    // Retour a l'ordre ABCD EFGH
+    tmp = _mm_shuffle_epi32( state0, 0x1B );
+    state1 = _mm_shuffle_epi32( state1, 0xB1 );
+    state0 = _mm_blend_epi16( tmp, state1, 0xF0 );
+    state1 = _mm_alignr_epi8( state1, tmp, 8 );
+    _mm_storeu_si128( (__m128i*)&state[0], state0 );
+    _mm_storeu_si128( (__m128i*)&state[4], state1 );
+}
+#endif
+
+
+static uint32_t readBigEndian32( const unsigned char* bytes )
+{
+    return( (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | (uint32_t)bytes[3] );
+}
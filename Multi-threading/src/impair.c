@@ -0,0 +1,508 @@
+// ppoll()
+#define _GNU_SOURCE
+
+#include "tftp/impair.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+// Local
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+
+
+// Taille max d'un datagramme UDP
+#define MAX_DATAGRAM_SIZE 65536
+
+/** Degradation d'un sens
+ *
+ */
+typedef struct
+{
+    double loss;                            // Probabilite de perte
+    double dup;                             // Probabilite de duplication
+    double reorder;                         // Probabilite de desordre
+    int64_t delay;                          // Delai fixe (us)
+    int64_t jitter;                         // Delai aleatoire supplementaire max (us)
+    int64_t gap;                            // Retard d'un paquet desordonne (us)
+    double rate;                            // Debit max (octets/s, 0 : illimite)
+    int64_t freeAt;                         // Date de fin d'emission du dernier paquet (debit limite)
+} Link;
+
+/** Paquet retarde (emission par le thread de fond, ou reception par le prochain SOCK_recvData)
+ *
+ */
+typedef struct Held
+{
+    int64_t due;                            // Date de remise (METRICS_now)
+    const Sock* sock;                       // Socket emettrice ou receptrice (NULL une fois fermee)
+    int fd;                                 // Descripteur d'emission
+    int closeFd;                            // Dernier paquet d'une socket fermee : descripteur a fermer
+    struct sockaddr_in addr;                // Destinataire (emission) ou emetteur (reception)
+    size_t size;                            // Taille du datagramme
+    struct Held* next;                      // Paquet suivant (par date de remise)
+    unsigned char data[];                   // Datagramme
+} Held;
+
+// Degradation de chaque sens
+static Link links[IMPAIR_DIRECTIONS] =
+{
+    { 0, 0, 0, 0, 0, IMPAIR_DEFAULT_GAP_MS * 1000, 0, 0 },
+    { 0, 0, 0, 0, 0, IMPAIR_DEFAULT_GAP_MS * 1000, 0, 0 }
+};
+static int active[IMPAIR_DIRECTIONS] = { 0, 0 };
+
+// Graine et nombre de sockets creees
+static uint64_t seed = 0;
+static uint64_t sockCount = 0;
+
+// Paquets retardes, par date de remise
+static Held* sendQueue = NULL;
+static Held* recvQueue = NULL;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Thread d'emission des paquets retardes (demarre au premier paquet retarde)
+static pthread_cond_t sendCond;
+static pthread_once_t sendOnce = PTHREAD_ONCE_INIT;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Tirage uniforme dans [0, 1) (splitmix64)
+ *
+ */
+static double draw( uint64_t* state );
+
+/** Dates de remise des copies d'un paquet (0 si perdu, 2 si duplique), sous le verrou
+ *
+ */
+static int schedule( int direction, uint64_t* state, size_t size, int64_t now, int64_t* dues );
+
+/** Copie d'un paquet a retarder
+ *
+ */
+static Held* hold( const Sock* sock, const struct sockaddr_in* addr, const void* data, size_t size, int64_t due );
+
+/** Insertion dans une file par date de remise (apres les paquets de meme date)
+ *
+ */
+static void insert( Held** queue, Held* held );
+
+/** Paquet d'une socket a remettre (NULL si aucun), et date du prochain paquet de cette socket (-1 si aucun)
+ *
+ */
+static Held* popReady( const Sock* sock, int64_t now, int64_t* nextDue );
+
+/** Abandon des paquets recus d'une socket
+ *
+ */
+static void purge( Held** queue, const Sock* sock );
+
+/** Paquets emis par une socket fermee : emission sur un descripteur duplique, ferme apres le dernier
+ *
+ */
+static void detach( Held* queue, const Sock* sock );
+
+/** Demarrage du thread d'emission
+ *
+ */
+static void startSendThread();
+
+/** Thread d'emission des paquets retardes
+ *
+ */
+static void* runSendThread( void* arg );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+int IMPAIR_configure( const char* spec )
+{
+    // Sens
+    int first = IMPAIR_SEND;
+    int last = IMPAIR_RECV;
+    if( strncmp( spec, "send:", 5 ) == 0 ) last = IMPAIR_SEND;
+    else if( strncmp( spec, "recv:", 5 ) == 0 ) first = IMPAIR_RECV;
+    else if( strncmp( spec, "both:", 5 ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Sens de dégradation invalide (send:, recv: ou both:) : %s\n", spec );
+        return( 1 );
+    }
+
+    // Liste de cle=valeur
+    char buff[256];
+    snprintf( buff, sizeof( buff ), "%s", spec + 5 );
+    for( char* token = strtok( buff, "," ); token != NULL; token = strtok( NULL, "," ) )
+    {
+        char* equal = strchr( token, '=' );
+        char* end = NULL;
+        double value = equal != NULL ? strtod( equal + 1, &end ) : -1;
+        if( end != NULL && ( *end == 'K' || *end == 'k' ) ) value *= 1024, ++end;
+        else if( end != NULL && ( *end == 'M' || *end == 'm' ) ) value *= 1024 * 1024, ++end;
+        if( equal == NULL || end == equal + 1 || *end != '\0' || value < 0 )
+        {
+            fprintf( stderr, "ERREUR - Dégradation invalide : %s\n", token );
+            return( 1 );
+        }
+        *equal = '\0';
+
+        for( int direction = first; direction <= last; ++direction )
+        {
+            Link* link = &links[direction];
+            const int probability = strcmp( token, "loss" ) == 0 || strcmp( token, "dup" ) == 0
+                                    || strcmp( token, "reorder" ) == 0;
+            if( probability && value > 1 )
+            {
+                fprintf( stderr, "ERREUR - Probabilité invalide : %s=%g\n", token, value );
+                return( 1 );
+            }
+
+            if( strcmp( token, "loss" ) == 0 ) link->loss = value;
+            else if( strcmp( token, "dup" ) == 0 ) link->dup = value;
+            else if( strcmp( token, "reorder" ) == 0 ) link->reorder = value;
+            else if( strcmp( token, "delay" ) == 0 ) link->delay = (int64_t)( value * 1000 );
+            else if( strcmp( token, "jitter" ) == 0 ) link->jitter = (int64_t)( value * 1000 );
+            else if( strcmp( token, "gap" ) == 0 ) link->gap = (int64_t)( value * 1000 );
+            else if( strcmp( token, "rate" ) == 0 ) link->rate = value;
+            else
+            {
+                fprintf( stderr, "ERREUR - Paramètre de dégradation inconnu : %s\n", token );
+                return( 1 );
+            }
+
+            active[direction] = link->loss > 0 || link->dup > 0 || link->reorder > 0 || link->delay > 0
+                                || link->jitter > 0 || link->rate > 0;
+        }
+    }
+
+    return( 0 );
+}
+
+
+void IMPAIR_setSeed( uint64_t value )
+{
+    seed = value;
+}
+
+
+int IMPAIR_isActive( int direction )
+{
+    return( active[direction] );
+}
+
+
+void IMPAIR_attach( Sock* sock )
+{
+    // Une suite de tirages par socket et par sens, independante de l'ordonnancement des threads
+    const uint64_t index = __atomic_add_fetch( &sockCount, 1, __ATOMIC_RELAXED );
+    for( int direction = 0; direction < IMPAIR_DIRECTIONS; ++direction )
+        sock->impair[direction] = seed ^ ( ( index * IMPAIR_DIRECTIONS + (uint64_t)direction ) * 0xD1B54A32D192ED03ULL );
+}
+
+
+int IMPAIR_send( Sock* sock, const void* data, size_t size, const Addr* to )
+{
+    // Copies retardees confiees au thread d'emission, les autres sont envoyees tout de suite
+    int immediate = 0;
+    pthread_mutex_lock( &mutex );
+    const int64_t now = METRICS_now();
+    int64_t dues[2];
+    const int copies = schedule( IMPAIR_SEND, &sock->impair[IMPAIR_SEND], size, now, dues );
+    for( int i = 0; i < copies; ++i )
+    {
+        if( dues[i] <= now ) ++immediate;
+        else insert( &sendQueue, hold( sock, &to->inAddr, data, size, dues[i] ) );
+    }
+    if( copies > immediate )
+    {
+        pthread_once( &sendOnce, startSendThread );
+        pthread_cond_signal( &sendCond );
+    }
+    pthread_mutex_unlock( &mutex );
+
+    for( int i = 0; i < immediate; ++i )
+    {
+        if( sendto( sock->fd, data, size, 0, (const struct sockaddr*)&( to->inAddr ), sizeof( to->inAddr ) ) == -1 )
+        {
+            LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec de l'envoi : %s", strerror( errno ) );
+            return( -1 );
+        }
+        METRICS_add( METRICS_BYTES_SENT, (int64_t)size );
+    }
+
+    return( 0 );
+}
+
+
+int IMPAIR_recv( Sock* sock, void* data, size_t* size, struct sockaddr_in* from )
+{
+    // Echeance du timeout de la socket (aucune si SO_RCVTIMEO nul). Socket non bloquante : paquets echus et
+    // datagrammes deja arrives seulement, sans attente
+    struct timeval timeout = { 0, 0 };
+    socklen_t length = sizeof( timeout );
+    getsockopt( sock->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &length );
+    const int64_t timeoutUs = (int64_t)timeout.tv_sec * 1000000 + timeout.tv_usec;
+    const int nonBlocking = ( fcntl( sock->fd, F_GETFL ) & O_NONBLOCK ) != 0;
+    const int64_t deadline = timeoutUs > 0 && ! nonBlocking ? METRICS_now() + timeoutUs : -1;
+
+    while( 1 )
+    {
+        // Paquet retarde arrive a echeance
+        int64_t now = METRICS_now();
+        int64_t nextDue = -1;
+        pthread_mutex_lock( &mutex );
+        Held* held = popReady( sock, now, &nextDue );
+        pthread_mutex_unlock( &mutex );
+        if( held != NULL )
+        {
+            *size = held->size < *size ? held->size : *size;
+            memcpy( data, held->data, *size );
+            *from = held->addr;
+            free( held );
+            return( 0 );
+        }
+
+        // Timeout
+        if( deadline != -1 && now >= deadline )
+        {
+            LOG_write( LOG_DEBUG, LOG_NO_BLOCK, "Timeout" );
+            return( -1 );
+        }
+
+        // Attente d'un datagramme, du prochain paquet retarde ou du timeout
+        int64_t wait = nextDue != -1 ? nextDue - now : -1;
+        if( deadline != -1 && ( wait == -1 || deadline - now < wait ) ) wait = deadline - now;
+        struct timespec waitTime = { (time_t)( wait / 1000000 ), (long)( wait % 1000000 ) * 1000 };
+        struct pollfd pollFd = { sock->fd, POLLIN, 0 };
+        const int ready = nonBlocking ? 1 : ppoll( &pollFd, 1, wait != -1 ? &waitTime : NULL, NULL );
+        if( ready == 0 ) continue;
+
+        // Lecture du datagramme
+        unsigned char buff[MAX_DATAGRAM_SIZE];
+        struct sockaddr_in senderAddr;
+        socklen_t addrLen = sizeof( senderAddr );
+        const ssize_t status = ready == -1 ? -1 : recvfrom( sock->fd, buff, sizeof( buff ), MSG_DONTWAIT,
+                                                            (struct sockaddr*)&senderAddr, &addrLen );
+        if( status == -1 )
+        {
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                if( ! nonBlocking ) continue;
+                LOG_write( LOG_DEBUG, LOG_NO_BLOCK, "Timeout" );
+                return( -1 );
+            }
+
+            // Interruption par un signal (arret du serveur) ou erreur
+            if( errno != EINTR ) LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Erreur de réception : %s", strerror( errno ) );
+            return( 1 );
+        }
+        METRICS_add( METRICS_BYTES_RECEIVED, status );
+
+        // Copies a remettre (perte : aucune), y-compris sans delai pour garder l'ordre des paquets retardes
+        pthread_mutex_lock( &mutex );
+        now = METRICS_now();
+        int64_t dues[2];
+        const int copies = schedule( IMPAIR_RECV, &sock->impair[IMPAIR_RECV], (size_t)status, now, dues );
+        for( int i = 0; i < copies; ++i )
+            insert( &recvQueue, hold( sock, &senderAddr, buff, (size_t)status, dues[i] ) );
+        pthread_mutex_unlock( &mutex );
+    }
+}
+
+
+int IMPAIR_nextRecv( int64_t* due )
+{
+    // File triee par date de remise : le premier paquet
+    pthread_mutex_lock( &mutex );
+    const int fd = recvQueue != NULL ? recvQueue->sock->fd : -1;
+    if( fd != -1 ) *due = recvQueue->due;
+    pthread_mutex_unlock( &mutex );
+
+    return( fd );
+}
+
+
+void IMPAIR_forget( Sock* sock )
+{
+    pthread_mutex_lock( &mutex );
+    detach( sendQueue, sock );
+    purge( &recvQueue, sock );
+    pthread_mutex_unlock( &mutex );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static double draw( uint64_t* state )
+{
+    uint64_t z = ( *state += 0x9E3779B97F4A7C15ULL );
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return( (double)( z >> 11 ) / (double)( 1ULL << 53 ) );
+}
+
+
+static int schedule( int direction, uint64_t* state, size_t size, int64_t now, int64_t* dues )
+{
+    Link* link = &links[direction];
+
+    // Perte et duplication
+    if( draw( state ) < link->loss ) return( 0 );
+    const int copies = draw( state ) < link->dup ? 2 : 1;
+
+    for( int i = 0; i < copies; ++i )
+    {
+        // Debit limite : emission apres les paquets precedents (file pleine : perte)
+        int64_t departure = now;
+        if( link->rate > 0 )
+        {
+            if( link->freeAt > departure ) departure = link->freeAt;
+            if( departure - now > IMPAIR_MAX_BACKLOG_US ) return( i );
+            departure += (int64_t)( (double)size * 1000000 / link->rate );
+            link->freeAt = departure;
+        }
+
+        // Delai, gigue et desordre
+        dues[i] = departure + link->delay;
+        if( link->jitter > 0 ) dues[i] += (int64_t)( draw( state ) * (double)link->jitter );
+        if( draw( state ) < link->reorder ) dues[i] += link->gap;
+    }
+
+    return( copies );
+}
+
+
+static Held* hold( const Sock* sock, const struct sockaddr_in* addr, const void* data, size_t size, int64_t due )
+{
+    Held* held = (Held*)malloc( sizeof( Held ) + size );
+    held->due = due;
+    held->sock = sock;
+    held->fd = sock->fd;
+    held->closeFd = 0;
+    held->addr = *addr;
+    held->size = size;
+    held->next = NULL;
+    memcpy( held->data, data, size );
+
+    return( held );
+}
+
+
+static void insert( Held** queue, Held* held )
+{
+    while( *queue != NULL && ( *queue )->due <= held->due ) queue = &( *queue )->next;
+    held->next = *queue;
+    *queue = held;
+}
+
+
+static Held* popReady( const Sock* sock, int64_t now, int64_t* nextDue )
+{
+    for( Held** previous = &recvQueue; *previous != NULL; previous = &( *previous )->next )
+    {
+        Held* held = *previous;
+        if( held->sock != sock ) continue;
+        if( held->due > now )
+        {
+            *nextDue = held->due;
+            return( NULL );
+        }
+        *previous = held->next;
+        return( held );
+    }
+
+    return( NULL );
+}
+
+
+static void purge( Held** queue, const Sock* sock )
+{
+    while( *queue != NULL )
+    {
+        Held* held = *queue;
+        if( held->sock == sock )
+        {
+            *queue = held->next;
+            free( held );
+        }
+        else queue = &held->next;
+    }
+}
+
+
+static void detach( Held* queue, const Sock* sock )
+{
+    // Les paquets deja "sur le reseau" arrivent meme si l'emetteur ferme sa socket (dernier ACK d'un WRQ)
+    int fd = -1;
+    Held* last = NULL;
+    for( Held* held = queue; held != NULL; held = held->next )
+    {
+        if( held->sock != sock ) continue;
+        if( last == NULL ) fd = dup( sock->fd );
+        held->sock = NULL;
+        held->fd = fd;
+        last = held;
+    }
+    if( last != NULL ) last->closeFd = 1;
+}
+
+
+static void startSendThread()
+{
+    // Attente en temps monotone (meme horloge que les dates de remise)
+    pthread_condattr_t attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &sendCond, &attr );
+    pthread_condattr_destroy( &attr );
+
+    pthread_t thread;
+    if( pthread_create( &thread, NULL, runSendThread, NULL ) == 0 ) pthread_detach( thread );
+    else LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Lancement du thread de dégradation impossible" );
+}
+
+
+static void* runSendThread( void* arg )
+{
+    (void)arg;
+
+    pthread_mutex_lock( &mutex );
+    while( 1 )
+    {
+        // Attente du prochain paquet a echeance
+        const int64_t now = METRICS_now();
+        if( sendQueue == NULL )
+        {
+            pthread_cond_wait( &sendCond, &mutex );
+            continue;
+        }
+        if( sendQueue->due > now )
+        {
+            const struct timespec due = { (time_t)( sendQueue->due / 1000000 ), (long)( sendQueue->due % 1000000 ) * 1000 };
+            pthread_cond_timedwait( &sendCond, &mutex, &due );
+            continue;
+        }
+
+        // Emission sous le verrou : la socket ne peut pas etre fermee entre-temps (IMPAIR_forget)
+        Held* held = sendQueue;
+        sendQueue = held->next;
+        if( sendto( held->fd, held->data, held->size, 0, (const struct sockaddr*)&held->addr,
+                    sizeof( held->addr ) ) != -1 )
+            METRICS_add( METRICS_BYTES_SENT, (int64_t)held->size );
+        if( held->closeFd && held->fd != -1 ) close( held->fd );
+        free( held );
+    }
+
+    return( NULL );
+}
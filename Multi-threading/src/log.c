@@ -0,0 +1,344 @@
+#include "tftp/log.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+// Local
+#include "tftp/metrics.h"
+
+
+/** Message en attente d'ecriture
+ *
+ */
+typedef struct
+{
+    struct timespec time;                   // Date du message
+    int level;                              // Niveau
+    uint64_t session;                       // Session (0 si aucune)
+    int64_t block;                          // Numero de bloc (LOG_NO_BLOCK si aucun)
+    char client[LOG_CLIENT_SIZE];           // Adresse du client (vide si aucune)
+    char file[LOG_FILE_SIZE];               // Fichier (vide si aucun)
+    char message[LOG_MESSAGE_SIZE];         // Texte
+} LogRecord;
+
+/** Tampon circulaire d'un thread
+ *
+ *  Un seul producteur (le thread) et un seul consommateur (le thread de vidage) : head n'est ecrit que par
+ *  le producteur et tail que par le consommateur, sans verrou.
+ */
+typedef struct LogRing
+{
+    LogRecord records[LOG_RING_SIZE];       // Messages
+    uint32_t head;                          // Prochain message ecrit (producteur)
+    uint32_t tail;                          // Prochain message lu (consommateur)
+    uint64_t dropped;                       // Messages perdus (tampon plein)
+    uint64_t reported;                      // Messages perdus deja signales (consommateur)
+    int closed;                             // Thread termine : tampon libere une fois vide
+    struct LogRing* next;                   // Tampon suivant (liste active ou libre)
+} LogRing;
+
+// Noms des niveaux (prefixes des messages, comme les messages historiques "INFO - ...")
+static const char* LEVELS[] = { "DEBUG", "INFO", "ATTENTION", "ERREUR" };
+
+// Niveau minimal
+static int minLevel = LOG_INFO;
+
+// Tampons des threads (actifs et recyclables)
+static LogRing* rings = NULL;
+static LogRing* freeRings = NULL;
+static pthread_mutex_t ringsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Rattachement du tampon et du contexte au thread
+static __thread LogRing* threadRing = NULL;
+static __thread uint64_t threadSession = 0;
+static __thread char threadClient[LOG_CLIENT_SIZE] = "";
+static __thread char threadFile[LOG_FILE_SIZE] = "";
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+// Thread de vidage
+static pthread_t flushThread;
+static volatile int running = 0;
+static volatile int stopFlush = 0;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Tampon du thread appelant (cree au premier message)
+ *
+ */
+static LogRing* attach();
+
+/** Creation de la cle de fin de thread
+ *
+ */
+static void createKey();
+
+/** Fin d'un thread : son tampon sera libere une fois vide
+ *
+ */
+static void detach( void* arg );
+
+/** Thread de vidage
+ *
+ */
+static void* flushLoop( void* arg );
+
+/** Ecriture des messages en attente de tous les tampons
+ *
+ */
+static void flushRings();
+
+/** Ecriture d'un message (avec date si timed)
+ *
+ */
+static void printRecord( const LogRecord* record, int timed );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void LOG_setLevel( int level )
+{
+    minLevel = level;
+}
+
+
+int LOG_parseLevel( const char* name )
+{
+    if( strcmp( name, "debug" ) == 0 ) return( LOG_DEBUG );
+    if( strcmp( name, "info" ) == 0 ) return( LOG_INFO );
+    if( strcmp( name, "warn" ) == 0 ) return( LOG_WARN );
+    if( strcmp( name, "error" ) == 0 ) return( LOG_ERROR );
+    return( -1 );
+}
+
+
+int LOG_start()
+{
+    stopFlush = 0;
+    if( pthread_create( &flushThread, NULL, flushLoop, NULL ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Lancement du journal asynchrone impossible\n" );
+        return( 1 );
+    }
+    running = 1;
+
+    return( 0 );
+}
+
+
+void LOG_stop()
+{
+    if( ! running ) return;
+
+    stopFlush = 1;
+    pthread_join( flushThread, NULL );
+    running = 0;
+
+    // Messages ecrits pendant l'arret
+    flushRings();
+}
+
+
+void LOG_setSession( uint64_t session, const Addr* client, const char* file )
+{
+    threadSession = session;
+    threadClient[0] = '\0';
+    if( client != NULL )
+        snprintf( threadClient, sizeof( threadClient ), "%s:%u", inet_ntoa( client->inAddr.sin_addr ),
+                  ntohs( client->inAddr.sin_port ) );
+    snprintf( threadFile, sizeof( threadFile ), "%s", file != NULL ? file : "" );
+}
+
+
+void LOG_clearSession()
+{
+    LOG_setSession( 0, NULL, NULL );
+}
+
+
+void LOG_write( int level, int64_t block, const char* format, ... )
+{
+    // Filtrage avant tout formatage
+    if( level < minLevel ) return;
+
+    // Sans thread de vidage : ecriture directe
+    LogRecord local;
+    LogRing* ring = NULL;
+    LogRecord* record = &local;
+    uint32_t head = 0;
+    if( running )
+    {
+        ring = threadRing != NULL ? threadRing : attach();
+        if( ring == NULL ) return;
+
+        // Tampon plein : message perdu et compte (pas d'attente dans le chemin critique)
+        head = ring->head;
+        if( head - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE ) == LOG_RING_SIZE )
+        {
+            __atomic_store_n( &ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED );
+            return;
+        }
+        record = &ring->records[head % LOG_RING_SIZE];
+    }
+
+    // Remplissage de l'enregistrement
+    clock_gettime( CLOCK_REALTIME, &record->time );
+    record->level = level;
+    record->session = threadSession;
+    record->block = block;
+    memcpy( record->client, threadClient, sizeof( record->client ) );
+    memcpy( record->file, threadFile, sizeof( record->file ) );
+    va_list args;
+    va_start( args, format );
+    vsnprintf( record->message, sizeof( record->message ), format, args );
+    va_end( args );
+
+    // Publication pour le thread de vidage, ou ecriture directe
+    if( ring != NULL ) __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE );
+    else printRecord( record, 0 );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static LogRing* attach()
+{
+    pthread_once( &ringKeyOnce, createKey );
+
+    // Tampon d'un thread termine, ou nouveau tampon
+    pthread_mutex_lock( &ringsMutex );
+    LogRing* ring = freeRings;
+    if( ring != NULL ) freeRings = ring->next;
+    else ring = (LogRing*)malloc( sizeof( LogRing ) );
+    if( ring != NULL )
+    {
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->reported = 0;
+        ring->closed = 0;
+        ring->next = rings;
+        rings = ring;
+    }
+    pthread_mutex_unlock( &ringsMutex );
+
+    threadRing = ring;
+    pthread_setspecific( ringKey, ring );
+
+    return( ring );
+}
+
+
+static void createKey()
+{
+    pthread_key_create( &ringKey, detach );
+}
+
+
+static void detach( void* arg )
+{
+    LogRing* ring = (LogRing*)arg;
+    __atomic_store_n( &ring->closed, 1, __ATOMIC_RELEASE );
+    threadRing = NULL;
+}
+
+
+static void* flushLoop( void* arg )
+{
+    (void)arg;
+
+    while( ! stopFlush )
+    {
+        flushRings();
+        usleep( LOG_FLUSH_MS * 1000 );
+    }
+
+    return( NULL );
+}
+
+
+static void flushRings()
+{
+    uint64_t dropped = 0;
+
+    pthread_mutex_lock( &ringsMutex );
+    LogRing** previous = &rings;
+    while( *previous != NULL )
+    {
+        LogRing* ring = *previous;
+
+        // Un tampon ferme est vide apres ce passage (son thread n'ecrit plus)
+        const int closed = __atomic_load_n( &ring->closed, __ATOMIC_ACQUIRE );
+
+        // Messages publies
+        const uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+        for( uint32_t tail = ring->tail; tail != head; ++tail )
+        {
+            printRecord( &ring->records[tail % LOG_RING_SIZE], 1 );
+            __atomic_store_n( &ring->tail, tail + 1, __ATOMIC_RELEASE );
+        }
+
+        // Messages perdus depuis le dernier passage
+        const uint64_t lost = __atomic_load_n( &ring->dropped, __ATOMIC_RELAXED );
+        dropped += lost - ring->reported;
+        ring->reported = lost;
+
+        // Tampon d'un thread termine : recyclage
+        if( closed )
+        {
+            *previous = ring->next;
+            ring->next = freeRings;
+            freeRings = ring;
+        }
+        else previous = &ring->next;
+    }
+    pthread_mutex_unlock( &ringsMutex );
+
+    // Signalement des pertes
+    if( dropped > 0 )
+    {
+        METRICS_add( METRICS_LOG_DROPPED, (int64_t)dropped );
+        fprintf( stderr, "ATTENTION - %llu message(s) de journal perdu(s) (tampon plein)\n",
+                 (unsigned long long)dropped );
+    }
+    fflush( stdout );
+}
+
+
+static void printRecord( const LogRecord* record, int timed )
+{
+    // Champs structures (ceux qui sont renseignes)
+    char fields[160] = "";
+    size_t length = 0;
+    if( record->session != 0 )
+        length += snprintf( fields + length, sizeof( fields ) - length, " session=%llu",
+                            (unsigned long long)record->session );
+    if( record->client[0] != '\0' && length < sizeof( fields ) )
+        length += snprintf( fields + length, sizeof( fields ) - length, " client=%s", record->client );
+    if( record->file[0] != '\0' && length < sizeof( fields ) )
+        length += snprintf( fields + length, sizeof( fields ) - length, " file=%s", record->file );
+    if( record->block != LOG_NO_BLOCK && length < sizeof( fields ) )
+        snprintf( fields + length, sizeof( fields ) - length, " block=%lld", (long long)record->block );
+
+    // Date (messages ecrits en differe)
+    char date[32] = "";
+    if( timed )
+    {
+        struct tm tm;
+        localtime_r( &record->time.tv_sec, &tm );
+        const size_t size = strftime( date, sizeof( date ), "%H:%M:%S", &tm );
+        snprintf( date + size, sizeof( date ) - size, ".%03ld ", record->time.tv_nsec / 1000000 );
+    }
+
+    // Erreurs et avertissements sur la sortie d'erreur, comme les messages historiques
+    FILE* out = record->level >= LOG_WARN ? stderr : stdout;
+    fprintf( out, "%s%s - %s%s%s%s\n", date, LEVELS[record->level], record->message, fields[0] != '\0' ? " [" : "",
+             fields[0] != '\0' ? fields + 1 : "", fields[0] != '\0' ? "]" : "" );
+}
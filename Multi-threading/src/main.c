@@ -6,17 +6,39 @@
 // Local
 #include "tftp/client.h"
 #include "tftp/server.h"
-
-
-// Executions en mode serveur, client et multi client
-enum { MODE_UNKNOWN = -1, MODE_NONE, MODE_CLT, MODE_SRV, MODE_MULT };
-static void runServer( uint16_t srvPort );
-static void runClient( const char* srvHost, uint16_t srvPort );
-static void runMultiClient( const char* srvHost, uint16_t srvPort );
+#include "tftp/writer.h"
+#include "tftp/reader.h"
+#include "tftp/mcast.h"
+#include "tftp/bench.h"
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+#include "tftp/trace.h"
+#include "tftp/impair.h"
+#include "tftp/capture.h"
+#include "tftp/xfer.h"
+#include "tftp/batch.h"
+#include "tftp/segment.h"
+#include "tftp/digest.h"
+
+
+// Executions en mode serveur, client et generateur de charge
+enum { MODE_UNKNOWN = -1, MODE_NONE, MODE_CLT, MODE_SRV, MODE_BENCH };
+static void runServer( uint16_t srvPort, const char* indexPath );
+static int runClient( const char* srvHost, uint16_t srvPort, const char* commands, const char* manifest,
+                      const char* report );
 static int getMode( const char* sMode );
 
 // Utilisation du programme
-static const char* USAGE = "tftp --mode CLT|SRV --host HOST --port PORT";
+static const char* USAGE = "tftp --mode CLT|SRV|BENCH --host HOST --port PORT\n"
+                            "     [--index FILE|none] [--sync none|file|group] [--prefetch BLOCKS] [--direct-threshold BYTES]\n"
+                            "     [--mcast-group ADDR] [--mcast-port PORT] [--metrics FILE|unix:PATH]\n"
+                            "     [--log-level debug|info|warn|error] [--trace FILE]\n"
+                            "     [--impair send|recv|both:loss=P,dup=P,reorder=P,delay=MS,jitter=MS,gap=MS,rate=B/S] [--impair-seed N]\n"
+                            "     [--capture FILE] [--capture-size BYTES] [--capture-files N]\n"
+                            "     [--blksize BYTES] [--windowsize BLOCKS] [--jobs N] [--exec 'CMD; CMD...']\n"
+                            "     [--manifest FILE|-] [--report FILE] [--retries N] [--segments K] [--checksum crc32c|sha256|none]\n"
+                            "     [--sessions N] [--rate REQ/S] [--requests N] [--duration S] [--mix get:W,put:W]\n"
+                            "     [--sizes SIZE,...] [--seed N]";
 
 
 int main( int argc, char* argv[] )
@@ -31,6 +53,21 @@ int main( int argc, char* argv[] )
     // Port utilise par le serveur
     uint16_t srvPort = 0;
 
+    // Snapshot de l'index du serveur ("none" pour desactiver)
+    char indexPath[INDEX_PATH_SIZE];
+    strcpy( indexPath, FILEAVL_INDEX_FILE );
+
+    // Commandes du client executees sans interaction (NULL : session interactive)
+    const char* commands = NULL;
+
+    // Manifeste de transferts du client et fichier du rapport (NULL : sortie standard)
+    const char* manifest = NULL;
+    const char* report = NULL;
+
+    // Parametres du generateur de charge
+    BenchConfig bench;
+    BENCH_initConfig( &bench );
+
     // Parsing de la ligne de commande
     int i = 0;
     while( argv[++i] )
@@ -57,6 +94,168 @@ int main( int argc, char* argv[] )
         else if( strcmp( option, "--port" ) == 0 )
             srvPort = (uint16_t)atoi( value );
 
+        // Snapshot de l'index
+        else if( strcmp( option, "--index" ) == 0 )
+            snprintf( indexPath, sizeof( indexPath ), "%s", strcmp( value, "none" ) == 0 ? "" : value );
+
+        // Politique de durabilite des fichiers recus
+        else if( strcmp( option, "--sync" ) == 0 )
+        {
+            const int policy = WRITER_parseSyncPolicy( value );
+            if( policy == -1 )
+            {
+                fprintf( stderr, "ERREUR - Politique de synchronisation inconnue : %s\n", value );
+                fprintf( stderr, "%s\n", USAGE );
+                return( 1 );
+            }
+            WRITER_setSyncPolicy( policy );
+        }
+
+        // Distance de lecture anticipee des fichiers envoyes
+        else if( strcmp( option, "--prefetch" ) == 0 )
+            READER_setPrefetchDistance( (size_t)atol( value ) );
+
+        // Lecture/ecriture directe des gros fichiers
+        else if( strcmp( option, "--direct-threshold" ) == 0 )
+        {
+            READER_setDirectThreshold( (off_t)atoll( value ) );
+            WRITER_setDirectThreshold( (size_t)atoll( value ) );
+        }
+
+        // Groupe de diffusion multicast (option "multicast" acceptee si specifie)
+        else if( strcmp( option, "--mcast-group" ) == 0 )
+        {
+            if( MCAST_setGroup( value ) != 0 ) return( 1 );
+        }
+
+        // Port de base des groupes multicast
+        else if( strcmp( option, "--mcast-port" ) == 0 )
+            MCAST_setBasePort( (uint16_t)atoi( value ) );
+
+        // Export des metriques du serveur
+        else if( strcmp( option, "--metrics" ) == 0 )
+            METRICS_setExport( value );
+
+        // Niveau minimal des messages du journal
+        else if( strcmp( option, "--log-level" ) == 0 )
+        {
+            const int level = LOG_parseLevel( value );
+            if( level == -1 )
+            {
+                fprintf( stderr, "ERREUR - Niveau de journal inconnu : %s\n", value );
+                fprintf( stderr, "%s\n", USAGE );
+                return( 1 );
+            }
+            LOG_setLevel( level );
+        }
+
+        // Traces binaires des sessions (bascule par SIGUSR1)
+        else if( strcmp( option, "--trace" ) == 0 )
+            TRACE_setOutput( value );
+
+        // Degradation du reseau (tests de performance), option repetable pour chaque sens
+        else if( strcmp( option, "--impair" ) == 0 )
+        {
+            if( IMPAIR_configure( value ) != 0 )
+            {
+                fprintf( stderr, "%s\n", USAGE );
+                return( 1 );
+            }
+        }
+
+        // Graine des tirages de la degradation
+        else if( strcmp( option, "--impair-seed" ) == 0 )
+            IMPAIR_setSeed( strtoull( value, NULL, 10 ) );
+
+        // Capture pcap des datagrammes
+        else if( strcmp( option, "--capture" ) == 0 )
+            CAPTURE_setOutput( value );
+
+        // Taille max d'un fichier de capture
+        else if( strcmp( option, "--capture-size" ) == 0 )
+            CAPTURE_setLimits( atol( value ), 0 );
+
+        // Nombre de fichiers de capture conserves
+        else if( strcmp( option, "--capture-files" ) == 0 )
+            CAPTURE_setLimits( 0, atoi( value ) );
+
+        // Client : taille de bloc demandee (512 : pas d'option blksize)
+        else if( strcmp( option, "--blksize" ) == 0 )
+            XFER_setBlockSize( (uint16_t)atoi( value ) );
+
+        // Client : fenetre demandee (1 : pas d'option windowsize)
+        else if( strcmp( option, "--windowsize" ) == 0 )
+            XFER_setWindowSize( (uint16_t)atoi( value ) );
+
+        // Client : empreinte demandee pour les lectures de fichier entier
+        else if( strcmp( option, "--checksum" ) == 0 )
+        {
+            const int algorithm = DIGEST_parse( value );
+            if( algorithm == -1 )
+            {
+                fprintf( stderr, "ERREUR - Empreinte inconnue : %s\n", value );
+                fprintf( stderr, "%s\n", USAGE );
+                return( 1 );
+            }
+            XFER_setChecksum( algorithm );
+        }
+
+        // Client : transferts simultanes de mget et mput
+        else if( strcmp( option, "--jobs" ) == 0 )
+            BATCH_setJobs( atoi( value ) );
+
+        // Client : commandes executees sans interaction
+        else if( strcmp( option, "--exec" ) == 0 )
+            commands = value;
+
+        // Client : manifeste de transferts
+        else if( strcmp( option, "--manifest" ) == 0 )
+            manifest = value;
+
+        // Client : rapport JSON du manifeste
+        else if( strcmp( option, "--report" ) == 0 )
+            report = value;
+
+        // Client : nouvelles tentatives apres un echec transitoire
+        else if( strcmp( option, "--retries" ) == 0 )
+            BATCH_setRetries( atoi( value ) );
+
+        // Client : segments simultanes d'un get
+        else if( strcmp( option, "--segments" ) == 0 )
+            SEGMENT_setCount( atoi( value ) );
+
+        // Generateur de charge : sessions simultanees
+        else if( strcmp( option, "--sessions" ) == 0 )
+            bench.sessions = atoi( value ) > 0 ? atoi( value ) : 1;
+
+        // Generateur de charge : requetes par seconde (boucle ouverte)
+        else if( strcmp( option, "--rate" ) == 0 )
+            bench.rate = atof( value );
+
+        // Generateur de charge : nombre de requetes
+        else if( strcmp( option, "--requests" ) == 0 )
+            bench.requests = atol( value );
+
+        // Generateur de charge : duree max
+        else if( strcmp( option, "--duration" ) == 0 )
+            bench.duration = atof( value );
+
+        // Generateur de charge : melange de requetes
+        else if( strcmp( option, "--mix" ) == 0 )
+        {
+            if( BENCH_parseMix( &bench, value ) != 0 ) return( 1 );
+        }
+
+        // Generateur de charge : tailles de fichiers
+        else if( strcmp( option, "--sizes" ) == 0 )
+        {
+            if( BENCH_parseSizes( &bench, value ) != 0 ) return( 1 );
+        }
+
+        // Generateur de charge : graine du tirage
+        else if( strcmp( option, "--seed" ) == 0 )
+            bench.seed = (unsigned int)atol( value );
+
         // Option inconnue
         else
         {
@@ -66,36 +265,42 @@ int main( int argc, char* argv[] )
         }
     }
 
+    // Capture des datagrammes (tous les modes)
+    if( CAPTURE_start() != 0 ) return( 1 );
+
     // Selon le mode de lancement
+    int status = 0;
     switch( mode )
     {
         // Mode client
         case MODE_CLT:
-            runClient( srvHost, srvPort );
+            if( runClient( srvHost, srvPort, commands, manifest, report ) != 0 ) status = 3;
             break;
 
         // Mode serveur
         case MODE_SRV:
-            runServer( srvPort );
+            runServer( srvPort, indexPath );
             break;
 
-        // Mode multi client
-        case MODE_MULT:
-            runMultiClient( srvHost, srvPort );
+        // Mode generateur de charge. Si port est nul, on utilise le port 69 (port TFTP standard)
+        case MODE_BENCH:
+            if( BENCH_run( &bench, srvHost, srvPort ? srvPort : 69 ) != 0 ) status = 3;
             break;
 
         // Mode inconnu
         default:
             fprintf( stderr, "ERREUR - Mode d'exécution inconnu !\n" );
             fprintf( stderr, "%s\n", USAGE );
-            return( 2 );
+            status = 2;
+            break;
     }
+    CAPTURE_stop();
 
-	return( 0 );
+	return( status );
 }
 
 
-static void runServer( uint16_t srvPort )
+static void runServer( uint16_t srvPort, const char* indexPath )
 {
     // Creation d'un serveur
     Server* srv = SERVER_create( srvPort );
@@ -104,6 +309,7 @@ static void runServer( uint16_t srvPort )
         fprintf( stderr, "FATAL - Echec d'initialisation du serveur!!!\n" );
         return;
     }
+    SERVER_setIndexPath( srv, indexPath );
 
     // Lancement du serveur (traitement des requetes entrantes)
     SERVER_run( srv );
@@ -113,39 +319,27 @@ static void runServer( uint16_t srvPort )
 }
 
 
-static void runClient( const char *srvHost, uint16_t srvPort )
+static int runClient( const char *srvHost, uint16_t srvPort, const char* commands, const char* manifest,
+                      const char* report )
 {
     // Creation d'un client. Si port est nul, on utilise le port 69 (port TFTP standard)
     Client* clt = CLIENT_create( srvHost, srvPort ? srvPort : 69 );
     if( clt == NULL )
     {
         fprintf( stderr, "FATAL - Echec d'initialisation du client!!!\n" );
-        return;
+        return( 1 );
     }
 
-    // Lancement de la session utilisateur
-    CLIENT_run( clt );
+    // Lancement de la session utilisateur, ou execution des commandes ou du manifeste specifies
+    int failed = 0;
+    if( manifest != NULL ) failed = CLIENT_runManifest( clt, manifest, report );
+    else if( commands != NULL ) failed = CLIENT_exec( clt, commands );
+    else CLIENT_run( clt );
 
     // Destruction du client
     CLIENT_destroy( clt );
-}
-
 
-static void runMultiClient( const char *srvHost, uint16_t srvPort )
-{
-    // Creation d'un client. Si port est nul, on utilise le port 69 (port TFTP standard)
-    Client* clt = CLIENT_create( srvHost, srvPort ? srvPort : 69 );
-    if( clt == NULL )
-    {
-        fprintf( stderr, "FATAL - Echec d'initialisation du client!!!\n" );
-        return;
-    }
-
-    // Lancement de la session utilisateur
-    CLIENT_MultiRun( clt );
-
-    // Destruction du client
-    CLIENT_destroy( clt );
+    return( failed );
 }
 
 
@@ -157,9 +351,9 @@ static int getMode( const char* sMode )
     // Mode serveur
     else if( strcmp( sMode, "SRV" ) == 0 )
         return( MODE_SRV );
-    // Mode multi client
-    else if( strcmp( sMode , "MULT" ) == 0 )
-        return( MODE_MULT );
+    // Mode generateur de charge
+    else if( strcmp( sMode, "BENCH" ) == 0 )
+        return( MODE_BENCH );
     // Mode inconnu
     else
         return( MODE_UNKNOWN );
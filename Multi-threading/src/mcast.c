@@ -0,0 +1,358 @@
+#include "tftp/mcast.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+// Local
+#include "tftp/tftp.h"
+#include "tftp/reader.h"
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+#include "tftp/trace.h"
+
+
+// Adresse du groupe (vide : diffusion multicast desactivee) et port de base
+static char groupHost[ADDR_SIZE] = "";
+static uint16_t basePort = MCAST_DEFAULT_PORT;
+
+// Sessions en cours (indexees par leur numero) et protection de leur liste de clients
+static McastSession* sessions[MCAST_MAX_SESSIONS];
+static pthread_mutex_t sessionsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Boucle de diffusion d'une session, jusqu'au depart du dernier client
+ *
+ */
+static void runSession( McastSession* session, Reader* reader );
+
+/** Envoi d'un OACK a un client (mc = 1 s'il devient maitre)
+ *
+ */
+static int sendOack( McastSession* session, const McastClient* client, int master );
+
+/** Envoi d'un bloc au groupe
+ *
+ */
+static int sendBlock( McastSession* session, Reader* reader, uint16_t blockNum );
+
+/** Ajout d'un client a une session (verrou des sessions pris), retourne sa position ou -1 si la session est pleine
+ *
+ */
+static int addClient( McastSession* session, const Addr* addr, int withSize );
+
+/** Retrait d'un client d'une session
+ *
+ */
+static void removeClient( McastSession* session, const Addr* addr );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+int MCAST_setGroup( const char* host )
+{
+    // Controle de l'adresse (classe D)
+    struct in_addr inAddr;
+    if( strlen( host ) >= ADDR_SIZE || inet_pton( AF_INET, host, &inAddr ) != 1
+        || ! IN_MULTICAST( ntohl( inAddr.s_addr ) ) )
+    {
+        fprintf( stderr, "ERREUR - Adresse de groupe multicast invalide : %s\n", host );
+        return( 1 );
+    }
+
+    strcpy( groupHost, host );
+    return( 0 );
+}
+
+
+void MCAST_setBasePort( uint16_t port )
+{
+    basePort = port;
+}
+
+
+int MCAST_sendFile( Sock* sock, const char* fileName, const XrqPacket* request, const Addr* client )
+{
+    // Diffusion desactivee ou non demandee
+    if( groupHost[0] == '\0' || PACKET_getOption( request->options, request->optionCount, "multicast" ) == NULL )
+        return( MCAST_DECLINED );
+    const int withSize = PACKET_getOption( request->options, request->optionCount, "tsize" ) != NULL;
+
+    pthread_mutex_lock( &sessionsMutex );
+
+    // Session en cours pour ce fichier : le client la rejoint (il recoit deja les blocs diffuses)
+    int freeSlot = -1;
+    for( int i = 0; i < MCAST_MAX_SESSIONS; ++i )
+    {
+        McastSession* session = sessions[i];
+        if( session == NULL )
+        {
+            if( freeSlot == -1 ) freeSlot = i;
+        }
+        else if( strcmp( session->fileName, fileName ) == 0 )
+        {
+            // Le premier client de la liste est le maitre
+            const int index = addClient( session, client, withSize );
+            if( index != -1 ) sendOack( session, &session->clients[index], index == 0 );
+            pthread_mutex_unlock( &sessionsMutex );
+            return( index != -1 ? 0 : MCAST_DECLINED );
+        }
+    }
+
+    // Plus de session disponible
+    if( freeSlot == -1 )
+    {
+        pthread_mutex_unlock( &sessionsMutex );
+        return( MCAST_DECLINED );
+    }
+
+    // Ouverture du fichier. Les numeros de bloc ne rebouclent pas en multicast : au-dela de 65535 blocs, le
+    // fichier est envoye en unicast
+    Reader* reader = READER_open( fileName );
+    if( reader == NULL || reader->size / DATA_SIZE + 1 > UINT16_MAX )
+    {
+        pthread_mutex_unlock( &sessionsMutex );
+        READER_close( reader );
+        return( MCAST_DECLINED );
+    }
+
+    // Creation de la session (la socket du service sert d'identifiant de transfert)
+    McastSession* session = (McastSession*)malloc( sizeof( McastSession ) );
+    if( session == NULL )
+    {
+        pthread_mutex_unlock( &sessionsMutex );
+        READER_close( reader );
+        return( MCAST_DECLINED );
+    }
+    snprintf( session->fileName, sizeof( session->fileName ), "%s", fileName );
+    session->size = reader->size;
+    session->slot = freeSlot;
+    session->sock = sock;
+    session->group = ADDR_createRemote( groupHost, (uint16_t)( basePort + freeSlot ) );
+    session->clientCount = 0;
+    if( session->group == NULL || SOCK_setMulticastInterface( sock ) != 0 )
+    {
+        pthread_mutex_unlock( &sessionsMutex );
+        ADDR_destroy( session->group );
+        free( session );
+        READER_close( reader );
+        return( MCAST_DECLINED );
+    }
+    addClient( session, client, withSize );
+    sessions[freeSlot] = session;
+
+    pthread_mutex_unlock( &sessionsMutex );
+
+    // Attente courte de l'ACK du maitre : les blocs perdus sont reemis rapidement
+    struct timeval timeout;
+    timeout.tv_sec = MCAST_TIMEOUT_MS / 1000;
+    timeout.tv_usec = ( MCAST_TIMEOUT_MS % 1000 ) * 1000;
+    setsockopt( sock->fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof( timeout ) );
+
+    // Diffusion
+    LOG_write( LOG_INFO, LOG_NO_BLOCK, "Diffusion multicast de %s sur %s:%u", fileName, groupHost, session->group->port );
+    runSession( session, reader );
+    LOG_write( LOG_INFO, LOG_NO_BLOCK, "Fin de la diffusion multicast de %s", fileName );
+
+    // Liberation memoire (la session n'est plus referencee)
+    READER_close( reader );
+    ADDR_destroy( session->group );
+    free( session );
+
+    return( 0 );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void runSession( McastSession* session, Reader* reader )
+{
+    // Nombre de blocs du fichier (le dernier peut etre vide)
+    const uint16_t nbBlocks = (uint16_t)( session->size / DATA_SIZE + 1 );
+
+    // Maitre courant et dernier bloc emis pour lui (0 : OACK)
+    McastClient master;
+    int hasMaster = 0;
+    uint16_t lastSent = 0;
+    int nbTry = 0;
+
+    Addr* from = ADDR_create();
+    while( 1 )
+    {
+        // Election d'un nouveau maitre : le plus ancien client en attente
+        if( ! hasMaster )
+        {
+            pthread_mutex_lock( &sessionsMutex );
+            if( session->clientCount == 0 )
+            {
+                // Plus de client : fin de la session (un nouveau client ouvrira une nouvelle session)
+                sessions[session->slot] = NULL;
+                pthread_mutex_unlock( &sessionsMutex );
+                break;
+            }
+            master = session->clients[0];
+            pthread_mutex_unlock( &sessionsMutex );
+
+            hasMaster = 1;
+            lastSent = 0;
+            nbTry = 0;
+            sendOack( session, &master, 1 );
+        }
+
+        // Attente d'un ACK (ou d'une erreur). Un datagramme invalide est ignore, une erreur de la socket met fin a la
+        // session (sans quoi la boucle tournerait sans attendre)
+        int sockError = 0;
+        Packet* packet = TFTP_recvPacketStatus( session->sock, from, &sockError );
+        if( packet == NULL && sockError )
+        {
+            LOG_write( LOG_ERROR, lastSent, "Erreur de la socket, fin de la diffusion" );
+            pthread_mutex_lock( &sessionsMutex );
+            sessions[session->slot] = NULL;
+            pthread_mutex_unlock( &sessionsMutex );
+            break;
+        }
+        if( packet == NULL ) continue;
+        if( packet == TIMEOUT )
+        {
+            // Maitre muet : il est abandonne au profit du suivant
+            if( nbTry++ == MAX_TRY_TIMEOUT )
+            {
+                LOG_write( LOG_WARN, lastSent, "Client maître sans réponse, élection d'un nouveau maître" );
+                removeClient( session, &master.addr );
+                hasMaster = 0;
+            }
+            else
+            {
+                METRICS_add( METRICS_RETRANSMITS, 1 );
+                if( lastSent == 0 ) sendOack( session, &master, 1 );
+                else
+                {
+                    TRACE_record( TRACE_DATA_RESENT, lastSent, (uint16_t)nbTry );
+                    sendBlock( session, reader, lastSent );
+                }
+            }
+            continue;
+        }
+
+        const int fromMaster = ADDR_equals( from, &master.addr );
+        switch( packet->code )
+        {
+            // ACK : le client a recu tous les blocs jusqu'au numero acquitte
+            case TFTP_ACK:
+            {
+                const uint16_t blockNum = ( (AckPacket*)packet->data )->blockNum;
+                if( blockNum >= nbBlocks )
+                {
+                    // Fichier complet pour ce client
+                    removeClient( session, from );
+                    if( fromMaster ) hasMaster = 0;
+                }
+                else if( fromMaster )
+                {
+                    // Emission du bloc suivant pour tout le groupe
+                    TRACE_record( TRACE_ACK_RECEIVED, blockNum, 0 );
+                    lastSent = blockNum + 1;
+                    nbTry = 0;
+                    TRACE_record( TRACE_DATA_SENT, lastSent, 0 );
+                    sendBlock( session, reader, lastSent );
+                }
+            }
+            break;
+
+            // ERROR : le client abandonne
+            case TFTP_ERROR:
+                TRACE_record( TRACE_ERROR_RECEIVED, lastSent, ( (ErrorPacket*)packet->data )->errorCode );
+                removeClient( session, from );
+                if( fromMaster ) hasMaster = 0;
+                break;
+
+            // Autres paquets ignores
+            default:
+                break;
+        }
+
+        PACKET_destroy( packet );
+    }
+
+    ADDR_destroy( from );
+}
+
+
+static int sendOack( McastSession* session, const McastClient* client, int master )
+{
+    // Option multicast : "adresse,port,mc"
+    Option options[2];
+    size_t optionCount = 0;
+    char value[OPTION_VALUE_SIZE];
+    snprintf( value, sizeof( value ), "%.15s,%u,%s", groupHost, session->group->port, master ? "1" : "0" );
+    PACKET_addOption( options, &optionCount, "multicast", value );
+
+    // Taille du fichier si demandee (le client en deduit le nombre de blocs)
+    if( client->withSize )
+    {
+        snprintf( value, sizeof( value ), "%lld", (long long)session->size );
+        PACKET_addOption( options, &optionCount, "tsize", value );
+    }
+
+    TRACE_record( TRACE_OPTIONS, 0, (uint16_t)optionCount );
+    return( TFTP_sendOackPacket( session->sock, options, optionCount, &client->addr ) );
+}
+
+
+static int sendBlock( McastSession* session, Reader* reader, uint16_t blockNum )
+{
+    // Lecture du bloc
+    const off_t offset = (off_t)( blockNum - 1 ) * DATA_SIZE;
+    const uint16_t bytesCount = session->size - offset < DATA_SIZE ? (uint16_t)( session->size - offset ) : DATA_SIZE;
+    unsigned char bytes[DATA_SIZE];
+    if( READER_read( reader, offset, bytes, bytesCount ) != (ssize_t)bytesCount )
+    {
+        LOG_write( LOG_ERROR, blockNum, "Echec de lecture" );
+        return( 1 );
+    }
+
+    // Emission vers le groupe
+    const int status = TFTP_sendDataPacket( session->sock, blockNum, bytes, bytesCount, session->group );
+    METRICS_recordFirstByte();
+    return( status );
+}
+
+
+static int addClient( McastSession* session, const Addr* addr, int withSize )
+{
+    // Client deja present (RRQ reemise) : il garde sa place
+    for( int i = 0; i < session->clientCount; ++i )
+    {
+        if( ADDR_equals( &session->clients[i].addr, addr ) ) return( i );
+    }
+
+    if( session->clientCount == MCAST_MAX_CLIENTS ) return( -1 );
+
+    McastClient* client = &session->clients[session->clientCount];
+    memcpy( &client->addr, addr, sizeof( Addr ) );
+    client->withSize = withSize;
+
+    return( session->clientCount++ );
+}
+
+
+static void removeClient( McastSession* session, const Addr* addr )
+{
+    pthread_mutex_lock( &sessionsMutex );
+    for( int i = 0; i < session->clientCount; ++i )
+    {
+        if( ADDR_equals( &session->clients[i].addr, addr ) )
+        {
+            memmove( &session->clients[i], &session->clients[i + 1],
+                     ( session->clientCount - i - 1 ) * sizeof( McastClient ) );
+            --session->clientCount;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &sessionsMutex );
+}
@@ -0,0 +1,525 @@
+#include "tftp/metrics.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+/** Mesures d'un thread
+ *
+ *  Seul le thread proprietaire ecrit ses valeurs (chargement + ecriture relaxes, sans instruction atomique
+ *  verrouillee). Le snapshot les lit sans bloquer les ecritures.
+ */
+typedef struct MetricsShard
+{
+    int64_t values[METRICS_COUNT];          // Valeurs du thread
+    uint64_t buckets[METRICS_HISTOGRAM_COUNT][METRICS_BUCKETS];     // Histogrammes du thread
+    int64_t sums[METRICS_HISTOGRAM_COUNT];  // Sommes des durees enregistrees
+    struct MetricsShard* next;              // Thread suivant (liste active ou libre)
+} MetricsShard;
+
+/** Description d'une mesure exportee
+ *
+ */
+typedef struct
+{
+    const char* name;                       // Nom Prometheus
+    const char* labels;                     // Etiquettes (vide si aucune)
+    const char* type;                       // counter, gauge ou histogram
+    const char* help;                       // Description
+} MetricsInfo;
+
+// Description des mesures (dans l'ordre de l'enum, les erreurs sont generees)
+static const MetricsInfo INFOS[METRICS_ERRORS] = {
+    { "tftp_requests_total", "type=\"rrq\"", "counter", "Requests received by type" },
+    { "tftp_requests_total", "type=\"wrq\"", "counter", "Requests received by type" },
+    { "tftp_requests_total", "type=\"other\"", "counter", "Requests received by type" },
+    { "tftp_active_sessions", "", "gauge", "Requests being served" },
+    { "tftp_sent_bytes_total", "", "counter", "UDP payload bytes sent" },
+    { "tftp_received_bytes_total", "", "counter", "UDP payload bytes received" },
+    { "tftp_retransmits_total", "", "counter", "Packets sent again after a timeout" },
+    { "tftp_timeouts_total", "", "counter", "Receive timeouts" },
+    { "tftp_dropped_requests_total", "", "counter", "Requests ignored because no service thread was free" },
+    { "tftp_index_lookups_total", "result=\"hit\"", "counter", "File index lookups by result" },
+    { "tftp_index_lookups_total", "result=\"miss\"", "counter", "File index lookups by result" },
+    { "tftp_log_dropped_total", "", "counter", "Log messages dropped because the thread buffer was full" },
+    { "tftp_trace_dropped_total", "", "counter", "Trace events dropped because the thread buffer was full" },
+    { "tftp_capture_dropped_total", "", "counter", "Packets missing from the capture because its buffer was full" },
+    { "tftp_digest_lookups_total", "result=\"hit\"", "counter", "File digest lookups by result" },
+    { "tftp_digest_lookups_total", "result=\"miss\"", "counter", "File digest lookups by result" }
+};
+
+// Description des histogrammes (dans l'ordre de l'enum)
+static const MetricsInfo HISTOGRAM_INFOS[METRICS_HISTOGRAM_COUNT] = {
+    { "tftp_first_byte_seconds", "", "histogram", "RRQ receipt to first DATA sent" },
+    { "tftp_block_rtt_seconds", "", "histogram", "DATA sent to ACK received, retransmitted blocks excluded" },
+    { "tftp_transfer_seconds", "size=\"64K\"", "histogram", "Transfer duration by file size" },
+    { "tftp_transfer_seconds", "size=\"1M\"", "histogram", "Transfer duration by file size" },
+    { "tftp_transfer_seconds", "size=\"16M\"", "histogram", "Transfer duration by file size" },
+    { "tftp_transfer_seconds", "size=\"+Inf\"", "histogram", "Transfer duration by file size" },
+    { "tftp_service_wait_seconds", "", "histogram", "Request receipt to start of its service" },
+    { "tftp_ack_delay_seconds", "block=\"data\"", "histogram", "DATA receipt to its ACK sent, by block" },
+    { "tftp_ack_delay_seconds", "block=\"last\"", "histogram", "DATA receipt to its ACK sent, by block" }
+};
+
+// Mesures des threads en cours, mesures cumulees des threads termines (les blocs sont recycles)
+static MetricsShard* shards = NULL;
+static MetricsShard* freeShards = NULL;
+static MetricsShard retired;
+static pthread_mutex_t shardsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Rattachement des mesures au thread (cle liberee a la fin du thread)
+static __thread MetricsShard* threadShard = NULL;
+static __thread int64_t requestStart = 0;
+static pthread_key_t shardKey;
+static pthread_once_t shardKeyOnce = PTHREAD_ONCE_INIT;
+
+// Export
+static char exportTarget[256] = "";
+static pthread_t exportThread;
+static int exporting = 0;
+static volatile int stopExport = 0;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Mesures du thread appelant (creees au premier appel)
+ *
+ */
+static MetricsShard* attach();
+
+/** Creation de la cle de fin de thread
+ *
+ */
+static void createKey();
+
+/** Fin d'un thread : ses mesures sont cumulees et son bloc recycle
+ *
+ */
+static void detach( void* arg );
+
+/** Ajout (relaxe, un seul ecrivain) a une valeur du thread
+ *
+ */
+static void addValue( int64_t* value, int64_t delta );
+
+/** Somme des blocs de tous les threads (verrou de la liste pris)
+ *
+ */
+static void sumShards( MetricsShard* total );
+
+/** Ecriture d'un histogramme au format Prometheus, retourne la taille ecrite
+ *
+ */
+static size_t formatHistogram( char* buff, size_t size, const MetricsInfo* info, const uint64_t* buckets,
+                               int64_t sum );
+
+/** Thread d'export vers un fichier
+ *
+ */
+static void* exportFile( void* arg );
+
+/** Thread d'export sur une socket UNIX
+ *
+ */
+static void* exportUnix( void* arg );
+
+/** Ecriture atomique du snapshot dans le fichier d'export
+ *
+ */
+static void writeFile( const char* path );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void METRICS_add( int metric, int64_t value )
+{
+    MetricsShard* shard = threadShard != NULL ? threadShard : attach();
+    if( shard != NULL ) addValue( &shard->values[metric], value );
+}
+
+
+int64_t METRICS_get( int metric )
+{
+    pthread_mutex_lock( &shardsMutex );
+    int64_t value = retired.values[metric];
+    for( MetricsShard* shard = shards; shard != NULL; shard = shard->next )
+        value += __atomic_load_n( &shard->values[metric], __ATOMIC_RELAXED );
+    pthread_mutex_unlock( &shardsMutex );
+
+    return( value );
+}
+
+
+int64_t METRICS_now()
+{
+    struct timespec time;
+    clock_gettime( CLOCK_MONOTONIC, &time );
+    return( (int64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000 );
+}
+
+
+void METRICS_record( int histogram, int64_t duration )
+{
+    MetricsShard* shard = threadShard != NULL ? threadShard : attach();
+    if( shard == NULL ) return;
+
+    addValue( (int64_t*)&shard->buckets[histogram][METRICS_bucketIndex( duration )], 1 );
+    addValue( &shard->sums[histogram], duration > 0 ? duration : 0 );
+}
+
+
+int METRICS_transferHistogram( int64_t size )
+{
+    if( size <= 64 * 1024 ) return( METRICS_TRANSFER_64K );
+    if( size <= 1024 * 1024 ) return( METRICS_TRANSFER_1M );
+    if( size <= 16 * 1024 * 1024 ) return( METRICS_TRANSFER_16M );
+    return( METRICS_TRANSFER_LARGE );
+}
+
+
+void METRICS_startRequest( int64_t received )
+{
+    requestStart = received;
+}
+
+
+void METRICS_recordFirstByte()
+{
+    if( requestStart == 0 ) return;
+    METRICS_record( METRICS_FIRST_BYTE, METRICS_now() - requestStart );
+    requestStart = 0;
+}
+
+
+void METRICS_getHistogram( int histogram, uint64_t* buckets, int64_t* sum, uint64_t* count )
+{
+    // Somme terme a terme des histogrammes de tous les threads
+    MetricsShard* total = (MetricsShard*)malloc( sizeof( MetricsShard ) );
+    pthread_mutex_lock( &shardsMutex );
+    sumShards( total );
+    pthread_mutex_unlock( &shardsMutex );
+
+    memcpy( buckets, total->buckets[histogram], sizeof( total->buckets[histogram] ) );
+    *sum = total->sums[histogram];
+    *count = 0;
+    for( int i = 0; i < METRICS_BUCKETS; ++i ) *count += buckets[i];
+    free( total );
+}
+
+
+int METRICS_bucketIndex( int64_t duration )
+{
+    // Valeurs exactes sous 2^METRICS_SUB_BITS
+    if( duration < ( 1 << METRICS_SUB_BITS ) ) return( duration > 0 ? (int)duration : 0 );
+    if( duration >= ( (int64_t)1 << ( METRICS_MAX_EXPONENT + 1 ) ) ) return( METRICS_BUCKETS - 1 );
+
+    // Puissance de 2, puis intervalle lineaire dans cette puissance (bits suivant le bit de poids fort)
+    const int exponent = 63 - __builtin_clzll( (uint64_t)duration );
+    const int sub = (int)( ( duration >> ( exponent - METRICS_SUB_BITS ) ) & ( ( 1 << METRICS_SUB_BITS ) - 1 ) );
+    return( ( ( exponent - METRICS_SUB_BITS + 1 ) << METRICS_SUB_BITS ) + sub );
+}
+
+
+int64_t METRICS_bucketLimit( int index )
+{
+    if( index < ( 1 << METRICS_SUB_BITS ) ) return( index + 1 );
+
+    const int exponent = ( index >> METRICS_SUB_BITS ) + METRICS_SUB_BITS - 1;
+    const int64_t sub = index & ( ( 1 << METRICS_SUB_BITS ) - 1 );
+    return( ( ( 1 << METRICS_SUB_BITS ) + sub + 1 ) << ( exponent - METRICS_SUB_BITS ) );
+}
+
+
+size_t METRICS_format( char* buff, size_t size )
+{
+    // Somme des mesures de tous les threads
+    MetricsShard* total = (MetricsShard*)malloc( sizeof( MetricsShard ) );
+    pthread_mutex_lock( &shardsMutex );
+    sumShards( total );
+    pthread_mutex_unlock( &shardsMutex );
+    const int64_t* values = total->values;
+
+    // Une famille (HELP + TYPE) par nom, suivie de ses series
+    size_t length = 0;
+    const char* family = NULL;
+    for( int i = 0; i < METRICS_COUNT && length < size; ++i )
+    {
+        char labels[32];
+        MetricsInfo info;
+        if( i < METRICS_ERRORS ) info = INFOS[i];
+        else
+        {
+            snprintf( labels, sizeof( labels ), "code=\"%d\"", i - METRICS_ERRORS );
+            info = (MetricsInfo){ "tftp_errors_total", labels, "counter", "ERROR packets sent by code" };
+        }
+
+        if( family == NULL || strcmp( family, info.name ) != 0 )
+        {
+            family = info.name;
+            length += snprintf( buff + length, size - length, "# HELP %s %s\n# TYPE %s %s\n",
+                                info.name, info.help, info.name, info.type );
+            if( length >= size ) break;
+        }
+        if( info.labels[0] != '\0' )
+            length += snprintf( buff + length, size - length, "%s{%s} %lld\n", info.name, info.labels,
+                                (long long)values[i] );
+        else
+            length += snprintf( buff + length, size - length, "%s %lld\n", info.name, (long long)values[i] );
+    }
+
+
+    // Histogrammes
+    for( int i = 0; i < METRICS_HISTOGRAM_COUNT && length < size; ++i )
+    {
+        const MetricsInfo* info = &HISTOGRAM_INFOS[i];
+        if( strcmp( family, info->name ) != 0 )
+        {
+            family = info->name;
+            length += snprintf( buff + length, size - length, "# HELP %s %s\n# TYPE %s %s\n",
+                                info->name, info->help, info->name, info->type );
+            if( length >= size ) break;
+        }
+        length += formatHistogram( buff + length, size - length, info, total->buckets[i], total->sums[i] );
+    }
+    free( total );
+
+    return( length < size ? length : size - 1 );
+}
+
+
+void METRICS_setExport( const char* target )
+{
+    snprintf( exportTarget, sizeof( exportTarget ), "%s", target );
+}
+
+
+int METRICS_startExport()
+{
+    if( exportTarget[0] == '\0' ) return( 0 );
+
+    // Socket UNIX ou fichier
+    stopExport = 0;
+    const int isUnix = strncmp( exportTarget, METRICS_UNIX_PREFIX, strlen( METRICS_UNIX_PREFIX ) ) == 0;
+    if( pthread_create( &exportThread, NULL, isUnix ? exportUnix : exportFile, NULL ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Lancement de l'export des métriques impossible\n" );
+        return( 1 );
+    }
+    exporting = 1;
+
+    return( 0 );
+}
+
+
+void METRICS_stopExport()
+{
+    if( ! exporting ) return;
+
+    stopExport = 1;
+    pthread_join( exportThread, NULL );
+    exporting = 0;
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static MetricsShard* attach()
+{
+    pthread_once( &shardKeyOnce, createKey );
+
+    // Bloc d'un thread termine, ou nouveau bloc
+    pthread_mutex_lock( &shardsMutex );
+    MetricsShard* shard = freeShards;
+    if( shard != NULL ) freeShards = shard->next;
+    else shard = (MetricsShard*)calloc( 1, sizeof( MetricsShard ) );
+    if( shard != NULL )
+    {
+        shard->next = shards;
+        shards = shard;
+    }
+    pthread_mutex_unlock( &shardsMutex );
+
+    threadShard = shard;
+    pthread_setspecific( shardKey, shard );
+
+    return( shard );
+}
+
+
+static void createKey()
+{
+    pthread_key_create( &shardKey, detach );
+}
+
+
+static void detach( void* arg )
+{
+    MetricsShard* shard = (MetricsShard*)arg;
+
+    pthread_mutex_lock( &shardsMutex );
+
+    // Cumul des valeurs (le thread ne les modifie plus)
+    for( int i = 0; i < METRICS_COUNT; ++i ) retired.values[i] += shard->values[i];
+    for( int h = 0; h < METRICS_HISTOGRAM_COUNT; ++h )
+    {
+        for( int i = 0; i < METRICS_BUCKETS; ++i ) retired.buckets[h][i] += shard->buckets[h][i];
+        retired.sums[h] += shard->sums[h];
+    }
+    memset( shard->values, 0, sizeof( shard->values ) );
+    memset( shard->buckets, 0, sizeof( shard->buckets ) );
+    memset( shard->sums, 0, sizeof( shard->sums ) );
+
+    // Retrait de la liste active et recyclage
+    MetricsShard** previous = &shards;
+    while( *previous != shard ) previous = &( *previous )->next;
+    *previous = shard->next;
+    shard->next = freeShards;
+    freeShards = shard;
+
+    pthread_mutex_unlock( &shardsMutex );
+
+    threadShard = NULL;
+}
+
+
+static void addValue( int64_t* value, int64_t delta )
+{
+    // Un seul ecrivain par bloc : pas besoin d'addition atomique
+    const int64_t current = __atomic_load_n( value, __ATOMIC_RELAXED );
+    __atomic_store_n( value, current + delta, __ATOMIC_RELAXED );
+}
+
+
+static void sumShards( MetricsShard* total )
+{
+    memcpy( total, &retired, sizeof( MetricsShard ) );
+    for( MetricsShard* shard = shards; shard != NULL; shard = shard->next )
+    {
+        for( int i = 0; i < METRICS_COUNT; ++i )
+            total->values[i] += __atomic_load_n( &shard->values[i], __ATOMIC_RELAXED );
+        for( int h = 0; h < METRICS_HISTOGRAM_COUNT; ++h )
+        {
+            for( int i = 0; i < METRICS_BUCKETS; ++i )
+                total->buckets[h][i] += __atomic_load_n( &shard->buckets[h][i], __ATOMIC_RELAXED );
+            total->sums[h] += __atomic_load_n( &shard->sums[h], __ATOMIC_RELAXED );
+        }
+    }
+}
+
+
+static size_t formatHistogram( char* buff, size_t size, const MetricsInfo* info, const uint64_t* buckets,
+                               int64_t sum )
+{
+    const char* separator = info->labels[0] != '\0' ? "," : "";
+    size_t length = 0;
+
+    // Compteurs cumules aux bornes 2^k us (chaque borne est la limite d'un intervalle)
+    uint64_t count = 0;
+    int index = 0;
+    for( int k = 0; k <= METRICS_EXPORT_EXPONENT && length < size; ++k )
+    {
+        const int64_t limit = (int64_t)1 << k;
+        while( index < METRICS_BUCKETS && METRICS_bucketLimit( index ) <= limit ) count += buckets[index++];
+        length += snprintf( buff + length, size - length, "%s_bucket{%s%sle=\"%.6f\"} %llu\n", info->name,
+                            info->labels, separator, (double)limit / 1e6, (unsigned long long)count );
+    }
+    while( index < METRICS_BUCKETS ) count += buckets[index++];
+    if( length < size )
+        length += snprintf( buff + length, size - length, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", info->name,
+                            info->labels, separator, (unsigned long long)count );
+
+    // Somme (secondes) et nombre
+    const char* open = info->labels[0] != '\0' ? "{" : "";
+    const char* close = info->labels[0] != '\0' ? "}" : "";
+    if( length < size )
+        length += snprintf( buff + length, size - length, "%s_sum%s%s%s %.6f\n%s_count%s%s%s %llu\n",
+                            info->name, open, info->labels, close, (double)sum / 1e6,
+                            info->name, open, info->labels, close, (unsigned long long)count );
+
+    return( length );
+}
+
+
+static void* exportFile( void* arg )
+{
+    (void)arg;
+
+    // Reecriture periodique, puis une derniere fois a l'arret
+    while( ! stopExport )
+    {
+        writeFile( exportTarget );
+        for( int elapsed = 0; elapsed < METRICS_PERIOD_MS && ! stopExport; elapsed += 100 ) usleep( 100000 );
+    }
+    writeFile( exportTarget );
+
+    return( NULL );
+}
+
+
+static void* exportUnix( void* arg )
+{
+    (void)arg;
+
+    // Socket d'ecoute (l'ancienne socket d'un serveur arrete est remplacee)
+    struct sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    snprintf( addr.sun_path, sizeof( addr.sun_path ), "%s", exportTarget + strlen( METRICS_UNIX_PREFIX ) );
+    unlink( addr.sun_path );
+
+    const int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd == -1 || bind( fd, (const struct sockaddr*)&addr, sizeof( addr ) ) != 0 || listen( fd, 16 ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Export des métriques sur %s impossible:\n%s\n", addr.sun_path, strerror( errno ) );
+        if( fd != -1 ) close( fd );
+        return( NULL );
+    }
+
+    // Un snapshot par connexion
+    while( ! stopExport )
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if( poll( &pfd, 1, 100 ) <= 0 ) continue;
+
+        const int client = accept( fd, NULL, NULL );
+        if( client == -1 ) continue;
+        char buff[METRICS_SNAPSHOT_SIZE];
+        const size_t size = METRICS_format( buff, sizeof( buff ) );
+        for( size_t sent = 0; sent < size; )
+        {
+            const ssize_t count = write( client, buff + sent, size - sent );
+            if( count <= 0 ) break;
+            sent += (size_t)count;
+        }
+        close( client );
+    }
+
+    close( fd );
+    unlink( addr.sun_path );
+
+    return( NULL );
+}
+
+
+static void writeFile( const char* path )
+{
+    char buff[METRICS_SNAPSHOT_SIZE];
+    const size_t size = METRICS_format( buff, sizeof( buff ) );
+
+    // Fichier temporaire puis rename : un lecteur ne voit jamais de snapshot partiel
+    char tmpPath[512];
+    snprintf( tmpPath, sizeof( tmpPath ), "%s.tmp", path );
+    FILE* file = fopen( tmpPath, "w" );
+    if( file == NULL ) return;
+    const int status = fwrite( buff, 1, size, file ) != size;
+    if( fclose( file ) != 0 || status != 0 || rename( tmpPath, path ) != 0 ) unlink( tmpPath );
+}
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 
@@ -17,6 +18,18 @@ static int decodeXrq( XrqPacket* packet, const unsigned char* buff, size_t buffS
 static int decodeData( DataPacket* packet, const unsigned char* buff, size_t buffSize );
 static int decodeAck( AckPacket* packet, const unsigned char* buff, size_t buffSize );
 static int decodeError( ErrorPacket* packet, const unsigned char* buff, size_t buffSize );
+static int decodeOack( OackPacket* packet, const unsigned char* buff, size_t buffSize );
+
+/** Decodage d'une chaine terminee par '\0' (tronquee a size - 1 caracteres), retourne la position suivante
+ *
+ */
+static size_t decodeString( char* str, size_t size, const unsigned char* buff, size_t buffSize, size_t offset );
+
+/** Decodage d'une liste d'options (paires nom/valeur)
+ *
+ */
+static void decodeOptions( Option* options, size_t* optionCount, const unsigned char* buff, size_t buffSize,
+                           size_t offset );
 
 /** Encodage des donnees specifiques de chaque type de paquet
  *
@@ -25,6 +38,12 @@ static void encodeXrq( XrqPacket* packet, unsigned char* buff, size_t* buffSize
 static void encodeData( DataPacket* packet, unsigned char* buff, size_t* buffSize );
 static void encodeAck( AckPacket* packet, unsigned char* buff, size_t* buffSize );
 static void encodeError( ErrorPacket* packet, unsigned char* buff, size_t* buffSize );
+static void encodeOack( OackPacket* packet, unsigned char* buff, size_t* buffSize );
+
+/** Encodage d'une liste d'options
+ *
+ */
+static void encodeOptions( const Option* options, size_t optionCount, unsigned char* buff, size_t* buffSize );
 
 
 //--- Fonctions publiques --------------------------------------------------------------------------------------
@@ -45,6 +64,7 @@ Packet* PACKET_create( uint16_t code )
             packet->data = (XrqPacket*)malloc( sizeof( XrqPacket ) );
             memset( ( (XrqPacket*)packet->data )->fileName, '\0', FILENAME_SIZE );
             strcpy( ( (XrqPacket*)packet->data )->mode, "octet" );
+            ( (XrqPacket*)packet->data )->optionCount = 0;
             break;
 
         // DATA
@@ -67,6 +87,12 @@ Packet* PACKET_create( uint16_t code )
             memset( ( (ErrorPacket*)packet->data )->errorMsg, '\0', ERROR_SIZE );
             break;
 
+        // OACK
+        case TFTP_OACK:
+            packet->data = (OackPacket*)malloc( sizeof( OackPacket ) );
+            ( (OackPacket*)packet->data )->optionCount = 0;
+            break;
+
         // Code inconnu
         default:
             fprintf( stderr, "Demande de création d'un paquet TFTP avec un code inconnu: %u", code );
@@ -100,6 +126,10 @@ int PACKET_decode( Packet* packet, const unsigned char* buff, size_t buffSize )
         case TFTP_ERROR:
             return( decodeError( (ErrorPacket*)packet->data, buff, buffSize ) );
 
+        // OACK
+        case TFTP_OACK:
+            return( decodeOack( (OackPacket*)packet->data, buff, buffSize ) );
+
         // Code inconnu
         default:
             fprintf( stderr, "Décodage d'un paquet TFTP avec un code inconnu: %u", packet->code );
@@ -144,6 +174,11 @@ int PACKET_encode( Packet* packet, unsigned char* buff, size_t* buffSize )
             encodeError( (ErrorPacket*)packet->data, buff, buffSize );
             break;
 
+        // OACK
+        case TFTP_OACK:
+            encodeOack( (OackPacket*)packet->data, buff, buffSize );
+            break;
+
         // Code inconnu
         default:
             fprintf( stderr, "Encodage d'un paquet TFTP avec un code inconnu: %u", packet->code );
@@ -154,6 +189,53 @@ int PACKET_encode( Packet* packet, unsigned char* buff, size_t* buffSize )
 }
 
 
+size_t PACKET_encodeData( unsigned char* buff, uint16_t blockNum, const unsigned char* bytes, size_t bytesCount )
+{
+    // Encodage du code TFTP
+    const uint16_t netValue = htons( TFTP_DATA );
+    memcpy( buff, &netValue, sizeof( uint16_t ) );
+    size_t size = sizeof( uint16_t );
+
+    // Encodage du numero de bloc
+    const uint16_t netBlockNum = htons( blockNum );
+    memcpy( buff + size, &netBlockNum, sizeof( uint16_t ) );
+    size += sizeof( uint16_t );
+
+    // Encodage des donnees
+    memcpy( buff + size, bytes, bytesCount );
+
+    return( size + bytesCount );
+}
+
+
+const char* PACKET_getOption( const Option* options, size_t optionCount, const char* name )
+{
+    for( size_t i = 0; i < optionCount; ++i )
+    {
+        if( strcasecmp( options[i].name, name ) == 0 ) return( options[i].value );
+    }
+
+    return( NULL );
+}
+
+
+int PACKET_addOption( Option* options, size_t* optionCount, const char* name, const char* value )
+{
+    // Controle de la place disponible (noms et valeurs encodes avec leur zero final)
+    if( *optionCount == MAX_OPTIONS || strlen( name ) >= OPTION_NAME_SIZE || strlen( value ) >= OPTION_VALUE_SIZE )
+        return( 1 );
+    size_t bytes = strlen( name ) + strlen( value ) + 2;
+    for( size_t i = 0; i < *optionCount; ++i ) bytes += strlen( options[i].name ) + strlen( options[i].value ) + 2;
+    if( bytes > OPTIONS_MAX_BYTES ) return( 2 );
+
+    strcpy( options[*optionCount].name, name );
+    strcpy( options[*optionCount].value, value );
+    ++*optionCount;
+
+    return( 0 );
+}
+
+
 void PACKET_destroy( Packet* packet )
 {
     // Si packet valide
@@ -172,25 +254,12 @@ void PACKET_destroy( Packet* packet )
 
 static int decodeXrq( XrqPacket* packet, const unsigned char* buff, size_t buffSize )
 {
-    // Position courante dans le buffer
-    size_t offset = 0;
+    // Decodage du nom du fichier puis du mode d'encodage (jusqu'au caractere '\0')
+    size_t offset = decodeString( packet->fileName, FILENAME_SIZE, buff, buffSize, 0 );
+    offset = decodeString( packet->mode, MODE_SIZE, buff, buffSize, offset );
 
-    // Decodage du nom du fichier (jusqu'au caractere '\0')
-    size_t index = 0;
-    while( offset < buffSize && buff[offset] != '\0' )
-    {
-        packet->fileName[index++] = buff[offset++];
-    }
-    packet->fileName[index] = '\0';
-    ++offset;
-
-    // Decodage du mode d'encodage (jusqu'au caractere '\0')
-    index = 0;
-    while( offset < buffSize && buff[offset] != '\0' )
-    {
-        packet->mode[index++] = buff[offset++];
-    }
-    packet->mode[index] = '\0';
+    // Options eventuelles (RFC 2347)
+    decodeOptions( packet->options, &packet->optionCount, buff, buffSize, offset );
 
     return( 0 );
 }
@@ -268,6 +337,43 @@ static int decodeError( ErrorPacket* packet, const unsigned char* buff, size_t b
 }
 
 
+static int decodeOack( OackPacket* packet, const unsigned char* buff, size_t buffSize )
+{
+    decodeOptions( packet->options, &packet->optionCount, buff, buffSize, 0 );
+
+    return( 0 );
+}
+
+
+static size_t decodeString( char* str, size_t size, const unsigned char* buff, size_t buffSize, size_t offset )
+{
+    // Copie jusqu'au caractere '\0', les caracteres au-dela de la taille du tableau sont ignores
+    size_t index = 0;
+    while( offset < buffSize && buff[offset] != '\0' )
+    {
+        if( index < size - 1 ) str[index++] = buff[offset];
+        ++offset;
+    }
+    str[index] = '\0';
+
+    return( offset + 1 );
+}
+
+
+static void decodeOptions( Option* options, size_t* optionCount, const unsigned char* buff, size_t buffSize,
+                           size_t offset )
+{
+    *optionCount = 0;
+    while( offset < buffSize && *optionCount < MAX_OPTIONS )
+    {
+        Option* option = &options[*optionCount];
+        offset = decodeString( option->name, OPTION_NAME_SIZE, buff, buffSize, offset );
+        offset = decodeString( option->value, OPTION_VALUE_SIZE, buff, buffSize, offset );
+        if( option->name[0] != '\0' ) ++*optionCount;
+    }
+}
+
+
 static void encodeXrq( XrqPacket* packet, unsigned char* buff, size_t* buffSize )
 {
     // Encodage du chemin du fichier
@@ -279,6 +385,9 @@ static void encodeXrq( XrqPacket* packet, unsigned char* buff, size_t* buffSize
     const size_t modeLength = strlen( packet->mode ) + 1;
     memcpy( buff + *buffSize, packet->mode, modeLength );
     *buffSize += modeLength;
+
+    // Encodage des options
+    encodeOptions( packet->options, packet->optionCount, buff, buffSize );
 }
 
 
@@ -316,3 +425,25 @@ static void encodeError( ErrorPacket* packet, unsigned char* buff, size_t* buffS
     memcpy( buff + *buffSize, packet->errorMsg, msgLength );
     *buffSize += msgLength;
 }
+
+
+static void encodeOack( OackPacket* packet, unsigned char* buff, size_t* buffSize )
+{
+    encodeOptions( packet->options, packet->optionCount, buff, buffSize );
+}
+
+
+static void encodeOptions( const Option* options, size_t optionCount, unsigned char* buff, size_t* buffSize )
+{
+    for( size_t i = 0; i < optionCount; ++i )
+    {
+        // Nom puis valeur, chacun termine par '\0'
+        const size_t nameLength = strlen( options[i].name ) + 1;
+        memcpy( buff + *buffSize, options[i].name, nameLength );
+        *buffSize += nameLength;
+
+        const size_t valueLength = strlen( options[i].value ) + 1;
+        memcpy( buff + *buffSize, options[i].value, valueLength );
+        *buffSize += valueLength;
+    }
+}
@@ -0,0 +1,253 @@
+// O_DIRECT
+#define _GNU_SOURCE
+
+#include "tftp/reader.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Local
+#include "tftp/packet.h"
+#include "tftp/log.h"
+
+
+// Distance de lecture anticipee (octets)
+static off_t prefetchDistance = (off_t)READER_DEFAULT_PREFETCH * DATA_SIZE;
+
+// Taille de fichier a partir de laquelle la lecture est directe (0 : jamais)
+static off_t directThreshold = 0;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Chargement du tampon contenant la position specifiee
+ *
+ */
+static int loadChunk( Reader* reader, off_t offset );
+
+/** Demande de lecture anticipee jusqu'a la distance configuree devant la position specifiee
+ *
+ */
+static void prefetch( Reader* reader, off_t offset );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void READER_setPrefetchDistance( size_t blocks )
+{
+    prefetchDistance = (off_t)blocks * DATA_SIZE;
+}
+
+
+void READER_setDirectThreshold( off_t size )
+{
+    directThreshold = size;
+}
+
+
+Reader* READER_open( const char* fileName )
+{
+    // Ouverture du fichier
+    int fd = open( fileName, O_RDONLY );
+    if( fd == -1 ) return( NULL );
+
+    // Recuperation de la taille du fichier
+    struct stat fileInfo;
+    if( fstat( fd, &fileInfo ) != 0 )
+    {
+        close( fd );
+        return( NULL );
+    }
+
+    // Allocation de la struture de donnees
+    Reader* reader = (Reader*)malloc( sizeof( Reader ) );
+    reader->fd = fd;
+    reader->size = fileInfo.st_size;
+    reader->direct = 0;
+    reader->chunkOffset = 0;
+    reader->chunkSize = 0;
+    reader->prefetched = 0;
+
+    // Gros fichier : lecture directe si le systeme de fichiers l'accepte, et si le fichier rouvert est bien celui
+    // dont la taille est connue (pas remplace entre les deux ouvertures)
+    if( directThreshold > 0 && fileInfo.st_size >= directThreshold )
+    {
+        struct stat directInfo;
+        int directFd = open( fileName, O_RDONLY | O_DIRECT );
+        if( directFd != -1 && ( fstat( directFd, &directInfo ) != 0 || directInfo.st_dev != fileInfo.st_dev
+                                || directInfo.st_ino != fileInfo.st_ino ) )
+        {
+            close( directFd );
+            directFd = -1;
+        }
+        if( directFd != -1 )
+        {
+            close( fd );
+            fd = directFd;
+            reader->fd = fd;
+            reader->direct = 1;
+        }
+    }
+
+    // Allocation du tampon aligne
+    reader->chunkCapacity = reader->direct ? READER_DIRECT_CHUNK_SIZE : READER_CHUNK_SIZE;
+    if( posix_memalign( (void**)&reader->chunk, READER_ALIGNMENT, reader->chunkCapacity ) != 0 )
+    {
+        close( fd );
+        free( reader );
+        return( NULL );
+    }
+
+    // Lecture sequentielle : le noyau double sa fenetre de lecture anticipee (inutile sans cache)
+    if( ! reader->direct )
+    {
+        posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+        prefetch( reader, 0 );
+    }
+
+    return( reader );
+}
+
+
+ssize_t READER_read( Reader* reader, off_t offset, void* data, size_t size )
+{
+    size_t count = 0;
+    while( count < size && offset < reader->size )
+    {
+        // Chargement du tampon si la position n'y est pas
+        if( offset < reader->chunkOffset || offset >= reader->chunkOffset + (off_t)reader->chunkSize )
+        {
+            if( loadChunk( reader, offset ) != 0 ) return( -1 );
+            if( reader->chunkSize == 0 ) break;
+        }
+
+        // Copie depuis le tampon
+        const size_t position = (size_t)( offset - reader->chunkOffset );
+        size_t length = reader->chunkSize - position;
+        if( length > size - count ) length = size - count;
+        memcpy( (unsigned char*)data + count, reader->chunk + position, length );
+        count += length;
+        offset += (off_t)length;
+    }
+
+    return( (ssize_t)count );
+}
+
+
+ssize_t READER_pread( const Reader* reader, off_t offset, void* data, size_t size )
+{
+    if( offset >= reader->size ) return( 0 );
+    if( (off_t)size > reader->size - offset ) size = (size_t)( reader->size - offset );
+
+    // Zone alignee contenant les octets demandes (lecture directe)
+    const off_t start = offset - offset % READER_ALIGNMENT;
+    const size_t position = (size_t)( offset - start );
+    const size_t length = ( position + size + READER_ALIGNMENT - 1 ) / READER_ALIGNMENT * READER_ALIGNMENT;
+    unsigned char* buffer = NULL;
+    if( posix_memalign( (void**)&buffer, READER_ALIGNMENT, length ) != 0 ) return( -1 );
+
+    size_t count = 0;
+    while( count < length )
+    {
+        const ssize_t status = pread( reader->fd, buffer + count, length - count, start + (off_t)count );
+        if( status == -1 )
+        {
+            if( errno == EINTR ) continue;
+            LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec de lecture : %s", strerror( errno ) );
+            free( buffer );
+            return( -1 );
+        }
+        if( status == 0 ) break;
+        count += (size_t)status;
+        if( count % READER_ALIGNMENT != 0 ) break;
+    }
+
+    // Octets demandes presents dans la zone lue
+    size_t copied = count > position ? count - position : 0;
+    if( copied > size ) copied = size;
+    memcpy( data, buffer + position, copied );
+    free( buffer );
+
+    return( (ssize_t)copied );
+}
+
+
+void READER_close( Reader* reader )
+{
+    // Si lecteur valide
+    if( reader != NULL )
+    {
+        close( reader->fd );
+        free( reader->chunk );
+        free( reader );
+    }
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static int loadChunk( Reader* reader, off_t offset )
+{
+    // Tampon aligne sur sa taille
+    const size_t capacity = reader->chunkCapacity;
+    const off_t chunkOffset = offset - offset % (off_t)capacity;
+
+    // La lecture anticipee reste devant la position lue
+    if( ! reader->direct ) prefetch( reader, chunkOffset );
+
+    // Lecture du tampon. En lecture directe, position et taille restent alignees : seule la lecture de la fin
+    // du fichier est partielle
+    size_t count = 0;
+    while( count < capacity )
+    {
+        const ssize_t status = pread( reader->fd, reader->chunk + count, capacity - count,
+                                      chunkOffset + (off_t)count );
+        if( status == -1 )
+        {
+            if( errno == EINTR ) continue;
+
+            // Lecture directe refusee par le systeme de fichiers : retour a la lecture par le cache
+            if( errno == EINVAL && reader->direct && fcntl( reader->fd, F_SETFL, 0 ) == 0 )
+            {
+                reader->direct = 0;
+                continue;
+            }
+            LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec de lecture : %s", strerror( errno ) );
+            reader->chunkSize = 0;
+            return( 1 );
+        }
+        if( status == 0 ) break;
+        count += (size_t)status;
+        if( reader->direct && count % READER_ALIGNMENT != 0 ) break;
+    }
+
+    reader->chunkOffset = chunkOffset;
+    reader->chunkSize = count;
+
+    return( 0 );
+}
+
+
+static void prefetch( Reader* reader, off_t offset )
+{
+    if( prefetchDistance == 0 ) return;
+
+    // Fin de la zone a demander
+    off_t end = offset + READER_CHUNK_SIZE + prefetchDistance;
+    if( end > reader->size ) end = reader->size;
+
+    // Demande par paquets d'au moins un quart de la distance (limite le nombre d'appels systeme)
+    if( end - reader->prefetched < prefetchDistance / 4 && end < reader->size ) return;
+    if( end <= reader->prefetched ) return;
+
+    // WILLNEED ne fait que mettre les lectures en file : l'appel ne bloque pas sur le disque
+    const off_t start = reader->prefetched > offset ? reader->prefetched : offset;
+    posix_fadvise( reader->fd, start, end - start, POSIX_FADV_WILLNEED );
+    reader->prefetched = end;
+}
@@ -0,0 +1,79 @@
+#include "tftp/reorder.h"
+
+// System
+#include <stdlib.h>
+#include <string.h>
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+Reorder* REORDER_create( size_t blockSize, uint16_t blocks )
+{
+    // Nombre d'emplacements arrondi a la puissance de 2 superieure
+    uint16_t slots = 1;
+    while( slots <= blocks && slots < REORDER_HALF_RANGE ) slots *= 2;
+
+    Reorder* reorder = (Reorder*)calloc( 1, sizeof( Reorder ) );
+    if( reorder == NULL ) return( NULL );
+    reorder->blockSize = blockSize;
+    reorder->slots = slots;
+    reorder->bytes = (unsigned char*)malloc( slots * blockSize );
+    reorder->counts = (size_t*)calloc( slots, sizeof( size_t ) );
+    reorder->used = (unsigned char*)calloc( slots, 1 );
+    if( reorder->bytes == NULL || reorder->counts == NULL || reorder->used == NULL )
+    {
+        REORDER_destroy( reorder );
+        return( NULL );
+    }
+
+    return( reorder );
+}
+
+
+int REORDER_hold( Reorder* reorder, uint16_t expected, uint16_t blockNum, const unsigned char* bytes,
+                  size_t count )
+{
+    // Emplacement du bloc attendu jamais occupe : blocs expected + 1 a expected + slots - 1
+    const uint16_t ahead = (uint16_t)( blockNum - expected );
+    if( ahead == 0 || ahead >= reorder->slots || count > reorder->blockSize ) return( REORDER_TOO_FAR );
+
+    const size_t slot = blockNum & ( reorder->slots - 1 );
+    if( reorder->used[slot] ) return( REORDER_DUPLICATE );
+    memcpy( reorder->bytes + slot * reorder->blockSize, bytes, count );
+    reorder->counts[slot] = count;
+    reorder->used[slot] = 1;
+    ++reorder->held;
+
+    return( REORDER_HELD );
+}
+
+
+const unsigned char* REORDER_take( Reorder* reorder, uint16_t blockNum, size_t* count )
+{
+    const size_t slot = blockNum & ( reorder->slots - 1 );
+    if( reorder->held == 0 || ! reorder->used[slot] ) return( NULL );
+    reorder->used[slot] = 0;
+    --reorder->held;
+    *count = reorder->counts[slot];
+
+    return( reorder->bytes + slot * reorder->blockSize );
+}
+
+
+void REORDER_clear( Reorder* reorder )
+{
+    memset( reorder->used, 0, reorder->slots );
+    reorder->held = 0;
+}
+
+
+void REORDER_destroy( Reorder* reorder )
+{
+    if( reorder != NULL )
+    {
+        free( reorder->used );
+        free( reorder->counts );
+        free( reorder->bytes );
+        free( reorder );
+    }
+}
@@ -0,0 +1,217 @@
+#include "tftp/resume.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Local
+#include "tftp/packet.h"
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Ouverture du fichier local : a la suite des octets enregistres si la reprise est possible, vide sinon
+ *
+ */
+static FILE* openLocal( ResumeState* state, const char* localPath, int64_t* size );
+
+/** Lecture du fichier de reprise (0 s'il concerne remoteName)
+ *
+ */
+static int loadSidecar( const char* path, const char* remoteName, int64_t* size, uint64_t* verified );
+
+/** Ecriture du fichier de reprise (fichier temporaire renomme : jamais de fichier de reprise incomplet)
+ *
+ */
+static int saveSidecar( const char* path, const char* remoteName, int64_t size, uint64_t verified );
+
+/** Suivi de progression : ecriture sur disque des octets recus, puis enregistrement
+ *
+ */
+static void saveProgress( void* context, uint64_t bytes, int64_t size );
+
+/** Echec transitoire (un get ulterieur peut reprendre)
+ *
+ */
+static int isTransient( const XferResult* result );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+FILE* RESUME_open( ResumeState* state, const char* remoteName, const char* localPath,
+                   const XferOptions* options, XferOptions* current, XferResult* result )
+{
+    memset( state, 0, sizeof( *state ) );
+    state->remoteName = remoteName;
+    state->localPath = localPath;
+    if( (size_t)snprintf( state->path, sizeof( state->path ), "%s%s", localPath, RESUME_SUFFIX )
+        >= sizeof( state->path ) )
+        state->path[0] = '\0';
+
+    int64_t size = -1;
+    state->file = openLocal( state, localPath, &size );
+    if( state->file == NULL )
+    {
+        memset( result, 0, sizeof( *result ) );
+        result->error = XFER_ERR_LOCAL;
+        snprintf( result->message, sizeof( result->message ), "Impossible d'ouvrir le fichier local" );
+        fprintf( stderr, "ERREUR - Impossible d'ouvrir le fichier local: %s\n", localPath );
+        return( NULL );
+    }
+
+    // Reprise a la suite des octets enregistres, refusee si la taille du fichier distant a change
+    if( options != NULL ) *current = *options;
+    else XFER_initOptions( current );
+    current->offset = state->verified;
+    current->expectedSize = size;
+    if( state->path[0] != '\0' )
+    {
+        current->progress = saveProgress;
+        current->context = state;
+    }
+    if( state->verified > 0 )
+        fprintf( stdout, "Reprise de %s à l'octet %llu\n", localPath, (unsigned long long)state->verified );
+
+    return( state->file );
+}
+
+
+int RESUME_close( ResumeState* state, int status, XferResult* result )
+{
+    if( fclose( state->file ) != 0 && status == 0 )
+    {
+        result->error = XFER_ERR_LOCAL;
+        snprintf( result->message, sizeof( result->message ), "Echec d'écriture" );
+        status = 1;
+    }
+    state->file = NULL;
+    if( status == 0 )
+    {
+        if( state->path[0] != '\0' ) unlink( state->path );
+        return( 0 );
+    }
+
+    // Fichier partiel conserve si des octets sont enregistres et qu'une reprise peut aboutir
+    if( state->verified > 0 && isTransient( result ) )
+    {
+        fprintf( stderr, "Fichier partiel conservé : %s (%llu octets, reprise au prochain get)\n", state->localPath,
+                 (unsigned long long)state->verified );
+    }
+    else
+    {
+        unlink( state->localPath );
+        if( state->path[0] != '\0' ) unlink( state->path );
+    }
+
+    return( 2 );
+}
+
+
+int RESUME_get( Sock* sock, const Addr* server, const char* remoteName, const char* localPath,
+                const XferOptions* options, XferResult* result )
+{
+    ResumeState state;
+    XferOptions current;
+    FILE* file = RESUME_open( &state, remoteName, localPath, options, &current, result );
+    if( file == NULL ) return( 1 );
+
+    return( RESUME_close( &state, XFER_get( sock, server, remoteName, file, &current, result ), result ) );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static FILE* openLocal( ResumeState* state, const char* localPath, int64_t* size )
+{
+    // Fichier partiel au moins aussi long que les octets enregistres : octets suivants (non enregistres) supprimes
+    uint64_t verified = 0;
+    if( state->path[0] != '\0' && loadSidecar( state->path, state->remoteName, size, &verified ) == 0 && verified > 0 )
+    {
+        FILE* file = fopen( localPath, "r+b" );
+        struct stat st;
+        if( file != NULL && fstat( fileno( file ), &st ) == 0 && (uint64_t)st.st_size >= verified
+            && ftruncate( fileno( file ), (off_t)verified ) == 0 && fseeko( file, (off_t)verified, SEEK_SET ) == 0 )
+        {
+            state->verified = verified;
+            return( file );
+        }
+        if( file != NULL ) fclose( file );
+    }
+
+    // Pas de reprise possible : fichier entier
+    *size = -1;
+    state->verified = 0;
+    if( state->path[0] != '\0' ) unlink( state->path );
+
+    return( fopen( localPath, "wb" ) );
+}
+
+
+static int loadSidecar( const char* path, const char* remoteName, int64_t* size, uint64_t* verified )
+{
+    FILE* sidecar = fopen( path, "r" );
+    if( sidecar == NULL ) return( 1 );
+
+    // Une cle par ligne : remote, size, verified
+    int found = 0;
+    char line[FILENAME_SIZE + 16];
+    while( fgets( line, sizeof( line ), sidecar ) != NULL )
+    {
+        line[strcspn( line, "\r\n" )] = '\0';
+        if( strncmp( line, "remote ", 7 ) == 0 && strcmp( line + 7, remoteName ) == 0 ) found |= 1;
+        else if( strncmp( line, "size ", 5 ) == 0 )
+        {
+            *size = strtoll( line + 5, NULL, 10 );
+            found |= 2;
+        }
+        else if( strncmp( line, "verified ", 9 ) == 0 )
+        {
+            *verified = strtoull( line + 9, NULL, 10 );
+            found |= 4;
+        }
+    }
+    fclose( sidecar );
+
+    return( found == 7 ? 0 : 2 );
+}
+
+
+static int saveSidecar( const char* path, const char* remoteName, int64_t size, uint64_t verified )
+{
+    char tmpPath[RESUME_PATH_SIZE + 8];
+    snprintf( tmpPath, sizeof( tmpPath ), "%s.tmp", path );
+    FILE* sidecar = fopen( tmpPath, "w" );
+    if( sidecar == NULL ) return( 1 );
+
+    fprintf( sidecar, "remote %s\nsize %lld\nverified %llu\n", remoteName, (long long)size,
+             (unsigned long long)verified );
+    if( fflush( sidecar ) != 0 || fsync( fileno( sidecar ) ) != 0 )
+    {
+        fclose( sidecar );
+        unlink( tmpPath );
+        return( 2 );
+    }
+    fclose( sidecar );
+
+    return( rename( tmpPath, path ) != 0 ? 3 : 0 );
+}
+
+
+static void saveProgress( void* context, uint64_t bytes, int64_t size )
+{
+    ResumeState* state = (ResumeState*)context;
+
+    // Enregistrement apres l'ecriture sur disque : le fichier de reprise ne depasse jamais le fichier local
+    if( fflush( state->file ) != 0 || fdatasync( fileno( state->file ) ) != 0 ) return;
+    if( saveSidecar( state->path, state->remoteName, size, bytes ) == 0 ) state->verified = bytes;
+}
+
+
+static int isTransient( const XferResult* result )
+{
+    return( result->error == XFER_ERR_TIMEOUT || result->error == XFER_ERR_SOCKET
+            || ( result->error == XFER_ERR_SERVER && result->errorCode == ERR_UNDEFINED ) );
+}
@@ -0,0 +1,214 @@
+#include "tftp/segment.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+// Local
+#include "tftp/packet.h"
+#include "tftp/metrics.h"
+#include "tftp/resume.h"
+#include "tftp/async.h"
+
+
+/** Segment d'une lecture, transfert de la boucle d'evenements
+ *
+ */
+typedef struct
+{
+    XferOptions options;                // Plage du segment (offset, length) et taille attendue
+    XferResult result;                  // Resultat du segment
+    int status;                         // 0 si le segment a ete recu en entier
+} Segment;
+
+// Segments d'une lecture
+static int segmentCount = SEGMENT_DEFAULT_COUNT;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Fin de la lecture d'un segment
+ *
+ */
+static void onSegmentDone( XferSession* session, void* context );
+
+/** Allocation de la taille finale du fichier local (les segments ecrivent dans des blocs deja alloues)
+ *
+ */
+static int preallocate( FILE* file, int64_t size );
+
+/** Plages non gerees par le serveur : repli sur la lecture en un seul transfert
+ *
+ */
+static int isRangeRefused( const XferResult* result );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void SEGMENT_setCount( int count )
+{
+    if( count >= 1 && count <= SEGMENT_MAX_COUNT ) segmentCount = count;
+}
+
+
+int SEGMENT_getCount()
+{
+    return( segmentCount );
+}
+
+
+int SEGMENT_get( Sock* sock, const Addr* server, const char* remoteName, const char* localPath,
+                 const XferOptions* options, XferResult* result )
+{
+    const int64_t start = METRICS_now();
+    XferOptions defaults;
+    XFER_initOptions( &defaults );
+    if( options == NULL ) options = &defaults;
+
+    FILE* file = fopen( localPath, "wb" );
+    if( file == NULL )
+    {
+        memset( result, 0, sizeof( *result ) );
+        result->error = XFER_ERR_LOCAL;
+        snprintf( result->message, sizeof( result->message ), "Impossible d'ouvrir le fichier local" );
+        fprintf( stderr, "ERREUR - Impossible d'ouvrir le fichier local: %s\n", localPath );
+        return( 1 );
+    }
+
+    // Taille du fichier : plage vide, avec tsize
+    XferOptions probe = *options;
+    probe.offset = 0;
+    probe.length = 0;
+    probe.progress = NULL;
+    int status = XFER_get( sock, server, remoteName, file, &probe, result );
+    const int64_t size = result->size;
+    if( status != 0 || size < 0 )
+    {
+        fclose( file );
+        if( status == 0 || isRangeRefused( result ) )
+        {
+            fprintf( stdout, "Segments non gérés par le serveur : lecture en un seul transfert\n" );
+            return( RESUME_get( sock, server, remoteName, localPath, options, result ) );
+        }
+        unlink( localPath );
+        return( 2 );
+    }
+
+    // Nombre de segments : au plus un par SEGMENT_MIN_SIZE octets
+    int count = segmentCount;
+    if( size / SEGMENT_MIN_SIZE < count ) count = size / SEGMENT_MIN_SIZE > 0 ? (int)( size / SEGMENT_MIN_SIZE ) : 1;
+    if( preallocate( file, size ) != 0 )
+    {
+        fclose( file );
+        unlink( localPath );
+        result->error = XFER_ERR_LOCAL;
+        snprintf( result->message, sizeof( result->message ), "Espace disque insuffisant" );
+        fprintf( stderr, "ERREUR - Espace disque insuffisant: %s\n", localPath );
+        return( 3 );
+    }
+
+    // Segments lus ensemble par la boucle d'evenements (une socket par segment, ecritures par pwrite)
+    Segment segments[SEGMENT_MAX_COUNT];
+    AsyncLoop* loop = ASYNC_create();
+    for( int i = 0; i < count; ++i )
+    {
+        Segment* segment = &segments[i];
+        memset( segment, 0, sizeof( *segment ) );
+        segment->options = *options;
+        segment->options.offset = (uint64_t)( size * i / count );
+        segment->options.length = size * ( i + 1 ) / count - (int64_t)segment->options.offset;
+        segment->options.expectedSize = size;
+        segment->options.progress = NULL;
+        segment->status = 1;
+        if( loop == NULL
+            || ASYNC_get( loop, server, remoteName, file, &segment->options, onSegmentDone, segment ) == NULL )
+        {
+            segment->result.error = XFER_ERR_SOCKET;
+            snprintf( segment->result.message, sizeof( segment->result.message ), "Création de la socket impossible" );
+        }
+    }
+    if( loop != NULL ) ASYNC_run( loop );
+    ASYNC_destroy( loop );
+
+    // Bilan : octets et renvois de tous les segments, cause du premier echec
+    memset( result, 0, sizeof( *result ) );
+    result->size = size;
+    result->length = -1;
+    result->negotiated = 1;
+    int failed = -1;
+    for( int i = 0; i < count; ++i )
+    {
+        const XferResult* part = &segments[i].result;
+        result->bytes += part->bytes;
+        result->retransmits += part->retransmits;
+        result->negotiated &= part->negotiated;
+        if( segments[i].status != 0 && failed == -1 ) failed = i;
+    }
+    result->blockSize = segments[0].result.blockSize;
+    result->windowSize = segments[0].result.windowSize;
+    if( failed != -1 )
+    {
+        result->error = segments[failed].result.error;
+        result->errorCode = segments[failed].result.errorCode;
+        memcpy( result->message, segments[failed].result.message, sizeof( result->message ) );
+    }
+    if( fclose( file ) != 0 && failed == -1 )
+    {
+        result->error = XFER_ERR_LOCAL;
+        snprintf( result->message, sizeof( result->message ), "Echec d'écriture" );
+        failed = 0;
+    }
+    result->duration = METRICS_now() - start;
+
+    // Echec d'un segment : pas de fichier incomplet
+    if( failed != -1 )
+    {
+        unlink( localPath );
+        return( 4 );
+    }
+    fprintf( stdout, "%s : %d segment(s)\n", localPath, count );
+
+    return( 0 );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void onSegmentDone( XferSession* session, void* context )
+{
+    Segment* segment = (Segment*)context;
+    segment->result = session->result;
+    segment->status = session->state == XFER_DONE ? 0 : 1;
+
+    // Plage recue en entier (le serveur peut la raccourcir si le fichier a change)
+    if( segment->status == 0 && segment->result.bytes != (uint64_t)segment->options.length )
+    {
+        segment->result.error = XFER_ERR_PROTOCOL;
+        snprintf( segment->result.message, sizeof( segment->result.message ), "Segment incomplet" );
+        fprintf( stderr, "ERREUR - Segment incomplet : %llu octets sur %lld\n",
+                 (unsigned long long)segment->result.bytes, (long long)segment->options.length );
+        segment->status = 2;
+    }
+}
+
+
+static int preallocate( FILE* file, int64_t size )
+{
+    // Systeme de fichiers sans allocation anticipee : fichier etendu (creux)
+    const int status = posix_fallocate( fileno( file ), 0, (off_t)size );
+    if( status == 0 ) return( 0 );
+    if( status != EOPNOTSUPP && status != EINVAL ) return( 1 );
+
+    return( ftruncate( fileno( file ), (off_t)size ) == 0 ? 0 : 2 );
+}
+
+
+static int isRangeRefused( const XferResult* result )
+{
+    return( result->error == XFER_ERR_PROTOCOL
+            || ( result->error == XFER_ERR_SERVER && result->errorCode == ERR_OPTION_REFUSED ) );
+}
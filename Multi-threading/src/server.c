@@ -5,10 +5,36 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 
 // Local
 #include "tftp/tftp.h"
 #include "tftp/packet.h"
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+#include "tftp/trace.h"
+
+// Demande d'arret du serveur (positionnee par SIGINT/SIGTERM)
+static volatile sig_atomic_t stopRequested = 0;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Gestionnaire de SIGINT/SIGTERM
+ *
+ */
+static void onStopSignal( int sig );
+
+/** Confrontation de l'index charge depuis le snapshot avec le disque (thread de fond)
+ *
+ */
+static void* reconcileIndex( void* arg );
+
+/** Attente de la fin des services en cours
+ *
+ */
+static void waitServices( Server* srv );
+
 
 //--- Fonctions publiques --------------------------------------------------------------------------------------
 
@@ -17,6 +43,9 @@ Server* SERVER_create( uint16_t port )
     // Allocation de la struture de donnees
     Server* srv= (Server*)malloc( sizeof( Server ) );
     srv->sock = NULL;
+    srv->avl = NULL;
+    pthread_mutex_init( &srv->avl_mutex, NULL );
+    strcpy( srv->indexPath, FILEAVL_INDEX_FILE );
 
     for( int i = 0; i < MAX_NB_THREADS; ++i )
         srv->listService[i] = SERVICE_createEmpty();
@@ -33,40 +62,99 @@ Server* SERVER_create( uint16_t port )
 }
 
 
+void SERVER_setIndexPath( Server* srv, const char* indexPath )
+{
+    snprintf( srv->indexPath, sizeof( srv->indexPath ), "%s", indexPath );
+}
+
+
 void SERVER_run( Server* srv )
 {
     // Index du thread
     int index = -1;
 
-    // Création de l'AVL
-    FileAVL *avl = FILEAVL_create();
-    if (!avl) return;
+    // Numero de la derniere requete
+    uint64_t lastId = 0;
+
+    // Interruption de l'attente des requetes par SIGINT/SIGTERM (pas de SA_RESTART)
+    struct sigaction action;
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = onStopSignal;
+    sigemptyset( &action.sa_mask );
+    sigaction( SIGINT, &action, NULL );
+    sigaction( SIGTERM, &action, NULL );
+
+    // Les signaux d'arret (et la bascule des traces) ne sont traites que par ce thread : les services en
+    // heritent le masque
+    sigset_t stopSignals;
+    sigemptyset( &stopSignals );
+    sigaddset( &stopSignals, SIGINT );
+    sigaddset( &stopSignals, SIGTERM );
+    sigaddset( &stopSignals, SIGUSR1 );
+
+    // Journal asynchrone (thread de fond)
+    pthread_sigmask( SIG_BLOCK, &stopSignals, NULL );
+    LOG_start();
+    pthread_sigmask( SIG_UNBLOCK, &stopSignals, NULL );
 
-    // Création du mutex spécifique à l'AVL
-    pthread_mutex_t avl_mutex;
-    pthread_mutex_init(&avl_mutex, NULL);
+    // Traces binaires des sessions (thread de fond)
+    pthread_sigmask( SIG_BLOCK, &stopSignals, NULL );
+    TRACE_start();
+    pthread_sigmask( SIG_UNBLOCK, &stopSignals, NULL );
+
+    // Création de l'AVL : depuis le snapshot si possible, le disque est confronte en tache de fond
+    pthread_t reconcileThread;
+    int reconciling = 0;
+    if( srv->indexPath[0] != '\0' ) srv->avl = FILEAVL_load( srv->indexPath );
+    if( srv->avl != NULL )
+    {
+        LOG_write( LOG_INFO, LOG_NO_BLOCK, "Index chargé depuis %s", srv->indexPath );
+        pthread_sigmask( SIG_BLOCK, &stopSignals, NULL );
+        reconciling = pthread_create( &reconcileThread, NULL, reconcileIndex, (void*)srv ) == 0;
+        pthread_sigmask( SIG_UNBLOCK, &stopSignals, NULL );
+    }
+    else srv->avl = FILEAVL_create();
+
+    // Export des metriques (thread de fond)
+    pthread_sigmask( SIG_BLOCK, &stopSignals, NULL );
+    METRICS_startExport();
+    pthread_sigmask( SIG_UNBLOCK, &stopSignals, NULL );
 
     // Boucle de traitement des requetes entrantes (soit RRQ, soit WRQ)
-    fprintf( stdout, "INFO - Serveur en attente de requêtes sur le port %u\n", srv->sock->addr->port );
-    while( 1 )
+    LOG_write( LOG_INFO, LOG_NO_BLOCK, "Serveur en attente de requêtes sur le port %u", srv->sock->addr->port );
+    while( ! stopRequested )
     {
         // Attente d'une requete sur la socket
         Addr* cltAddr = ADDR_create();
         Packet* request = TFTP_recvPacket( srv->sock, cltAddr );
-        fprintf( stdout, "INFO - Requête reçue (code = %u)\n", request->code );
+        if( request == NULL || request == TIMEOUT )
+        {
+            // Paquet invalide ou interruption par un signal
+            ADDR_destroy( cltAddr );
+            continue;
+        }
+        const int64_t received = METRICS_now();
+        LOG_write( LOG_INFO, LOG_NO_BLOCK, "Requête reçue (code = %u)", request->code );
+        METRICS_add( request->code == TFTP_RRQ ? METRICS_REQUESTS_RRQ
+                     : request->code == TFTP_WRQ ? METRICS_REQUESTS_WRQ : METRICS_REQUESTS_OTHER, 1 );
 
         // Lock des mutex pour les variables flag dans chaque service
         for( int i = 0; i < MAX_NB_THREADS; ++i )
         {
             pthread_mutex_lock( &srv->listService[i]->mutex );
         }
-        // On parcour la liste de thread pour trouver un thread disponible
+        // On parcour la liste de thread pour trouver un thread disponible, et un service deja lance pour le meme
+        // client (requete dupliquee par le reseau ou renvoyee : le service renvoie lui-meme sa reponse)
+        int duplicate = 0;
         for( int i = 0; i < MAX_NB_THREADS; ++i )
         {
             if( srv->listService[i]->flag )
             {
-                index = i;
-                break;
+                if( index == -1 ) index = i;
+            }
+            else if( srv->listService[i]->addr != NULL && ADDR_equals( srv->listService[i]->addr, cltAddr ) )
+            {
+                duplicate = 1;
             }
         }
         // Unlock des mutex pour les variables flag dans chaque service
@@ -75,33 +163,80 @@ void SERVER_run( Server* srv )
             pthread_mutex_unlock( &srv->listService[i]->mutex );
         }
         
+        // Requete d'un transfert en cours
+        if( duplicate )
+        {
+            LOG_write( LOG_WARN, LOG_NO_BLOCK, "Requête d'un transfert en cours (port client %u). Ignorer la requête.",
+                       cltAddr->port );
+            ADDR_destroy( cltAddr );
+            PACKET_destroy( request );
+            index = -1;
+        }
         // Si aucun thread n'est disponible alors 
-        if( index == -1 )
+        else if( index == -1 )
         {
             // Si le nombre maximal de threads est atteint on ignore la requete
-            fprintf( stderr, "Nombre maximal de threads atteint. Ignorer la requête.\n" );
+            LOG_write( LOG_WARN, LOG_NO_BLOCK, "Nombre maximal de threads atteint. Ignorer la requête." );
+            METRICS_add( METRICS_DROPPED_REQUESTS, 1 );
             ADDR_destroy( cltAddr );
             PACKET_destroy( request );
         }
         else
         {
-            // Creation d'un service
-            srv->listService[index] = SERVICE_create( 0 , &avl);
+            // Creation d'un service (echec : requete ignoree, l'ancien service libre reste en place)
+            Service* service = SERVICE_create( 0 , &srv->avl);
+            if( service == NULL )
+            {
+                LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Création du service impossible. Ignorer la requête." );
+                METRICS_add( METRICS_DROPPED_REQUESTS, 1 );
+                ADDR_destroy( cltAddr );
+                PACKET_destroy( request );
+                index = -1;
+                continue;
+            }
+            srv->listService[index] = service;
 
             // Attribution du mutex de l'AVL
-            srv->listService[index]->avl_mutex = &avl_mutex;
+            srv->listService[index]->avl_mutex = &srv->avl_mutex;
             
             // Attribution de l'adresse et d'un paquet
             srv->listService[index]->addr = cltAddr;
             srv->listService[index]->packet = request;
+            srv->listService[index]->received = received;
+            srv->listService[index]->id = ++lastId;
+            TRACE_setSession( lastId );
+            TRACE_record( TRACE_REQUEST, 0, request->code );
+            TRACE_setSession( 0 );
 
             // Creation d'un thread
-            pthread_create( &srv->listService[index]->thread, NULL, SERVICE_ProcessRequest, (void*)srv->listService[index] );
+            pthread_sigmask( SIG_BLOCK, &stopSignals, NULL );
+            const int created = pthread_create( &srv->listService[index]->thread, NULL, SERVICE_ProcessRequest,
+                                                (void*)srv->listService[index] );
+            pthread_sigmask( SIG_UNBLOCK, &stopSignals, NULL );
+
+            // Thread non cree : service de nouveau libre (sinon attendu indefiniment a l'arret)
+            if( created != 0 )
+            {
+                LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Création du thread impossible : %s", strerror( created ) );
+                SERVICE_destroy( srv->listService[index] );
+                srv->listService[index] = SERVICE_createEmpty();
+            }
 
             index = -1;
         }
     }
-    FILEAVL_destroy(avl);
+
+    // Arret : fin des transferts en cours puis ecriture du snapshot
+    LOG_write( LOG_INFO, LOG_NO_BLOCK, "Arrêt du serveur" );
+    if( reconciling ) pthread_join( reconcileThread, NULL );
+    waitServices( srv );
+    METRICS_stopExport();
+    TRACE_stop();
+    if( srv->indexPath[0] != '\0' && FILEAVL_save( &srv->avl, srv->indexPath, &srv->avl_mutex ) == 0 )
+    {
+        LOG_write( LOG_INFO, LOG_NO_BLOCK, "Index sauvegardé dans %s", srv->indexPath );
+    }
+    LOG_stop();
 }
 
 
@@ -113,7 +248,47 @@ void SERVER_destroy( Server* srv )
         // Destruction de la socket
         if( srv->sock ) SOCK_destroy( srv->sock );
 
+        // Destruction de l'index
+        FILEAVL_destroy( srv->avl );
+        pthread_mutex_destroy( &srv->avl_mutex );
+
         // Liberation memoire
         free( srv );
     }
 }
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void onStopSignal( int sig )
+{
+    (void)sig;
+    stopRequested = 1;
+}
+
+
+static void* reconcileIndex( void* arg )
+{
+    Server* srv = (Server*)arg;
+    FILEAVL_reconcile( &srv->avl, &srv->avl_mutex );
+    LOG_write( LOG_INFO, LOG_NO_BLOCK, "Index confronté au disque" );
+    return( NULL );
+}
+
+
+static void waitServices( Server* srv )
+{
+    // Un service est libre quand son flag est remis a 1 par son thread
+    int busy = 1;
+    while( busy )
+    {
+        busy = 0;
+        for( int i = 0; i < MAX_NB_THREADS && ! busy; ++i )
+        {
+            pthread_mutex_lock( &srv->listService[i]->mutex );
+            busy = ! srv->listService[i]->flag;
+            pthread_mutex_unlock( &srv->listService[i]->mutex );
+        }
+        if( busy ) usleep( 100000 );
+    }
+}
@@ -5,11 +5,46 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 // Local
 #include "tftp/tftp.h"
 #include "tftp/packet.h"
 #include "tftp/server.h"
+#include "tftp/mcast.h"
+#include "tftp/share.h"
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+#include "tftp/trace.h"
+#include "tftp/digest.h"
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Envoi d'une plage du fichier demandee par les options "offset" (reprise) et "length" (telechargement par
+ *  segments) : OACK, puis blocs de la plage
+ */
+static int sendRange( Sock* sock, const char* fileName, const XrqPacket* request, const Addr* cltAddr );
+
+/** Refus d'une requete sur un fichier interne du serveur (snapshot, fichiers temporaires) : ERROR envoyee,
+ *  retourne 1 si la requete est refusee
+ */
+static int denyPrivate( Sock* sock, const XrqPacket* request, const Addr* cltAddr );
+
+/** Annonce de l'empreinte du fichier ouvert par reader demandee par l'option "checksum" : OACK avec l'empreinte
+ *  si elle est connue pour cette version (trailer->algorithm a DIGEST_NONE), sinon avec l'algorithme seul, l'empreinte
+ *  etant alors calculee au fil de l'envoi dans trailer (et tsize si demandee). Retourne MCAST_DECLINED si l'option
+ *  est ignoree
+ */
+static int sendChecksum( Sock* sock, FileAVL* node, pthread_mutex_t* avl_mutex, const Reader* reader,
+                         const XrqPacket* request, const struct stat* version, Digest* trailer,
+                         const Addr* cltAddr );
+
+/** Fin d'un service (y compris en echec avant le traitement) : requete et socket d'ecoute liberees, service de
+ *  nouveau disponible
+ */
+static void releaseService( Service* service );
 
 
 //--- Fonctions publiques --------------------------------------------------------------------------------------
@@ -45,6 +80,7 @@ Service* SERVICE_createEmpty()
     service->addr = NULL;
     service->packet = NULL;
     service->flag = 1;
+    pthread_mutex_init( &service->mutex, NULL );
 
     return( service );
 }
@@ -57,7 +93,12 @@ void* SERVICE_ProcessRequest( void* arg )
 
     // Creation de la socket qu'on va utiliser pour les echanges avec le client
     Sock* sock = SOCK_create( 0 );
-    if( sock == NULL ) return NULL;
+    if( sock == NULL )
+    {
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Création de la socket du service impossible" );
+        releaseService( service );
+        return NULL;
+    }
 
     // Gestion du timeout
     struct timeval timeout;
@@ -66,11 +107,27 @@ void* SERVICE_ProcessRequest( void* arg )
 
     if (setsockopt(sock->fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout)) < 0) 
     {
-        perror("Erreur timeout : ");
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Erreur timeout : %s", strerror( errno ) );
         SOCK_destroy( sock);
+        releaseService( service );
         return NULL;
     }
 
+    // Service en cours (attente depuis la reception de la requete)
+    METRICS_add( METRICS_ACTIVE_SESSIONS, 1 );
+    const int64_t start = METRICS_now();
+    METRICS_record( METRICS_SERVICE_WAIT, start - service->received );
+    METRICS_startRequest( service->received );
+
+    // Contexte des messages du journal
+    LOG_setSession( service->id, service->addr,
+                    service->packet->code == TFTP_RRQ || service->packet->code == TFTP_WRQ
+                    ? ( (XrqPacket*)service->packet->data )->fileName : NULL );
+    TRACE_setSession( service->id );
+
+    // Resultat de la session (trace de fin)
+    int status = 1;
+
     // Va servir à la recherche dans l'AVL
     FileAVL *node = NULL;
 
@@ -79,98 +136,166 @@ void* SERVICE_ProcessRequest( void* arg )
     {
         // RRQ
         case TFTP_RRQ:
-            // On cherche le noeud associé au fichier
-            node = FILEAVL_findInAVL(*(service->avl), ((XrqPacket*)service->packet->data )->fileName, service->avl_mutex);
-            if (node) {
-                pthread_mutex_lock(&(node->mutex));
-                TFTP_sendFileToEndpoint( sock, ( (XrqPacket*)service->packet->data )->fileName, service->addr );
-                pthread_mutex_unlock(&(node->mutex));
+            if( denyPrivate( sock, (const XrqPacket*)service->packet->data, service->addr ) ) break;
+            // On cherche le noeud associé au fichier, puis on confronte l'entrée au disque si besoin
+            node = FILEAVL_findInAVL(service->avl, ((XrqPacket*)service->packet->data )->fileName, service->avl_mutex);
+            // Pas de mutex : les WRQ publient par rename, le fichier ouvert reste la version complete lue
+            if (node && FILEAVL_check(node, service->avl_mutex) == 0) {
+                // Diffusion multicast si demandee (le client rejoint la session du fichier), sinon envoi unicast
+                // partage avec les autres lecteurs du fichier
+                status = MCAST_sendFile( sock, node->filename, (XrqPacket*)service->packet->data, service->addr );
+                const XrqPacket* request = (const XrqPacket*)service->packet->data;
+                if( status == MCAST_DECLINED && ( PACKET_getOption( request->options, request->optionCount, "offset" )
+                    || PACKET_getOption( request->options, request->optionCount, "length" ) ) )
+                {
+                    // Reprise ou segment (hors envoi partage : chaque client a sa plage)
+                    status = sendRange( sock, node->filename, request, service->addr );
+                }
+                else if( status == MCAST_DECLINED )
+                {
+                    // Empreinte annoncee si demandee, puis envoi partage du fichier ouvert : un WRQ publie entre les
+                    // deux ne change pas la version envoyee, dont l'empreinte est calculee au fil des blocs si elle
+                    // n'est pas connue
+                    Reader* reader = NULL;
+                    struct stat version;
+                    Digest trailer = { .algorithm = DIGEST_NONE };
+                    if( PACKET_getOption( request->options, request->optionCount, "checksum" ) != NULL )
+                        reader = READER_open( node->filename );
+                    if( reader != NULL && fstat( reader->fd, &version ) != 0 )
+                    {
+                        READER_close( reader );
+                        reader = NULL;
+                    }
+                    status = reader != NULL
+                             ? sendChecksum( sock, node, service->avl_mutex, reader, request, &version, &trailer,
+                                             service->addr )
+                             : MCAST_DECLINED;
+                    if( status == 0 || status == MCAST_DECLINED )
+                        status = SHARE_sendFile( sock, node->filename, reader,
+                                                 trailer.algorithm != DIGEST_NONE ? &trailer : NULL, service->addr );
+                    else READER_close( reader );
+                    if( status == 0 && trailer.algorithm != DIGEST_NONE )
+                        FILEAVL_setDigest( node, service->avl_mutex, &version, &trailer );
+                    if( status == 0 ) METRICS_record( METRICS_transferHistogram( node->size ), METRICS_now() - start );
+                }
             }
             else {
                 TFTP_sendErrorPacket( sock, ERR_FILE_NOT_FOUND, "Fichier introuvable", service->addr );
             }
             break;
 
-        // RRQ
+        // WRQ
         case TFTP_WRQ:
-            // On cherche le noeud associé au fichier
-            node = FILEAVL_findInAVL(*(service->avl), ((XrqPacket*)service->packet->data )->fileName, service->avl_mutex);
-
-            if (node) { // Si le noeud existe déjà, pas besoin de le recréer
+            if( denyPrivate( sock, (const XrqPacket*)service->packet->data, service->addr ) ) break;
+            // On cherche le noeud associé au fichier (créé s'il s'agit d'un nouveau fichier)
+            // Le mutex ne sérialise que les écrivains entre eux
+            node = FILEAVL_addInAVL(((XrqPacket*)service->packet->data )->fileName, service->avl, service->avl_mutex);
+            if (node) {
                 pthread_mutex_lock(&(node->mutex));
-                SERVICE_RecvFile( sock, service->addr, (XrqPacket*)service->packet->data );
+                status = SERVICE_RecvFile( sock, service->addr, node->filename );
+                FILEAVL_update(node, service->avl_mutex);
+                if( status == 0 ) METRICS_record( METRICS_transferHistogram( node->size ), METRICS_now() - start );
                 pthread_mutex_unlock(&(node->mutex));
             }
-            else {  // Si le noeud n'existe pas cela veut dire qu'on doit le créer car on reçoit un nouveau fichier
-                FILEAVL_addInAVL(((XrqPacket*)service->packet->data )->fileName, *(service->avl), service->avl_mutex);
-                node = FILEAVL_findInAVL(*(service->avl), ((XrqPacket*)service->packet->data )->fileName, service->avl_mutex);
-                if (node) {
-                    pthread_mutex_lock(&(node->mutex));
-                    SERVICE_RecvFile( sock, service->addr, (XrqPacket*)service->packet->data );
-                    pthread_mutex_unlock(&(node->mutex));
-                }
-                else {
-                    perror("Erreur création du fichier dans l'AVL.");
-                    TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Erreur AVL", service->addr );
-                }
+            else {
+                LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Erreur création du fichier dans l'AVL." );
+                TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Erreur AVL", service->addr );
             }
             break;
 
         // Requete hors protocole
         default:
-            fprintf( stderr, "ERREUR - Requête inattendue (code = %u)\n", service->packet->code );
+            LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Requête inattendue (code = %u)", service->packet->code );
             break;
     }
 
+    // Fin de la session
+    TRACE_record( TRACE_COMPLETE, 0, (uint16_t)status );
+    TRACE_setSession( 0 );
+
     // Liberation memoire
-    PACKET_destroy( service->packet );
-    ADDR_destroy( service->addr );
-    SOCK_destroy( service->sock );
+    METRICS_startRequest( 0 );
+    LOG_clearSession();
     SOCK_destroy( sock );
-
-    // Liberation des ressources associe au thread
-    pthread_detach( service->thread );
-
-    // Lock du mutex pour la variable flag
-    pthread_mutex_lock( &service->mutex );
-    // thread de nouveau disponible
-    service->flag = 1;
-    // Unlock du mutex pour la variable flag
-    pthread_mutex_unlock( &service->mutex );
+    METRICS_add( METRICS_ACTIVE_SESSIONS, -1 );
+    releaseService( service );
 
     return NULL;
 }
 
 
-int SERVICE_RecvFile( Sock* sock, Addr* cltAddr, XrqPacket* wrq )
+int SERVICE_RecvFile( Sock* sock, Addr* cltAddr, const char* fileName )
 {
-    // Envoi ACK (numero de bloc = 0)
-    if( TFTP_sendAckPacket( sock, 0, cltAddr ) != 0 ) return( 1 );
-
-    // Ouverture du fichier
-    FILE* file = fopen( wrq->fileName, "wb" );
-    if( file == NULL )
+    // Fichier temporaire a cote du fichier final (meme systeme de fichiers, pour un rename atomique)
+    char tmpPath[512];
+    const char* lastSlash = strrchr( fileName, '/' );
+    const int dirLength = lastSlash != NULL ? (int)( lastSlash - fileName + 1 ) : 0;
+    snprintf( tmpPath, sizeof( tmpPath ), "%.*s%s-XXXXXX", dirLength, fileName, FILEAVL_PRIVATE_PREFIX );
+
+    // Ouverture du fichier temporaire
+    int fd = mkstemp( tmpPath );
+    Writer* writer = fd != -1 ? WRITER_create( fd ) : NULL;
+    if( writer == NULL )
     {
-        // Fichier non trouve, envoi d'une erreur
-        fprintf( stderr, "ERREUR - Fichier inexistant : %s\n", wrq->fileName );
-        if( TFTP_sendErrorPacket( sock, ERR_FILE_NOT_FOUND, "Fichier inexistant", cltAddr ) != 0 )
+        // Creation impossible, envoi d'une erreur
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Impossible de créer le fichier : %s", fileName );
+        if( fd != -1 )
         {
-            fclose( file );
-            unlink( wrq->fileName );
-            return( 1 );
+            close( fd );
+            unlink( tmpPath );
         }
+        TFTP_sendErrorPacket( sock, ERR_NOT_PERMITTED, "Ecriture impossible", cltAddr );
+        return( 1 );
     }
 
-    // Reception du fichier
-    if( TFTP_recvFileFromEndpoint( sock, file, cltAddr ) == 0 )
+    // Envoi ACK (numero de bloc = 0)
+    if( TFTP_sendAckPacket( sock, 0, cltAddr ) != 0 )
     {
-        fprintf( stdout, "INFO - Fichier reçu : %s\n", wrq->fileName );
+        WRITER_close( writer );
+        close( fd );
+        unlink( tmpPath );
+        return( 1 );
     }
+    TRACE_record( TRACE_ACK_SENT, 0, 0 );
+
+    // Reception du fichier
+    uint16_t lastBlock = 0;
+    const int status = TFTP_recvFileFromEndpoint( sock, writer, cltAddr, &lastBlock );
+    const int64_t receivedAt = METRICS_now();
+
+    // Fin des ecritures differees et durabilite (avant publication)
+    int error = WRITER_close( writer );
+
+    // Droits d'un fichier cree normalement (mkstemp cree en 0600)
+    fchmod( fd, 0644 );
+    if( close( fd ) != 0 && error == 0 ) error = errno;
 
-    // Fermeture du fichier
-    fclose( file );
+    // Publication de la nouvelle version : les lecteurs en cours gardent l'ancienne
+    if( status == 0 && error == 0 && rename( tmpPath, fileName ) != 0 ) error = errno;
+
+    // Durabilite de la nouvelle entree du repertoire (sans elle, le fichier synchronise peut disparaitre)
+    if( status == 0 && error == 0 ) error = WRITER_syncDirectory( fileName );
+    if( status == 0 && error == 0 )
+    {
+        // ACK du dernier bloc seulement maintenant : le client n'apprend la reussite qu'une fois le fichier publie
+        // (ses renvois du dernier bloc attendent dans la socket)
+        LOG_write( LOG_INFO, LOG_NO_BLOCK, "Fichier reçu : %s", fileName );
+        if( TFTP_sendAckPacket( sock, lastBlock, cltAddr ) != 0 ) return( 1 );
+        TRACE_record( TRACE_ACK_SENT, lastBlock, 0 );
+        METRICS_record( METRICS_ACK_DELAY_LAST, METRICS_now() - receivedAt );
+        return( 0 );
+    }
 
-    return( 0 );
+    // Echec : la version precedente reste intacte, le client est prevenu d'un echec d'ecriture
+    unlink( tmpPath );
+    if( error != 0 )
+    {
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec d'enregistrement de %s : %s", fileName, strerror( error ) );
+        if( error == ENOSPC || error == EDQUOT )
+            TFTP_sendErrorPacket( sock, ERR_NOT_ENOUGH_SPACE_ON_DISK, "Disque plein", cltAddr );
+        else TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Echec d'écriture", cltAddr );
+    }
+    return( 1 );
 }
 
 
@@ -195,3 +320,117 @@ void SERVICE_destroy( Service* service )
         free( service );
     }
 }
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void releaseService( Service* service )
+{
+    // Liberation memoire
+    PACKET_destroy( service->packet );
+    service->packet = NULL;
+    SOCK_destroy( service->sock );
+    service->sock = NULL;
+
+    // Liberation des ressources associe au thread
+    pthread_detach( service->thread );
+
+    // Lock du mutex pour la variable flag (et l'adresse, comparee par le serveur aux nouvelles requetes)
+    pthread_mutex_lock( &service->mutex );
+    ADDR_destroy( service->addr );
+    service->addr = NULL;
+    // thread de nouveau disponible
+    service->flag = 1;
+    // Unlock du mutex pour la variable flag
+    pthread_mutex_unlock( &service->mutex );
+}
+
+
+static int denyPrivate( Sock* sock, const XrqPacket* request, const Addr* cltAddr )
+{
+    if( ! FILEAVL_isPrivate( request->fileName ) ) return( 0 );
+
+    LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Accès refusé à un fichier interne : %s", request->fileName );
+    TFTP_sendErrorPacket( sock, ERR_NOT_PERMITTED, "Accès refusé", cltAddr );
+    return( 1 );
+}
+
+
+static int sendRange( Sock* sock, const char* fileName, const XrqPacket* request, const Addr* cltAddr )
+{
+    // Offset (0 si absent) : au plus la taille du fichier ; length (jusqu'a la fin si absent) : entier positif
+    const char* offsetValue = PACKET_getOption( request->options, request->optionCount, "offset" );
+    const char* lengthValue = PACKET_getOption( request->options, request->optionCount, "length" );
+    char* offsetEnd = NULL;
+    char* lengthEnd = NULL;
+    const long long offset = offsetValue != NULL ? strtoll( offsetValue, &offsetEnd, 10 ) : 0;
+    long long length = lengthValue != NULL ? strtoll( lengthValue, &lengthEnd, 10 ) : -1;
+    struct stat fileStat;
+    if( ( offsetValue != NULL && ( *offsetValue == '\0' || *offsetEnd != '\0' ) )
+        || ( lengthValue != NULL && ( *lengthValue == '\0' || *lengthEnd != '\0' || length < 0 ) )
+        || offset < 0 || stat( fileName, &fileStat ) != 0 || offset > fileStat.st_size )
+    {
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Plage invalide : offset %s, length %s", offsetValue ? offsetValue : "-",
+                   lengthValue ? lengthValue : "-" );
+        TFTP_sendErrorPacket( sock, ERR_OPTION_REFUSED, "Plage invalide", cltAddr );
+        return( 1 );
+    }
+    if( length > fileStat.st_size - offset ) length = fileStat.st_size - offset;
+
+    // Options acceptees : offset, longueur retenue, et taille du fichier si demandee (le client verifie que
+    // c'est la meme version)
+    Option options[3];
+    size_t optionCount = 0;
+    char value[OPTION_VALUE_SIZE];
+    snprintf( value, sizeof( value ), "%lld", offset );
+    PACKET_addOption( options, &optionCount, "offset", value );
+    if( length >= 0 )
+    {
+        snprintf( value, sizeof( value ), "%lld", length );
+        PACKET_addOption( options, &optionCount, "length", value );
+    }
+    if( PACKET_getOption( request->options, request->optionCount, "tsize" ) != NULL )
+    {
+        snprintf( value, sizeof( value ), "%lld", (long long)fileStat.st_size );
+        PACKET_addOption( options, &optionCount, "tsize", value );
+    }
+    if( TFTP_sendOackAndWaitAck( sock, options, optionCount, cltAddr ) != 0 ) return( 1 );
+
+    if( length >= 0 )
+        LOG_write( LOG_INFO, LOG_NO_BLOCK, "Plage de %lld octets à l'octet %lld : %s", length, offset, fileName );
+    else LOG_write( LOG_INFO, LOG_NO_BLOCK, "Reprise à l'octet %lld : %s", offset, fileName );
+    return( TFTP_sendFileToEndpoint( sock, fileName, (off_t)offset, (off_t)length, cltAddr ) );
+}
+
+
+static int sendChecksum( Sock* sock, FileAVL* node, pthread_mutex_t* avl_mutex, const Reader* reader,
+                         const XrqPacket* request, const struct stat* version, Digest* trailer,
+                         const Addr* cltAddr )
+{
+    // Algorithme inconnu : option ignoree (RFC 2347)
+    const char* name = PACKET_getOption( request->options, request->optionCount, "checksum" );
+    const int algorithm = DIGEST_parse( name );
+    if( algorithm != DIGEST_CRC32C && algorithm != DIGEST_SHA256 ) return( MCAST_DECLINED );
+
+    // Empreinte conservee pour cette version, sinon annoncee apres les donnees : pas de lecture du fichier avant
+    // l'OACK, le client n'attend pas le calcul
+    Digest digest;
+    Option options[2];
+    size_t optionCount = 0;
+    char value[OPTION_VALUE_SIZE];
+    if( FILEAVL_getDigest( node, avl_mutex, algorithm, version, &digest ) == 0 )
+        DIGEST_format( &digest, value, sizeof( value ) );
+    else
+    {
+        trailer->algorithm = algorithm;
+        snprintf( value, sizeof( value ), "%s", DIGEST_name( algorithm ) );
+    }
+    PACKET_addOption( options, &optionCount, "checksum", value );
+    if( PACKET_getOption( request->options, request->optionCount, "tsize" ) != NULL )
+    {
+        snprintf( value, sizeof( value ), "%lld", (long long)reader->size );
+        PACKET_addOption( options, &optionCount, "tsize", value );
+    }
+
+    return( TFTP_sendOackAndWaitAck( sock, options, optionCount, cltAddr ) != 0 ? 1 : 0 );
+}
@@ -0,0 +1,386 @@
+#include "tftp/share.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Local
+#include "tftp/tftp.h"
+#include "tftp/packet.h"
+#include "tftp/log.h"
+
+
+// Taille de l'en-tete d'un paquet DATA (code et numero de bloc)
+#define DATA_HEADER_SIZE 4
+
+// Fichiers en cours d'envoi
+static SharedFile* sharedFiles = NULL;
+static pthread_mutex_t sharedMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Recuperation du fichier partage correspondant a la version courante du fichier, ou a celle ouverte par
+ *  reader (cree si besoin, reader detruit s'il n'est pas retenu)
+ */
+static SharedFile* acquire( const char* fileName, Reader* reader );
+
+/** Recherche du fichier partage d'une version du fichier, rattachement d'un lecteur (verrou global pris)
+ *
+ */
+static SharedFile* find( const char* fileName, const struct stat* info );
+
+/** Creation d'un fichier partage sur un fichier ouvert (hors verrou global)
+ *
+ */
+static SharedFile* create( const char* fileName, const struct stat* info, Reader* reader );
+
+/** Abandon d'un fichier partage par un lecteur (detruit apres le dernier lecteur)
+ *
+ */
+static void release( SharedFile* shared );
+
+/** Destruction d'un fichier partage
+ *
+ */
+static void destroy( SharedFile* shared );
+
+/** Copie du paquet DATA encode d'un bloc (lu et encode s'il n'est pas dans l'anneau, lu par le lecteur seul s'il
+ *  en est deja sorti), retourne sa taille
+ */
+static size_t getPacket( SharedFile* shared, uint64_t blockIndex, unsigned char* buff );
+
+/** Reservation des cases des blocs a partir du bloc specifie, lecture et encodage hors verrou, puis publication
+ *  (verrou du fichier pris a l'appel et au retour)
+ */
+static int fill( SharedFile* shared, uint64_t blockIndex );
+
+/** Lecture et encodage d'un bloc : par le lecteur partage (own = 0, un seul appelant a la fois), ou par une
+ *  lecture positionnelle propre. Retourne la taille du paquet, 0 en cas d'erreur
+ */
+static size_t readBlock( SharedFile* shared, uint64_t blockIndex, unsigned char* packet, int own );
+
+/** Envoi de l'empreinte des blocs envoyes (tous sauf le dernier deja ajoutes), avant le dernier bloc
+ *
+ */
+static int sendTrailer( Sock* sock, DigestContext* context, Digest* trailer, uint16_t previousBlock,
+                        const Addr* endpoint );
+
+/** Date de modification en nanosecondes
+ *
+ */
+static int64_t getMtime( const struct stat* info );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+int SHARE_sendFile( Sock* sock, const char* fileName, Reader* reader, Digest* trailer, const Addr* endpoint )
+{
+    // Rattachement au fichier partage
+    SharedFile* shared = acquire( fileName, reader );
+    if( shared == NULL )
+    {
+        // Message d'erreur
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Fichier inexistant: %s", fileName );
+
+        // Envoi paquet ERROR
+        if( TFTP_sendErrorPacket( sock, ERR_FILE_NOT_FOUND, "Fichier inexistant", endpoint ) != 0 ) return( 1 );
+        return( 3 );
+    }
+
+    // Nombre de paquets DATA necessaires (y-compris le dernier, eventuellement vide)
+    const uint64_t nbDataPacket = (uint64_t)shared->size / DATA_SIZE + 1;
+
+    // Empreinte des blocs envoyes, dans l'ordre
+    DigestContext context;
+    if( trailer != NULL ) DIGEST_init( &context, trailer->algorithm );
+
+    // Boucle d'envoi : le curseur du lecteur avance a chaque ACK, le paquet copie sert aux renvois
+    int status = 0;
+    for( uint64_t blockIndex = 1; blockIndex <= nbDataPacket; ++blockIndex )
+    {
+        unsigned char buff[PACKET_MAX_SIZE];
+        const size_t size = getPacket( shared, blockIndex, buff );
+        if( size != 0 && trailer != NULL )
+        {
+            DIGEST_add( &context, buff + DATA_HEADER_SIZE, size - DATA_HEADER_SIZE );
+            if( blockIndex == nbDataPacket
+                && sendTrailer( sock, &context, trailer, (uint16_t)( blockIndex - 1 ), endpoint ) != 0 )
+            {
+                status = 2;
+                break;
+            }
+        }
+        if( size == 0 || TFTP_sendDataAndWaitAck( sock, buff, size, (uint16_t)blockIndex, endpoint ) != 0 )
+        {
+            status = 2;
+            break;
+        }
+    }
+
+    // Fin de lecture
+    release( shared );
+
+    return( status );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static SharedFile* acquire( const char* fileName, Reader* reader )
+{
+    // Version courante du fichier, ou version deja ouverte
+    struct stat info;
+    if( reader != NULL ? fstat( reader->fd, &info ) != 0 : stat( fileName, &info ) != 0 )
+    {
+        READER_close( reader );
+        return( NULL );
+    }
+
+    // Meme version deja en cours d'envoi : nouveau lecteur
+    pthread_mutex_lock( &sharedMutex );
+    SharedFile* shared = find( fileName, &info );
+    pthread_mutex_unlock( &sharedMutex );
+    if( shared != NULL )
+    {
+        READER_close( reader );
+        return( shared );
+    }
+
+    // Premier lecteur : ouverture hors verrou global (open, lecture anticipee, O_DIRECT), pour ne pas retarder les
+    // requetes des autres fichiers. La version est celle du fichier ouvert (il a pu etre remplace depuis le stat)
+    if( reader == NULL )
+    {
+        reader = READER_open( fileName );
+        if( reader == NULL || fstat( reader->fd, &info ) != 0 )
+        {
+            READER_close( reader );
+            return( NULL );
+        }
+    }
+    SharedFile* created = create( fileName, &info, reader );
+    if( created == NULL ) return( NULL );
+
+    // Meme version ouverte entre temps par un autre lecteur : la sienne est partagee, la notre abandonnee
+    pthread_mutex_lock( &sharedMutex );
+    shared = find( fileName, &info );
+    if( shared == NULL )
+    {
+        created->next = sharedFiles;
+        sharedFiles = created;
+    }
+    pthread_mutex_unlock( &sharedMutex );
+    if( shared == NULL ) return( created );
+    destroy( created );
+
+    return( shared );
+}
+
+
+static SharedFile* find( const char* fileName, const struct stat* info )
+{
+    for( SharedFile* shared = sharedFiles; shared != NULL; shared = shared->next )
+    {
+        if( shared->dev == info->st_dev && shared->ino == info->st_ino && shared->mtime == getMtime( info )
+            && shared->size == info->st_size && strcmp( shared->fileName, fileName ) == 0 )
+        {
+            ++shared->refCount;
+            return( shared );
+        }
+    }
+
+    return( NULL );
+}
+
+
+static SharedFile* create( const char* fileName, const struct stat* info, Reader* reader )
+{
+    // Anneau limite au nombre de blocs du fichier
+    const uint64_t nbBlocks = (uint64_t)info->st_size / DATA_SIZE + 1;
+    const size_t ringBlocks = nbBlocks < SHARE_RING_BLOCKS ? (size_t)nbBlocks : SHARE_RING_BLOCKS;
+
+    // Allocation de la struture de donnees
+    SharedFile* shared = (SharedFile*)calloc( 1, sizeof( SharedFile ) );
+    if( shared == NULL )
+    {
+        READER_close( reader );
+        return( NULL );
+    }
+    snprintf( shared->fileName, sizeof( shared->fileName ), "%s", fileName );
+    shared->dev = info->st_dev;
+    shared->ino = info->st_ino;
+    shared->mtime = getMtime( info );
+    shared->size = info->st_size;
+    shared->reader = reader;
+    shared->ringBlocks = ringBlocks;
+    shared->packets = (unsigned char*)malloc( ringBlocks * PACKET_MAX_SIZE );
+    shared->sizes = (uint16_t*)malloc( ringBlocks * sizeof( uint16_t ) );
+    shared->blocks = (uint64_t*)calloc( ringBlocks, sizeof( uint64_t ) );
+    shared->refCount = 1;
+    pthread_mutex_init( &shared->mutex, NULL );
+    pthread_cond_init( &shared->filled, NULL );
+    if( shared->packets == NULL || shared->sizes == NULL || shared->blocks == NULL )
+    {
+        destroy( shared );
+        return( NULL );
+    }
+
+    return( shared );
+}
+
+
+static void release( SharedFile* shared )
+{
+    pthread_mutex_lock( &sharedMutex );
+
+    // Encore des lecteurs
+    if( --shared->refCount > 0 )
+    {
+        pthread_mutex_unlock( &sharedMutex );
+        return;
+    }
+
+    // Retrait de la liste
+    SharedFile** previous = &sharedFiles;
+    while( *previous != shared ) previous = &( *previous )->next;
+    *previous = shared->next;
+
+    pthread_mutex_unlock( &sharedMutex );
+
+    destroy( shared );
+}
+
+
+static void destroy( SharedFile* shared )
+{
+    // Liberation memoire
+    READER_close( shared->reader );
+    pthread_mutex_destroy( &shared->mutex );
+    pthread_cond_destroy( &shared->filled );
+    free( shared->packets );
+    free( shared->sizes );
+    free( shared->blocks );
+    free( shared );
+}
+
+
+static size_t getPacket( SharedFile* shared, uint64_t blockIndex, unsigned char* buff )
+{
+    const size_t slot = (size_t)( blockIndex % shared->ringBlocks );
+
+    pthread_mutex_lock( &shared->mutex );
+    while( shared->blocks[slot] != blockIndex )
+    {
+        // Bloc sorti de l'anneau (lecteur en retard) : lecture propre, sans ramener l'anneau en arriere
+        if( blockIndex + shared->ringBlocks <= shared->head )
+        {
+            pthread_mutex_unlock( &shared->mutex );
+            return( readBlock( shared, blockIndex, buff, 1 ) );
+        }
+
+        // Lecture en cours par un autre lecteur : attente de la publication de ses cases
+        if( shared->filling )
+        {
+            pthread_cond_wait( &shared->filled, &shared->mutex );
+            continue;
+        }
+
+        // Bloc absent : le lecteur le plus avance lit et encode la suite pour les autres
+        if( fill( shared, blockIndex ) != 0 )
+        {
+            pthread_mutex_unlock( &shared->mutex );
+            return( 0 );
+        }
+    }
+
+    // Copie du paquet (envoye hors verrou)
+    const size_t size = shared->sizes[slot];
+    memcpy( buff, shared->packets + slot * PACKET_MAX_SIZE, size );
+
+    pthread_mutex_unlock( &shared->mutex );
+
+    return( size );
+}
+
+
+static int fill( SharedFile* shared, uint64_t blockIndex )
+{
+    // Reservation des cases des blocs absents : videes, elles ne sont plus lues ni ecrites par les autres lecteurs
+    const uint64_t nbBlocks = (uint64_t)shared->size / DATA_SIZE + 1;
+    const uint64_t end = blockIndex + SHARE_FILL_BLOCKS <= nbBlocks ? blockIndex + SHARE_FILL_BLOCKS : nbBlocks + 1;
+    for( uint64_t index = blockIndex; index < end; ++index )
+    {
+        const size_t slot = (size_t)( index % shared->ringBlocks );
+        if( shared->blocks[slot] != index ) shared->blocks[slot] = 0;
+    }
+    shared->filling = 1;
+    pthread_mutex_unlock( &shared->mutex );
+
+    // Lecture et encodage hors verrou (les autres lecteurs copient les blocs deja publies)
+    int status = 0;
+    uint64_t index = blockIndex;
+    for( ; index < end; ++index )
+    {
+        const size_t slot = (size_t)( index % shared->ringBlocks );
+        if( shared->blocks[slot] == index ) continue;
+        const size_t size = readBlock( shared, index, shared->packets + slot * PACKET_MAX_SIZE, 0 );
+        if( size == 0 )
+        {
+            status = 1;
+            break;
+        }
+        shared->sizes[slot] = (uint16_t)size;
+    }
+
+    // Publication des blocs lus
+    pthread_mutex_lock( &shared->mutex );
+    for( uint64_t published = blockIndex; published < index; ++published )
+        shared->blocks[published % shared->ringBlocks] = published;
+    if( index > blockIndex && index - 1 > shared->head ) shared->head = index - 1;
+    shared->filling = 0;
+    pthread_cond_broadcast( &shared->filled );
+
+    return( status );
+}
+
+
+static size_t readBlock( SharedFile* shared, uint64_t blockIndex, unsigned char* packet, int own )
+{
+    // Lecture des donnees (le dernier bloc peut etre vide)
+    const off_t offset = (off_t)( blockIndex - 1 ) * DATA_SIZE;
+    const uint16_t bytesCount = shared->size - offset < DATA_SIZE ? (uint16_t)( shared->size - offset ) : DATA_SIZE;
+    unsigned char bytes[DATA_SIZE];
+    const ssize_t count = own ? READER_pread( shared->reader, offset, bytes, bytesCount )
+                              : READER_read( shared->reader, offset, bytes, bytesCount );
+    if( count != (ssize_t)bytesCount )
+    {
+        LOG_write( LOG_ERROR, (int64_t)blockIndex, "Echec de lecture" );
+        return( 0 );
+    }
+
+    // Encodage (le numero de bloc transmis reboucle au-dela de 65535 blocs)
+    return( PACKET_encodeData( packet, (uint16_t)blockIndex, bytes, bytesCount ) );
+}
+
+
+static int sendTrailer( Sock* sock, DigestContext* context, Digest* trailer, uint16_t previousBlock,
+                        const Addr* endpoint )
+{
+    // Empreinte complete : le dernier bloc vient d'etre ajoute
+    DIGEST_final( context, trailer );
+    Option options[1];
+    size_t optionCount = 0;
+    char value[OPTION_VALUE_SIZE];
+    DIGEST_format( trailer, value, sizeof( value ) );
+    PACKET_addOption( options, &optionCount, "checksum", value );
+
+    return( TFTP_sendOackAndWaitBlockAck( sock, options, optionCount, previousBlock, endpoint ) );
+}
+
+
+static int64_t getMtime( const struct stat* info )
+{
+    return( (int64_t)info->st_mtim.tv_sec * 1000000000 + info->st_mtim.tv_nsec );
+}
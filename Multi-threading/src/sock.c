@@ -6,8 +6,15 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <unistd.h>
 
+// Local
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+#include "tftp/impair.h"
+#include "tftp/capture.h"
+
 
 Sock* SOCK_create( uint16_t port )
 {
@@ -50,23 +57,88 @@ Sock* SOCK_create( uint16_t port )
     {
         // Recuperation du port effectif de la socket
         struct sockaddr_in addr;
-        socklen_t addrLen = 0;
+        socklen_t addrLen = sizeof( addr );
         getsockname( sock->fd, (struct sockaddr*)&addr, &addrLen );
         sock->addr->port = ntohs( addr.sin_port );
+        sock->addr->inAddr.sin_port = addr.sin_port;
+    }
+    IMPAIR_attach( sock );
+
+    return( sock );
+}
+
+
+Sock* SOCK_createMulticast( const Addr* group, const Sock* unicast )
+{
+    // Allocation de la struture de donnees
+    Sock* sock = (Sock*)malloc( sizeof( Sock ) );
+    sock->addr = NULL;
+
+    // Creation d une socket UDP/IP
+    sock->fd = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( sock->fd == -1 )
+    {
+        fprintf( stderr, "ERREUR - Echec de création de la socket:\n%s\n", strerror( errno ) );
+        free( sock );
+        return( NULL );
+    }
+
+    // Plusieurs clients de la meme machine ecoutent le meme groupe
+    const int reuse = 1;
+    setsockopt( sock->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+
+    // Bind sur l'adresse du groupe : seuls les datagrammes du groupe sont recus
+    sock->addr = ADDR_create();
+    memcpy( sock->addr, group, sizeof( Addr ) );
+    if( bind( sock->fd, (const struct sockaddr*)&( sock->addr->inAddr ), sizeof( struct sockaddr_in ) ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Echec du bind de la socket:\n%s\n", strerror( errno ) );
+        SOCK_destroy( sock );
+        return( NULL );
+    }
+
+    // Adhesion au groupe sur l'interface de la socket unicast
+    struct ip_mreq request;
+    request.imr_multiaddr = group->inAddr.sin_addr;
+    request.imr_interface = unicast->addr->inAddr.sin_addr;
+    if( setsockopt( sock->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof( request ) ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Echec de l'adhésion au groupe multicast:\n%s\n", strerror( errno ) );
+        SOCK_destroy( sock );
+        return( NULL );
     }
+    IMPAIR_attach( sock );
 
     return( sock );
 }
 
 
+int SOCK_setMulticastInterface( Sock* sock )
+{
+    if( setsockopt( sock->fd, IPPROTO_IP, IP_MULTICAST_IF, &( sock->addr->inAddr.sin_addr ),
+                    sizeof( struct in_addr ) ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Echec du choix de l'interface multicast:\n%s\n", strerror( errno ) );
+        return( 1 );
+    }
+
+    return( 0 );
+}
+
+
 int SOCK_sendData( Sock* sock, const void* data, size_t size, const Addr* to )
 {
+    // Capture telle qu'envoyee par l'application (avant degradation)
+    CAPTURE_packet( sock, &to->inAddr, 1, data, size );
+    if( IMPAIR_isActive( IMPAIR_SEND ) ) return( IMPAIR_send( sock, data, size, to ) );
+
     // Envoi des donnees
     if( sendto( sock->fd, data, size, 0, (const struct sockaddr*)&( to->inAddr ), sizeof( to->inAddr ) ) == -1 )
     {
-        fprintf( stderr, "ERREUR - Echec de l'envoi:\n%s\n", strerror( errno ) );
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec de l'envoi : %s", strerror( errno ) );
         return( -1 );
     }
+    METRICS_add( METRICS_BYTES_SENT, (int64_t)size );
 
     return( 0 );
 }
@@ -102,17 +174,30 @@ int SOCK_recvData( Sock* sock, void* data, size_t* size, Addr* from )
     struct sockaddr_in senderAddr;
     socklen_t addrLen = sizeof( senderAddr );
 
+    // Reception degradee
+    if( IMPAIR_isActive( IMPAIR_RECV ) )
+    {
+        const int result = IMPAIR_recv( sock, data, size, &senderAddr );
+        if( result != 0 ) return( result );
+        if( from != NULL ) ADDR_update( from, &senderAddr );
+        CAPTURE_packet( sock, &senderAddr, 0, data, *size );
+        return( 0 );
+    }
+
     // Attente et lecture de donnees
     ssize_t status = recvfrom( sock->fd, data, *size, 0, (struct sockaddr*)&senderAddr, &addrLen );
 
     if (status == -1) {
         // Timeout
         if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            printf("Timeout catched\n");
+            LOG_write( LOG_DEBUG, LOG_NO_BLOCK, "Timeout" );
             return -1; // On renvoie -1 lors des timeout
+        } else if (errno == EINTR) {
+            // Interruption par un signal (arret du serveur)
+            return 1;
         } else {
             // Erreur de réception
-            perror("Erreur de réception");
+            LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Erreur de réception : %s", strerror( errno ) );
             return 1;
         }
     }
@@ -126,6 +211,8 @@ int SOCK_recvData( Sock* sock, void* data, size_t* size, Addr* from )
 
     // Mise a jour de la taille des donnees recues
     *size = (size_t)status;
+    METRICS_add( METRICS_BYTES_RECEIVED, status );
+    CAPTURE_packet( sock, &senderAddr, 0, data, *size );
 
     return( 0 );
 }
@@ -136,7 +223,8 @@ void SOCK_destroy( Sock* sock )
     // Si socket valide
     if( sock != NULL )
     {
-        // Fermeture de la socket
+        // Fermeture de la socket (apres abandon de ses paquets retardes)
+        if( IMPAIR_isActive( IMPAIR_SEND ) || IMPAIR_isActive( IMPAIR_RECV ) ) IMPAIR_forget( sock );
         if( sock->fd != 0 ) close( sock->fd );
 
         // Destruction de l'adresse
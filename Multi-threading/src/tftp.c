@@ -6,8 +6,17 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
 
+// Local
+#include "tftp/reader.h"
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+#include "tftp/trace.h"
+#include "tftp/reorder.h"
+
 
 // Terminaison possible lors de l'envoie de fichier
 enum
@@ -33,10 +42,32 @@ enum
  */
 static int sendPacket( Sock* sock, Packet* packet, const Addr* to );
 
+/** ACK d'un bloc deja acquitte (doublon de l'ACK precedent ou ACK retarde)
+ *
+ */
+static int isStaleAck( const Packet* packet, uint16_t blockNum );
+
+/** Timeout de reception de la socket (us, 0 si aucun)
+ *
+ */
+static int64_t getRecvTimeout( const Sock* sock );
+
+/** Reception d'un paquet avant l'echeance specifiee (us, METRICS_now), TIMEOUT une fois l'echeance passee
+ *
+ *  Les paquets ignores (doublons, ACK en retard) ne relancent pas l'attente : l'echeance est fixee une fois
+ */
+static Packet* recvBefore( Sock* sock, int64_t deadline );
+
 
 //--- Fonctions publiques --------------------------------------------------------------------------------------
 
-int TFTP_sendXrqPacket( Sock* sock, uint16_t code, const char* fileName, const Addr* to )
+int TFTP_sendXrqPacket(
+                    Sock* sock,
+                    uint16_t code,
+                    const char* fileName,
+                    const Option* options,
+                    size_t optionCount,
+                    const Addr* to )
 {
     // Verification code
     assert( ( code == TFTP_RRQ || code == TFTP_WRQ ) && "Code RRQ/WRQ invalide !" );
@@ -45,6 +76,23 @@ int TFTP_sendXrqPacket( Sock* sock, uint16_t code, const char* fileName, const A
     Packet* packet = PACKET_create( code );
     if( packet == NULL ) return( 1 );
     strcpy( ( (XrqPacket*)packet->data )->fileName, fileName );
+    memcpy( ( (XrqPacket*)packet->data )->options, options, optionCount * sizeof( Option ) );
+    ( (XrqPacket*)packet->data )->optionCount = optionCount;
+
+    // Envoi du paquet
+    if( sendPacket( sock, packet, to ) != 0 ) return( 2 );
+
+    return( 0 );
+}
+
+
+int TFTP_sendOackPacket( Sock* sock, const Option* options, size_t optionCount, const Addr* to )
+{
+    // Construction du paquet OACK
+    Packet* packet = PACKET_create( TFTP_OACK );
+    if( packet == NULL ) return( 1 );
+    memcpy( ( (OackPacket*)packet->data )->options, options, optionCount * sizeof( Option ) );
+    ( (OackPacket*)packet->data )->optionCount = optionCount;
 
     // Envoi du paquet
     if( sendPacket( sock, packet, to ) != 0 ) return( 2 );
@@ -95,6 +143,8 @@ int TFTP_sendErrorPacket( Sock* sock, uint16_t error, const char* msg, const Add
     if( packet == NULL ) return( 1 );
     ( (ErrorPacket*)packet->data )->errorCode = error;
     strcpy( ( (ErrorPacket*)packet->data )->errorMsg, msg );
+    METRICS_add( METRICS_ERRORS + ( error < METRICS_ERROR_CODES ? error : ERR_UNDEFINED ), 1 );
+    TRACE_record( TRACE_ERROR_SENT, 0, error );
 
     // Envoi du paquet
     if( sendPacket( sock, packet, to ) != 0 ) return( 2 );
@@ -104,14 +154,27 @@ int TFTP_sendErrorPacket( Sock* sock, uint16_t error, const char* msg, const Add
 
 
 Packet* TFTP_recvPacket( Sock* sock, Addr* from )
+{
+    int sockError = 0;
+    return( TFTP_recvPacketStatus( sock, from, &sockError ) );
+}
+
+
+Packet* TFTP_recvPacketStatus( Sock* sock, Addr* from, int* sockError )
 {
     // Attente du paquet dans un buffer en reception et recuperation du nouveau port
     unsigned char buff[PACKET_MAX_SIZE];
     size_t size = PACKET_MAX_SIZE;
 
     int response = SOCK_recvData( sock, buff, &size, from );
+    *sockError = response > 0;
     if( response > 0) return( NULL );
-    else if (response == -1) return TIMEOUT;
+    else if (response == -1)
+    {
+        METRICS_add( METRICS_TIMEOUTS, 1 );
+        TRACE_record( TRACE_TIMEOUT, 0, 0 );
+        return TIMEOUT;
+    }
 
     // Position courante dans le buffer lors du decodage
     size_t offset = 0;
@@ -119,7 +182,7 @@ Packet* TFTP_recvPacket( Sock* sock, Addr* from )
     // Verification taille des donnees recues
     if( size < sizeof( uint16_t ) )
     {
-        fprintf( stderr, "ERREUR - Taille des donnees recues insuffisante\n" );
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Taille des donnees recues insuffisante" );
         return( NULL );
     }
 
@@ -146,134 +209,230 @@ Packet* TFTP_recvPacket( Sock* sock, Addr* from )
 }
 
 
-int TFTP_sendFileToEndpoint( Sock* sock, const char* fileName, const Addr* endpoint )
+int TFTP_sendFileToEndpoint( Sock* sock, const char* fileName, off_t start, off_t length, const Addr* endpoint )
 {
     // Code de retour
     int status = SEND_FILE_IN_PROGRESS;
 
-    // Open file
-    FILE* file = fopen( fileName, "rb" );
-    if( file == NULL )
+    // Ouverture du fichier (lecture par tampons et lecture anticipee)
+    Reader* reader = READER_open( fileName );
+    if( reader == NULL )
     {
         // Message d'erreur
-        fprintf( stderr, "ERREUR - Fichier inexistant: %s\n", fileName );
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Fichier inexistant: %s", fileName );
 
         // Envoi paquet ERROR
         if( TFTP_sendErrorPacket( sock, ERR_FILE_NOT_FOUND, "Fichier inexistant", endpoint ) != 0 ) return( 1 );
         return 3;
     }
 
-    // Recuperation de la taille du fichier
-    int fd = fileno( file );
-    struct stat fileInfo;
-    fstat( fd, &fileInfo );
-    const off_t fileSize = fileInfo.st_size;
-
-    // Nombre de paquets DATA necessaires (y-compris le dernier)
-    const uint16_t nbDataPacket = fileSize / DATA_SIZE + 1;
+    // Fin de la plage envoyee (reprise au-dela de la fin : rien a envoyer)
+    const off_t fileEnd = length >= 0 && length < reader->size - start ? start + length : reader->size;
+    if( start > reader->size )
+    {
+        READER_close( reader );
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Reprise au-delà de la fin du fichier: %s", fileName );
+        TFTP_sendErrorPacket( sock, ERR_OPTION_REFUSED, "Offset invalide", endpoint );
+        return( 1 );
+    }
 
-    // Taille du dernier paquet. Si cette taille est nulle, le dernier paquet ne contient pas de donnees,
-    // mais doit quand meme etre envoye
-    uint16_t lastPacketSize = fileSize % DATA_SIZE;
+    // Nombre de paquets DATA necessaires (y-compris le dernier). Au-dela de 65535 blocs, le numero de bloc
+    // transmis reboucle a 0
+    const uint64_t nbDataPacket = (uint64_t)( fileEnd - start ) / DATA_SIZE + 1;
 
     // Boucle d'envoi
-    for( uint16_t blockNum = 1; blockNum <= nbDataPacket; ++blockNum )
+    for( uint64_t blockIndex = 1; blockIndex <= nbDataPacket; ++blockIndex )
     {
-        // Taille des donnees (differente pour le dernier paquet)
-        const uint16_t bytesCount = ( blockNum == nbDataPacket ? lastPacketSize : DATA_SIZE );
+        // Numero de bloc transmis
+        const uint16_t blockNum = (uint16_t)blockIndex;
 
-        // Lecture des donnees
+        // Lecture des donnees. Si la taille du fichier est un multiple de DATA_SIZE, le dernier paquet ne
+        // contient pas de donnees, mais doit quand meme etre envoye
+        const off_t offset = start + (off_t)( blockIndex - 1 ) * DATA_SIZE;
+        const uint16_t bytesCount = fileEnd - offset < DATA_SIZE ? (uint16_t)( fileEnd - offset ) : DATA_SIZE;
         unsigned char bytes[DATA_SIZE];
-        if( fread( bytes, bytesCount, 1, file ) != 1 )
+        if( READER_read( reader, offset, bytes, bytesCount ) != (ssize_t)bytesCount )
         {
-            fprintf( stderr, "ERREUR - Echec de lecture\n");
+            LOG_write( LOG_ERROR, (int64_t)blockIndex, "Echec de lecture" );
             status = SEND_FILE_ERROR;
             break;
         }
 
-        Packet *response = TIMEOUT;
-        int nb_try = 0;
+        // Envoi du paquet DATA et attente de son ACK
+        unsigned char buff[PACKET_MAX_SIZE];
+        const size_t size = PACKET_encodeData( buff, blockNum, bytes, bytesCount );
+        if( TFTP_sendDataAndWaitAck( sock, buff, size, blockNum, endpoint ) != 0 )
+        {
+            status = SEND_FILE_ERROR;
+            break;
+        }
+    }
+
+    // Fermeture du fichier
+    READER_close( reader );
+
+    return( status == SEND_FILE_IN_PROGRESS ? SEND_FILE_COMPLETE : status );
+}
+
+
+int TFTP_sendOackAndWaitAck( Sock* sock, const Option* options, size_t optionCount, const Addr* endpoint )
+{
+    // Envoi de l'OACK, renvoye tant que l'ACK 0 n'arrive pas
+    for( int nbTry = 0; nbTry <= MAX_TRY_TIMEOUT; ++nbTry )
+    {
+        if( TFTP_sendOackPacket( sock, options, optionCount, endpoint ) != 0 ) return( 1 );
+        TRACE_record( TRACE_OPTIONS, 0, (uint16_t)optionCount );
+
+        Packet* response = TFTP_recvPacket( sock, NULL );
+        if( response == TIMEOUT )
+        {
+            METRICS_add( METRICS_RETRANSMITS, 1 );
+            LOG_write( LOG_WARN, 0, "Timeout. Nouvel envoi de l'OACK. (%d)", nbTry + 1 );
+            continue;
+        }
+        if( response == NULL ) return( 1 );
+
+        // ACK 0 : options acceptees ; ERROR : le client les refuse
+        const int status = response->code == TFTP_ACK && ( (AckPacket*)response->data )->blockNum == 0 ? 0 : 2;
+        if( status != 0 ) LOG_write( LOG_ERROR, 0, "Options refusées par le client (paquet %u)", response->code );
+        else TRACE_record( TRACE_ACK_RECEIVED, 0, 0 );
+        PACKET_destroy( response );
+        return( status );
+    }
+
+    TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Timeout", endpoint );
+    return( 3 );
+}
+
 
-        // Envoie du paquet DATA
-        while (response == TIMEOUT) {
-            if( TFTP_sendDataPacket( sock, blockNum, bytes, bytesCount, endpoint ) != 0 )
+int TFTP_sendOackAndWaitBlockAck( Sock* sock, const Option* options, size_t optionCount, uint16_t blockNum,
+                                  const Addr* endpoint )
+{
+    // Encodage de l'OACK
+    Packet* packet = PACKET_create( TFTP_OACK );
+    if( packet == NULL ) return( 1 );
+    memcpy( ( (OackPacket*)packet->data )->options, options, optionCount * sizeof( Option ) );
+    ( (OackPacket*)packet->data )->optionCount = optionCount;
+    unsigned char buff[PACKET_MAX_SIZE];
+    size_t size = 0;
+    const int encoded = PACKET_encode( packet, buff, &size );
+    PACKET_destroy( packet );
+    if( encoded != 0 ) return( 1 );
+
+    // Envoi, renvois et attente de l'ACK comme pour un bloc
+    TRACE_record( TRACE_OPTIONS, blockNum, (uint16_t)optionCount );
+    return( TFTP_sendDataAndWaitAck( sock, buff, size, blockNum, endpoint ) );
+}
+
+
+int TFTP_sendDataAndWaitAck( Sock* sock, const unsigned char* buff, size_t size, uint16_t blockNum,
+                             const Addr* endpoint )
+{
+    Packet *response = TIMEOUT;
+    int nb_try = 0;
+    int sends = 0;
+    int64_t sentAt = 0;
+
+    // Envoie du paquet DATA
+    while (response == TIMEOUT) {
+        if( SOCK_sendData( sock, buff, size, endpoint ) != 0 ) return( 1 );
+        sentAt = METRICS_now();
+        METRICS_recordFirstByte();
+        TRACE_record( sends++ == 0 ? TRACE_DATA_SENT : TRACE_DATA_RESENT, blockNum, (uint16_t)nb_try );
+
+        // Attente de la reponse (ACK ou ERROR). Les ACK en retard sont ignores sans renvoi du bloc (un renvoi par
+        // doublon doublerait tous les envois suivants), sauf un ACK du bloc precedent tardif (timeout du client).
+        // L'attente ne depasse pas le timeout de la socket depuis l'envoi, quel que soit le nombre d'ACK ignores
+        int requested = 0;
+        int64_t deadline = 0;
+        response = TFTP_recvPacket( sock, NULL );
+        while( isStaleAck( response, blockNum ) )
+        {
+            const uint16_t ackNum = ( (AckPacket*)response->data )->blockNum;
+            TRACE_record( TRACE_DUPLICATE, ackNum, 0 );
+            PACKET_destroy( response );
+            if( ackNum == (uint16_t)( blockNum - 1 ) && METRICS_now() - sentAt >= DUP_ACK_RESEND_MS * 1000 )
             {
-                status = SEND_FILE_ERROR;
+                requested = 1;
+                response = TIMEOUT;
                 break;
             }
+            if( deadline == 0 ) deadline = sentAt + getRecvTimeout( sock );
+            response = recvBefore( sock, deadline );
+        }
 
-            // Attente de la reponse (ACK ou ERROR)
-            response = TFTP_recvPacket( sock, NULL );
-            if (response == TIMEOUT) {
-                if (nb_try++ == MAX_TRY_TIMEOUT) {
-                    // On abandonne l'envoie de paquet
-                    // Envoie d'un paquet erreur
-                    if( TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Timeout", endpoint ) != 0 )return( 1 );
-                    response = NULL;
-                }
-                else printf("Timeout. Nouvel envoi paquet data. (%d)\n", nb_try);
+        // Renvoi sur timeout ou a la demande du client : limite a MAX_TRY_TIMEOUT renvois dans les deux cas
+        if (response == TIMEOUT) {
+            if (nb_try++ == MAX_TRY_TIMEOUT) {
+                // On abandonne l'envoie de paquet
+                // Envoie d'un paquet erreur
+                TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Timeout", endpoint );
+                response = NULL;
+            }
+            else
+            {
+                METRICS_add( METRICS_RETRANSMITS, 1 );
+                if( requested ) LOG_write( LOG_WARN, blockNum, "ACK du bloc précédent. Nouvel envoi paquet data." );
+                else LOG_write( LOG_WARN, blockNum, "Timeout. Nouvel envoi paquet data. (%d)", nb_try );
             }
         }
+    }
 
-        if( response == NULL )
-        {
-            status = SEND_FILE_ERROR;
-            break;
-        }
+    if( response == NULL ) return( 1 );
 
-        // Selon le code de la reponse
-        switch( response->code )
+    // Code de retour
+    int status = 0;
+
+    // Selon le code de la reponse
+    switch( response->code )
+    {
+        // ACK
+        case TFTP_ACK:
         {
-            // ACK
-            case TFTP_ACK:
+            // Controle du numero de bloc
+            AckPacket* ack = (AckPacket*)response->data;
+            if( ack->blockNum == blockNum )
             {
-                // Controle du numero de bloc
-                AckPacket* ack = (AckPacket*)response->data;
-                if( ack->blockNum != blockNum )
-                {
-                    fprintf( stderr,
-                             "ERREUR - ACK incohérent (num bloc = %u, attendu = %u\n",
-                             ack->blockNum,
-                             blockNum );
-                    status = SEND_FILE_ERROR;
-                }
-
+                // Aller-retour sans renvoi (un ACK apres renvoi ne dit pas quel envoi il acquitte)
+                if( sends == 1 ) METRICS_record( METRICS_BLOCK_RTT, METRICS_now() - sentAt );
+                TRACE_record( TRACE_ACK_RECEIVED, blockNum, 0 );
             }
-            break;
-
-            // ERROR
-            case TFTP_ERROR:
+            else
             {
-                // Affichage de l'erreur
-                ErrorPacket* err = (ErrorPacket*)response->data;
-                fprintf( stderr, "ERREUR - code = %u, msg = %s\n", err->errorCode, err->errorMsg );
-                status = SEND_FILE_ERROR;
+                LOG_write( LOG_ERROR, blockNum, "ACK incohérent (num bloc = %u, attendu = %u)", ack->blockNum,
+                           blockNum );
+                status = 1;
             }
-            break;
 
-            // Code imprevu, on renvoie une erreur
-            default:
-                if( TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Code paquet inattendu", endpoint ) != 0 )
-                    return( 1 );
-                status = SEND_FILE_ERROR;
-                break;
         }
+        break;
 
-        // Liberation memoire
-        PACKET_destroy( response );
+        // ERROR
+        case TFTP_ERROR:
+        {
+            // Affichage de l'erreur
+            ErrorPacket* err = (ErrorPacket*)response->data;
+            LOG_write( LOG_ERROR, blockNum, "code = %u, msg = %s", err->errorCode, err->errorMsg );
+            TRACE_record( TRACE_ERROR_RECEIVED, blockNum, err->errorCode );
+            status = 1;
+        }
+        break;
 
-        // Controle erreur
-        if( status != SEND_FILE_IN_PROGRESS ) return( status );
+        // Code imprevu, on renvoie une erreur
+        default:
+            TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Code paquet inattendu", endpoint );
+            status = 1;
+            break;
     }
 
-    // Fermeture du fichier
-    fclose( file );
+    // Liberation memoire
+    PACKET_destroy( response );
 
-    return( SEND_FILE_COMPLETE );
+    return( status );
 }
 
 
-int TFTP_recvFileFromEndpoint( Sock* sock, FILE* file, const Addr* endpoint )
+int TFTP_recvFileFromEndpoint( Sock* sock, Writer* writer, const Addr* endpoint, uint16_t* lastBlock )
 {
     // Code de retour
     int status = RECV_FILE_IN_PROGRESS;
@@ -281,64 +440,117 @@ int TFTP_recvFileFromEndpoint( Sock* sock, FILE* file, const Addr* endpoint )
     // Numero de bloc attendu
     uint16_t blockNum = 1;
 
+    // Blocs arrives en avance
+    Reorder* reorder = REORDER_create( DATA_SIZE, REORDER_DEFAULT_BLOCKS );
+    if( reorder == NULL ) return( 1 );
+
+    // Echeance du bloc attendu : fixee au premier paquet ignore (doublon, bloc en avance), a partir du dernier
+    // bloc recu dans l'ordre, pour qu'un flot de doublons ne prolonge pas la session indefiniment
+    int64_t progressAt = METRICS_now();
+    int64_t deadline = 0;
+
     // Boucle de reception
     Packet* packet = NULL;
     while( 1 )
     {
         // Attente du prochain paquet DATA
         if( packet != NULL ) PACKET_destroy( packet );
-        packet = TFTP_recvPacket( sock, NULL );
-        if( packet == NULL || packet == TIMEOUT) return( 1 );
+        packet = deadline != 0 ? recvBefore( sock, deadline ) : TFTP_recvPacket( sock, NULL );
+        if( packet == NULL || packet == TIMEOUT)
+        {
+            packet = NULL;
+            status = 1;
+            break;
+        }
+
+        const int64_t receivedAt = METRICS_now();
 
         // Si ce n'est pas un paquet DATA
         if( packet->code != TFTP_DATA )
         {
             // Renvoi d'une erreur
-            fprintf( stderr, "ERREUR - Réception d'un paquet non prévu (code = %u)\n", packet->code );
-            if( TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Code paquet inattendu", endpoint ) != 0 )
-                return( 1 );
+            LOG_write( LOG_ERROR, blockNum, "Réception d'un paquet non prévu (code = %u)", packet->code );
             status = RECV_FILE_ERROR;
+            if( TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Code paquet inattendu", endpoint ) != 0 ) status = 1;
             break;
         }
         else
         {
-            // Controle du numero de bloc
+            // Position du bloc par rapport au bloc attendu (numeros sur 16 bits)
             const DataPacket* data = (const DataPacket*)packet->data;
-            if( data->blockNum != blockNum )
+            const uint16_t ahead = (uint16_t)( data->blockNum - blockNum );
+            TRACE_record( ahead >= REORDER_HALF_RANGE ? TRACE_DUPLICATE : TRACE_DATA_RECEIVED, data->blockNum,
+                          data->bytesCount );
+
+            // Bloc deja recu (doublon, renvoi apres perte de l'ACK) : nouvel ACK du dernier bloc recu dans l'ordre
+            if( ahead >= REORDER_HALF_RANGE )
             {
-                // Renvoi d'une erreur
-                fprintf( stderr, "ERREUR - Mauvais numero de bloc (attendu = %u, reçu = %u)\n",
-                         blockNum, data->blockNum );
-                if( TFTP_sendErrorPacket( sock, ERR_UNDEFINED, "Mauvais numero de bloc", endpoint ) != 0 )
-                    return( 1 );
-                status = RECV_FILE_ERROR;
-                break;
+                if( TFTP_sendAckPacket( sock, (uint16_t)( blockNum - 1 ), endpoint ) != 0 )
+                {
+                    status = 1;
+                    break;
+                }
+                TRACE_record( TRACE_ACK_SENT, (uint16_t)( blockNum - 1 ), 0 );
+                if( deadline == 0 ) deadline = progressAt + getRecvTimeout( sock );
+                continue;
             }
 
-            // Ecriture des donnees dans le fichier
-            if( fwrite( data->bytes, data->bytesCount, 1, file ) != 1 )
+            // Bloc en avance : conserve jusqu'a la reception des blocs manquants, sans ACK
+            if( ahead != 0 )
             {
-                fprintf( stderr, "ERREUR - Echec d'écriture\n");
-                status = RECV_FILE_ERROR;
-                break;
+                const int held = REORDER_hold( reorder, blockNum, data->blockNum, data->bytes, data->bytesCount );
+                if( held == REORDER_TOO_FAR )
+                    LOG_write( LOG_WARN, blockNum, "Bloc %u hors du tampon de réordonnancement", data->blockNum );
+                if( deadline == 0 ) deadline = progressAt + getRecvTimeout( sock );
+                continue;
             }
 
-            // Envoi de l'ACK
-            if( TFTP_sendAckPacket( sock, blockNum++, endpoint ) != 0 ) return( 1 );
-            status = RECV_FILE_ERROR;
+            // Ecriture des donnees dans le fichier (differee), puis des blocs conserves qui suivent
+            const unsigned char* bytes = data->bytes;
+            size_t bytesCount = data->bytesCount;
+            while( bytes != NULL )
+            {
+                if( WRITER_write( writer, bytes, bytesCount ) != 0 )
+                {
+                    LOG_write( LOG_ERROR, blockNum, "Echec d'écriture" );
+                    status = RECV_FILE_ERROR;
+                    break;
+                }
+                ++blockNum;
+
+                // Si taille des donnees inferieure a 512 : reception terminee
+                if( bytesCount < DATA_SIZE )
+                {
+                    status = RECV_FILE_COMPLETE;
+                    break;
+                }
+                bytes = REORDER_take( reorder, blockNum, &bytesCount );
+            }
+            if( status == RECV_FILE_ERROR ) break;
 
-            // Si taille des donnees inferieure a 512
-            if( data->bytesCount < DATA_SIZE )
+            // Dernier bloc : ACK laisse a l'appelant (envoye une fois le fichier ecrit et publie)
+            if( status == RECV_FILE_COMPLETE )
             {
-                // Reception terminee
-                status = RECV_FILE_COMPLETE;
+                *lastBlock = (uint16_t)( blockNum - 1 );
                 break;
             }
+
+            // Envoi de l'ACK du dernier bloc recu dans l'ordre
+            if( TFTP_sendAckPacket( sock, (uint16_t)( blockNum - 1 ), endpoint ) != 0 )
+            {
+                status = 1;
+                break;
+            }
+            TRACE_record( TRACE_ACK_SENT, (uint16_t)( blockNum - 1 ), 0 );
+            progressAt = METRICS_now();
+            METRICS_record( METRICS_ACK_DELAY, progressAt - receivedAt );
+            deadline = 0;
         }
     }
 
     // Liberation memoire
     if( packet != NULL ) PACKET_destroy( packet );
+    REORDER_destroy( reorder );
 
     return( status );
 }
@@ -346,6 +558,7 @@ int TFTP_recvFileFromEndpoint( Sock* sock, FILE* file, const Addr* endpoint )
 
 //--- Fonctions locales ----------------------------------------------------------------------------------------
 
+
 static int sendPacket( Sock* sock, Packet* packet, const Addr* to )
 {
     // Encodage du paquet dans un buffer en emission
@@ -368,3 +581,49 @@ static int sendPacket( Sock* sock, Packet* packet, const Addr* to )
 
     return( 0 );
 }
+
+
+static int isStaleAck( const Packet* packet, uint16_t blockNum )
+{
+    if( packet == NULL || packet == TIMEOUT || packet->code != TFTP_ACK ) return( 0 );
+    const uint16_t behind = (uint16_t)( blockNum - ( (const AckPacket*)packet->data )->blockNum );
+
+    return( behind != 0 && behind < REORDER_HALF_RANGE );
+}
+
+
+static int64_t getRecvTimeout( const Sock* sock )
+{
+    struct timeval timeout;
+    socklen_t length = sizeof( timeout );
+    if( getsockopt( sock->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &length ) != 0 ) return( 0 );
+
+    return( (int64_t)timeout.tv_sec * 1000000 + timeout.tv_usec );
+}
+
+
+static Packet* recvBefore( Sock* sock, int64_t deadline )
+{
+    // Socket sans timeout : attente normale
+    const int64_t timeout = getRecvTimeout( sock );
+    if( timeout == 0 ) return( TFTP_recvPacket( sock, NULL ) );
+
+    // Echeance passee
+    const int64_t wait = deadline - METRICS_now();
+    if( wait <= 0 )
+    {
+        METRICS_add( METRICS_TIMEOUTS, 1 );
+        TRACE_record( TRACE_TIMEOUT, 0, 0 );
+        return( TIMEOUT );
+    }
+
+    // Attente limitee au temps restant, puis retour au timeout de la socket
+    if( wait >= timeout ) return( TFTP_recvPacket( sock, NULL ) );
+    struct timeval remaining = { (time_t)( wait / 1000000 ), (suseconds_t)( wait % 1000000 ) };
+    setsockopt( sock->fd, SOL_SOCKET, SO_RCVTIMEO, &remaining, sizeof( remaining ) );
+    Packet* packet = TFTP_recvPacket( sock, NULL );
+    struct timeval previous = { (time_t)( timeout / 1000000 ), (suseconds_t)( timeout % 1000000 ) };
+    setsockopt( sock->fd, SOL_SOCKET, SO_RCVTIMEO, &previous, sizeof( previous ) );
+
+    return( packet );
+}
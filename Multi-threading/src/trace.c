@@ -0,0 +1,345 @@
+#include "tftp/trace.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+// Local
+#include "tftp/metrics.h"
+#include "tftp/log.h"
+
+
+/** Tampon circulaire d'un thread
+ *
+ *  Un seul producteur (le thread) et un seul consommateur (le thread d'ecriture), sans verrou.
+ */
+typedef struct TraceRing
+{
+    TraceEvent events[TRACE_RING_SIZE];     // Evenements
+    uint32_t head;                          // Prochain evenement ecrit (producteur)
+    uint32_t tail;                          // Prochain evenement lu (consommateur)
+    uint64_t dropped;                       // Evenements perdus (tampon plein)
+    uint64_t reported;                      // Evenements perdus deja comptes (consommateur)
+    int closed;                             // Thread termine : tampon recycle une fois vide
+    struct TraceRing* next;                 // Tampon suivant (liste active ou libre)
+} TraceRing;
+
+// Noms des evenements (dans l'ordre de l'enum)
+static const char* EVENT_NAMES[TRACE_EVENT_COUNT] = {
+    "unknown", "request", "options", "data-sent", "data-resent", "ack-received", "duplicate", "data-received",
+    "ack-sent", "timeout", "error-sent", "error-received", "complete"
+};
+
+// Fichier de traces et activation (lue sans verrou dans le chemin critique)
+static char outputPath[256] = "";
+static volatile sig_atomic_t enabled = 0;
+
+// Tampons des threads (actifs et recyclables)
+static TraceRing* rings = NULL;
+static TraceRing* freeRings = NULL;
+static pthread_mutex_t ringsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Rattachement du tampon et de la session au thread
+static __thread TraceRing* threadRing = NULL;
+static __thread uint64_t threadSession = 0;
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+// Thread d'ecriture et fichier courant
+static pthread_t writeThread;
+static int running = 0;
+static volatile int stopWrite = 0;
+static FILE* output = NULL;
+static long outputSize = 0;
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Tampon du thread appelant (cree au premier evenement)
+ *
+ */
+static TraceRing* attach();
+
+/** Creation de la cle de fin de thread
+ *
+ */
+static void createKey();
+
+/** Fin d'un thread : son tampon sera recycle une fois vide
+ *
+ */
+static void detach( void* arg );
+
+/** Gestionnaire de SIGUSR1 (activation / desactivation)
+ *
+ */
+static void onToggleSignal( int sig );
+
+/** Thread d'ecriture
+ *
+ */
+static void* writeLoop( void* arg );
+
+/** Ecriture des evenements en attente de tous les tampons
+ *
+ */
+static void flushRings();
+
+/** Ouverture d'un nouveau fichier de traces (avec rotation de l'ancien)
+ *
+ */
+static int openOutput( int rotate );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+const char* TRACE_eventName( int type )
+{
+    return( type > 0 && type < TRACE_EVENT_COUNT ? EVENT_NAMES[type] : EVENT_NAMES[0] );
+}
+
+
+void TRACE_setOutput( const char* path )
+{
+    snprintf( outputPath, sizeof( outputPath ), "%s", path );
+}
+
+
+int TRACE_start()
+{
+    if( outputPath[0] == '\0' ) return( 0 );
+    if( openOutput( 0 ) != 0 ) return( 1 );
+
+    // Bascule des traces par SIGUSR1 (appels systeme interrompus relances)
+    struct sigaction action;
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = onToggleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+    sigaction( SIGUSR1, &action, NULL );
+
+    stopWrite = 0;
+    if( pthread_create( &writeThread, NULL, writeLoop, NULL ) != 0 )
+    {
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Lancement de l'écriture des traces impossible" );
+        fclose( output );
+        output = NULL;
+        return( 1 );
+    }
+    running = 1;
+    enabled = 1;
+
+    return( 0 );
+}
+
+
+void TRACE_stop()
+{
+    if( ! running ) return;
+
+    enabled = 0;
+    stopWrite = 1;
+    pthread_join( writeThread, NULL );
+    running = 0;
+
+    // Evenements enregistres pendant l'arret
+    flushRings();
+    fclose( output );
+    output = NULL;
+}
+
+
+void TRACE_setEnabled( int value )
+{
+    enabled = running && value;
+}
+
+
+void TRACE_setSession( uint64_t session )
+{
+    threadSession = session;
+}
+
+
+void TRACE_record( int type, uint32_t block, uint16_t arg )
+{
+    // Traces desactivees : un seul test
+    if( ! enabled ) return;
+
+    TraceRing* ring = threadRing != NULL ? threadRing : attach();
+    if( ring == NULL ) return;
+
+    // Tampon plein : evenement perdu et compte
+    const uint32_t head = ring->head;
+    if( head - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE ) == TRACE_RING_SIZE )
+    {
+        __atomic_store_n( &ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED );
+        return;
+    }
+
+    // Remplissage puis publication pour le thread d'ecriture
+    TraceEvent* event = &ring->events[head % TRACE_RING_SIZE];
+    struct timespec time;
+    clock_gettime( CLOCK_REALTIME, &time );
+    event->time = (uint64_t)time.tv_sec * 1000000000 + (uint64_t)time.tv_nsec;
+    event->session = threadSession;
+    event->block = block;
+    event->type = (uint16_t)type;
+    event->arg = arg;
+    __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static TraceRing* attach()
+{
+    pthread_once( &ringKeyOnce, createKey );
+
+    // Tampon d'un thread termine, ou nouveau tampon
+    pthread_mutex_lock( &ringsMutex );
+    TraceRing* ring = freeRings;
+    if( ring != NULL ) freeRings = ring->next;
+    else ring = (TraceRing*)malloc( sizeof( TraceRing ) );
+    if( ring != NULL )
+    {
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->reported = 0;
+        ring->closed = 0;
+        ring->next = rings;
+        rings = ring;
+    }
+    pthread_mutex_unlock( &ringsMutex );
+
+    threadRing = ring;
+    pthread_setspecific( ringKey, ring );
+
+    return( ring );
+}
+
+
+static void createKey()
+{
+    pthread_key_create( &ringKey, detach );
+}
+
+
+static void detach( void* arg )
+{
+    TraceRing* ring = (TraceRing*)arg;
+    __atomic_store_n( &ring->closed, 1, __ATOMIC_RELEASE );
+    threadRing = NULL;
+}
+
+
+static void onToggleSignal( int sig )
+{
+    (void)sig;
+    enabled = ! enabled;
+}
+
+
+static void* writeLoop( void* arg )
+{
+    (void)arg;
+
+    while( ! stopWrite )
+    {
+        flushRings();
+        usleep( TRACE_FLUSH_MS * 1000 );
+    }
+
+    return( NULL );
+}
+
+
+static void flushRings()
+{
+    uint64_t dropped = 0;
+
+    pthread_mutex_lock( &ringsMutex );
+    TraceRing** previous = &rings;
+    while( *previous != NULL )
+    {
+        TraceRing* ring = *previous;
+        const int closed = __atomic_load_n( &ring->closed, __ATOMIC_ACQUIRE );
+
+        // Evenements publies (au plus deux morceaux contigus dans l'anneau)
+        const uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+        while( ring->tail != head )
+        {
+            const uint32_t start = ring->tail % TRACE_RING_SIZE;
+            uint32_t count = head - ring->tail;
+            if( start + count > TRACE_RING_SIZE ) count = TRACE_RING_SIZE - start;
+            if( output != NULL )
+            {
+                fwrite( &ring->events[start], sizeof( TraceEvent ), count, output );
+                outputSize += (long)( count * sizeof( TraceEvent ) );
+            }
+            __atomic_store_n( &ring->tail, ring->tail + count, __ATOMIC_RELEASE );
+        }
+
+        // Evenements perdus depuis le dernier passage
+        const uint64_t lost = __atomic_load_n( &ring->dropped, __ATOMIC_RELAXED );
+        dropped += lost - ring->reported;
+        ring->reported = lost;
+
+        // Tampon d'un thread termine : recyclage
+        if( closed )
+        {
+            *previous = ring->next;
+            ring->next = freeRings;
+            freeRings = ring;
+        }
+        else previous = &ring->next;
+    }
+    pthread_mutex_unlock( &ringsMutex );
+
+    if( dropped > 0 ) METRICS_add( METRICS_TRACE_DROPPED, (int64_t)dropped );
+
+    // Rotation au-dela de la taille max
+    if( output != NULL )
+    {
+        fflush( output );
+        if( outputSize >= TRACE_MAX_FILE_SIZE ) openOutput( 1 );
+    }
+}
+
+
+static int openOutput( int rotate )
+{
+    if( output != NULL ) fclose( output );
+
+    // Ancien fichier conserve sous FICHIER.1
+    if( rotate )
+    {
+        char oldPath[sizeof( outputPath ) + 2];
+        snprintf( oldPath, sizeof( oldPath ), "%s.1", outputPath );
+        rename( outputPath, oldPath );
+    }
+
+    output = fopen( outputPath, "w" );
+    if( output == NULL )
+    {
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Ouverture du fichier de traces impossible : %s", outputPath );
+        return( 1 );
+    }
+
+    // Entete
+    TraceHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, TRACE_MAGIC, sizeof( TRACE_MAGIC ) );
+    header.version = TRACE_VERSION;
+    header.eventSize = sizeof( TraceEvent );
+    fwrite( &header, sizeof( header ), 1, output );
+    outputSize = sizeof( header );
+
+    return( 0 );
+}
@@ -0,0 +1,409 @@
+// syncfs(), O_DIRECT
+#define _GNU_SOURCE
+
+#include "tftp/writer.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Local
+#include "tftp/log.h"
+
+
+// Politique de durabilite courante
+static int syncPolicy = WRITER_SYNC_NONE;
+
+// Taille a partir de laquelle l'ecriture est directe (0 : jamais)
+static size_t directThreshold = 0;
+
+// Noms des politiques (dans l'ordre de l'enum)
+static const char* SYNC_POLICIES[] = { "none", "file", "group" };
+
+// Nombre max de fichiers synchronises par un meme commit de groupe
+#define GROUP_MAX_SIZE 256
+
+/** Etat du commit de groupe, partage par tous les ecrivains
+ *
+ *  Chaque transfert termine depose son fichier et attend que le thread de commit ait synchronise le lot le
+ *  contenant. Un seul syncfs() par systeme de fichiers couvre tout le lot. Le resultat d'un lot reste publie
+ *  jusqu'a ce que tous ses transferts l'aient lu : le lot suivant n'est publie qu'ensuite.
+ */
+static struct
+{
+    pthread_once_t once;                    // Demarrage du thread de commit
+    pthread_mutex_t mutex;                  // Protection de l'etat
+    pthread_cond_t requestCond;             // Nouveau fichier a synchroniser
+    pthread_cond_t doneCond;                // Lot synchronise
+    pthread_cond_t readCond;                // Resultat du lot lu par tous ses transferts
+    int fds[GROUP_MAX_SIZE];                // Fichiers en attente
+    int count;                              // Nombre de fichiers en attente
+    unsigned long batch;                    // Numero du lot en attente
+    unsigned long doneBatch;                // Numero du dernier lot synchronise
+    int doneError;                          // Resultat du dernier lot synchronise (errno, 0 si succes)
+    int doneWaiters;                        // Transferts du dernier lot n'ayant pas encore lu son resultat
+} group =
+{
+    PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, { 0 }, 0, 1, 0, 0, 0
+};
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Thread d'ecriture des tampons pleins
+ *
+ */
+static void* writeChunks( void* arg );
+
+/** Ecriture complete d'un tampon (gestion des ecritures partielles), retourne 0 ou le code errno de l'echec
+ *
+ */
+static int writeAll( int fd, const unsigned char* data, size_t size );
+
+/** Activation ou desactivation de l'ecriture directe sur le fichier
+ *
+ */
+static void setDirect( Writer* writer, int direct );
+
+/** Synchronisation du fichier via le commit de groupe, retourne 0 ou l'erreur (errno) du lot
+ *
+ */
+static int groupCommit( int fd );
+
+/** Demarrage du thread de commit de groupe
+ *
+ */
+static void startGroupCommit();
+
+/** Thread de commit de groupe
+ *
+ */
+static void* runGroupCommit( void* arg );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void WRITER_setSyncPolicy( int policy )
+{
+    syncPolicy = policy;
+}
+
+
+void WRITER_setDirectThreshold( size_t size )
+{
+    directThreshold = size;
+}
+
+
+int WRITER_parseSyncPolicy( const char* name )
+{
+    for( size_t i = 0; i < sizeof( SYNC_POLICIES ) / sizeof( char* ); ++i )
+    {
+        if( strcmp( name, SYNC_POLICIES[i] ) == 0 ) return( (int)i );
+    }
+
+    return( -1 );
+}
+
+
+Writer* WRITER_create( int fd )
+{
+    // Allocation de la struture de donnees
+    Writer* writer = (Writer*)malloc( sizeof( Writer ) );
+    memset( writer, 0, sizeof( Writer ) );
+    writer->fd = fd;
+
+    // Allocation des tampons alignes
+    for( int i = 0; i < WRITER_CHUNK_COUNT; ++i )
+    {
+        if( posix_memalign( (void**)&writer->chunks[i], WRITER_ALIGNMENT, WRITER_CHUNK_SIZE ) != 0 )
+        {
+            for( int j = 0; j < i; ++j ) free( writer->chunks[j] );
+            free( writer );
+            return( NULL );
+        }
+    }
+
+    pthread_mutex_init( &writer->mutex, NULL );
+    pthread_cond_init( &writer->cond, NULL );
+
+    // Lancement du thread d'ecriture
+    if( pthread_create( &writer->thread, NULL, writeChunks, (void*)writer ) != 0 )
+    {
+        fprintf( stderr, "ERREUR - Echec de création du thread d'écriture\n" );
+        pthread_cond_destroy( &writer->cond );
+        pthread_mutex_destroy( &writer->mutex );
+        for( int i = 0; i < WRITER_CHUNK_COUNT; ++i ) free( writer->chunks[i] );
+        free( writer );
+        return( NULL );
+    }
+
+    return( writer );
+}
+
+
+int WRITER_write( Writer* writer, const void* data, size_t size )
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    while( size > 0 )
+    {
+        // Copie dans le tampon courant
+        size_t* fill = &writer->fill[writer->head];
+        const size_t count = size < WRITER_CHUNK_SIZE - *fill ? size : WRITER_CHUNK_SIZE - *fill;
+        memcpy( writer->chunks[writer->head] + *fill, bytes, count );
+        *fill += count;
+        bytes += count;
+        size -= count;
+
+        // Tampon plein : transmission au thread d'ecriture
+        if( *fill == WRITER_CHUNK_SIZE )
+        {
+            pthread_mutex_lock( &writer->mutex );
+            ++writer->pending;
+            pthread_cond_broadcast( &writer->cond );
+
+            // Attente d'un tampon libre
+            while( writer->pending == WRITER_CHUNK_COUNT && ! writer->error )
+                pthread_cond_wait( &writer->cond, &writer->mutex );
+            writer->head = ( writer->head + 1 ) % WRITER_CHUNK_COUNT;
+            const int error = writer->error;
+            pthread_mutex_unlock( &writer->mutex );
+
+            if( error ) return( 1 );
+        }
+    }
+
+    return( 0 );
+}
+
+
+int WRITER_close( Writer* writer )
+{
+    // Transmission du dernier tampon (partiel) et demande de fin
+    pthread_mutex_lock( &writer->mutex );
+    if( writer->fill[writer->head] > 0 ) ++writer->pending;
+    writer->closing = 1;
+    pthread_cond_broadcast( &writer->cond );
+    pthread_mutex_unlock( &writer->mutex );
+
+    // Attente de la fin des ecritures
+    pthread_join( writer->thread, NULL );
+    int error = writer->error;
+
+    // Durabilite (erreur rapportee par le thread qui a synchronise)
+    if( error == 0 )
+    {
+        switch( syncPolicy )
+        {
+            case WRITER_SYNC_FILE:
+                error = fdatasync( writer->fd ) != 0 ? errno : 0;
+                break;
+
+            case WRITER_SYNC_GROUP:
+                error = groupCommit( writer->fd );
+                break;
+
+            default:
+                break;
+        }
+        if( error != 0 ) LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec de synchronisation : %s", strerror( error ) );
+    }
+
+    // Liberation memoire
+    pthread_cond_destroy( &writer->cond );
+    pthread_mutex_destroy( &writer->mutex );
+    for( int i = 0; i < WRITER_CHUNK_COUNT; ++i ) free( writer->chunks[i] );
+    free( writer );
+
+    return( error );
+}
+
+
+int WRITER_syncDirectory( const char* path )
+{
+    if( syncPolicy == WRITER_SYNC_NONE ) return( 0 );
+
+    // Repertoire du fichier (repertoire courant si le chemin n'en a pas)
+    char directory[512];
+    const char* lastSlash = strrchr( path, '/' );
+    if( lastSlash != NULL ) snprintf( directory, sizeof( directory ), "%.*s", (int)( lastSlash - path + 1 ), path );
+    else snprintf( directory, sizeof( directory ), "." );
+
+    // Synchronisation, regroupee avec celles des autres transferts en mode WRITER_SYNC_GROUP
+    int error = 0;
+    const int fd = open( directory, O_RDONLY | O_DIRECTORY );
+    if( fd == -1 ) error = errno;
+    else
+    {
+        if( syncPolicy == WRITER_SYNC_FILE ) error = fsync( fd ) != 0 ? errno : 0;
+        else error = groupCommit( fd );
+        close( fd );
+    }
+    if( error != 0 )
+        LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec de synchronisation de %s : %s", directory, strerror( error ) );
+
+    return( error );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static void* writeChunks( void* arg )
+{
+    Writer* writer = (Writer*)arg;
+
+    pthread_mutex_lock( &writer->mutex );
+    while( 1 )
+    {
+        // Attente d'un tampon a ecrire
+        while( writer->pending == 0 && ! writer->closing )
+            pthread_cond_wait( &writer->cond, &writer->mutex );
+        if( writer->pending == 0 ) break;
+
+        // Ecriture hors verrou : le thread reseau continue de remplir les autres tampons
+        const int index = writer->tail;
+        const size_t size = writer->fill[index];
+        pthread_mutex_unlock( &writer->mutex );
+
+        // Gros fichier : les tampons pleins (alignes) contournent le cache, le dernier tampon non
+        if( directThreshold > 0 && writer->written + size > directThreshold )
+            setDirect( writer, size == WRITER_CHUNK_SIZE );
+
+        const int error = writeAll( writer->fd, writer->chunks[index], size );
+        writer->written += size;
+        pthread_mutex_lock( &writer->mutex );
+
+        // Liberation du tampon
+        writer->fill[index] = 0;
+        writer->tail = ( index + 1 ) % WRITER_CHUNK_COUNT;
+        --writer->pending;
+        if( error ) writer->error = error;
+        pthread_cond_broadcast( &writer->cond );
+        if( writer->error ) break;
+    }
+    pthread_mutex_unlock( &writer->mutex );
+
+    return( NULL );
+}
+
+
+static int writeAll( int fd, const unsigned char* data, size_t size )
+{
+    while( size > 0 )
+    {
+        ssize_t written = write( fd, data, size );
+        if( written == -1 )
+        {
+            if( errno == EINTR ) continue;
+            LOG_write( LOG_ERROR, LOG_NO_BLOCK, "Echec d'écriture : %s", strerror( errno ) );
+            return( errno );
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+
+    return( 0 );
+}
+
+
+static void setDirect( Writer* writer, int direct )
+{
+    if( writer->direct == direct ) return;
+
+    const int flags = fcntl( writer->fd, F_GETFL );
+    if( flags == -1 ) return;
+
+    // Sans support d'O_DIRECT (tmpfs...), l'ecriture continue par le cache
+    if( fcntl( writer->fd, F_SETFL, direct ? flags | O_DIRECT : flags & ~O_DIRECT ) == 0 ) writer->direct = direct;
+}
+
+
+static int groupCommit( int fd )
+{
+    pthread_once( &group.once, startGroupCommit );
+
+    pthread_mutex_lock( &group.mutex );
+
+    // Lot plein : attente du commit en cours
+    while( group.count == GROUP_MAX_SIZE ) pthread_cond_wait( &group.doneCond, &group.mutex );
+
+    // Depot du fichier et attente du resultat du lot qui le contient (publie jusqu'a sa lecture)
+    group.fds[group.count++] = fd;
+    const unsigned long batch = group.batch;
+    pthread_cond_signal( &group.requestCond );
+    while( group.doneBatch != batch ) pthread_cond_wait( &group.doneCond, &group.mutex );
+    const int error = group.doneError;
+    if( --group.doneWaiters == 0 ) pthread_cond_signal( &group.readCond );
+
+    pthread_mutex_unlock( &group.mutex );
+
+    return( error );
+}
+
+
+static void startGroupCommit()
+{
+    pthread_t thread;
+    if( pthread_create( &thread, NULL, runGroupCommit, NULL ) == 0 ) pthread_detach( thread );
+}
+
+
+static void* runGroupCommit( void* arg )
+{
+    (void)arg;
+
+    pthread_mutex_lock( &group.mutex );
+    while( 1 )
+    {
+        // Attente d'une demande
+        while( group.count == 0 ) pthread_cond_wait( &group.requestCond, &group.mutex );
+
+        // Fenetre de regroupement : les transferts qui se terminent en meme temps rejoignent le lot
+        pthread_mutex_unlock( &group.mutex );
+        usleep( WRITER_GROUP_WINDOW_US );
+        pthread_mutex_lock( &group.mutex );
+
+        // Prise du lot
+        int fds[GROUP_MAX_SIZE];
+        const int count = group.count;
+        const unsigned long batch = group.batch++;
+        memcpy( fds, group.fds, count * sizeof( int ) );
+        group.count = 0;
+        pthread_mutex_unlock( &group.mutex );
+
+        // Un syncfs() par systeme de fichiers distinct
+        int error = 0;
+        dev_t synced[GROUP_MAX_SIZE];
+        int syncedCount = 0;
+        for( int i = 0; i < count; ++i )
+        {
+            struct stat info;
+            if( fstat( fds[i], &info ) != 0 )
+            {
+                error = errno;
+                continue;
+            }
+            int done = 0;
+            for( int j = 0; j < syncedCount && ! done; ++j ) done = synced[j] == info.st_dev;
+            if( done ) continue;
+            if( syncfs( fds[i] ) != 0 ) error = errno;
+            synced[syncedCount++] = info.st_dev;
+        }
+
+        // Publication une fois le resultat du lot precedent lu par tous ses transferts, puis reveil du lot
+        pthread_mutex_lock( &group.mutex );
+        while( group.doneWaiters > 0 ) pthread_cond_wait( &group.readCond, &group.mutex );
+        group.doneBatch = batch;
+        group.doneError = error;
+        group.doneWaiters = count;
+        pthread_cond_broadcast( &group.doneCond );
+    }
+
+    return( NULL );
+}
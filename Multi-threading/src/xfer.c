@@ -0,0 +1,907 @@
+#include "tftp/xfer.h"
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+// Local
+#include "tftp/tftp.h"
+#include "tftp/packet.h"
+#include "tftp/metrics.h"
+
+
+// Entete d'un paquet DATA (code et numero de bloc)
+#define DATA_HEADER_SIZE 4
+
+// Options demandees
+static uint16_t requestedBlockSize = XFER_DEFAULT_BLOCK_SIZE;
+static uint16_t requestedWindowSize = XFER_DEFAULT_WINDOW_SIZE;
+static int requestedChecksum = DIGEST_NONE;
+
+// Tampon de reception a la taille max (blksize inconnu avant l'OACK), un par thread : les paquets sont traites
+// des leur reception
+static __thread unsigned char recvBuffer[DATA_HEADER_SIZE + XFER_MAX_BLOCK_SIZE];
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Attente et traitement des paquets jusqu'a la fin du transfert (XFER_get et XFER_put)
+ *
+ */
+static int run( XferSession* session, XferResult* result );
+
+/** Duree du transfert a sa fin, retourne l'etat du transfert
+ *
+ */
+static int settle( XferSession* session );
+
+/** Progression : compteur de renvois remis a zero, echeance du renvoi reportee (les doublons ne la reportent
+ *  pas, pour qu'un pair qui repete son dernier paquet ne bloque pas le transfert)
+ */
+static void restartTimer( XferSession* session );
+
+/** Traitement d'un paquet recu en lecture
+ *
+ */
+static void handleGet( XferSession* session, const unsigned char* buff, size_t size, const Addr* from,
+                       uint16_t code, uint16_t blockNum );
+
+/** Traitement d'un paquet recu en ecriture
+ *
+ */
+static void handlePut( XferSession* session, const unsigned char* buff, size_t size, const Addr* from,
+                       uint16_t code, uint16_t blockNum );
+
+/** Emission des blocs de la fenetre (lus une seule fois, conserves jusqu'a leur acquittement)
+ *
+ */
+static void sendWindow( XferSession* session );
+
+/** Envoi de la requete RRQ ou WRQ, avec les options si le serveur ne les a pas refusees
+ *
+ */
+static int sendRequest( XferSession* session );
+
+/** Lecture des options acceptees par le serveur (refus si elles depassent la demande), empreinte annoncee
+ *  enregistree dans digest (lecture)
+ */
+static int applyOack( const unsigned char* buff, size_t size, const XferOptions* options, XferResult* result,
+                      DigestCheck* digest );
+
+/** Lecture de l'empreinte envoyee par le serveur apres les donnees (OACK avant le dernier bloc)
+ *
+ */
+static int applyTrailer( const unsigned char* buff, size_t size, DigestCheck* digest );
+
+/** Code d'erreur d'un paquet ERROR recu, enregistre comme cause d'echec si session n'est pas NULL
+ *
+ */
+static uint16_t readError( const unsigned char* buff, size_t size, XferSession* session );
+
+/** Ecriture d'un bloc recu : a la suite dans le fichier, ou a sa position par pwrite pour une plage
+ *
+ */
+static int writeData( XferSession* session, const unsigned char* data, size_t count );
+
+/** Retour au debut d'un fichier recu (reprise refusee ou fichier distant modifie)
+ *
+ */
+static int restartFile( XferSession* session );
+
+/** Enregistrement et affichage de la cause d'un echec, retourne XFER_FAILED
+ *
+ */
+static int fail( XferSession* session, int error, const char* format, ... );
+
+/** Reception d'un paquet : 0 si recu, -1 si timeout, 1 si erreur
+ *
+ */
+static int recvPacket( Sock* sock, unsigned char* buff, size_t* size, Addr* from, uint16_t* code,
+                       uint16_t* blockNum );
+
+/** Etat initial du resultat
+ *
+ */
+static void initResult( XferResult* result );
+
+
+//--- Fonctions publiques --------------------------------------------------------------------------------------
+
+void XFER_setBlockSize( uint16_t blockSize )
+{
+    if( blockSize >= XFER_MIN_BLOCK_SIZE && blockSize <= XFER_MAX_BLOCK_SIZE ) requestedBlockSize = blockSize;
+}
+
+
+void XFER_setWindowSize( uint16_t windowSize )
+{
+    if( windowSize >= 1 && windowSize <= XFER_MAX_WINDOW_SIZE ) requestedWindowSize = windowSize;
+}
+
+
+void XFER_setChecksum( int algorithm )
+{
+    if( algorithm >= DIGEST_NONE && algorithm < DIGEST_COUNT ) requestedChecksum = algorithm;
+}
+
+
+void XFER_initOptions( XferOptions* options )
+{
+    memset( options, 0, sizeof( *options ) );
+    options->blockSize = requestedBlockSize;
+    options->windowSize = requestedWindowSize;
+    options->length = -1;
+    options->expectedSize = -1;
+    options->checksum = requestedChecksum;
+}
+
+
+XferSession* XFER_create( Sock* sock, int type, const Addr* server, const char* remoteName, FILE* file,
+                          const XferOptions* options )
+{
+    XferSession* session = (XferSession*)calloc( 1, sizeof( XferSession ) );
+    if( session == NULL ) return( NULL );
+    session->sock = sock;
+    session->type = type;
+    session->state = XFER_REQUEST;
+    session->server = server;
+    snprintf( session->remoteName, sizeof( session->remoteName ), "%s", remoteName );
+    session->file = file;
+    if( options != NULL ) session->options = *options;
+    else XFER_initOptions( &session->options );
+    session->withOptions = 1;
+    session->expected = 1;
+    session->base = 1;
+    session->next = 1;
+    initResult( &session->result );
+
+    if( type == XFER_GET )
+    {
+        // Reprise : le fichier est positionne apres les octets deja recus (origin : debut du fichier). Plage : pas
+        // de repli sur le fichier entier, les blocs sont ecrits a leur position
+        session->ranged = session->options.length >= 0;
+        session->origin = session->ranged || file == NULL ? (off_t)session->options.offset : ftello( file );
+        if( session->origin == -1 ) session->options.offset = 0;
+        else session->origin -= (off_t)session->options.offset;
+    }
+    else
+    {
+        // Taille restant a envoyer, annoncee par tsize (inconnue si le fichier n'est pas positionnable)
+        session->size = -1;
+        const off_t position = ftello( file );
+        if( position != -1 && fseeko( file, 0, SEEK_END ) == 0 )
+        {
+            session->size = (int64_t)( ftello( file ) - position );
+            fseeko( file, position, SEEK_SET );
+        }
+    }
+
+    return( session );
+}
+
+
+int XFER_start( XferSession* session, int64_t now )
+{
+    session->start = now;
+    session->deadline = now + (int64_t)XFER_TIMEOUT_MS * 1000;
+    if( sendRequest( session ) != 0 ) fail( session, XFER_ERR_SOCKET, "Echec d'envoi de la requête" );
+
+    return( settle( session ) );
+}
+
+
+int XFER_onReadable( XferSession* session )
+{
+    // Lecture de tous les paquets disponibles
+    Addr from;
+    while( session->state == XFER_REQUEST || session->state == XFER_TRANSFER )
+    {
+        size_t size = sizeof( recvBuffer );
+        uint16_t code = 0;
+        uint16_t blockNum = 0;
+        const int received = recvPacket( session->sock, recvBuffer, &size, &from, &code, &blockNum );
+        if( received == -1 ) break;
+        if( received != 0 )
+        {
+            fail( session, XFER_ERR_SOCKET, "Echec de réception" );
+            break;
+        }
+
+        // Paquet d'un autre emetteur que le serveur du transfert
+        if( session->state == XFER_TRANSFER && ! ADDR_equals( &from, &session->peer ) )
+        {
+            TFTP_sendErrorPacket( session->sock, ERR_UNKNOWN_TRANSFER_ID, "TID inconnu", &from );
+            continue;
+        }
+
+        if( session->type == XFER_GET ) handleGet( session, recvBuffer, size, &from, code, blockNum );
+        else handlePut( session, recvBuffer, size, &from, code, blockNum );
+
+        // Echeance passee : la main revient a l'appelant pour le renvoi (doublons recus en continu)
+        if( METRICS_now() >= session->deadline ) break;
+    }
+
+    return( settle( session ) );
+}
+
+
+int XFER_onTimer( XferSession* session, int64_t now )
+{
+    // Transfert en cours dont l'echeance est passee
+    if( ( session->state != XFER_REQUEST && session->state != XFER_TRANSFER ) || now < session->deadline )
+        return( session->state );
+    session->deadline = now + (int64_t)XFER_TIMEOUT_MS * 1000;
+
+    // Abandon apres MAX_TRY_TIMEOUT renvois sans progression
+    if( ++session->tries > MAX_TRY_TIMEOUT )
+    {
+        fail( session, XFER_ERR_TIMEOUT, "Pas de réponse du serveur" );
+        return( settle( session ) );
+    }
+
+    // Renvoi de la requete, du dernier ACK (le serveur reprend la fenetre qui suit) ou de la fenetre depuis le
+    // premier bloc non acquitte
+    if( session->state == XFER_REQUEST )
+    {
+        ++session->result.retransmits;
+        sendRequest( session );
+    }
+    else if( session->type == XFER_GET )
+    {
+        ++session->result.retransmits;
+        session->acked = (uint16_t)( session->expected - 1 );
+        TFTP_sendAckPacket( session->sock, session->acked, &session->peer );
+    }
+    else
+    {
+        session->next = session->base;
+        sendWindow( session );
+    }
+
+    return( settle( session ) );
+}
+
+
+void XFER_destroy( XferSession* session )
+{
+    if( session != NULL )
+    {
+        REORDER_destroy( session->reorder );
+        free( session->sizes );
+        free( session->window );
+        free( session );
+    }
+}
+
+
+int XFER_get( Sock* sock, const Addr* server, const char* remoteName, FILE* file, const XferOptions* options,
+              XferResult* result )
+{
+    XferSession* session = XFER_create( sock, XFER_GET, server, remoteName, file, options );
+    if( session == NULL )
+    {
+        initResult( result );
+        result->error = XFER_ERR_LOCAL;
+        return( 1 );
+    }
+
+    const int status = run( session, result );
+    XFER_destroy( session );
+
+    return( status );
+}
+
+
+int XFER_put( Sock* sock, const Addr* server, const char* remoteName, FILE* file, const XferOptions* options,
+              XferResult* result )
+{
+    XferSession* session = XFER_create( sock, XFER_PUT, server, remoteName, file, options );
+    if( session == NULL )
+    {
+        initResult( result );
+        result->error = XFER_ERR_LOCAL;
+        return( 1 );
+    }
+
+    const int status = run( session, result );
+    XFER_destroy( session );
+
+    return( status );
+}
+
+
+void XFER_printResult( FILE* out, const char* name, const XferResult* result )
+{
+    const double seconds = result->duration > 0 ? result->duration / 1e6 : 1e-6;
+    fprintf( out, "%s : %llu octets en %.3f s (%.2f Mo/s), blksize %u, windowsize %u%s, %u renvois",
+             name, (unsigned long long)result->bytes, seconds, result->bytes / seconds / 1e6,
+             result->blockSize, result->windowSize, result->negotiated ? "" : " (sans OACK)",
+             result->retransmits );
+    if( result->offset > 0 ) fprintf( out, ", reprise à l'octet %llu", (unsigned long long)result->offset );
+    if( result->checksum != DIGEST_NONE ) fprintf( out, ", empreinte %s vérifiée", DIGEST_name( result->checksum ) );
+    fprintf( out, "\n" );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static int run( XferSession* session, XferResult* result )
+{
+    // Timeout de la socket sauvegarde, puis attente de chaque paquet jusqu'a l'echeance du renvoi
+    struct timeval previous;
+    socklen_t length = sizeof( previous );
+    getsockopt( session->sock->fd, SOL_SOCKET, SO_RCVTIMEO, &previous, &length );
+
+    XFER_start( session, METRICS_now() );
+    while( session->state == XFER_REQUEST || session->state == XFER_TRANSFER )
+    {
+        const int64_t wait = session->deadline - METRICS_now();
+        if( wait > 0 )
+        {
+            struct timeval timeout = { (time_t)( wait / 1000000 ), (suseconds_t)( wait % 1000000 ) };
+            setsockopt( session->sock->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+            XFER_onReadable( session );
+        }
+        XFER_onTimer( session, METRICS_now() );
+    }
+
+    setsockopt( session->sock->fd, SOL_SOCKET, SO_RCVTIMEO, &previous, sizeof( previous ) );
+    *result = session->result;
+
+    return( session->state == XFER_DONE ? 0 : 1 );
+}
+
+
+static void restartTimer( XferSession* session )
+{
+    session->tries = 0;
+    session->deadline = METRICS_now() + (int64_t)XFER_TIMEOUT_MS * 1000;
+}
+
+
+static int settle( XferSession* session )
+{
+    if( ( session->state == XFER_DONE || session->state == XFER_FAILED ) && session->result.duration == 0 )
+        session->result.duration = METRICS_now() - session->start;
+
+    return( session->state );
+}
+
+
+static void handleGet( XferSession* session, const unsigned char* buff, size_t size, const Addr* from,
+                       uint16_t code, uint16_t blockNum )
+{
+    XferResult* result = &session->result;
+    const XferOptions* options = &session->options;
+    if( session->state == XFER_REQUEST && session->hasStale && ADDR_equals( from, &session->stale ) ) return;
+
+    switch( code )
+    {
+        // OACK : options acceptees, le transfert commence apres l'ACK 0 (renvoye si l'OACK est repete)
+        case TFTP_OACK:
+            if( session->state == XFER_REQUEST )
+            {
+                if( applyOack( buff, size, options, result, &session->digest ) != 0 )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_OPTION_REFUSED, "Options invalides", from );
+                    fail( session, XFER_ERR_PROTOCOL, "Options du serveur invalides" );
+                    break;
+                }
+
+                // Plage ignoree, deplacee, ou fichier distant modifie
+                if( session->ranged && ( result->length < 0 || result->offset != options->offset
+                    || ( options->expectedSize >= 0 && result->size != options->expectedSize ) ) )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_OPTION_REFUSED, "Plage refusée", from );
+                    fail( session, XFER_ERR_PROTOCOL, "Plage refusée par le serveur" );
+                    break;
+                }
+
+                // Reprise ignoree : le serveur envoie le fichier depuis le debut
+                if( options->offset > 0 && result->offset == 0 && restartFile( session ) != 0 )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_UNDEFINED, "Echec d'écriture", from );
+                    break;
+                }
+
+                // Fichier distant modifie depuis la reception des premiers octets : abandon de la reprise,
+                // nouvelle requete pour le fichier entier
+                if( result->offset > 0 && ( result->offset != options->offset
+                    || ( options->expectedSize >= 0 && result->size != options->expectedSize ) ) )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_OPTION_REFUSED, "Fichier modifié", from );
+                    session->stale = *from;
+                    session->hasStale = 1;
+                    session->options.offset = 0;
+                    restartTimer( session );
+                    if( restartFile( session ) == 0 && sendRequest( session ) != 0 )
+                        fail( session, XFER_ERR_SOCKET, "Echec d'envoi de la requête" );
+                    break;
+                }
+                ADDR_update( &session->peer, &from->inAddr );
+                session->state = XFER_TRANSFER;
+                restartTimer( session );
+            }
+            else if( session->digest.deferred )
+            {
+                // Empreinte calculee par le serveur au fil de l'envoi : annoncee avant le dernier bloc, acquittee
+                // par l'ACK du dernier bloc recu
+                if( applyTrailer( buff, size, &session->digest ) != 0 )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_OPTION_REFUSED, "Empreinte invalide", from );
+                    fail( session, XFER_ERR_PROTOCOL, "Empreinte du serveur invalide" );
+                    break;
+                }
+                session->acked = (uint16_t)( session->expected - 1 );
+                TFTP_sendAckPacket( session->sock, session->acked, &session->peer );
+                break;
+            }
+            if( session->expected == 1 ) TFTP_sendAckPacket( session->sock, 0, &session->peer );
+            break;
+
+        // DATA
+        case TFTP_DATA:
+        {
+            // Options ignorees par le serveur : pas a pas de 512 octets, depuis le debut du fichier
+            if( session->state == XFER_REQUEST )
+            {
+                if( session->ranged )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_OPTION_REFUSED, "Plage refusée", from );
+                    fail( session, XFER_ERR_PROTOCOL, "Plage refusée par le serveur" );
+                    break;
+                }
+                if( options->offset > 0 && restartFile( session ) != 0 )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_UNDEFINED, "Echec d'écriture", from );
+                    break;
+                }
+                result->offset = 0;
+                result->blockSize = DATA_SIZE;
+                result->windowSize = 1;
+                result->size = -1;
+                ADDR_update( &session->peer, &from->inAddr );
+                session->state = XFER_TRANSFER;
+                restartTimer( session );
+            }
+
+            // Bloc hors sequence : un bloc en avance dans la fenetre est conserve. Un seul ACK du dernier bloc
+            // recu dans l'ordre pour un doublon, un bloc non conserve, ou une fin de fenetre arrivee avec un trou
+            const size_t count = size - DATA_HEADER_SIZE;
+            const uint16_t ahead = (uint16_t)( blockNum - session->expected );
+            if( ahead != 0 || count > result->blockSize )
+            {
+                int held = 0;
+                if( ahead < result->windowSize && count <= result->blockSize )
+                {
+                    if( session->reorder == NULL )
+                        session->reorder = REORDER_create( result->blockSize, result->windowSize );
+                    held = session->reorder != NULL && (uint16_t)( blockNum - session->acked ) < result->windowSize
+                           && REORDER_hold( session->reorder, session->expected, blockNum, buff + DATA_HEADER_SIZE,
+                                            count ) != REORDER_TOO_FAR;
+                }
+                if( ! held && ! session->resync )
+                {
+                    session->acked = (uint16_t)( session->expected - 1 );
+                    TFTP_sendAckPacket( session->sock, session->acked, &session->peer );
+                    ++result->retransmits;
+                    session->resync = 1;
+                }
+                break;
+            }
+
+            // Bloc attendu, puis blocs conserves qui le suivent
+            const unsigned char* data = buff + DATA_HEADER_SIZE;
+            size_t dataCount = count;
+            while( data != NULL && session->state == XFER_TRANSFER )
+            {
+                if( dataCount > 0 && writeData( session, data, dataCount ) != 0 )
+                {
+                    TFTP_sendErrorPacket( session->sock, ERR_NOT_ENOUGH_SPACE_ON_DISK, "Echec d'écriture",
+                                          &session->peer );
+                    fail( session, XFER_ERR_LOCAL, "Echec d'écriture" );
+                    break;
+                }
+                DIGEST_update( &session->digest, data, dataCount );
+                result->bytes += dataCount;
+                ++session->expected;
+                if( dataCount < result->blockSize ) session->state = XFER_DONE;
+                data = session->reorder != NULL ? REORDER_take( session->reorder, session->expected, &dataCount )
+                                                : NULL;
+            }
+            if( session->state == XFER_FAILED ) break;
+            session->resync = 0;
+            restartTimer( session );
+
+            // Fichier recu en entier : empreinte comparee a celle annoncee, pas d'ACK final en cas d'ecart
+            if( session->state == XFER_DONE && DIGEST_verify( &session->digest ) != 0 )
+            {
+                TFTP_sendErrorPacket( session->sock, ERR_UNDEFINED, "Empreinte invalide", &session->peer );
+                fail( session, XFER_ERR_CHECKSUM, session->digest.pending ? "Empreinte %s non reçue"
+                                                                          : "Empreinte %s invalide",
+                      DIGEST_name( session->digest.expected.algorithm ) );
+                break;
+            }
+            if( session->state == XFER_DONE ) result->checksum = session->digest.expected.algorithm;
+
+            // Dernier bloc, ou fin de fenetre : ACK du dernier bloc recu dans l'ordre
+            const uint16_t last = (uint16_t)( session->expected - 1 );
+            if( session->state == XFER_DONE || (uint16_t)( last - session->acked ) >= result->windowSize )
+            {
+                TFTP_sendAckPacket( session->sock, last, &session->peer );
+                session->acked = last;
+            }
+
+            // Suivi de la progression
+            if( options->progress != NULL && result->bytes - session->reported >= XFER_PROGRESS_BYTES )
+            {
+                session->reported = result->bytes;
+                options->progress( options->context, result->offset + result->bytes, result->size );
+            }
+        }
+        break;
+
+        // ERROR : nouvelle requete sans options si elles sont refusees (sauf plage)
+        case TFTP_ERROR:
+            if( session->state == XFER_REQUEST && session->withOptions && ! session->ranged
+                && readError( buff, size, NULL ) == ERR_OPTION_REFUSED )
+            {
+                session->withOptions = 0;
+                restartTimer( session );
+                if( ( options->offset == 0 || restartFile( session ) == 0 ) && sendRequest( session ) != 0 )
+                    fail( session, XFER_ERR_SOCKET, "Echec d'envoi de la requête" );
+                break;
+            }
+            readError( buff, size, session );
+            break;
+
+        // Code imprevu
+        default:
+            fail( session, XFER_ERR_PROTOCOL, "Réception d'un paquet non-prévu: code = %u", code );
+            break;
+    }
+}
+
+
+static void handlePut( XferSession* session, const unsigned char* buff, size_t size, const Addr* from,
+                       uint16_t code, uint16_t blockNum )
+{
+    XferResult* result = &session->result;
+
+    // Premiere reponse : OACK, ou ACK 0 d'un serveur qui ignore les options
+    if( session->state == XFER_REQUEST && ( code == TFTP_OACK || ( code == TFTP_ACK && blockNum == 0 ) ) )
+    {
+        if( code == TFTP_OACK && applyOack( buff, size, &session->options, result, NULL ) != 0 )
+        {
+            TFTP_sendErrorPacket( session->sock, ERR_OPTION_REFUSED, "Options invalides", from );
+            fail( session, XFER_ERR_PROTOCOL, "Options du serveur invalides" );
+            return;
+        }
+        if( code == TFTP_ACK )
+        {
+            result->blockSize = DATA_SIZE;
+            result->windowSize = 1;
+            result->size = -1;
+        }
+        ADDR_update( &session->peer, &from->inAddr );
+        const size_t packetSize = DATA_HEADER_SIZE + result->blockSize;
+        session->window = (unsigned char*)malloc( (size_t)result->windowSize * packetSize );
+        session->sizes = (size_t*)calloc( result->windowSize, sizeof( size_t ) );
+        if( session->window == NULL || session->sizes == NULL )
+        {
+            TFTP_sendErrorPacket( session->sock, ERR_UNDEFINED, "Mémoire insuffisante", from );
+            fail( session, XFER_ERR_LOCAL, "Mémoire insuffisante" );
+            return;
+        }
+        session->state = XFER_TRANSFER;
+        restartTimer( session );
+        sendWindow( session );
+        return;
+    }
+
+    switch( code )
+    {
+        // ACK (ou OACK repete : le bloc 1 n'est pas arrive)
+        case TFTP_ACK:
+        case TFTP_OACK:
+        {
+            if( session->state == XFER_REQUEST ) break;
+            if( code == TFTP_OACK ) blockNum = 0;
+
+            // Bloc acquitte, sur 64 bits a partir du numero de 16 bits
+            const uint64_t acked = session->base - 1 + (uint16_t)( blockNum - (uint16_t)( session->base - 1 ) );
+            if( acked >= session->next ) break;
+            if( acked >= session->base )
+            {
+                // Progression ; acquittement partiel d'une fenetre : le serveur reprend apres le trou
+                session->base = acked + 1;
+                restartTimer( session );
+                session->resync = 0;
+                if( session->last != 0 && session->base > session->last ) session->state = XFER_DONE;
+                else if( acked < session->next - 1 && result->windowSize > 1 )
+                {
+                    session->next = session->base;
+                    session->resync = 1;
+                }
+            }
+            else if( ! session->resync && session->next > session->base
+                     && ( result->windowSize > 1 || code == TFTP_OACK ) )
+            {
+                // Doublon de l'ACK precedent en mode fenetre : premier bloc perdu (un seul renvoi par bloc)
+                session->next = session->base;
+                session->resync = 1;
+            }
+            sendWindow( session );
+        }
+        break;
+
+        // ERROR : nouvelle requete sans options si elles sont refusees
+        case TFTP_ERROR:
+            if( session->state == XFER_REQUEST && session->withOptions
+                && readError( buff, size, NULL ) == ERR_OPTION_REFUSED )
+            {
+                session->withOptions = 0;
+                restartTimer( session );
+                if( sendRequest( session ) != 0 ) fail( session, XFER_ERR_SOCKET, "Echec d'envoi de la requête" );
+                break;
+            }
+            readError( buff, size, session );
+            break;
+
+        // Code imprevu
+        default:
+            fail( session, XFER_ERR_PROTOCOL, "Réception d'un paquet non-prévu: code = %u", code );
+            break;
+    }
+}
+
+
+static void sendWindow( XferSession* session )
+{
+    XferResult* result = &session->result;
+    while( session->state == XFER_TRANSFER && session->next < session->base + result->windowSize
+           && ( session->last == 0 || session->next <= session->last ) )
+    {
+        const uint64_t next = session->next;
+        unsigned char* packet = session->window
+                                + ( next % result->windowSize ) * ( DATA_HEADER_SIZE + result->blockSize );
+        size_t* packetSize = &session->sizes[next % result->windowSize];
+        if( next > session->read )
+        {
+            const size_t count = fread( packet + DATA_HEADER_SIZE, 1, result->blockSize, session->file );
+            if( ferror( session->file ) )
+            {
+                TFTP_sendErrorPacket( session->sock, ERR_UNDEFINED, "Echec de lecture", &session->peer );
+                fail( session, XFER_ERR_LOCAL, "Echec de lecture" );
+                return;
+            }
+            const uint16_t header[2] = { htons( TFTP_DATA ), htons( (uint16_t)next ) };
+            memcpy( packet, header, sizeof( header ) );
+            *packetSize = DATA_HEADER_SIZE + count;
+            result->bytes += count;
+            session->read = next;
+            if( count < result->blockSize ) session->last = next;
+        }
+        else ++result->retransmits;
+
+        if( SOCK_sendData( session->sock, packet, *packetSize, &session->peer ) != 0 )
+            fail( session, XFER_ERR_SOCKET, "Echec d'envoi" );
+        ++session->next;
+    }
+}
+
+
+static int sendRequest( XferSession* session )
+{
+    const XferOptions* requested = &session->options;
+    const uint16_t code = session->type == XFER_GET ? TFTP_RRQ : TFTP_WRQ;
+    const int64_t size = session->type == XFER_GET ? 0 : session->size;
+    Option options[6];
+    size_t optionCount = 0;
+    char value[OPTION_VALUE_SIZE];
+    if( session->withOptions )
+    {
+        if( code == TFTP_RRQ && requested->offset > 0 )
+        {
+            snprintf( value, sizeof( value ), "%llu", (unsigned long long)requested->offset );
+            PACKET_addOption( options, &optionCount, "offset", value );
+        }
+        if( code == TFTP_RRQ && requested->length >= 0 )
+        {
+            snprintf( value, sizeof( value ), "%lld", (long long)requested->length );
+            PACKET_addOption( options, &optionCount, "length", value );
+        }
+        if( code == TFTP_RRQ && requested->checksum != DIGEST_NONE && requested->offset == 0 && ! session->ranged )
+            PACKET_addOption( options, &optionCount, "checksum", DIGEST_name( requested->checksum ) );
+        if( requested->blockSize != DATA_SIZE )
+        {
+            snprintf( value, sizeof( value ), "%u", requested->blockSize );
+            PACKET_addOption( options, &optionCount, "blksize", value );
+        }
+        if( requested->windowSize != 1 )
+        {
+            snprintf( value, sizeof( value ), "%u", requested->windowSize );
+            PACKET_addOption( options, &optionCount, "windowsize", value );
+        }
+        if( size >= 0 )
+        {
+            snprintf( value, sizeof( value ), "%lld", (long long)size );
+            PACKET_addOption( options, &optionCount, "tsize", value );
+        }
+    }
+
+    return( TFTP_sendXrqPacket( session->sock, code, session->remoteName, options, optionCount, session->server ) );
+}
+
+
+static int applyOack( const unsigned char* buff, size_t size, const XferOptions* options, XferResult* result,
+                      DigestCheck* digest )
+{
+    Packet* packet = PACKET_create( TFTP_OACK );
+    if( packet == NULL ) return( 1 );
+    if( PACKET_decode( packet, buff + sizeof( uint16_t ), size - sizeof( uint16_t ) ) != 0 )
+    {
+        PACKET_destroy( packet );
+        return( 1 );
+    }
+    const OackPacket* oack = (const OackPacket*)packet->data;
+
+    // Options absentes de l'OACK : valeurs par defaut du protocole
+    const char* blockSize = PACKET_getOption( oack->options, oack->optionCount, "blksize" );
+    const char* windowSize = PACKET_getOption( oack->options, oack->optionCount, "windowsize" );
+    const char* tsize = PACKET_getOption( oack->options, oack->optionCount, "tsize" );
+    const char* offset = PACKET_getOption( oack->options, oack->optionCount, "offset" );
+    const char* length = PACKET_getOption( oack->options, oack->optionCount, "length" );
+    result->offset = offset != NULL ? strtoull( offset, NULL, 10 ) : 0;
+    result->length = length != NULL ? strtoll( length, NULL, 10 ) : -1;
+    const long block = blockSize != NULL ? atol( blockSize ) : DATA_SIZE;
+    const long windowCount = windowSize != NULL ? atol( windowSize ) : 1;
+    result->size = tsize != NULL ? atoll( tsize ) : -1;
+
+    // Empreinte : seulement si elle est demandee, dans l'algorithme demande
+    const char* checksum = PACKET_getOption( oack->options, oack->optionCount, "checksum" );
+    int invalid = 0;
+    if( digest != NULL ) memset( digest, 0, sizeof( *digest ) );
+    if( checksum != NULL )
+    {
+        invalid = digest == NULL || options->checksum == DIGEST_NONE || DIGEST_start( digest, checksum ) != 0
+                  || digest->expected.algorithm != options->checksum;
+    }
+    PACKET_destroy( packet );
+    if( invalid ) return( 1 );
+
+    // Le serveur ne peut que reduire les valeurs demandees
+    if( block < XFER_MIN_BLOCK_SIZE || ( blockSize != NULL && block > options->blockSize )
+        || windowCount < 1 || ( windowSize != NULL && windowCount > options->windowSize ) )
+        return( 1 );
+    result->blockSize = (uint16_t)block;
+    result->windowSize = (uint16_t)windowCount;
+    result->negotiated = 1;
+
+    return( 0 );
+}
+
+
+static int applyTrailer( const unsigned char* buff, size_t size, DigestCheck* digest )
+{
+    Packet* packet = PACKET_create( TFTP_OACK );
+    if( packet == NULL ) return( 1 );
+    if( PACKET_decode( packet, buff + sizeof( uint16_t ), size - sizeof( uint16_t ) ) != 0 )
+    {
+        PACKET_destroy( packet );
+        return( 1 );
+    }
+    const OackPacket* oack = (const OackPacket*)packet->data;
+    const char* checksum = PACKET_getOption( oack->options, oack->optionCount, "checksum" );
+    const int invalid = checksum == NULL || DIGEST_complete( digest, checksum ) != 0;
+    PACKET_destroy( packet );
+
+    return( invalid );
+}
+
+
+static uint16_t readError( const unsigned char* buff, size_t size, XferSession* session )
+{
+    Packet* packet = PACKET_create( TFTP_ERROR );
+    if( packet == NULL ) return( ERR_UNDEFINED );
+    uint16_t errorCode = ERR_UNDEFINED;
+    if( PACKET_decode( packet, buff + sizeof( uint16_t ), size - sizeof( uint16_t ) ) == 0 )
+    {
+        const ErrorPacket* err = (const ErrorPacket*)packet->data;
+        errorCode = err->errorCode;
+        if( session != NULL )
+        {
+            fail( session, XFER_ERR_SERVER, "code = %u, msg = %s", err->errorCode, err->errorMsg );
+            session->result.errorCode = errorCode;
+        }
+    }
+    else if( session != NULL ) fail( session, XFER_ERR_SERVER, "Paquet ERROR invalide" );
+    PACKET_destroy( packet );
+
+    return( errorCode );
+}
+
+
+static int writeData( XferSession* session, const unsigned char* data, size_t count )
+{
+    // Donnees ignorees (generateur de charge)
+    if( session->file == NULL ) return( 0 );
+
+    // Plage : plusieurs transferts ecrivent dans le meme fichier, sans position partagee
+    if( session->ranged )
+    {
+        const off_t position = (off_t)( session->options.offset + session->result.bytes );
+        return( pwrite( fileno( session->file ), data, count, position ) == (ssize_t)count ? 0 : 1 );
+    }
+
+    return( fwrite( data, 1, count, session->file ) == count ? 0 : 1 );
+}
+
+
+static int restartFile( XferSession* session )
+{
+    FILE* file = session->file;
+    if( file != NULL && ( fflush( file ) != 0 || ftruncate( fileno( file ), session->origin ) != 0
+                          || fseeko( file, session->origin, SEEK_SET ) != 0 ) )
+    {
+        fail( session, XFER_ERR_LOCAL, "Echec d'écriture" );
+        return( 1 );
+    }
+    session->result.offset = 0;
+
+    return( 0 );
+}
+
+
+static int fail( XferSession* session, int error, const char* format, ... )
+{
+    va_list args;
+    va_start( args, format );
+    vsnprintf( session->result.message, sizeof( session->result.message ), format, args );
+    va_end( args );
+    session->result.error = error;
+    session->state = XFER_FAILED;
+    if( ! session->options.quiet ) fprintf( stderr, "ERREUR - %s\n", session->result.message );
+
+    return( XFER_FAILED );
+}
+
+
+static int recvPacket( Sock* sock, unsigned char* buff, size_t* size, Addr* from, uint16_t* code,
+                       uint16_t* blockNum )
+{
+    // Paquets tronques ignores
+    int status = 0;
+    do
+    {
+        const size_t capacity = *size;
+        status = SOCK_recvData( sock, buff, size, from );
+        if( status == 0 && *size < DATA_HEADER_SIZE ) *size = capacity;
+        else break;
+    }
+    while( 1 );
+    if( status != 0 ) return( status );
+
+    uint16_t header[2];
+    memcpy( header, buff, sizeof( header ) );
+    *code = ntohs( header[0] );
+    *blockNum = ntohs( header[1] );
+
+    return( 0 );
+}
+
+
+static void initResult( XferResult* result )
+{
+    memset( result, 0, sizeof( *result ) );
+    result->size = -1;
+    result->length = -1;
+    result->blockSize = DATA_SIZE;
+    result->windowSize = 1;
+}
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Telechargement avec empreinte sha256 d'un fichier plus long a hacher que le delai du client (5 essais de 1 s) :
+# le premier bloc doit arriver avant la fin de ce delai, que l'empreinte soit connue du serveur ou non
+#   - la taille du fichier en Mo
+#   - le numero de port
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 <taille fichier (Mo)> <numéro de port>"
+    exit 1
+fi
+
+size=$1
+port=$2
+bin=${TFTP_BIN:-$(pwd)/bin/tftp}
+work=$(mktemp -d)
+
+# Fichier telecharge
+mkdir -p $work/srv $work/clt
+head -c $(( size * 1024 * 1024 )) /dev/urandom > $work/srv/image.bin
+
+# Duree d'un calcul de l'empreinte avant l'envoi (hors cache)
+start=$(date +%s%N)
+sha256sum $work/srv/image.bin > /dev/null
+hashed=$(( ( $(date +%s%N) - start ) / 1000000 ))
+
+(cd $work/srv && exec $bin --mode SRV --port $port --index none > $work/srv.log 2>&1) &
+srvPid=$!
+sleep 0.5
+
+# Premier telechargement : empreinte calculee au fil de l'envoi, puis conservee pour le second
+failed=0
+for run in miss hit; do
+    rm -f $work/clt/image.bin
+    start=$(date +%s%N)
+    (cd $work/clt && exec $bin --mode CLT --port $port --checksum sha256 --exec "get image.bin" \
+        > $work/clt-$run.log 2>&1) &
+    cltPid=$!
+
+    # Premiers octets recus
+    while [ ! -s $work/clt/image.bin ] && kill -0 $cltPid 2> /dev/null; do sleep 0.01; done
+    firstData=$(( ( $(date +%s%N) - start ) / 1000000 ))
+    wait $cltPid
+    status=$?
+    elapsed=$(( ( $(date +%s%N) - start ) / 1000000 ))
+
+    if [ $status -ne 0 ] || [ $firstData -ge 1000 ] || ! cmp -s $work/srv/image.bin $work/clt/image.bin; then
+        echo "ECHEC - $run"
+        cat $work/clt-$run.log
+        failed=1
+    fi
+    echo "$run : premiers octets ${firstData} ms, total ${elapsed} ms"
+done
+
+kill -INT $srvPid
+wait $srvPid 2> /dev/null
+
+echo "${size} Mo, sha256sum ${hashed} ms"
+if [ $hashed -lt 1000 ]; then echo "ATTENTION - fichier haché en moins de 1 s : augmenter la taille"; fi
+
+rm -rf $work
+if [ $failed -eq 0 ]; then echo "OK"; else exit 1; fi
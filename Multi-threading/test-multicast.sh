@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Diffusion multicast d'un meme fichier a plusieurs clients sur la machine locale
+#   - le nombre de clients (la moitie demarre pendant la diffusion)
+#   - la taille du fichier en Ko
+#   - le numero de port
+if [ $# -ne 3 ]; then
+    echo "Usage: $0 <nombre de clients> <taille fichier (Ko)> <numéro de port>"
+    exit 1
+fi
+
+nbClients=$1
+size=$2
+port=$3
+bin=${TFTP_BIN:-$(pwd)/bin/tftp}
+work=$(mktemp -d)
+
+# Fichier diffuse
+mkdir -p $work/srv
+head -c $(( size * 1024 )) /dev/urandom > $work/srv/image.bin
+
+(cd $work/srv && exec $bin --mode SRV --port $port --index none --mcast-group 239.255.0.1 > $work/srv.log 2>&1) &
+srvPid=$!
+sleep 0.5
+
+# Lancement d'un client dans son propre repertoire
+startClient() {
+    mkdir -p $work/clt$1
+    (cd $work/clt$1 && printf "mcget image.bin\nexit\n" | $bin --mode CLT --port $port > $work/clt$1.log 2>&1) &
+    pids+=( $! )
+}
+
+start=$(date +%s%N)
+pids=()
+for ((i=0; i<$nbClients; i++)); do
+    # Seconde moitie : clients tardifs, qui redemandent les blocs manques une fois maitres
+    if [ $i -eq $(( nbClients / 2 )) ]; then sleep 0.3; fi
+    startClient $i
+done
+wait "${pids[@]}"
+elapsed=$(( ( $(date +%s%N) - start ) / 1000000 ))
+
+kill -INT $srvPid
+wait $srvPid 2> /dev/null
+
+# Controle des copies
+failed=0
+for ((i=0; i<$nbClients; i++)); do
+    cmp -s $work/srv/image.bin $work/clt$i/image.bin || { echo "ECHEC - client $i"; failed=1; }
+done
+echo "$nbClients clients, ${size} Ko, ${elapsed} ms, sessions : $(grep -c 'Diffusion multicast' $work/srv.log)"
+
+rm -rf $work
+if [ $failed -eq 0 ]; then echo "OK"; else exit 1; fi
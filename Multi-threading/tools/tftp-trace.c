@@ -0,0 +1,205 @@
+//--------------------------------------------------------------------------------------------------------------
+// tftp-trace : decodage des fichiers de traces du serveur (option --trace)
+//
+// Usage : tftp-trace [--csv] [--session N] FICHIER...
+//
+// Par defaut, une chronologie par session : date de debut, puis un evenement par ligne avec son decalage
+// (millisecondes) depuis le premier evenement de la session. Avec --csv, tous les evenements par date :
+//      time_ns,session,event,block,arg
+// Les fichiers tournes (FICHIER.1) se donnent avec le fichier courant, les evenements sont fusionnes.
+//--------------------------------------------------------------------------------------------------------------
+
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Local
+#include "tftp/trace.h"
+
+
+// Utilisation du programme
+static const char* USAGE = "tftp-trace [--csv] [--session N] FILE...";
+
+
+//--- Declaration des fonctions locales ------------------------------------------------------------------------
+
+/** Lecture des evenements d'un fichier (ajoutes a events), filtres par session si non nulle
+ *
+ */
+static int readFile( const char* path, uint64_t session, TraceEvent** events, size_t* count, size_t* capacity );
+
+/** Ordre des evenements : par session puis par date
+ *
+ */
+static int compareSession( const void* a, const void* b );
+
+/** Ordre des evenements : par date
+ *
+ */
+static int compareTime( const void* a, const void* b );
+
+/** Ecriture de la chronologie de chaque session
+ *
+ */
+static void printTimeline( const TraceEvent* events, size_t count );
+
+/** Ecriture au format CSV
+ *
+ */
+static void printCsv( const TraceEvent* events, size_t count );
+
+
+//--- Programme principal --------------------------------------------------------------------------------------
+
+int main( int argc, char* argv[] )
+{
+    int csv = 0;
+    uint64_t session = 0;
+
+    // Evenements de tous les fichiers
+    TraceEvent* events = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int files = 0;
+
+    // Parsing de la ligne de commande (options puis fichiers)
+    for( int i = 1; i < argc; ++i )
+    {
+        if( strcmp( argv[i], "--csv" ) == 0 ) csv = 1;
+        else if( strcmp( argv[i], "--session" ) == 0 && i + 1 < argc )
+            session = strtoull( argv[++i], NULL, 10 );
+        else if( argv[i][0] == '-' )
+        {
+            fprintf( stderr, "%s\n", USAGE );
+            return( 1 );
+        }
+        else
+        {
+            if( readFile( argv[i], session, &events, &count, &capacity ) != 0 ) return( 1 );
+            ++files;
+        }
+    }
+    if( files == 0 )
+    {
+        fprintf( stderr, "%s\n", USAGE );
+        return( 1 );
+    }
+
+    // Tri puis ecriture
+    if( csv )
+    {
+        qsort( events, count, sizeof( TraceEvent ), compareTime );
+        printCsv( events, count );
+    }
+    else
+    {
+        qsort( events, count, sizeof( TraceEvent ), compareSession );
+        printTimeline( events, count );
+    }
+
+    free( events );
+    return( 0 );
+}
+
+
+//--- Fonctions locales ----------------------------------------------------------------------------------------
+
+static int readFile( const char* path, uint64_t session, TraceEvent** events, size_t* count, size_t* capacity )
+{
+    FILE* file = fopen( path, "rb" );
+    if( file == NULL )
+    {
+        fprintf( stderr, "ERREUR - Ouverture impossible : %s\n", path );
+        return( 1 );
+    }
+
+    // Controle de l'entete
+    TraceHeader header;
+    if( fread( &header, sizeof( header ), 1, file ) != 1 || memcmp( header.magic, TRACE_MAGIC, sizeof( TRACE_MAGIC ) ) != 0
+        || header.version != TRACE_VERSION || header.eventSize != sizeof( TraceEvent ) )
+    {
+        fprintf( stderr, "ERREUR - Fichier de traces invalide : %s\n", path );
+        fclose( file );
+        return( 1 );
+    }
+
+    // Lecture des evenements (un evenement tronque en fin de fichier est ignore)
+    TraceEvent event;
+    while( fread( &event, sizeof( event ), 1, file ) == 1 )
+    {
+        if( session != 0 && event.session != session ) continue;
+        if( *count == *capacity )
+        {
+            *capacity = *capacity > 0 ? *capacity * 2 : 4096;
+            TraceEvent* grown = (TraceEvent*)realloc( *events, *capacity * sizeof( TraceEvent ) );
+            if( grown == NULL )
+            {
+                fprintf( stderr, "ERREUR - Mémoire insuffisante\n" );
+                fclose( file );
+                return( 1 );
+            }
+            *events = grown;
+        }
+        ( *events )[( *count )++] = event;
+    }
+
+    fclose( file );
+    return( 0 );
+}
+
+
+static int compareSession( const void* a, const void* b )
+{
+    const TraceEvent* ea = (const TraceEvent*)a;
+    const TraceEvent* eb = (const TraceEvent*)b;
+    if( ea->session != eb->session ) return( ea->session < eb->session ? -1 : 1 );
+    return( compareTime( a, b ) );
+}
+
+
+static int compareTime( const void* a, const void* b )
+{
+    const TraceEvent* ea = (const TraceEvent*)a;
+    const TraceEvent* eb = (const TraceEvent*)b;
+    return( ea->time < eb->time ? -1 : ea->time > eb->time );
+}
+
+
+static void printTimeline( const TraceEvent* events, size_t count )
+{
+    uint64_t start = 0;
+    for( size_t i = 0; i < count; ++i )
+    {
+        const TraceEvent* event = &events[i];
+
+        // Nouvelle session : date de son premier evenement
+        if( i == 0 || event->session != events[i - 1].session )
+        {
+            start = event->time;
+            const time_t seconds = (time_t)( start / 1000000000 );
+            struct tm tm;
+            localtime_r( &seconds, &tm );
+            char date[32];
+            strftime( date, sizeof( date ), "%Y-%m-%d %H:%M:%S", &tm );
+            printf( "%ssession %llu  %s.%06llu\n", i > 0 ? "\n" : "", (unsigned long long)event->session, date,
+                    (unsigned long long)( start % 1000000000 / 1000 ) );
+        }
+
+        printf( "  %+12.3f ms  %-15s block=%-6u arg=%u\n", (double)( event->time - start ) / 1e6,
+                TRACE_eventName( event->type ), event->block, event->arg );
+    }
+}
+
+
+static void printCsv( const TraceEvent* events, size_t count )
+{
+    printf( "time_ns,session,event,block,arg\n" );
+    for( size_t i = 0; i < count; ++i )
+    {
+        const TraceEvent* event = &events[i];
+        printf( "%llu,%llu,%s,%u,%u\n", (unsigned long long)event->time, (unsigned long long)event->session,
+                TRACE_eventName( event->type ), event->block, event->arg );
+    }
+}